@@ -0,0 +1,1176 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// bench measures the packet output path of a bulk transfer.  Client
+// and server run in the same process.  Client sends a single stream
+// to server over a loopback UDP socket, and server's ACKs are fed
+// back to client directly.  The client's sending syscalls and the
+// server's receiving syscalls are counted.  The number of ACK
+// packets sent by server and the CPU time of the process are also
+// reported.  The handshake is faked, and
+// packets are not encrypted.  All memory of the connections is
+// allocated through a counting allocator, and the allocations per
+// packet are reported along with the time to set up and tear down a
+// connection, and the peak memory usage of each connection.
+// Optionally, server receives a portion of packets out of order to
+// exercise the reassembly of stream data, and it can lend its packet
+// buffers to the connection instead of letting it copy the data.
+// With more than one thread, each thread runs its own pairs of
+// connections, and the aggregate rates are reported as well.  In
+// AEAD mode, no connection is made.  Instead, packets are encrypted
+// and decrypted with each AEAD which TLS may negotiate, once with the
+// key installed for every packet and once with a keyed context
+// reused for all packets, and the packet rates are compared.
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "template.h"
+#include "util.h"
+#include "udp.h"
+#include "crypto.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif // UDP_SEGMENT
+
+using namespace ngtcp2;
+
+namespace {
+enum class Mode {
+  // One ngtcp2_conn_send and one send(2) per packet.
+  SINGLE,
+  // ngtcp2_conn_write_pkts and one sendmsg(2) with UDP_SEGMENT per
+  // burst.
+  GSO,
+  // ngtcp2_conn_write_pkts and one sendmmsg(2) per burst.
+  MMSG,
+};
+} // namespace
+
+namespace {
+struct Config {
+  Mode mode;
+  size_t total;
+  size_t burst;
+  size_t pktlen;
+  // ack_threshold is the number of packets server receives before it
+  // sends ACK.
+  size_t ack_threshold;
+  // pool is true if the connections allocate from their memory pool.
+  bool pool;
+  // nsetups is the number of connections set up and torn down to
+  // measure their cost.
+  size_t nsetups;
+  // reorder is the percentage of packets which server receives out
+  // of order.
+  size_t reorder;
+  // window is the flow control window of stream and connection.  0
+  // uses the default.
+  size_t window;
+  // zerocopy is true if server receives each packet into a buffer of
+  // its own, and passes it by ngtcp2_conn_recv_ref.
+  bool zerocopy;
+  // chunk is the size of server's reorder buffer chunks.  0 uses the
+  // default.
+  size_t chunk;
+  // adaptive is true if server sizes its reorder buffer chunks after
+  // the data, up to chunk bytes.
+  bool adaptive;
+  // recvmmsg is true if server receives a batch of packets per
+  // recvmmsg(2) instead of one per recv(2).
+  bool recvmmsg;
+  // gro is true if the kernel may coalesce the packets which server
+  // receives.  It implies recvmmsg.
+  bool gro;
+  // threads is the number of threads which run connections.
+  size_t threads;
+  // aead_npkts is the number of packets encrypted and decrypted with
+  // each AEAD.  If it is nonzero, only AEAD is measured.
+  size_t aead_npkts;
+} config;
+} // namespace
+
+namespace {
+// Endpoint is the application state of one side of the connection.
+struct Endpoint {
+  bool server;
+  // hs_nrecv is the number of bytes of handshake data received.
+  size_t hs_nrecv;
+  // hs_sent is true if the handshake data of this side is sent.
+  bool hs_sent;
+  // nrecv is the number of bytes of stream data received.
+  uint64_t nrecv;
+  bool fin;
+};
+} // namespace
+
+namespace {
+// nalloc is the number of allocations made through counting_mem by
+// this thread.
+thread_local size_t nalloc;
+} // namespace
+
+namespace {
+void *counting_malloc(size_t size, void *mem_user_data) {
+  ++nalloc;
+  return malloc(size);
+}
+} // namespace
+
+namespace {
+void counting_free(void *ptr, void *mem_user_data) { free(ptr); }
+} // namespace
+
+namespace {
+void *counting_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  ++nalloc;
+  return calloc(nmemb, size);
+}
+} // namespace
+
+namespace {
+void *counting_realloc(void *ptr, size_t size, void *mem_user_data) {
+  ++nalloc;
+  return realloc(ptr, size);
+}
+} // namespace
+
+namespace {
+ngtcp2_mem counting_mem{nullptr, counting_malloc, counting_free,
+                        counting_calloc, counting_realloc};
+} // namespace
+
+namespace {
+std::array<uint8_t, 200> handshake_data;
+std::array<uint8_t, 16> null_key;
+std::array<uint8_t, 16> null_iv;
+} // namespace
+
+namespace {
+ssize_t send_client_initial(ngtcp2_conn *conn, uint32_t flags,
+                            uint64_t *ppkt_num, const uint8_t **pdest,
+                            void *user_data) {
+  *ppkt_num = 0;
+  *pdest = handshake_data.data();
+  return handshake_data.size();
+}
+} // namespace
+
+namespace {
+ssize_t send_handshake_data(Endpoint *ep, const uint8_t **pdest) {
+  if (ep->hs_sent) {
+    return 0;
+  }
+  ep->hs_sent = true;
+  *pdest = handshake_data.data();
+  return handshake_data.size();
+}
+} // namespace
+
+namespace {
+ssize_t send_client_cleartext(ngtcp2_conn *conn, uint32_t flags,
+                              const uint8_t **pdest, void *user_data) {
+  return send_handshake_data(static_cast<Endpoint *>(user_data), pdest);
+}
+} // namespace
+
+namespace {
+ssize_t send_server_cleartext(ngtcp2_conn *conn, uint32_t flags,
+                              uint64_t *ppkt_num, const uint8_t **pdest,
+                              void *user_data) {
+  if (ppkt_num) {
+    *ppkt_num = 0;
+  }
+  return send_handshake_data(static_cast<Endpoint *>(user_data), pdest);
+}
+} // namespace
+
+namespace {
+int recv_handshake_data(ngtcp2_conn *conn, const uint8_t *data,
+                        size_t datalen, void *user_data) {
+  auto ep = static_cast<Endpoint *>(user_data);
+
+  ep->hs_nrecv += datalen;
+
+  // Client completes the handshake after receiving Server Cleartext,
+  // and server does after receiving Client Initial and Client
+  // Cleartext.
+  if (ep->hs_nrecv == (ep->server ? 2 : 1) * handshake_data.size()) {
+    ngtcp2_conn_update_tx_keys(conn, null_key.data(), null_key.size(),
+                               null_iv.data(), null_iv.size());
+    ngtcp2_conn_update_rx_keys(conn, null_key.data(), null_key.size(),
+                               null_iv.data(), null_iv.size());
+    ngtcp2_conn_handshake_completed(conn);
+  }
+
+  return 0;
+}
+} // namespace
+
+namespace {
+ssize_t null_crypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                   const uint8_t *src, size_t srclen, const uint8_t *key,
+                   size_t keylen, const uint8_t *nonce, size_t noncelen,
+                   const uint8_t *ad, size_t adlen, void *user_data) {
+  memmove(dest, src, srclen);
+  return srclen;
+}
+} // namespace
+
+namespace {
+int recv_stream_data(ngtcp2_conn *conn, uint32_t stream_id, uint8_t fin,
+                     const uint8_t *data, size_t datalen, void *user_data,
+                     void *stream_user_data) {
+  auto ep = static_cast<Endpoint *>(user_data);
+
+  ep->nrecv += datalen;
+  ep->fin = ep->fin || fin;
+
+  return 0;
+}
+} // namespace
+
+namespace {
+void release_pkt(ngtcp2_conn *conn, uint8_t *pkt, void *pkt_user_data,
+                 void *user_data) {
+  free(pkt);
+}
+} // namespace
+
+namespace {
+int create_socket(sockaddr_in &addr) {
+  auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    std::cerr << "socket: " << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  int bufsize = 8 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+  addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  socklen_t addrlen = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), addrlen) == -1 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addrlen) == -1) {
+    std::cerr << "bind: " << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+} // namespace
+
+namespace {
+// Sender writes the packets of client to the socket, and counts the
+// syscalls.
+struct Sender {
+  int fd;
+  uint64_t npkts;
+  uint64_t nsyscalls;
+  uint64_t nbytes;
+
+  // send_burst sends |npkts| packets in |buf| of length |len|.  Every
+  // packet but the last one is config.pktlen bytes long.
+  int send_burst(const uint8_t *buf, size_t len, size_t npkts) {
+    ssize_t nwrite = -1;
+
+    switch (config.mode) {
+    case Mode::SINGLE:
+      nwrite = send(fd, buf, len, 0);
+      break;
+    case Mode::GSO: {
+      iovec iov{const_cast<uint8_t *>(buf), len};
+      msghdr msg{};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t))> cmsgbuf{};
+      if (npkts > 1) {
+        msg.msg_control = cmsgbuf.data();
+        msg.msg_controllen = cmsgbuf.size();
+
+        auto cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        auto segsize = static_cast<uint16_t>(config.pktlen);
+        memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+      }
+
+      nwrite = sendmsg(fd, &msg, 0);
+      break;
+    }
+    case Mode::MMSG: {
+      std::vector<iovec> iovs(npkts);
+      std::vector<mmsghdr> msgs(npkts);
+      for (size_t i = 0; i < npkts; ++i) {
+        auto off = i * config.pktlen;
+        iovs[i].iov_base = const_cast<uint8_t *>(buf + off);
+        iovs[i].iov_len = std::min(config.pktlen, len - off);
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      nwrite = sendmmsg(fd, msgs.data(), npkts, 0);
+      if (nwrite != -1 && static_cast<size_t>(nwrite) != npkts) {
+        std::cerr << "sendmmsg: partial write" << std::endl;
+        return -1;
+      }
+      break;
+    }
+    }
+
+    ++nsyscalls;
+
+    if (nwrite == -1) {
+      // Dropped packets are recovered by loss detection.
+      if (errno == EAGAIN || errno == ENOBUFS) {
+        return 0;
+      }
+      std::cerr << "send: " << strerror(errno) << std::endl;
+      return -1;
+    }
+
+    this->npkts += npkts;
+    nbytes += len;
+
+    return 0;
+  }
+};
+} // namespace
+
+namespace {
+// client_write writes the packets of |conn| until congestion window
+// is full or there is no data to send.
+int client_write(ngtcp2_conn *conn, Sender &sender, std::vector<uint8_t> &buf) {
+  for (;;) {
+    ssize_t n;
+    size_t npkts;
+    auto ts = util::timestamp();
+
+    if (config.mode == Mode::SINGLE) {
+      n = ngtcp2_conn_send(conn, buf.data(), config.pktlen, ts);
+      npkts = n > 0;
+    } else {
+      n = ngtcp2_conn_write_pkts(conn, buf.data(), buf.size(), config.pktlen,
+                                 &npkts, ts);
+    }
+    if (n < 0) {
+      std::cerr << "ngtcp2_conn_write_pkts: " << ngtcp2_strerror(n)
+                << std::endl;
+      return -1;
+    }
+    if (n == 0) {
+      return 0;
+    }
+
+    if (sender.send_burst(buf.data(), n, npkts) != 0) {
+      return -1;
+    }
+  }
+}
+} // namespace
+
+namespace {
+// server_write feeds the ACKs which |server| sends to |client|.  The
+// number of ACK packets is added to |nacks|.
+int server_write(ngtcp2_conn *server, ngtcp2_conn *client, size_t &nacks) {
+  std::array<uint8_t, NGTCP2_MAX_PKTLEN_IPV4> buf;
+
+  for (;;) {
+    auto n = ngtcp2_conn_send(server, buf.data(), config.pktlen,
+                              util::timestamp());
+    if (n < 0) {
+      std::cerr << "ngtcp2_conn_send: " << ngtcp2_strerror(n) << std::endl;
+      return -1;
+    }
+    if (n == 0) {
+      return 0;
+    }
+
+    ++nacks;
+
+    auto rv = ngtcp2_conn_recv(client, buf.data(), n, util::timestamp());
+    if (rv != 0) {
+      std::cerr << "ngtcp2_conn_recv: " << ngtcp2_strerror(rv) << std::endl;
+      return -1;
+    }
+  }
+}
+} // namespace
+
+namespace {
+// server_recv feeds a packet to |server|.  Like examples/server.cc,
+// server writes after each packet it receives, and the ACKs are fed
+// to |client| by server_write.  If config.zerocopy is true, |data|
+// must be allocated by malloc, and |server| takes it.
+int server_recv(ngtcp2_conn *server, ngtcp2_conn *client, uint8_t *data,
+                size_t datalen, size_t &nacks) {
+  if (config.zerocopy) {
+    auto rv = ngtcp2_conn_recv_ref(server, data, datalen, nullptr,
+                                   util::timestamp());
+    if (rv != 0) {
+      std::cerr << "ngtcp2_conn_recv_ref: " << ngtcp2_strerror(rv)
+                << std::endl;
+      return -1;
+    }
+  } else {
+    auto rv = ngtcp2_conn_recv(server, data, datalen, util::timestamp());
+    if (rv != 0) {
+      std::cerr << "ngtcp2_conn_recv: " << ngtcp2_strerror(rv) << std::endl;
+      return -1;
+    }
+  }
+
+  return server_write(server, client, nacks);
+}
+} // namespace
+
+namespace {
+// Reorderer holds back config.reorder percent of the packets, and
+// releases each of them after up to 64 later packets are received.
+struct Reorderer {
+  struct Packet {
+    // release_at is the value of npkts when this packet is released.
+    uint64_t release_at;
+    // data is allocated by malloc.
+    uint8_t *data;
+    size_t datalen;
+  };
+
+  std::mt19937 gen{1};
+  std::vector<Packet> held;
+  // npkts is the number of packets received in order.
+  uint64_t npkts;
+
+  // hold returns true if it takes the packet |data| of length
+  // |datalen|.  It is copied unless config.zerocopy is true.
+  bool hold(uint8_t *data, size_t datalen) {
+    if (gen() % 100 >= config.reorder) {
+      ++npkts;
+      return false;
+    }
+    if (!config.zerocopy) {
+      auto p = static_cast<uint8_t *>(malloc(datalen));
+      memcpy(p, data, datalen);
+      data = p;
+    }
+    held.push_back({npkts + 1 + gen() % 64, data, datalen});
+    return true;
+  }
+
+  // release feeds the packets which are due to |server|.  If |all| is
+  // true, all packets are fed.
+  int release(ngtcp2_conn *server, ngtcp2_conn *client, size_t &nacks,
+              bool all) {
+    for (size_t i = 0; i < held.size();) {
+      if (!all && held[i].release_at > npkts) {
+        ++i;
+        continue;
+      }
+      auto pkt = held[i];
+      held.erase(std::begin(held) + i);
+      auto rv = server_recv(server, client, pkt.data, pkt.datalen, nacks);
+      if (!config.zerocopy) {
+        free(pkt.data);
+      }
+      if (rv != 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+};
+} // namespace
+
+namespace {
+thread_local Reorderer reorderer;
+} // namespace
+
+namespace {
+// nrecv_syscalls is the number of syscalls server made to receive
+// packets.
+thread_local uint64_t nrecv_syscalls;
+} // namespace
+
+namespace {
+// server_read feeds the packets arrived at |fd| to |server|.  The
+// packets held back by reorderer are fed before it returns.  If
+// config.zerocopy is true, each packet is received into a buffer of
+// its own, which is freed when server releases it.  Otherwise, if
+// config.recvmmsg is true, packets are received in batches.
+int server_read(ngtcp2_conn *server, ngtcp2_conn *client, int fd,
+                size_t &nacks) {
+  std::array<uint8_t, 65536> stackbuf;
+  static thread_local udp::Reader reader(
+      udp::MAX_BATCH, config.gro ? 64 * 1024 : config.pktlen);
+
+  while (config.recvmmsg) {
+    auto nread = reader.recv(fd);
+
+    ++nrecv_syscalls;
+
+    if (nread == -1) {
+      return -1;
+    }
+    if (nread == 0) {
+      break;
+    }
+
+    for (ssize_t i = 0; i < nread; ++i) {
+      auto data = reader.data(i);
+      auto datalen = reader.datalen(i);
+
+      if (reorderer.hold(data, datalen)) {
+        continue;
+      }
+
+      if (server_recv(server, client, data, datalen, nacks) != 0 ||
+          reorderer.release(server, client, nacks, false) != 0) {
+        return -1;
+      }
+    }
+  }
+
+  for (; !config.recvmmsg;) {
+    auto buf = stackbuf.data();
+    auto buflen = stackbuf.size();
+    if (config.zerocopy) {
+      buflen = config.pktlen;
+      buf = static_cast<uint8_t *>(malloc(buflen));
+    }
+
+    auto nread = recv(fd, buf, buflen, 0);
+
+    ++nrecv_syscalls;
+
+    if (nread == -1) {
+      if (config.zerocopy) {
+        free(buf);
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      std::cerr << "recv: " << strerror(errno) << std::endl;
+      return -1;
+    }
+
+    if (reorderer.hold(buf, nread)) {
+      continue;
+    }
+
+    if (server_recv(server, client, buf, nread, nacks) != 0 ||
+        reorderer.release(server, client, nacks, false) != 0) {
+      return -1;
+    }
+  }
+
+  if (reorderer.release(server, client, nacks, true) != 0) {
+    return -1;
+  }
+
+  // Delayed ACK may be due.
+  return server_write(server, client, nacks);
+}
+} // namespace
+
+namespace {
+// connect_endpoints creates client and server, and lets them finish
+// the handshake.  |cep| and |sep| are their application states.
+int connect_endpoints(ngtcp2_conn **pclient, ngtcp2_conn **pserver,
+                      Endpoint &cep, Endpoint &sep) {
+  ngtcp2_conn_callbacks callbacks{};
+  callbacks.send_client_initial = send_client_initial;
+  callbacks.send_client_cleartext = send_client_cleartext;
+  callbacks.send_server_cleartext = send_server_cleartext;
+  callbacks.recv_handshake_data = recv_handshake_data;
+  callbacks.encrypt = null_crypt;
+  callbacks.decrypt = null_crypt;
+  callbacks.recv_stream_data = recv_stream_data;
+  callbacks.release_pkt = release_pkt;
+
+  ngtcp2_settings settings, server_settings;
+  ngtcp2_settings_default(&settings);
+  settings.mem = &counting_mem;
+  settings.mem_pool = config.pool;
+  if (config.window) {
+    settings.max_stream_data = config.window;
+    settings.max_stream_window = config.window;
+    settings.max_data = config.window;
+    settings.max_window = config.window;
+  }
+  server_settings = settings;
+  server_settings.ack_eliciting_threshold = config.ack_threshold;
+  if (config.chunk) {
+    server_settings.reorder_chunk = config.chunk;
+  }
+  server_settings.reorder_chunk_adaptive = config.adaptive;
+
+  sep.server = true;
+
+  if (ngtcp2_conn_client_new(pclient, 1, NGTCP2_PROTO_VERSION, &callbacks,
+                             &settings, &cep) != 0) {
+    std::cerr << "Could not create connection" << std::endl;
+    return -1;
+  }
+  if (ngtcp2_conn_server_new(pserver, 1, NGTCP2_PROTO_VERSION, &callbacks,
+                             &server_settings, &sep) != 0) {
+    std::cerr << "Could not create connection" << std::endl;
+    ngtcp2_conn_del(*pclient);
+    return -1;
+  }
+
+  auto client = *pclient;
+  auto server = *pserver;
+
+  // Handshake: Client Initial, Server Cleartext, Client Cleartext.
+  for (auto i = 0; i < 3; ++i) {
+    auto from = i % 2 ? server : client;
+    auto to = i % 2 ? client : server;
+    std::array<uint8_t, NGTCP2_MAX_PKTLEN_IPV4> buf;
+    auto n = ngtcp2_conn_send(from, buf.data(), buf.size(), util::timestamp());
+    if (n <= 0 ||
+        ngtcp2_conn_recv(to, buf.data(), n, util::timestamp()) != 0) {
+      std::cerr << "Handshake failed" << std::endl;
+      ngtcp2_conn_del(client);
+      ngtcp2_conn_del(server);
+      return -1;
+    }
+  }
+
+  // The flow control limits are carried by TLS in the real handshake.
+  ngtcp2_transport_params params;
+  ngtcp2_conn_get_local_transport_params(server, &params);
+  ngtcp2_conn_set_remote_transport_params(client, &params);
+  ngtcp2_conn_get_local_transport_params(client, &params);
+  ngtcp2_conn_set_remote_transport_params(server, &params);
+
+  return 0;
+}
+} // namespace
+
+namespace {
+std::mutex print_mutex;
+} // namespace
+
+namespace {
+// print writes the report |s| of a thread to stdout at once.
+void print(const std::string &s) {
+  std::lock_guard<std::mutex> lock(print_mutex);
+  std::cout << s << std::flush;
+}
+} // namespace
+
+namespace {
+// measure_setup sets up and tears down config.nsetups pairs of
+// connections, and reports the average time and allocations per
+// pair.
+int measure_setup() {
+  if (config.nsetups == 0) {
+    return 0;
+  }
+
+  auto nalloc_start = nalloc;
+  auto start = util::timestamp();
+
+  for (size_t i = 0; i < config.nsetups; ++i) {
+    ngtcp2_conn *client, *server;
+    Endpoint cep{}, sep{};
+    if (connect_endpoints(&client, &server, cep, sep) != 0) {
+      return -1;
+    }
+    ngtcp2_conn_del(client);
+    ngtcp2_conn_del(server);
+  }
+
+  auto elapsed = util::timestamp() - start;
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2) << "setup/teardown: "
+            << static_cast<double>(elapsed) / config.nsetups
+            << "us per connection pair ("
+            << static_cast<double>(nalloc - nalloc_start) / config.nsetups
+            << " allocations)\n";
+
+  print(out.str());
+
+  return 0;
+}
+} // namespace
+
+namespace {
+int run() {
+  sockaddr_in caddr, saddr;
+
+  auto cfd = create_socket(caddr);
+  if (cfd == -1) {
+    return -1;
+  }
+  auto cfd_d = defer(close, cfd);
+
+  auto sfd = create_socket(saddr);
+  if (sfd == -1) {
+    return -1;
+  }
+  auto sfd_d = defer(close, sfd);
+
+  if (config.gro && !udp::enable_gro(sfd)) {
+    std::cerr << "UDP GRO is not available: " << strerror(errno)
+              << std::endl;
+  }
+
+  if (connect(cfd, reinterpret_cast<sockaddr *>(&saddr), sizeof(saddr)) ==
+      -1) {
+    std::cerr << "connect: " << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  ngtcp2_conn *client, *server;
+  Endpoint cep{}, sep{};
+  if (connect_endpoints(&client, &server, cep, sep) != 0) {
+    return -1;
+  }
+  auto client_d = defer(ngtcp2_conn_del, client);
+  auto server_d = defer(ngtcp2_conn_del, server);
+
+  uint32_t stream_id;
+  if (ngtcp2_conn_open_stream(client, &stream_id, nullptr) != 0) {
+    std::cerr << "ngtcp2_conn_open_stream failed" << std::endl;
+    return -1;
+  }
+
+  // The data must be alive until it is sent.
+  static std::array<uint8_t, 1024 * 1024> data;
+  for (size_t n = 0; n < config.total; n += data.size()) {
+    auto len = std::min(data.size(), config.total - n);
+    ngtcp2_conn_submit_stream_data(client, stream_id,
+                                   n + len == config.total, data.data(), len);
+  }
+
+  Sender sender{cfd};
+  std::vector<uint8_t> buf(config.mode == Mode::SINGLE
+                               ? config.pktlen
+                               : config.burst * config.pktlen);
+
+  size_t nacks = 0;
+  size_t client_mem = 0, server_mem = 0;
+  auto nalloc_start = nalloc;
+  auto start = util::timestamp();
+
+  while (!sep.fin) {
+    if (client_write(client, sender, buf) != 0 ||
+        server_read(server, client, sfd, nacks) != 0) {
+      return -1;
+    }
+
+    client_mem = std::max(client_mem, ngtcp2_conn_get_mem_usage(client));
+    server_mem = std::max(server_mem, ngtcp2_conn_get_mem_usage(server));
+
+    auto now = util::timestamp();
+    if (ngtcp2_conn_get_expiry(client) <= now &&
+        ngtcp2_conn_handle_expiry(client, now) != 0) {
+      std::cerr << "Connection timed out" << std::endl;
+      return -1;
+    }
+  }
+
+  auto elapsed = static_cast<double>(util::timestamp() - start) / 1000000.;
+
+  rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  auto cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+             (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.;
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2) << "received: " << sep.nrecv
+      << " bytes in " << elapsed << "s\n"
+      << "packets: " << sender.npkts << " ("
+      << sender.npkts / elapsed / 1000. << "k packets/s, "
+      << sender.nbytes * 8 / elapsed / 1000000. << " Mbps)\n"
+      << "syscalls: " << sender.nsyscalls << " (" << std::setprecision(3)
+      << static_cast<double>(sender.nsyscalls) / sender.npkts
+      << " syscalls/packet), receive " << nrecv_syscalls << " ("
+      << static_cast<double>(nrecv_syscalls) / sender.npkts
+      << " syscalls/packet)\n"
+      << "acks: " << nacks << " ("
+      << static_cast<double>(nacks) / sender.npkts << " acks/packet)\n"
+      << "allocations: " << nalloc - nalloc_start << " ("
+      << static_cast<double>(nalloc - nalloc_start) / sender.npkts
+      << " allocations/packet)\n"
+      << "peak memory: client " << client_mem << " bytes, server "
+      << server_mem << " bytes\n"
+      << std::setprecision(2) << "cpu: " << cpu << "s\n";
+
+  print(out.str());
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// aead_rate encrypts and decrypts config.aead_npkts packets with
+// ctx.aead, and returns the number of packets per second, or -1.  If
+// |rekey| is true, the keyed contexts are created and freed for each
+// packet, which is what crypto::encrypt and crypto::decrypt used to
+// do.  Otherwise, a pair of keyed contexts is used for all packets.
+double aead_rate(const crypto::Context &ctx, bool rekey) {
+  std::array<uint8_t, 32> key{};
+  std::array<uint8_t, 32> nonce{};
+  // ad is as long as a short header with 8 bytes connection ID.
+  std::array<uint8_t, 13> ad{};
+  std::vector<uint8_t> buf(config.pktlen);
+
+  auto keylen = crypto::aead_key_length(ctx);
+  auto noncelen = crypto::aead_nonce_length(ctx);
+  auto datalen = buf.size() - ad.size() - crypto::aead_max_overhead(ctx);
+
+  assert(keylen <= key.size());
+  assert(noncelen >= sizeof(uint64_t) && noncelen <= nonce.size());
+
+  crypto::AEADContext *tx = nullptr, *rx = nullptr;
+  auto ctx_d = defer([&tx, &rx]() {
+    crypto::aead_ctx_free(tx);
+    crypto::aead_ctx_free(rx);
+  });
+
+  auto start = util::timestamp();
+
+  for (uint64_t i = 0; i < config.aead_npkts; ++i) {
+    if (rekey || tx == nullptr) {
+      crypto::aead_ctx_free(tx);
+      crypto::aead_ctx_free(rx);
+      tx = crypto::aead_ctx_new(ctx, key.data(), keylen, noncelen, true);
+      rx = crypto::aead_ctx_new(ctx, key.data(), keylen, noncelen, false);
+      if (tx == nullptr || rx == nullptr) {
+        std::cerr << "aead_ctx_new failed" << std::endl;
+        return -1;
+      }
+    }
+
+    // Like the packet protection nonce, each packet number makes a
+    // distinct nonce.
+    memcpy(nonce.data() + noncelen - sizeof(i), &i, sizeof(i));
+
+    auto n = crypto::encrypt(buf.data(), buf.size(), buf.data(), datalen, ctx,
+                             tx, nonce.data(), noncelen, ad.data(), ad.size());
+    if (n < 0) {
+      std::cerr << "encrypt failed" << std::endl;
+      return -1;
+    }
+
+    n = crypto::decrypt(buf.data(), buf.size(), buf.data(), n, ctx, rx,
+                        nonce.data(), noncelen, ad.data(), ad.size());
+    if (n != static_cast<ssize_t>(datalen)) {
+      std::cerr << "decrypt failed" << std::endl;
+      return -1;
+    }
+  }
+
+  auto elapsed = static_cast<double>(util::timestamp() - start) / 1000000.;
+
+  return config.aead_npkts / elapsed;
+}
+} // namespace
+
+namespace {
+// run_aead measures the packet rates of each AEAD which TLS may
+// negotiate, with and without reusing the keyed contexts.
+int run_aead() {
+  struct {
+    const char *name;
+    decltype(crypto::Context::aead) aead;
+  } aeads[] = {
+#if defined(OPENSSL_IS_BORINGSSL)
+      {"AES-128-GCM", EVP_aead_aes_128_gcm()},
+      {"AES-256-GCM", EVP_aead_aes_256_gcm()},
+      {"ChaCha20-Poly1305", EVP_aead_chacha20_poly1305()},
+#else  // !OPENSSL_IS_BORINGSSL
+      {"AES-128-GCM", EVP_aes_128_gcm()},
+      {"AES-256-GCM", EVP_aes_256_gcm()},
+      {"ChaCha20-Poly1305", EVP_chacha20_poly1305()},
+#endif // !OPENSSL_IS_BORINGSSL
+  };
+
+  for (auto &a : aeads) {
+    crypto::Context ctx{};
+    ctx.aead = a.aead;
+
+    auto rekey_rate = aead_rate(ctx, true);
+    if (rekey_rate < 0) {
+      return -1;
+    }
+
+    auto reuse_rate = aead_rate(ctx, false);
+    if (reuse_rate < 0) {
+      return -1;
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << a.name << ": key per packet "
+        << rekey_rate / 1000. << "k packets/s, keyed context "
+        << reuse_rate / 1000. << "k packets/s (" << reuse_rate / rekey_rate
+        << "x)\n";
+
+    print(out.str());
+  }
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// run_threads runs |f| in config.threads threads at once, and returns
+// the wall clock time it took in seconds, or -1 if any of them fails.
+double run_threads(int (*f)()) {
+  std::vector<std::thread> threads;
+  std::atomic<bool> failed(false);
+
+  auto start = util::timestamp();
+
+  for (size_t i = 0; i < config.threads; ++i) {
+    threads.emplace_back([f, &failed]() {
+      if (f() != 0) {
+        failed = true;
+      }
+    });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  if (failed) {
+    return -1;
+  }
+
+  return static_cast<double>(util::timestamp() - start) / 1000000.;
+}
+} // namespace
+
+namespace {
+void print_usage() {
+  std::cerr << "Usage: bench [-m single|gso|mmsg] [-s SIZE_MIB] [-b BURST] "
+               "[-a ACK_THRESHOLD]\n"
+               "             [-p] [-c NSETUPS] [-r REORDER_PERCENT] "
+               "[-w WINDOW_MIB] [-z]\n"
+               "             [-k CHUNK] [-K] [-M] [-G] [-t THREADS] "
+               "[-e AEAD_NPKTS]"
+            << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  config.mode = Mode::GSO;
+  config.total = 256 * 1024 * 1024;
+  config.burst = 16;
+  config.pktlen = NGTCP2_MAX_PKTLEN_IPV4;
+  config.ack_threshold = NGTCP2_DEFAULT_ACK_ELICITING_THRESHOLD;
+  config.pool = false;
+  config.nsetups = 10000;
+  config.reorder = 0;
+  config.window = 0;
+  config.zerocopy = false;
+  config.chunk = 0;
+  config.adaptive = false;
+  config.recvmmsg = false;
+  config.gro = false;
+  config.threads = 1;
+  config.aead_npkts = 0;
+
+  for (;;) {
+    constexpr static option long_opts[] = {{"mode", required_argument, nullptr,
+                                            'm'},
+                                           {"size", required_argument, nullptr,
+                                            's'},
+                                           {"burst", required_argument,
+                                            nullptr, 'b'},
+                                           {"ack-threshold", required_argument,
+                                            nullptr, 'a'},
+                                           {"pool", no_argument, nullptr,
+                                            'p'},
+                                           {"setups", required_argument,
+                                            nullptr, 'c'},
+                                           {"reorder", required_argument,
+                                            nullptr, 'r'},
+                                           {"window", required_argument,
+                                            nullptr, 'w'},
+                                           {"zerocopy", no_argument, nullptr,
+                                            'z'},
+                                           {"chunk", required_argument,
+                                            nullptr, 'k'},
+                                           {"adaptive", no_argument, nullptr,
+                                            'K'},
+                                           {"recvmmsg", no_argument, nullptr,
+                                            'M'},
+                                           {"gro", no_argument, nullptr, 'G'},
+                                           {"threads", required_argument,
+                                            nullptr, 't'},
+                                           {"aead", required_argument,
+                                            nullptr, 'e'},
+                                           {nullptr, 0, nullptr, 0}};
+
+    auto optidx = 0;
+    auto c = getopt_long(argc, argv, "m:s:b:a:pc:r:w:zk:KMGt:e:", long_opts,
+                         &optidx);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'm':
+      if (strcmp(optarg, "single") == 0) {
+        config.mode = Mode::SINGLE;
+      } else if (strcmp(optarg, "gso") == 0) {
+        config.mode = Mode::GSO;
+      } else if (strcmp(optarg, "mmsg") == 0) {
+        config.mode = Mode::MMSG;
+      } else {
+        print_usage();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 's':
+      config.total = strtoul(optarg, nullptr, 10) * 1024 * 1024;
+      break;
+    case 'b':
+      // UDP GSO accepts at most 64 segments.
+      config.burst = std::min(std::max(strtoul(optarg, nullptr, 10), 1ul), 64ul);
+      break;
+    case 'a':
+      config.ack_threshold = strtoul(optarg, nullptr, 10);
+      break;
+    case 'p':
+      config.pool = true;
+      break;
+    case 'c':
+      config.nsetups = strtoul(optarg, nullptr, 10);
+      break;
+    case 'r':
+      config.reorder = std::min(strtoul(optarg, nullptr, 10), 100ul);
+      break;
+    case 'w':
+      config.window = strtoul(optarg, nullptr, 10) * 1024 * 1024;
+      break;
+    case 'z':
+      config.zerocopy = true;
+      break;
+    case 'k':
+      config.chunk = strtoul(optarg, nullptr, 10);
+      break;
+    case 'K':
+      config.adaptive = true;
+      break;
+    case 'M':
+      config.recvmmsg = true;
+      break;
+    case 'G':
+      config.gro = true;
+      config.recvmmsg = true;
+      break;
+    case 't':
+      config.threads = std::max(strtoul(optarg, nullptr, 10), 1ul);
+      break;
+    case 'e':
+      config.aead_npkts = strtoul(optarg, nullptr, 10);
+      break;
+    case '?':
+      print_usage();
+      exit(EXIT_FAILURE);
+    default:
+      break;
+    };
+  }
+
+  if (config.recvmmsg && config.zerocopy) {
+    std::cerr << "-M or -G cannot be used with -z" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.aead_npkts) {
+    if (run_aead() != 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
+
+  if (config.threads == 1) {
+    if (measure_setup() != 0 || run() != 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
+
+  auto elapsed = run_threads(measure_setup);
+  if (elapsed < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.nsetups) {
+    std::cout << std::fixed << std::setprecision(2) << "total setup/teardown: "
+              << config.threads * config.nsetups / elapsed
+              << " connection pairs/s with " << config.threads << " threads"
+              << std::endl;
+  }
+
+  elapsed = run_threads(run);
+  if (elapsed < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "total received: " << config.threads * config.total
+            << " bytes in " << elapsed << "s ("
+            << config.threads * config.total * 8 / elapsed / 1000000.
+            << " Mbps) with " << config.threads << " threads" << std::endl;
+}
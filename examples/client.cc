@@ -26,6 +26,7 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 #include <unistd.h>
 #include <getopt.h>
@@ -49,6 +50,17 @@ namespace {
 auto randgen = util::make_mt19937();
 } // namespace
 
+namespace {
+struct Config {
+  // gso is true if client sends a burst of packets with one
+  // sendmsg(2) with UDP_SEGMENT.
+  bool gso;
+  // gro is true if the kernel may coalesce the datagrams which client
+  // receives.
+  bool gro;
+} config;
+} // namespace
+
 namespace {
 int bio_write(BIO *b, const char *buf, int len) {
   BIO_clear_retry_flags(b);
@@ -145,10 +157,9 @@ namespace {
 void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto c = static_cast<Client *>(w->data);
 
-  debug::print_timestamp();
-  std::cerr << "Timeout" << std::endl;
-
-  c->disconnect();
+  if (c->on_timeout() != 0) {
+    c->disconnect();
+  }
 }
 } // namespace
 
@@ -162,12 +173,17 @@ Client::Client(struct ev_loop *loop, SSL_CTX *ssl_ctx)
       ncread_(0),
       nsread_(0),
       conn_(nullptr),
-      crypto_ctx_{} {
+      crypto_ctx_{},
+      tx_aead_ctx_(nullptr),
+      rx_aead_ctx_(nullptr),
+      close_pending_(false),
+      reader_(udp::MAX_BATCH, 64_k),
+      writer_(udp::MAX_BATCH, NGTCP2_MAX_PKTLEN_IPV4) {
   ev_io_init(&wev_, writecb, 0, EV_WRITE);
   ev_io_init(&rev_, readcb, 0, EV_READ);
   wev_.data = this;
   rev_.data = this;
-  ev_timer_init(&timer_, timeoutcb, 5., 0.);
+  ev_timer_init(&timer_, timeoutcb, 0., 0.);
   timer_.data = this;
 }
 
@@ -184,6 +200,11 @@ void Client::disconnect() {
     conn_ = nullptr;
   }
 
+  crypto::aead_ctx_free(rx_aead_ctx_);
+  rx_aead_ctx_ = nullptr;
+  crypto::aead_ctx_free(tx_aead_ctx_);
+  tx_aead_ctx_ = nullptr;
+
   if (ssl_) {
     SSL_free(ssl_);
     ssl_ = nullptr;
@@ -254,6 +275,10 @@ int handshake_completed(ngtcp2_conn *conn, void *user_data) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
 
+  // This client has nothing to send yet, so close connection right
+  // away.
+  c->schedule_connection_close();
+
   return 0;
 }
 } // namespace
@@ -266,8 +291,8 @@ ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
-  auto nwrite = c->encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  auto nwrite = c->encrypt_data(dest, destlen, plaintext, plaintextlen, nonce,
+                                noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -284,8 +309,8 @@ ssize_t do_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
-  auto nwrite = c->decrypt_data(dest, destlen, ciphertext, ciphertextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  auto nwrite = c->decrypt_data(dest, destlen, ciphertext, ciphertextlen,
+                                nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -311,6 +336,16 @@ int Client::init(int fd, const Address &remote_addr) {
   }
 
   fd_ = fd;
+
+  if (config.gso) {
+    writer_.enable_gso();
+  }
+
+  if (config.gro && !udp::enable_gro(fd_)) {
+    std::cerr << "UDP GRO is not available: " << strerror(errno)
+              << std::endl;
+  }
+
   ssl_ = SSL_new(ssl_ctx_);
   auto bio = BIO_new(create_bio_method());
   BIO_set_data(bio, this);
@@ -331,13 +366,18 @@ int Client::init(int fd, const Address &remote_addr) {
       debug::recv_version_negotiation,
       do_encrypt,
       do_decrypt,
+      nullptr,
+      nullptr,
   };
 
   auto conn_id = std::uniform_int_distribution<uint64_t>(
       0, std::numeric_limits<uint64_t>::max())(randgen);
 
+  ngtcp2_settings settings;
+  ngtcp2_settings_default(&settings);
+
   rv = ngtcp2_conn_client_new(&conn_, conn_id, NGTCP2_PROTO_VERSION, &callbacks,
-                              this);
+                              &settings, this);
   if (rv != 0) {
     std::cerr << "ngtcp2_conn_client_new: " << ngtcp2_strerror(rv) << std::endl;
     return -1;
@@ -347,7 +387,6 @@ int Client::init(int fd, const Address &remote_addr) {
   ev_io_set(&rev_, fd_, EV_READ);
 
   ev_io_start(loop_, &rev_);
-  ev_timer_start(loop_, &timer_);
 
   return 0;
 }
@@ -390,17 +429,40 @@ int Client::feed_data(uint8_t *data, size_t datalen) {
 }
 
 int Client::on_read() {
-  std::array<uint8_t, 65536> buf;
-
-  auto nread =
-      recvfrom(fd_, buf.data(), buf.size(), MSG_DONTWAIT, nullptr, nullptr);
-
+  auto nread = reader_.recv(fd_);
   if (nread == -1) {
-    std::cerr << "recvfrom: " << strerror(errno) << std::endl;
     return 0;
   }
 
-  if (feed_data(buf.data(), nread) != 0) {
+  for (ssize_t i = 0; i < nread; ++i) {
+    if (feed_data(reader_.data(i), reader_.datalen(i)) != 0) {
+      return -1;
+    }
+  }
+
+  return on_write();
+}
+
+void Client::schedule_timer() {
+  auto expiry = ngtcp2_conn_get_expiry(conn_);
+  if (expiry == std::numeric_limits<ngtcp2_tstamp>::max()) {
+    ev_timer_stop(loop_, &timer_);
+    return;
+  }
+
+  auto now = util::timestamp();
+  // ev_timer_again does nothing if repeat is 0.
+  timer_.repeat =
+      expiry > now ? static_cast<ev_tstamp>(expiry - now) / 1000000. : 1e-9;
+  ev_timer_again(loop_, &timer_);
+}
+
+int Client::on_timeout() {
+  auto rv = ngtcp2_conn_handle_expiry(conn_, util::timestamp());
+  if (rv != 0) {
+    debug::print_timestamp();
+    std::cerr << "ngtcp2_conn_handle_expiry: " << ngtcp2_strerror(rv)
+              << std::endl;
     return -1;
   }
 
@@ -408,28 +470,54 @@ int Client::on_read() {
 }
 
 int Client::on_write() {
-  std::array<uint8_t, NGTCP2_MAX_PKTLEN_IPV4> buf;
-  assert(buf.size() >= max_pktlen_);
+  assert(writer_.buflen() >= max_pktlen_);
 
   for (;;) {
     auto n =
-        ngtcp2_conn_send(conn_, buf.data(), max_pktlen_, util::timestamp());
+        ngtcp2_conn_send(conn_, writer_.buf(), max_pktlen_, util::timestamp());
     if (n < 0) {
       std::cerr << "ngtcp2_conn_send: " << ngtcp2_strerror(n) << std::endl;
       return -1;
     }
     if (n == 0) {
-      return 0;
+      break;
     }
 
-    auto nwrite = write(fd_, buf.data(), n);
-    if (nwrite == -1) {
-      std::cerr << "write: " << strerror(errno) << std::endl;
+    writer_.push(n, nullptr);
+
+    if (writer_.full() && writer_.flush(fd_) != 0) {
       return -1;
     }
   }
+
+  if (writer_.flush(fd_) != 0) {
+    return -1;
+  }
+
+  schedule_timer();
+
+  if (!close_pending_) {
+    return 0;
+  }
+
+  close_pending_ = false;
+
+  auto n = ngtcp2_conn_write_connection_close(
+      conn_, writer_.buf(), max_pktlen_, NGTCP2_QUIC_INTERNAL_ERROR,
+      util::timestamp());
+  if (n < 0) {
+    std::cerr << "ngtcp2_conn_write_connection_close: " << ngtcp2_strerror(n)
+              << std::endl;
+    return -1;
+  }
+
+  writer_.push(n, nullptr);
+
+  return writer_.flush(fd_);
 }
 
+void Client::schedule_connection_close() { close_pending_ = true; }
+
 void Client::write_client_handshake(const uint8_t *data, size_t datalen) {
   std::copy_n(data, datalen, std::back_inserter(chandshake_));
 }
@@ -492,6 +580,12 @@ int Client::setup_crypto_context() {
 
   ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
 
+  tx_aead_ctx_ = crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen,
+                                      true);
+  if (tx_aead_ctx_ == nullptr) {
+    return -1;
+  }
+
   rv = crypto::export_server_secret(crypto_ctx_.rx_secret.data(),
                                     crypto_ctx_.secretlen, ssl_);
   if (rv != 0) {
@@ -514,6 +608,12 @@ int Client::setup_crypto_context() {
 
   ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
 
+  rx_aead_ctx_ = crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen,
+                                      false);
+  if (rx_aead_ctx_ == nullptr) {
+    return -1;
+  }
+
   ngtcp2_conn_set_aead_overhead(conn_, crypto::aead_max_overhead(crypto_ctx_));
 
   return 0;
@@ -521,20 +621,18 @@ int Client::setup_crypto_context() {
 
 ssize_t Client::encrypt_data(uint8_t *dest, size_t destlen,
                              const uint8_t *plaintext, size_t plaintextlen,
-                             const uint8_t *key, size_t keylen,
                              const uint8_t *nonce, size_t noncelen,
                              const uint8_t *ad, size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         tx_aead_ctx_, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Client::decrypt_data(uint8_t *dest, size_t destlen,
                              const uint8_t *ciphertext, size_t ciphertextlen,
-                             const uint8_t *key, size_t keylen,
                              const uint8_t *nonce, size_t noncelen,
                              const uint8_t *ad, size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         rx_aead_ctx_, nonce, noncelen, ad, adlen);
 }
 
 namespace {
@@ -629,13 +727,17 @@ int run(Client &c, const char *addr, const char *port) {
 } // namespace
 
 namespace {
-void print_usage() { std::cerr << "Usage: client ADDR PORT" << std::endl; }
+void print_usage() {
+  std::cerr << "Usage: client [--gso] [--gro] ADDR PORT" << std::endl;
+}
 } // namespace
 
 int main(int argc, char **argv) {
   for (;;) {
     static int flag = 0;
-    constexpr static option long_opts[] = {{nullptr, 0, nullptr, 0}};
+    constexpr static option long_opts[] = {{"gso", no_argument, &flag, 1},
+                                           {"gro", no_argument, &flag, 2},
+                                           {nullptr, 0, nullptr, 0}};
 
     auto optidx = 0;
     auto c = getopt_long(argc, argv, "", long_opts, &optidx);
@@ -646,6 +748,18 @@ int main(int argc, char **argv) {
     case '?':
       print_usage();
       exit(EXIT_FAILURE);
+    case 0:
+      switch (flag) {
+      case 1:
+        // --gso
+        config.gso = true;
+        break;
+      case 2:
+        // --gro
+        config.gro = true;
+        break;
+      }
+      break;
     default:
       break;
     };
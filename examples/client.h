@@ -39,6 +39,7 @@
 
 #include "network.h"
 #include "crypto.h"
+#include "udp.h"
 
 using namespace ngtcp2;
 
@@ -53,7 +54,12 @@ public:
   int tls_handshake();
   int on_read();
   int on_write();
+  int on_timeout();
+  // schedule_timer arms timer_ to fire at the expiry of conn_, or
+  // stops it if there is no expiry.
+  void schedule_timer();
   int feed_data(uint8_t *data, size_t datalen);
+  void schedule_connection_close();
 
   void write_client_handshake(const uint8_t *data, size_t datalen);
   size_t read_client_handshake(const uint8_t **pdest);
@@ -63,13 +69,11 @@ public:
 
   int setup_crypto_context();
   ssize_t encrypt_data(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                       size_t plaintextlen, const uint8_t *key, size_t keylen,
-                       const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
-                       size_t adlen);
+                       size_t plaintextlen, const uint8_t *nonce,
+                       size_t noncelen, const uint8_t *ad, size_t adlen);
   ssize_t decrypt_data(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                       size_t ciphertextlen, const uint8_t *key, size_t keylen,
-                       const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
-                       size_t adlen);
+                       size_t ciphertextlen, const uint8_t *nonce,
+                       size_t noncelen, const uint8_t *ad, size_t adlen);
 
 private:
   Address remote_addr_;
@@ -87,6 +91,15 @@ private:
   size_t nsread_;
   ngtcp2_conn *conn_;
   crypto::Context crypto_ctx_;
+  // tx_aead_ctx_ and rx_aead_ctx_ are keyed AEAD contexts created
+  // when 1-RTT keys are installed, and reused for every packet.
+  crypto::AEADContext *tx_aead_ctx_;
+  crypto::AEADContext *rx_aead_ctx_;
+  // close_pending_ is true if CONNECTION_CLOSE should be sent after
+  // outstanding packets are written.
+  bool close_pending_;
+  udp::Reader reader_;
+  udp::Writer writer_;
 };
 
 #endif // CLIENT_H
@@ -39,6 +39,12 @@ namespace ngtcp2 {
 
 namespace crypto {
 
+#if defined(OPENSSL_IS_BORINGSSL)
+using AEADContext = EVP_AEAD_CTX;
+#else  // !OPENSSL_IS_BORINGSSL
+using AEADContext = EVP_CIPHER_CTX;
+#endif // !OPENSSL_IS_BORINGSSL
+
 struct Context {
 #if defined(OPENSSL_IS_BORINGSSL)
   const EVP_AEAD *aead;
@@ -92,25 +98,43 @@ ssize_t derive_packet_protection_iv(uint8_t *dest, size_t destlen,
                                     const uint8_t *secret, size_t secretlen,
                                     const Context &ctx);
 
-// encrypt encrypts |plaintext| of length |plaintextlen| and writes
-// the encrypted data in the buffer pointed by |dest| of length
-// |destlen|.  This function can encrypt data in-place.  In other
-// words, |dest| == |plaintext| is allowed.  This function returns the
-// number of bytes written if it succeeds, or -1.
+// aead_ctx_new creates AEAD context for ctx.aead keyed with |key| of
+// length |keylen|.  |noncelen| is the length of nonce used for each
+// packet.  If |encrypt| is true, the context is used for encryption,
+// otherwise it is used for decryption.  The key schedule is done only
+// once here, and the context can be reused for any number of packets.
+// |keylen| and |noncelen| must match the key and nonce length of
+// ctx.aead.  This function returns the created context if it
+// succeeds, or nullptr.
+AEADContext *aead_ctx_new(const Context &ctx, const uint8_t *key,
+                          size_t keylen, size_t noncelen, bool encrypt);
+
+// aead_ctx_free frees |actx|.  |actx| may be nullptr.
+void aead_ctx_free(AEADContext *actx);
+
+// encrypt encrypts |plaintext| of length |plaintextlen| with the
+// keyed AEAD context |actx|, and writes the encrypted data in the
+// buffer pointed by |dest| of length |destlen|.  |actx| must be
+// created by aead_ctx_new for encryption.  This function can encrypt
+// data in-place.  In other words, |dest| == |plaintext| is allowed.
+// This function returns the number of bytes written if it succeeds,
+// or -1.
 ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                size_t plaintextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen);
-
-// decrypt decrypts |ciphertext| of length |ciphertextlen| and writes
-// the decrypted data in the buffer pointed by |dest| of length
-// |destlen|.  This function can decrypt data in-place.  In other
-// words, |dest| == |ciphertext| is allowed.  This function returns
-// the number of bytes written if it succeeds, or -1.
+                size_t plaintextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen);
+
+// decrypt decrypts |ciphertext| of length |ciphertextlen| with the
+// keyed AEAD context |actx|, and writes the decrypted data in the
+// buffer pointed by |dest| of length |destlen|.  |actx| must be
+// created by aead_ctx_new for decryption.  This function can decrypt
+// data in-place.  In other words, |dest| == |ciphertext| is allowed.
+// This function returns the number of bytes written if it succeeds,
+// or -1.
 ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                size_t ciphertextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen);
+                size_t ciphertextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen);
 
 // aead_max_overhead returns the maximum overhead of ctx.aead.
 size_t aead_max_overhead(const Context &ctx);
@@ -31,6 +31,7 @@
 #include <openssl/evp.h>
 #include <openssl/hkdf.h>
 #include <openssl/aead.h>
+#include <openssl/mem.h>
 
 #include "template.h"
 
@@ -68,18 +69,43 @@ int negotiated_aead(Context &ctx, SSL *ssl) {
   }
 }
 
-ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                size_t plaintextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
-  int rv;
+AEADContext *aead_ctx_new(const Context &ctx, const uint8_t *key,
+                          size_t keylen, size_t noncelen, bool encrypt) {
+  if (keylen != EVP_AEAD_key_length(ctx.aead) ||
+      noncelen != EVP_AEAD_nonce_length(ctx.aead)) {
+    return nullptr;
+  }
 
-  auto actx = EVP_AEAD_CTX_new(ctx.aead, key, keylen, 0);
+  auto actx = static_cast<EVP_AEAD_CTX *>(OPENSSL_malloc(sizeof(*actx)));
+  if (actx == nullptr) {
+    return nullptr;
+  }
 
-  assert(actx);
+  EVP_AEAD_CTX_zero(actx);
 
-  auto actx_d = defer(EVP_AEAD_CTX_free, actx);
+  if (EVP_AEAD_CTX_init_with_direction(
+          actx, ctx.aead, key, keylen, EVP_AEAD_DEFAULT_TAG_LENGTH,
+          encrypt ? evp_aead_seal : evp_aead_open) != 1) {
+    OPENSSL_free(actx);
+    return nullptr;
+  }
+
+  return actx;
+}
+
+void aead_ctx_free(AEADContext *actx) {
+  if (actx == nullptr) {
+    return;
+  }
 
+  EVP_AEAD_CTX_free(actx);
+}
+
+ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
+                size_t plaintextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
+  int rv;
   size_t outlen;
 
   rv = EVP_AEAD_CTX_seal(actx, dest, &outlen, destlen, nonce, noncelen,
@@ -92,17 +118,10 @@ ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
 }
 
 ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                size_t ciphertextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
+                size_t ciphertextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
   int rv;
-
-  auto actx = EVP_AEAD_CTX_new(ctx.aead, key, keylen, 0);
-
-  assert(actx);
-
-  auto actx_d = defer(EVP_AEAD_CTX_free, actx);
-
   size_t outlen;
 
   rv = EVP_AEAD_CTX_open(actx, dest, &outlen, destlen, nonce, noncelen,
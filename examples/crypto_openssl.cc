@@ -77,33 +77,54 @@ static size_t aead_tag_length(const Context &ctx) {
   assert(0);
 }
 
-ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                size_t plaintextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
-  auto taglen = aead_tag_length(ctx);
-
-  if (destlen < plaintextlen + taglen) {
-    return -1;
+AEADContext *aead_ctx_new(const Context &ctx, const uint8_t *key,
+                          size_t keylen, size_t noncelen, bool encrypt) {
+  if (keylen != aead_key_length(ctx) || noncelen != aead_nonce_length(ctx)) {
+    return nullptr;
   }
 
   auto actx = EVP_CIPHER_CTX_new();
   if (actx == nullptr) {
-    return -1;
+    return nullptr;
   }
 
-  auto actx_d = defer(EVP_CIPHER_CTX_free, actx);
-
-  if (EVP_EncryptInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr) != 1) {
-    return -1;
+  if (EVP_CipherInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr,
+                        encrypt ? 1 : 0) != 1) {
+    EVP_CIPHER_CTX_free(actx);
+    return nullptr;
   }
 
   if (EVP_CIPHER_CTX_ctrl(actx, EVP_CTRL_AEAD_SET_IVLEN, noncelen, nullptr) !=
       1) {
+    EVP_CIPHER_CTX_free(actx);
+    return nullptr;
+  }
+
+  // Install key now so that the key schedule is computed only once.
+  // The nonce is set per packet in encrypt/decrypt.
+  if (EVP_CipherInit_ex(actx, nullptr, nullptr, key, nullptr, -1) != 1) {
+    EVP_CIPHER_CTX_free(actx);
+    return nullptr;
+  }
+
+  return actx;
+}
+
+void aead_ctx_free(AEADContext *actx) { EVP_CIPHER_CTX_free(actx); }
+
+ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
+                size_t plaintextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
+  auto taglen = aead_tag_length(ctx);
+
+  if (destlen < plaintextlen + taglen) {
     return -1;
   }
 
-  if (EVP_EncryptInit_ex(actx, nullptr, nullptr, key, nonce) != 1) {
+  assert(noncelen == static_cast<size_t>(EVP_CIPHER_CTX_iv_length(actx)));
+
+  if (EVP_EncryptInit_ex(actx, nullptr, nullptr, nullptr, nonce) != 1) {
     return -1;
   }
 
@@ -139,9 +160,9 @@ ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
 }
 
 ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                size_t ciphertextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
+                size_t ciphertextlen, const Context &ctx, AEADContext *actx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
   auto taglen = aead_tag_length(ctx);
 
   if (taglen > ciphertextlen || destlen + taglen < ciphertextlen) {
@@ -151,23 +172,9 @@ ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
   ciphertextlen -= taglen;
   auto tag = ciphertext + ciphertextlen;
 
-  auto actx = EVP_CIPHER_CTX_new();
-  if (actx == nullptr) {
-    return -1;
-  }
-
-  auto actx_d = defer(EVP_CIPHER_CTX_free, actx);
-
-  if (EVP_DecryptInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr) != 1) {
-    return -1;
-  }
-
-  if (EVP_CIPHER_CTX_ctrl(actx, EVP_CTRL_AEAD_SET_IVLEN, noncelen, nullptr) !=
-      1) {
-    return -1;
-  }
+  assert(noncelen == static_cast<size_t>(EVP_CIPHER_CTX_iv_length(actx)));
 
-  if (EVP_DecryptInit_ex(actx, nullptr, nullptr, key, nonce) != 1) {
+  if (EVP_DecryptInit_ex(actx, nullptr, nullptr, nullptr, nonce) != 1) {
     return -1;
   }
 
@@ -0,0 +1,103 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <atomic>
+#include <utility>
+
+namespace ngtcp2 {
+
+// MPSCQueue is an unbounded lock-free queue which any number of
+// threads push to, and a single thread pops from.  Each push
+// allocates a node, and no lock is taken.  It is the intrusive queue
+// of Dmitry Vyukov with a stub node.
+template <typename T> class MPSCQueue {
+public:
+  MPSCQueue() : head_(&stub_), tail_(&stub_) {}
+
+  ~MPSCQueue() {
+    T v;
+    while (pop(v)) {
+    }
+
+    if (tail_ != &stub_) {
+      delete tail_;
+    }
+  }
+
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  // push appends |v|.  It may be called by any thread.
+  void push(T v) {
+    auto node = new Node(std::move(v));
+    auto prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // pop moves the first element to |v|, and returns true.  It returns
+  // false if the queue is empty, or the first element is still being
+  // pushed.  It must be called by the consumer thread only.
+  bool pop(T &v) {
+    auto tail = tail_;
+    auto next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+
+    // next becomes the new stub, and its value is taken out.
+    v = std::move(next->value);
+    tail_ = next;
+
+    if (tail != &stub_) {
+      delete tail;
+    }
+
+    return true;
+  }
+
+private:
+  struct Node {
+    Node() : value{}, next(nullptr) {}
+    explicit Node(T v) : value(std::move(v)), next(nullptr) {}
+
+    T value;
+    std::atomic<Node *> next;
+  };
+
+  Node stub_;
+  std::atomic<Node *> head_;
+  // tail_ is only touched by the consumer.
+  Node *tail_;
+};
+
+} // namespace ngtcp2
+
+#endif // MPSC_QUEUE_H
@@ -26,7 +26,9 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <memory>
+#include <thread>
 
 #include <unistd.h>
 #include <getopt.h>
@@ -47,7 +49,26 @@
 using namespace ngtcp2;
 
 namespace {
-auto randgen = util::make_mt19937();
+thread_local auto randgen = util::make_mt19937();
+} // namespace
+
+namespace {
+struct Config {
+  // single_socket is true if all connections share the listening
+  // socket, and Server dispatches datagrams to them by connection ID.
+  // Otherwise, each connection has a socket connected to its client.
+  bool single_socket;
+  // gso is true if Handlers send a burst of packets with one
+  // sendmsg(2) with UDP_SEGMENT.
+  bool gso;
+  // gro is true if the kernel may coalesce the datagrams which server
+  // receives.
+  bool gro;
+  // threads is the number of threads.  Each of them runs its own
+  // event loop and Server on a socket of its own, which shares the
+  // port with the others by SO_REUSEPORT.
+  size_t threads;
+} config;
 } // namespace
 
 namespace {
@@ -116,14 +137,19 @@ int bio_destroy(BIO *b) {
 
 namespace {
 BIO_METHOD *create_bio_method() {
-  static auto meth = BIO_meth_new(BIO_TYPE_FD, "bio");
-  BIO_meth_set_write(meth, bio_write);
-  BIO_meth_set_read(meth, bio_read);
-  BIO_meth_set_puts(meth, bio_puts);
-  BIO_meth_set_gets(meth, bio_gets);
-  BIO_meth_set_ctrl(meth, bio_ctrl);
-  BIO_meth_set_create(meth, bio_create);
-  BIO_meth_set_destroy(meth, bio_destroy);
+  // The method is shared by all worker threads.  It is set up exactly
+  // once, and never modified afterwards.
+  static auto meth = []() {
+    auto meth = BIO_meth_new(BIO_TYPE_FD, "bio");
+    BIO_meth_set_write(meth, bio_write);
+    BIO_meth_set_read(meth, bio_read);
+    BIO_meth_set_puts(meth, bio_puts);
+    BIO_meth_set_gets(meth, bio_gets);
+    BIO_meth_set_ctrl(meth, bio_ctrl);
+    BIO_meth_set_create(meth, bio_create);
+    BIO_meth_set_destroy(meth, bio_destroy);
+    return meth;
+  }();
   return meth;
 }
 } // namespace
@@ -133,7 +159,7 @@ void hwritecb(struct ev_loop *loop, ev_io *w, int revents) {
   auto h = static_cast<Handler *>(w->data);
 
   if (h->on_write() != 0) {
-    delete h;
+    h->server()->remove(h);
   }
 }
 } // namespace
@@ -143,7 +169,7 @@ void hreadcb(struct ev_loop *loop, ev_io *w, int revents) {
   auto h = static_cast<Handler *>(w->data);
 
   if (h->on_read() != 0) {
-    delete h;
+    h->server()->remove(h);
   }
 }
 } // namespace
@@ -152,29 +178,33 @@ namespace {
 void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto h = static_cast<Handler *>(w->data);
 
-  debug::print_timestamp();
-  std::cerr << "Timeout" << std::endl;
-
-  delete h;
+  if (h->on_timeout() != 0) {
+    h->server()->remove(h);
+  }
 }
 } // namespace
 
-Handler::Handler(struct ev_loop *loop, SSL_CTX *ssl_ctx)
+Handler::Handler(struct ev_loop *loop, SSL_CTX *ssl_ctx, Server *server)
     : remote_addr_{},
       max_pktlen_(0),
       loop_(loop),
       ssl_ctx_(ssl_ctx),
+      server_(server),
       ssl_(nullptr),
       fd_(-1),
       ncread_(0),
       nsread_(0),
       conn_(nullptr),
-      crypto_ctx_{} {
+      conn_id_(0),
+      client_conn_id_(0),
+      crypto_ctx_{},
+      tx_aead_ctx_(nullptr),
+      rx_aead_ctx_(nullptr) {
   ev_io_init(&wev_, hwritecb, 0, EV_WRITE);
   ev_io_init(&rev_, hreadcb, 0, EV_READ);
   wev_.data = this;
   rev_.data = this;
-  ev_timer_init(&timer_, timeoutcb, 5., 0.);
+  ev_timer_init(&timer_, timeoutcb, 0., 0.);
   timer_.data = this;
 }
 
@@ -191,11 +221,14 @@ Handler::~Handler() {
     ngtcp2_conn_del(conn_);
   }
 
+  crypto::aead_ctx_free(rx_aead_ctx_);
+  crypto::aead_ctx_free(tx_aead_ctx_);
+
   if (ssl_) {
     SSL_free(ssl_);
   }
 
-  if (fd_ != -1) {
+  if (fd_ != -1 && !config.single_socket) {
     close(fd_);
   }
 }
@@ -249,8 +282,8 @@ ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
-  auto nwrite = h->encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  auto nwrite = h->encrypt_data(dest, destlen, plaintext, plaintextlen, nonce,
+                                noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -267,8 +300,8 @@ ssize_t do_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
-  auto nwrite = h->decrypt_data(dest, destlen, ciphertext, ciphertextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  auto nwrite = h->decrypt_data(dest, destlen, ciphertext, ciphertextlen,
+                                nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -292,7 +325,8 @@ int recv_handshake_data(ngtcp2_conn *conn, const uint8_t *data, size_t datalen,
 }
 } // namespace
 
-int Handler::init(int fd, const sockaddr *sa, socklen_t salen) {
+int Handler::init(int fd, const sockaddr *sa, socklen_t salen,
+                  uint64_t client_conn_id) {
   int rv;
 
   remote_addr_.len = salen;
@@ -330,13 +364,21 @@ int Handler::init(int fd, const sockaddr *sa, socklen_t salen) {
       nullptr,
       do_encrypt,
       do_decrypt,
+      nullptr,
+      nullptr,
   };
 
-  auto conn_id = std::uniform_int_distribution<uint64_t>(
-      0, std::numeric_limits<uint64_t>::max())(randgen);
+  client_conn_id_ = client_conn_id;
+  // The most significant byte tells which worker owns the connection.
+  conn_id_ = std::uniform_int_distribution<uint64_t>(
+                 0, std::numeric_limits<uint64_t>::max() >> 8)(randgen) |
+             (static_cast<uint64_t>(server_->worker_id()) << 56);
+
+  ngtcp2_settings settings;
+  ngtcp2_settings_default(&settings);
 
-  rv = ngtcp2_conn_server_new(&conn_, conn_id, NGTCP2_PROTO_VERSION, &callbacks,
-                              this);
+  rv = ngtcp2_conn_server_new(&conn_, conn_id_, NGTCP2_PROTO_VERSION,
+                              &callbacks, &settings, this);
   if (rv != 0) {
     std::cerr << "ngtcp2_conn_server_new: " << ngtcp2_strerror(rv) << std::endl;
     return -1;
@@ -345,8 +387,10 @@ int Handler::init(int fd, const sockaddr *sa, socklen_t salen) {
   ev_io_set(&wev_, fd_, EV_WRITE);
   ev_io_set(&rev_, fd_, EV_READ);
 
-  ev_io_start(loop_, &rev_);
-  ev_timer_start(loop_, &timer_);
+  // Server reads the shared socket, and hands datagrams to us.
+  if (!config.single_socket) {
+    ev_io_start(loop_, &rev_);
+  }
 
   return 0;
 }
@@ -442,6 +486,12 @@ int Handler::setup_crypto_context() {
 
   ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
 
+  tx_aead_ctx_ = crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen,
+                                      true);
+  if (tx_aead_ctx_ == nullptr) {
+    return -1;
+  }
+
   rv = crypto::export_client_secret(crypto_ctx_.rx_secret.data(),
                                     crypto_ctx_.secretlen, ssl_);
   if (rv != 0) {
@@ -464,6 +514,12 @@ int Handler::setup_crypto_context() {
 
   ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
 
+  rx_aead_ctx_ = crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen,
+                                      false);
+  if (rx_aead_ctx_ == nullptr) {
+    return -1;
+  }
+
   ngtcp2_conn_set_aead_overhead(conn_, crypto::aead_max_overhead(crypto_ctx_));
 
   return 0;
@@ -471,23 +527,22 @@ int Handler::setup_crypto_context() {
 
 ssize_t Handler::encrypt_data(uint8_t *dest, size_t destlen,
                               const uint8_t *plaintext, size_t plaintextlen,
-                              const uint8_t *key, size_t keylen,
                               const uint8_t *nonce, size_t noncelen,
                               const uint8_t *ad, size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         tx_aead_ctx_, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Handler::decrypt_data(uint8_t *dest, size_t destlen,
                               const uint8_t *ciphertext, size_t ciphertextlen,
-                              const uint8_t *key, size_t keylen,
                               const uint8_t *nonce, size_t noncelen,
                               const uint8_t *ad, size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         rx_aead_ctx_, nonce, noncelen, ad, adlen);
 }
 
-int Handler::feed_data(uint8_t *data, size_t datalen) {
+int Handler::feed_data(const Address &remote_addr, uint8_t *data,
+                       size_t datalen) {
   int rv;
 
   rv = ngtcp2_conn_recv(conn_, data, datalen, util::timestamp());
@@ -496,22 +551,55 @@ int Handler::feed_data(uint8_t *data, size_t datalen) {
     return -1;
   }
 
+  if (config.single_socket &&
+      (remote_addr.len != remote_addr_.len ||
+       memcmp(&remote_addr.su, &remote_addr_.su, remote_addr.len) != 0)) {
+    debug::print_timestamp();
+    std::cerr << "Client address changed" << std::endl;
+    remote_addr_ = remote_addr;
+  }
+
   return 0;
 }
 
 int Handler::on_read() {
-  sockaddr_union su;
-  socklen_t addrlen = sizeof(su);
-  std::array<uint8_t, 64_k> buf;
+  auto &reader = server_->reader();
 
-  auto nread =
-      recvfrom(fd_, buf.data(), buf.size(), MSG_DONTWAIT, &su.sa, &addrlen);
+  auto nread = reader.recv(fd_);
   if (nread == -1) {
-    std::cerr << "recvfrom: " << strerror(errno) << std::endl;
     return 0;
   }
 
-  if (feed_data(buf.data(), nread) != 0) {
+  for (ssize_t i = 0; i < nread; ++i) {
+    if (feed_data(reader.remote_addr(i), reader.data(i), reader.datalen(i)) !=
+        0) {
+      return -1;
+    }
+  }
+
+  return on_write();
+}
+
+void Handler::schedule_timer() {
+  auto expiry = ngtcp2_conn_get_expiry(conn_);
+  if (expiry == std::numeric_limits<ngtcp2_tstamp>::max()) {
+    ev_timer_stop(loop_, &timer_);
+    return;
+  }
+
+  auto now = util::timestamp();
+  // ev_timer_again does nothing if repeat is 0.
+  timer_.repeat =
+      expiry > now ? static_cast<ev_tstamp>(expiry - now) / 1000000. : 1e-9;
+  ev_timer_again(loop_, &timer_);
+}
+
+int Handler::on_timeout() {
+  auto rv = ngtcp2_conn_handle_expiry(conn_, util::timestamp());
+  if (rv != 0) {
+    debug::print_timestamp();
+    std::cerr << "ngtcp2_conn_handle_expiry: " << ngtcp2_strerror(rv)
+              << std::endl;
     return -1;
   }
 
@@ -519,30 +607,45 @@ int Handler::on_read() {
 }
 
 int Handler::on_write() {
-  std::array<uint8_t, NGTCP2_MAX_PKTLEN_IPV4> buf;
+  auto &writer = server_->writer();
 
-  assert(buf.size() >= max_pktlen_);
+  assert(writer.buflen() >= max_pktlen_);
 
   for (;;) {
-    auto n = ngtcp2_conn_send(conn_, buf.data(), buf.size(), util::timestamp());
+    auto n =
+        ngtcp2_conn_send(conn_, writer.buf(), max_pktlen_, util::timestamp());
     if (n < 0) {
       std::cerr << "ngtcp2_conn_send: " << ngtcp2_strerror(n) << std::endl;
       return -1;
     }
     if (n == 0) {
-      return 0;
+      break;
     }
 
-    auto nwrite = write(fd_, buf.data(), n);
-    if (nwrite == -1) {
-      std::cerr << "write: " << strerror(errno) << std::endl;
+    writer.push(n, config.single_socket ? &remote_addr_ : nullptr);
+
+    if (writer.full() && writer.flush(fd_) != 0) {
       return -1;
     }
   }
+
+  if (writer.flush(fd_) != 0) {
+    return -1;
+  }
+
+  schedule_timer();
+
+  return 0;
 }
 
 void Handler::signal_write() { ev_feed_event(loop_, &wev_, EV_WRITE); }
 
+Server *Handler::server() const { return server_; }
+
+uint64_t Handler::conn_id() const { return conn_id_; }
+
+uint64_t Handler::client_conn_id() const { return client_conn_id_; }
+
 namespace {
 void swritecb(struct ev_loop *loop, ev_io *w, int revents) {}
 } // namespace
@@ -555,15 +658,49 @@ void sreadcb(struct ev_loop *loop, ev_io *w, int revents) {
 }
 } // namespace
 
+namespace {
+void forwardcb(struct ev_loop *loop, ev_async *w, int revents) {
+  auto s = static_cast<Server *>(w->data);
+
+  s->on_forward();
+}
+} // namespace
+
+namespace {
+void statscb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto s = static_cast<Server *>(w->data);
+
+  s->print_stats();
+}
+} // namespace
+
 Server::Server(struct ev_loop *loop, SSL_CTX *ssl_ctx)
-    : loop_(loop), ssl_ctx_(ssl_ctx), fd_(-1) {
+    : loop_(loop),
+      ssl_ctx_(ssl_ctx),
+      fd_(-1),
+      reader_(udp::MAX_BATCH, 64_k),
+      writer_(udp::MAX_BATCH, NGTCP2_MAX_PKTLEN_IPV4),
+      worker_id_(0),
+      nmisrouted_(0),
+      nforwarded_(0),
+      forward_latency_(0),
+      max_forward_latency_(0),
+      nreported_(0) {
   ev_io_init(&wev_, swritecb, 0, EV_WRITE);
   ev_io_init(&rev_, sreadcb, 0, EV_READ);
   wev_.data = this;
   rev_.data = this;
+  ev_async_init(&forwardev_, forwardcb);
+  forwardev_.data = this;
+  ev_timer_init(&statsev_, statscb, 10., 10.);
+  statsev_.data = this;
 }
 
 Server::~Server() {
+  handlers_.clear();
+
+  ev_timer_stop(loop_, &statsev_);
+  ev_async_stop(loop_, &forwardev_);
   ev_io_stop(loop_, &rev_);
   ev_io_stop(loop_, &wev_);
 
@@ -575,6 +712,15 @@ Server::~Server() {
 int Server::init(int fd) {
   fd_ = fd;
 
+  if (config.gso) {
+    writer_.enable_gso();
+  }
+
+  if (config.gro && !udp::enable_gro(fd_)) {
+    std::cerr << "UDP GRO is not available: " << strerror(errno)
+              << std::endl;
+  }
+
   ev_io_set(&wev_, fd_, EV_WRITE);
   ev_io_set(&rev_, fd_, EV_READ);
 
@@ -584,91 +730,263 @@ int Server::init(int fd) {
 }
 
 int Server::on_read() {
-  sockaddr_union su;
-  socklen_t addrlen = sizeof(su);
-  std::array<uint8_t, 64_k> buf;
-  int rv;
-  ngtcp2_pkt_hd hd;
-
-  auto nread =
-      recvfrom(fd_, buf.data(), buf.size(), MSG_DONTWAIT, &su.sa, &addrlen);
-  if (nread == -1) {
-    std::cerr << "recvfrom: " << strerror(errno) << std::endl;
+  auto nread = reader_.recv(fd_);
+  if (nread <= 0) {
     // TODO Handle running out of fd
     return 0;
   }
 
-  switch (su.storage.ss_family) {
+  // A connection writes once after all of its packets in the batch
+  // are fed to it.
+  for (ssize_t i = 0; i < nread; ++i) {
+    auto data = reader_.data(i);
+    auto datalen = reader_.datalen(i);
+
+    if (config.single_socket) {
+      ngtcp2_pkt_hd hd;
+
+      if (ngtcp2_pkt_decode_hd(&hd, data, datalen) < 0) {
+        std::cerr << "Could not decode QUIC packet header" << std::endl;
+        continue;
+      }
+
+      if (!(hd.flags &
+            (NGTCP2_PKT_FLAG_LONG_FORM | NGTCP2_PKT_FLAG_CONN_ID))) {
+        // We have no way to tell which connection it belongs to.
+        continue;
+      }
+
+      // Client Initial and 0-RTT Protected packets carry the
+      // connection ID which client chose.
+      if (workers_.size() > 1 &&
+          (!(hd.flags & NGTCP2_PKT_FLAG_LONG_FORM) ||
+           hd.type == NGTCP2_PKT_CLIENT_CLEARTEXT)) {
+        auto worker = worker_of(hd.conn_id);
+        if (worker != worker_id_) {
+          if (worker < workers_.size()) {
+            ++nmisrouted_;
+            workers_[worker]->forward(ForwardedPacket{
+                std::vector<uint8_t>(data, data + datalen),
+                reader_.remote_addr(i), hd.conn_id, util::timestamp()});
+          }
+          continue;
+        }
+      }
+
+      if (dispatch(hd.conn_id, reader_.remote_addr(i), data, datalen)) {
+        continue;
+      }
+    }
+
+    accept_conn(reader_.remote_addr(i), data, datalen);
+  }
+
+  write_pending();
+
+  return 0;
+}
+
+bool Server::dispatch(uint64_t conn_id, const Address &remote_addr,
+                      uint8_t *data, size_t datalen) {
+  auto h = find(conn_id);
+  if (!h) {
+    return false;
+  }
+
+  if (h->feed_data(remote_addr, data, datalen) != 0) {
+    remove(h);
+    return true;
+  }
+
+  if (std::find(std::begin(pending_), std::end(pending_), h->conn_id()) ==
+      std::end(pending_)) {
+    pending_.push_back(h->conn_id());
+  }
+
+  return true;
+}
+
+void Server::write_pending() {
+  for (auto conn_id : pending_) {
+    auto h = find(conn_id);
+    if (h && h->on_write() != 0) {
+      remove(h);
+    }
+  }
+
+  pending_.clear();
+}
+
+int Server::accept_conn(const Address &remote_addr, uint8_t *data,
+                        size_t datalen) {
+  int rv;
+  ngtcp2_pkt_hd hd;
+
+  switch (remote_addr.su.storage.ss_family) {
   case AF_INET:
-    if (nread < NGTCP2_MAX_PKTLEN_IPV4) {
+    if (datalen < NGTCP2_MAX_PKTLEN_IPV4) {
       return 0;
     }
     break;
   case AF_INET6:
-    if (nread < NGTCP2_MAX_PKTLEN_IPV6) {
+    if (datalen < NGTCP2_MAX_PKTLEN_IPV6) {
       return 0;
     }
     break;
   }
 
-  rv = ngtcp2_accept(&hd, buf.data(), nread);
+  rv = ngtcp2_accept(&hd, data, datalen);
   if (rv == -1) {
     std::cerr << "Unexpected packet received" << std::endl;
     return 0;
   }
   if (rv == 1) {
     std::cerr << "Unsupported version: Send Version Negotiation" << std::endl;
-    send_version_negotiation(&hd, &su.sa, addrlen);
+    send_version_negotiation(&hd, &remote_addr.su.sa, remote_addr.len);
     return 0;
   }
 
-  if ((buf[0] & 0x7f) != NGTCP2_PKT_CLIENT_INITIAL) {
+  if ((data[0] & 0x7f) != NGTCP2_PKT_CLIENT_INITIAL) {
     return 0;
   }
 
-  auto fd = socket(su.storage.ss_family, SOCK_DGRAM, 0);
-  if (fd == -1) {
-    std::cerr << "socket: " << strerror(errno) << std::endl;
-    return 0;
-  }
+  auto fd = fd_;
 
-  auto val = 1;
-  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val,
-                 static_cast<socklen_t>(sizeof(val))) == -1) {
-    close(fd);
-    return 0;
-  }
+  if (!config.single_socket) {
+    fd = socket(remote_addr.su.storage.ss_family, SOCK_DGRAM, 0);
+    if (fd == -1) {
+      std::cerr << "socket: " << strerror(errno) << std::endl;
+      return 0;
+    }
 
-  {
-    sockaddr_union su;
-    socklen_t addrlen = sizeof(su);
+    auto val = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      close(fd);
+      return 0;
+    }
+
+    {
+      sockaddr_union su;
+      socklen_t addrlen = sizeof(su);
 
-    if (getsockname(fd_, &su.sa, &addrlen) == -1) {
-      std::cerr << "getsockname: " << strerror(errno) << std::endl;
+      if (getsockname(fd_, &su.sa, &addrlen) == -1) {
+        std::cerr << "getsockname: " << strerror(errno) << std::endl;
+      }
+
+      if (bind(fd, &su.sa, addrlen) == -1) {
+        std::cerr << "bind: " << strerror(errno) << std::endl;
+      }
     }
 
-    if (bind(fd, &su.sa, addrlen) == -1) {
-      std::cerr << "bind: " << strerror(errno) << std::endl;
+    if (connect(fd, &remote_addr.su.sa, remote_addr.len) == -1) {
+      std::cerr << "connect: " << strerror(errno) << std::endl;
+      close(fd);
+      return 0;
+    }
+
+    if (config.gro) {
+      udp::enable_gro(fd);
     }
   }
 
-  if (connect(fd, &su.sa, addrlen) == -1) {
-    std::cerr << "connect: " << strerror(errno) << std::endl;
-    close(fd);
+  auto h = std::make_unique<Handler>(loop_, ssl_ctx_, this);
+  h->init(fd, &remote_addr.su.sa, remote_addr.len, hd.conn_id);
+  if (handlers_.count(h->conn_id())) {
+    // Server chose a connection ID which is already in use.
     return 0;
   }
-
-  auto h = std::make_unique<Handler>(loop_, ssl_ctx_);
-  h->init(fd, &su.sa, addrlen);
-  if (h->feed_data(buf.data(), nread) != 0) {
+  if (h->feed_data(remote_addr, data, datalen) != 0) {
     return 0;
   }
   h->signal_write();
-  h.release();
+
+  ctos_.emplace(hd.conn_id, h->conn_id());
+  handlers_.emplace(h->conn_id(), std::move(h));
 
   return 0;
 }
 
+Handler *Server::find(uint64_t conn_id) {
+  auto it = handlers_.find(conn_id);
+  if (it != std::end(handlers_)) {
+    return (*it).second.get();
+  }
+
+  auto cit = ctos_.find(conn_id);
+  if (cit == std::end(ctos_)) {
+    return nullptr;
+  }
+
+  it = handlers_.find((*cit).second);
+  if (it == std::end(handlers_)) {
+    return nullptr;
+  }
+
+  return (*it).second.get();
+}
+
+udp::Reader &Server::reader() { return reader_; }
+
+udp::Writer &Server::writer() { return writer_; }
+
+void Server::set_workers(size_t id, std::vector<Server *> workers) {
+  worker_id_ = id;
+  workers_ = std::move(workers);
+
+  if (workers_.size() > 1) {
+    ev_async_start(loop_, &forwardev_);
+    ev_timer_again(loop_, &statsev_);
+  }
+}
+
+size_t Server::worker_id() const { return worker_id_; }
+
+void Server::forward(ForwardedPacket pkt) {
+  forwardq_.push(std::move(pkt));
+  ev_async_send(loop_, &forwardev_);
+}
+
+void Server::on_forward() {
+  ForwardedPacket pkt;
+
+  while (forwardq_.pop(pkt)) {
+    auto now = util::timestamp();
+    auto latency = now > pkt.ts ? now - pkt.ts : 0;
+
+    ++nforwarded_;
+    forward_latency_ += latency;
+    max_forward_latency_ = std::max(max_forward_latency_, latency);
+
+    dispatch(pkt.conn_id, pkt.remote_addr, pkt.data.data(), pkt.data.size());
+  }
+
+  write_pending();
+}
+
+void Server::print_stats() {
+  if (nmisrouted_ + nforwarded_ == nreported_) {
+    return;
+  }
+
+  nreported_ = nmisrouted_ + nforwarded_;
+
+  debug::print_timestamp();
+  std::cerr << "worker " << worker_id_ << ": " << nmisrouted_
+            << " packets misrouted, " << nforwarded_
+            << " packets forwarded to us";
+  if (nforwarded_) {
+    std::cerr << " (latency avg " << forward_latency_ / nforwarded_
+              << "us, max " << max_forward_latency_ << "us)";
+  }
+  std::cerr << std::endl;
+}
+
+void Server::remove(const Handler *h) {
+  ctos_.erase(h->client_conn_id());
+  handlers_.erase(h->conn_id());
+}
+
 namespace {
 uint32_t generate_reserved_vesrion(const sockaddr *sa, socklen_t salen,
                                    uint32_t version) {
@@ -815,6 +1133,15 @@ int create_sock(const char *addr, const char *port) {
       continue;
     }
 
+    auto val = 1;
+    if (config.threads > 1 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      std::cerr << "setsockopt: " << strerror(errno) << std::endl;
+      close(fd);
+      continue;
+    }
+
     if (bind(fd, rp->ai_addr, rp->ai_addrlen) != -1) {
       break;
     }
@@ -839,19 +1166,22 @@ int create_sock(const char *addr, const char *port) {
 } // namespace
 
 namespace {
-int serve(Server &s, const char *addr, const char *port) {
-  int rv;
-
+// serve runs Server on |loop|.  The connections which it accepts
+// stay on |loop| until they are closed.
+int serve(struct ev_loop *loop, SSL_CTX *ssl_ctx, const char *addr,
+          const char *port) {
   auto fd = create_sock(addr, port);
   if (fd == -1) {
     return -1;
   }
 
+  Server s(loop, ssl_ctx);
+
   if (s.init(fd) != 0) {
     return -1;
   }
 
-  ev_run(EV_DEFAULT, 0);
+  ev_run(loop, 0);
 
   return 0;
 }
@@ -859,15 +1189,24 @@ int serve(Server &s, const char *addr, const char *port) {
 
 namespace {
 void print_usage() {
-  std::cerr << "Usage: server ADDR PORT PRIVATE_KEY_FILE CERTIFICATE_FILE"
+  std::cerr << "Usage: server [--single-socket] [--gso] [--gro] [--threads N] "
+               "ADDR PORT\n"
+               "              PRIVATE_KEY_FILE CERTIFICATE_FILE"
             << std::endl;
 }
 } // namespace
 
 int main(int argc, char **argv) {
+  config.threads = 1;
+
   for (;;) {
     static int flag = 0;
-    constexpr static option long_opts[] = {{nullptr, 0, nullptr, 0}};
+    constexpr static option long_opts[] = {
+        {"single-socket", no_argument, &flag, 1},
+        {"gso", no_argument, &flag, 2},
+        {"gro", no_argument, &flag, 3},
+        {"threads", required_argument, &flag, 4},
+        {nullptr, 0, nullptr, 0}};
 
     auto optidx = 0;
     auto c = getopt_long(argc, argv, "", long_opts, &optidx);
@@ -878,6 +1217,27 @@ int main(int argc, char **argv) {
     case '?':
       print_usage();
       exit(EXIT_FAILURE);
+    case 0:
+      switch (flag) {
+      case 1:
+        // --single-socket
+        config.single_socket = true;
+        break;
+      case 2:
+        // --gso
+        config.gso = true;
+        break;
+      case 3:
+        // --gro
+        config.gro = true;
+        break;
+      case 4:
+        // --threads
+        config.threads = std::min(
+            std::max(strtoul(optarg, nullptr, 10), 1ul), MAX_WORKERS);
+        break;
+      }
+      break;
     default:
       break;
     };
@@ -901,15 +1261,67 @@ int main(int argc, char **argv) {
 
   auto ssl_ctx_d = defer(SSL_CTX_free, ssl_ctx);
 
+  // Set up the shared BIO_METHOD before any worker thread starts.
+  create_bio_method();
+
   debug::reset_timestamp();
 
   if (isatty(STDOUT_FILENO)) {
     debug::set_color_output(true);
   }
 
-  Server s(EV_DEFAULT, ssl_ctx);
+  if (config.threads == 1) {
+    if (serve(EV_DEFAULT, ssl_ctx, addr, port) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
 
-  if (serve(s, addr, port) != 0) {
-    exit(EXIT_FAILURE);
+  // The Servers are set up before any thread starts, so that each of
+  // them can forward datagrams to the others.
+  std::vector<struct ev_loop *> loops;
+  std::vector<std::unique_ptr<Server>> servers;
+  std::vector<Server *> workers;
+
+  for (size_t i = 0; i < config.threads; ++i) {
+    auto loop = ev_loop_new(EVFLAG_AUTO);
+    if (loop == nullptr) {
+      std::cerr << "ev_loop_new failed" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    loops.push_back(loop);
+
+    auto fd = create_sock(addr, port);
+    if (fd == -1) {
+      exit(EXIT_FAILURE);
+    }
+
+    servers.push_back(std::make_unique<Server>(loop, ssl_ctx));
+    if (servers.back()->init(fd) != 0) {
+      exit(EXIT_FAILURE);
+    }
+
+    workers.push_back(servers.back().get());
+  }
+
+  for (size_t i = 0; i < config.threads; ++i) {
+    servers[i]->set_workers(i, workers);
+  }
+
+  std::vector<std::thread> threads;
+
+  for (auto loop : loops) {
+    threads.emplace_back([loop]() { ev_run(loop, 0); });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  servers.clear();
+
+  for (auto loop : loops) {
+    ev_loop_destroy(loop);
   }
 }
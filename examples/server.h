@@ -30,6 +30,8 @@
 #endif // HAVE_CONFIG_H
 
 #include <vector>
+#include <unordered_map>
+#include <memory>
 
 #include <ngtcp2/ngtcp2.h>
 
@@ -38,19 +40,56 @@
 
 #include "network.h"
 #include "crypto.h"
+#include "udp.h"
+#include "mpsc_queue.h"
 
 using namespace ngtcp2;
 
+// MAX_WORKERS is the maximum number of worker threads.  The index of
+// the worker which owns a connection is encoded in the most
+// significant byte of the connection ID which server chooses.
+constexpr size_t MAX_WORKERS = 256;
+
+// worker_of returns the index of the worker which owns the connection
+// identified by |conn_id|.
+constexpr size_t worker_of(uint64_t conn_id) { return conn_id >> 56; }
+
+// ForwardedPacket is a datagram which a worker received for a
+// connection of another worker.
+struct ForwardedPacket {
+  std::vector<uint8_t> data;
+  Address remote_addr;
+  uint64_t conn_id;
+  // ts is the time when the datagram was forwarded.
+  ngtcp2_tstamp ts;
+};
+
+class Server;
+
 class Handler {
 public:
-  Handler(struct ev_loop *loop, SSL_CTX *ssl_ctx);
+  Handler(struct ev_loop *loop, SSL_CTX *ssl_ctx, Server *server);
   ~Handler();
 
-  int init(int fd, const sockaddr *sa, socklen_t salen);
+  // init starts the connection with the client at |sa|, which sent
+  // Client Initial with |client_conn_id|.  Unless all connections
+  // share the listening socket, |fd| is a socket connected to the
+  // client, and Handler owns it.
+  int init(int fd, const sockaddr *sa, socklen_t salen,
+           uint64_t client_conn_id);
   int tls_handshake();
   int on_read();
   int on_write();
-  int feed_data(uint8_t *data, size_t datalen);
+  int on_timeout();
+  // schedule_timer arms timer_ to fire at the expiry of conn_, or
+  // stops it if there is no expiry.
+  void schedule_timer();
+  // feed_data feeds the datagram |data| of length |datalen| received
+  // from |remote_addr| to conn_.  In single socket mode, the packets
+  // are sent to the address which the last valid datagram came from,
+  // so that the connection follows the client which changes its
+  // address.
+  int feed_data(const Address &remote_addr, uint8_t *data, size_t datalen);
   void signal_write();
 
   void write_server_handshake(const uint8_t *data, size_t datalen);
@@ -61,19 +100,24 @@ public:
 
   int setup_crypto_context();
   ssize_t encrypt_data(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                       size_t plaintextlen, const uint8_t *key, size_t keylen,
-                       const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
-                       size_t adlen);
+                       size_t plaintextlen, const uint8_t *nonce,
+                       size_t noncelen, const uint8_t *ad, size_t adlen);
   ssize_t decrypt_data(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                       size_t ciphertextlen, const uint8_t *key, size_t keylen,
-                       const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
-                       size_t adlen);
+                       size_t ciphertextlen, const uint8_t *nonce,
+                       size_t noncelen, const uint8_t *ad, size_t adlen);
+
+  Server *server() const;
+  // conn_id returns the connection ID which server chose.
+  uint64_t conn_id() const;
+  // client_conn_id returns the connection ID of Client Initial.
+  uint64_t client_conn_id() const;
 
 private:
   Address remote_addr_;
   size_t max_pktlen_;
   struct ev_loop *loop_;
   SSL_CTX *ssl_ctx_;
+  Server *server_;
   SSL *ssl_;
   int fd_;
   ev_io wev_;
@@ -84,7 +128,13 @@ private:
   std::vector<uint8_t> shandshake_;
   size_t nsread_;
   ngtcp2_conn *conn_;
+  uint64_t conn_id_;
+  uint64_t client_conn_id_;
   crypto::Context crypto_ctx_;
+  // tx_aead_ctx_ and rx_aead_ctx_ are keyed AEAD contexts created
+  // when 1-RTT keys are installed, and reused for every packet.
+  crypto::AEADContext *tx_aead_ctx_;
+  crypto::AEADContext *rx_aead_ctx_;
 };
 
 class Server {
@@ -94,15 +144,76 @@ public:
 
   int init(int fd);
   int on_read();
+  // accept_conn starts a new connection if |data| of length |datalen|
+  // from |remote_addr| is Client Initial.
+  int accept_conn(const Address &remote_addr, uint8_t *data,
+                  size_t datalen);
   int send_version_negotiation(const ngtcp2_pkt_hd *hd, const sockaddr *sa,
                                socklen_t salen);
+  // find returns the Handler of the connection which |conn_id|
+  // identifies, or nullptr.
+  Handler *find(uint64_t conn_id);
+  // remove removes and deletes |h|.
+  void remove(const Handler *h);
+  // reader and writer are shared by Server and its Handlers.  The
+  // event loop runs one of them at a time.
+  udp::Reader &reader();
+  udp::Writer &writer();
+  // set_workers makes this Server |id|-th of |workers|, the Servers
+  // which share the port.  The datagrams of the connections of the
+  // other workers are forwarded to them.
+  void set_workers(size_t id, std::vector<Server *> workers);
+  size_t worker_id() const;
+  // forward hands |pkt| to this Server.  It may be called by any
+  // thread.
+  void forward(ForwardedPacket pkt);
+  // on_forward feeds the datagrams forwarded to this Server.
+  void on_forward();
+  void print_stats();
 
 private:
+  // dispatch feeds |data| of length |datalen| received from
+  // |remote_addr| to the Handler of the connection identified by
+  // |conn_id|, and returns true if there is one.  The Handler writes
+  // when write_pending is called.
+  bool dispatch(uint64_t conn_id, const Address &remote_addr, uint8_t *data,
+                size_t datalen);
+  void write_pending();
+
   struct ev_loop *loop_;
   SSL_CTX *ssl_ctx_;
   int fd_;
   ev_io wev_;
   ev_io rev_;
+  udp::Reader reader_;
+  udp::Writer writer_;
+  // handlers_ maps the connection ID which server chose to the
+  // Handler of the connection.
+  std::unordered_map<uint64_t, std::unique_ptr<Handler>> handlers_;
+  // ctos_ maps the connection ID of Client Initial to the one which
+  // server chose.  Client uses the former until it receives the
+  // first packet from server.
+  std::unordered_map<uint64_t, uint64_t> ctos_;
+  // pending_ is the connection IDs of the connections which write
+  // after the current batch of datagrams is processed.
+  std::vector<uint64_t> pending_;
+  size_t worker_id_;
+  std::vector<Server *> workers_;
+  MPSCQueue<ForwardedPacket> forwardq_;
+  ev_async forwardev_;
+  ev_timer statsev_;
+  // nmisrouted_ is the number of datagrams which this Server received
+  // for the connections of the other workers.
+  uint64_t nmisrouted_;
+  // nforwarded_ is the number of datagrams forwarded to this Server.
+  // forward_latency_ and max_forward_latency_ are the sum and the
+  // maximum of the time they took to arrive, in microseconds.
+  uint64_t nforwarded_;
+  uint64_t forward_latency_;
+  uint64_t max_forward_latency_;
+  // nreported_ is nmisrouted_ + nforwarded_ when print_stats printed
+  // them last time.
+  uint64_t nreported_;
 };
 
 #endif // SERVER_H
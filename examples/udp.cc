@@ -0,0 +1,326 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "udp.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+#include <array>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif // UDP_SEGMENT
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif // UDP_GRO
+
+namespace ngtcp2 {
+
+namespace udp {
+
+bool enable_gro(int fd) {
+  int val = 1;
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &val,
+                    static_cast<socklen_t>(sizeof(val))) == 0;
+}
+
+Reader::Reader(size_t nslots, size_t slotlen)
+    : nsyscalls(0),
+      npkts(0),
+      slotlen_(slotlen),
+      ctrllen_(CMSG_SPACE(sizeof(int))),
+      buf_(nslots * slotlen),
+      ctrl_(nslots * ctrllen_),
+      addrs_(nslots),
+      iovs_(nslots),
+      msgs_(nslots) {
+  dgrams_.reserve(nslots);
+}
+
+namespace {
+// gro_size returns the size of the datagrams coalesced in |msg|, or
+// 0 if it is not coalesced.
+size_t gro_size(msghdr *msg) {
+  for (auto cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+      int size;
+      memcpy(&size, CMSG_DATA(cm), sizeof(size));
+      return size > 0 ? size : 0;
+    }
+  }
+
+  return 0;
+}
+} // namespace
+
+ssize_t Reader::recv(int fd) {
+  dgrams_.clear();
+
+  for (size_t i = 0; i < msgs_.size(); ++i) {
+    iovs_[i].iov_base = buf_.data() + i * slotlen_;
+    iovs_[i].iov_len = slotlen_;
+
+    auto &hdr = msgs_[i].msg_hdr;
+    hdr = {};
+    hdr.msg_name = &addrs_[i].su;
+    hdr.msg_namelen = sizeof(addrs_[i].su);
+    hdr.msg_iov = &iovs_[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl_.data() + i * ctrllen_;
+    hdr.msg_controllen = ctrllen_;
+  }
+
+  ssize_t n;
+  do {
+    n = recvmmsg(fd, msgs_.data(), msgs_.size(), MSG_DONTWAIT, nullptr);
+  } while (n == -1 && errno == EINTR);
+
+  ++nsyscalls;
+
+  if (n == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    std::cerr << "recvmmsg: " << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  for (ssize_t i = 0; i < n; ++i) {
+    auto &hdr = msgs_[i].msg_hdr;
+    if (hdr.msg_flags & MSG_TRUNC) {
+      continue;
+    }
+
+    addrs_[i].len = hdr.msg_namelen;
+
+    auto data = buf_.data() + i * slotlen_;
+    size_t len = msgs_[i].msg_len;
+    auto size = gro_size(&hdr);
+    if (size == 0) {
+      size = len;
+    }
+
+    for (size_t off = 0; off < len; off += size) {
+      dgrams_.push_back(Datagram{data + off, std::min(size, len - off),
+                                 static_cast<size_t>(i)});
+    }
+  }
+
+  npkts += dgrams_.size();
+
+  return dgrams_.size();
+}
+
+uint8_t *Reader::data(size_t i) { return dgrams_[i].data; }
+
+size_t Reader::datalen(size_t i) const { return dgrams_[i].datalen; }
+
+const Address &Reader::remote_addr(size_t i) const {
+  return addrs_[dgrams_[i].msgidx];
+}
+
+Writer::Writer(size_t nslots, size_t slotlen)
+    : nsyscalls(0),
+      npkts(0),
+      slotlen_(slotlen),
+      len_(0),
+      gso_(false),
+      buf_(nslots * slotlen),
+      addrs_(nslots),
+      iovs_(nslots),
+      msgs_(nslots) {}
+
+void Writer::enable_gso() { gso_ = true; }
+
+bool Writer::gso() const { return gso_; }
+
+uint8_t *Writer::buf() {
+  assert(!full());
+
+  return buf_.data() + len_ * slotlen_;
+}
+
+size_t Writer::buflen() const { return slotlen_; }
+
+void Writer::push(size_t len, const Address *remote_addr) {
+  assert(!full());
+  assert(len <= slotlen_);
+
+  iovs_[len_].iov_base = buf_.data() + len_ * slotlen_;
+  iovs_[len_].iov_len = len;
+
+  auto &hdr = msgs_[len_].msg_hdr;
+  hdr = {};
+  if (remote_addr) {
+    addrs_[len_] = *remote_addr;
+    hdr.msg_name = &addrs_[len_].su;
+    hdr.msg_namelen = remote_addr->len;
+  }
+  hdr.msg_iov = &iovs_[len_];
+  hdr.msg_iovlen = 1;
+
+  ++len_;
+}
+
+bool Writer::full() const { return len_ == msgs_.size(); }
+
+bool Writer::empty() const { return len_ == 0; }
+
+size_t Writer::gso_run(size_t i) const {
+  auto segsize = iovs_[i].iov_len;
+  auto &first = msgs_[i].msg_hdr;
+  auto j = i + 1;
+
+  for (; j < len_ && j - i < MAX_GSO_SEGMENTS &&
+         (j - i + 1) * segsize <= MAX_GSO_BYTES;
+       ++j) {
+    // Only the last packet may be shorter than the others.
+    if (iovs_[j - 1].iov_len != segsize || iovs_[j].iov_len > segsize) {
+      break;
+    }
+
+    auto &hdr = msgs_[j].msg_hdr;
+    if (hdr.msg_namelen != first.msg_namelen ||
+        (hdr.msg_namelen &&
+         memcmp(hdr.msg_name, first.msg_name, hdr.msg_namelen) != 0)) {
+      break;
+    }
+  }
+
+  return j - i;
+}
+
+int Writer::send_gso(int fd, size_t i, size_t n) {
+  auto msg = msgs_[i].msg_hdr;
+  msg.msg_iov = &iovs_[i];
+  msg.msg_iovlen = n;
+
+  std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t))> cmsgbuf{};
+  msg.msg_control = cmsgbuf.data();
+  msg.msg_controllen = cmsgbuf.size();
+
+  auto cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_UDP;
+  cm->cmsg_type = UDP_SEGMENT;
+  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  auto segsize = static_cast<uint16_t>(iovs_[i].iov_len);
+  memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+
+  for (;;) {
+    auto nwrite = sendmsg(fd, &msg, 0);
+
+    ++nsyscalls;
+
+    if (nwrite != -1) {
+      npkts += n;
+      return 0;
+    }
+
+    switch (errno) {
+    case EINTR:
+      continue;
+    case EAGAIN:
+    case ENOBUFS:
+      // Dropped packets are recovered by loss detection.
+      return 0;
+    case EIO:
+    case EINVAL:
+    case ENOPROTOOPT:
+    case EOPNOTSUPP:
+      return 1;
+    default:
+      std::cerr << "sendmsg: " << strerror(errno) << std::endl;
+      return -1;
+    }
+  }
+}
+
+int Writer::flush(int fd) {
+  size_t i = 0;
+
+  while (i < len_) {
+    size_t n = len_ - i;
+
+    if (gso_) {
+      n = gso_run(i);
+      if (n > 1) {
+        auto rv = send_gso(fd, i, n);
+        if (rv == 0) {
+          i += n;
+          continue;
+        }
+        if (rv == -1) {
+          len_ = 0;
+          return -1;
+        }
+
+        std::cerr << "UDP GSO is not available: " << strerror(errno)
+                  << std::endl;
+        gso_ = false;
+        n = len_ - i;
+      } else {
+        // Send the packets which are not in any run with a single
+        // call.
+        while (i + n < len_ && gso_run(i + n) == 1) {
+          ++n;
+        }
+      }
+    }
+
+    auto nwrite = sendmmsg(fd, msgs_.data() + i, n, 0);
+
+    ++nsyscalls;
+
+    if (nwrite == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      len_ = 0;
+      // Dropped packets are recovered by loss detection.
+      if (errno == EAGAIN || errno == ENOBUFS) {
+        return 0;
+      }
+      std::cerr << "sendmmsg: " << strerror(errno) << std::endl;
+      return -1;
+    }
+
+    i += nwrite;
+    npkts += nwrite;
+  }
+
+  len_ = 0;
+
+  return 0;
+}
+
+} // namespace udp
+
+} // namespace ngtcp2
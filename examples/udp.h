@@ -0,0 +1,161 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef UDP_H
+#define UDP_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "network.h"
+
+namespace ngtcp2 {
+
+namespace udp {
+
+// MAX_BATCH is the default number of datagrams which Reader and
+// Writer handle per syscall.
+constexpr size_t MAX_BATCH = 32;
+
+// MAX_GSO_SEGMENTS is the maximum number of packets which Writer
+// sends in one sendmsg(2) with UDP_SEGMENT.  Linux accepts at most
+// 64.
+constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+// MAX_GSO_BYTES is the maximum number of bytes which Writer sends in
+// one sendmsg(2) with UDP_SEGMENT.  It is below the largest UDP
+// payload.
+constexpr size_t MAX_GSO_BYTES = 60000;
+
+// enable_gro lets the kernel coalesce the datagrams arriving at |fd|
+// with UDP_GRO.  It returns true if the kernel supports it.  Reader
+// splits coalesced datagrams.
+bool enable_gro(int fd);
+
+// Reader receives datagrams with recvmmsg(2) into a preallocated
+// ring of buffers.  The datagrams are valid until the next call of
+// recv.
+class Reader {
+public:
+  // Reader receives up to |nslots| datagrams of at most |slotlen|
+  // bytes per syscall.  If GRO is enabled, |slotlen| should be 64KiB
+  // to hold coalesced datagrams.
+  Reader(size_t nslots, size_t slotlen);
+
+  // recv receives datagrams from |fd| without blocking.  It returns
+  // the number of datagrams received, 0 if there is none, or -1 if
+  // it fails.  A truncated datagram is discarded, and a coalesced
+  // one is split into the original datagrams.
+  ssize_t recv(int fd);
+
+  uint8_t *data(size_t i);
+  size_t datalen(size_t i) const;
+  // remote_addr returns the address which |i|-th datagram came from.
+  const Address &remote_addr(size_t i) const;
+
+  // nsyscalls is the number of recvmmsg(2) calls made.
+  uint64_t nsyscalls;
+  // npkts is the number of datagrams received.
+  uint64_t npkts;
+
+private:
+  struct Datagram {
+    uint8_t *data;
+    size_t datalen;
+    // msgidx is the index of the slot which the datagram is in.
+    size_t msgidx;
+  };
+
+  size_t slotlen_;
+  size_t ctrllen_;
+  std::vector<uint8_t> buf_;
+  std::vector<uint8_t> ctrl_;
+  std::vector<Address> addrs_;
+  std::vector<iovec> iovs_;
+  std::vector<mmsghdr> msgs_;
+  std::vector<Datagram> dgrams_;
+};
+
+// Writer queues outgoing packets in a preallocated ring of buffers,
+// and sends them with sendmmsg(2).
+class Writer {
+public:
+  // Writer queues up to |nslots| packets of at most |slotlen| bytes.
+  Writer(size_t nslots, size_t slotlen);
+
+  // enable_gso makes flush send a run of packets of the same size to
+  // the same destination with one sendmsg(2) with UDP_SEGMENT.  The
+  // last packet of a run may be shorter.  If the kernel turns it
+  // down, Writer falls back to sendmmsg(2) for good.
+  void enable_gso();
+  bool gso() const;
+  // buf returns the buffer to write the next packet to.  It must not
+  // be called if full() is true.
+  uint8_t *buf();
+  size_t buflen() const;
+  // push queues the packet of |len| bytes written to buf().  The
+  // packet is sent to |remote_addr|, or the peer of the connected
+  // socket if it is nullptr.
+  void push(size_t len, const Address *remote_addr);
+  bool full() const;
+  bool empty() const;
+  // flush sends all queued packets to |fd|.  It returns 0 if it
+  // succeeds, or -1.  The queue is empty in either case.
+  int flush(int fd);
+
+  // nsyscalls is the number of sendmmsg(2) and sendmsg(2) calls
+  // made.
+  uint64_t nsyscalls;
+  // npkts is the number of packets sent.
+  uint64_t npkts;
+
+private:
+  // gso_run returns the number of packets from |i|-th one which can
+  // be sent with one sendmsg(2) with UDP_SEGMENT.
+  size_t gso_run(size_t i) const;
+  // send_gso sends |n| packets from |i|-th one with UDP_SEGMENT.  It
+  // returns 0 if it succeeds or the packets are dropped, 1 if the
+  // kernel does not support it, or -1.
+  int send_gso(int fd, size_t i, size_t n);
+
+  size_t slotlen_;
+  size_t len_;
+  bool gso_;
+  std::vector<uint8_t> buf_;
+  std::vector<Address> addrs_;
+  std::vector<iovec> iovs_;
+  std::vector<mmsghdr> msgs_;
+};
+
+} // namespace udp
+
+} // namespace ngtcp2
+
+#endif // UDP_H
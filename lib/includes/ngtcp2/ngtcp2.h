@@ -161,6 +161,52 @@ typedef struct {
 #define NGTCP2_MAX_PKTLEN_IPV4 1252
 #define NGTCP2_MAX_PKTLEN_IPV6 1232
 
+/* NGTCP2_MIN_WEIGHT is the minimum stream weight. */
+#define NGTCP2_MIN_WEIGHT 1
+/* NGTCP2_MAX_WEIGHT is the maximum stream weight. */
+#define NGTCP2_MAX_WEIGHT 256
+/* NGTCP2_DEFAULT_WEIGHT is the default stream weight. */
+#define NGTCP2_DEFAULT_WEIGHT 16
+
+/* NGTCP2_MAX_URGENCY is the largest (least urgent) urgency level. */
+#define NGTCP2_MAX_URGENCY 7
+/* NGTCP2_DEFAULT_URGENCY is the default urgency level of stream. */
+#define NGTCP2_DEFAULT_URGENCY 3
+
+/* NGTCP2_DEFAULT_IDLE_TIMEOUT is the default idle timeout in
+   microseconds. */
+#define NGTCP2_DEFAULT_IDLE_TIMEOUT 30000000
+
+/* NGTCP2_DEFAULT_MAX_STREAM_DATA is the default initial flow control
+   window of each stream in bytes. */
+#define NGTCP2_DEFAULT_MAX_STREAM_DATA (64 * 1024)
+/* NGTCP2_DEFAULT_MAX_DATA is the default initial connection-level
+   flow control window in bytes. */
+#define NGTCP2_DEFAULT_MAX_DATA (1024 * 1024)
+/* NGTCP2_DEFAULT_MAX_STREAM_WINDOW is the default upper limit of the
+   flow control window of each stream in bytes. */
+#define NGTCP2_DEFAULT_MAX_STREAM_WINDOW (16 * 1024 * 1024)
+/* NGTCP2_DEFAULT_MAX_WINDOW is the default upper limit of the
+   connection-level flow control window in bytes. */
+#define NGTCP2_DEFAULT_MAX_WINDOW (24 * 1024 * 1024)
+/* NGTCP2_DEFAULT_ACK_ELICITING_THRESHOLD is the default number of
+   packets which require ACK received before ACK frame is sent. */
+#define NGTCP2_DEFAULT_ACK_ELICITING_THRESHOLD 2
+/* NGTCP2_DEFAULT_MAX_ACK_DELAY is the default maximum duration in
+   microseconds for which ACK frame is delayed. */
+#define NGTCP2_DEFAULT_MAX_ACK_DELAY 25000
+
+/* NGTCP2_DEFAULT_REORDER_CHUNK is the default size in bytes of each
+   buffer which stream data received out of order is copied into. */
+#define NGTCP2_DEFAULT_REORDER_CHUNK (8 * 1024)
+/* NGTCP2_DEFAULT_MAX_STREAM_ID is the default largest stream ID
+   which the remote endpoint is allowed to open. */
+#define NGTCP2_DEFAULT_MAX_STREAM_ID 200
+
+/* NGTCP2_MAX_NUM_ACK_BLK is the maximum number of additional ACK
+   blocks which ACK frame can contain. */
+#define NGTCP2_MAX_NUM_ACK_BLK 255
+
 typedef enum {
   NGTCP2_ERR_INVALID_ARGUMENT = -201,
   NGTCP2_ERR_UNKNOWN_PKT_TYPE = -202,
@@ -168,6 +214,12 @@ typedef enum {
   NGTCP2_ERR_BAD_PKT_HASH = -204,
   NGTCP2_ERR_PROTO = -205,
   NGTCP2_ERR_INVALID_STATE = -206,
+  NGTCP2_ERR_STREAM_ID = -207,
+  NGTCP2_ERR_STREAM_NOT_FOUND = -208,
+  NGTCP2_ERR_STREAM_SHUT_WR = -209,
+  NGTCP2_ERR_IDLE_CLOSE = -210,
+  NGTCP2_ERR_FLOW_CONTROL = -211,
+  NGTCP2_ERR_MEM_LIMIT = -212,
   /* Fatal error >= 500 */
   NGTCP2_ERR_NOMEM = -501,
   NGTCP2_ERR_CALLBACK_FAILURE = -502,
@@ -258,7 +310,12 @@ typedef struct {
   uint16_t ack_delay;
   uint64_t first_ack_blklen;
   size_t num_blks;
-  ngtcp2_ack_blk blks[255];
+  /**
+   * blks points to the array of |num_blks| additional ACK blocks.
+   * The array is not owned by this object.  When decoding, it is the
+   * buffer given to `ngtcp2_pkt_decode_frame`.
+   */
+  ngtcp2_ack_blk *blks;
   size_t num_ts;
 } ngtcp2_ack;
 
@@ -365,7 +422,29 @@ typedef union {
 NGTCP2_EXTERN ssize_t ngtcp2_pkt_decode_hd(ngtcp2_pkt_hd *dest,
                                            const uint8_t *pkt, size_t pktlen);
 
+/**
+ * @function
+ *
+ * `ngtcp2_pkt_decode_frame` decodes a frame from |payload| of length
+ * |payloadlen|, and stores the result in the object pointed by
+ * |dest|.  |max_rx_pkt_num| is the largest packet number received so
+ * far, and is used to recover the largest acknowledged packet number
+ * of ACK frame.
+ *
+ * If the frame is ACK frame, its additional ACK blocks are written to
+ * |ack_blks|, and ``dest->ack.blks`` points to it.  |ack_blks| must
+ * be able to store at least :macro:`NGTCP2_MAX_NUM_ACK_BLK` blocks.
+ * Keeping the blocks out of :type:`ngtcp2_frame` makes it small
+ * enough to be placed on stack cheaply.
+ *
+ * This function returns the number of bytes read to decode a frame,
+ * or one of the following negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     Payload is too short, or frame type is unknown
+ */
 NGTCP2_EXTERN ssize_t ngtcp2_pkt_decode_frame(ngtcp2_frame *dest,
+                                              ngtcp2_ack_blk *ack_blks,
                                               const uint8_t *payload,
                                               size_t payloadlen,
                                               uint64_t max_rx_pkt_num);
@@ -552,6 +631,78 @@ typedef ssize_t (*ngtcp2_decrypt)(ngtcp2_conn *conn, uint8_t *dest,
                                   size_t noncelen, const uint8_t *ad,
                                   size_t adlen, void *user_data);
 
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_recv_stream_data` is invoked when stream data is
+ * received.  The stream is specified by |stream_id|.  If |fin| is
+ * nonzero, this portion of the data is the last data in this stream.
+ * The data is delivered in order, and |datalen| may be 0 if |fin| is
+ * nonzero.
+ *
+ * The implementation of this callback must return 0 if it succeeds.
+ * Returning nonzero value makes `ngtcp2_conn_recv` return
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` immediately.
+ */
+typedef int (*ngtcp2_recv_stream_data)(ngtcp2_conn *conn, uint32_t stream_id,
+                                       uint8_t fin, const uint8_t *data,
+                                       size_t datalen, void *user_data,
+                                       void *stream_user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_stream_close` is invoked when a stream is closed.
+ * This callback is not called when QUIC connection is closed before
+ * stream is closed.  |error_code| is the error code carried by
+ * RST_STREAM if the stream was reset by the remote endpoint, or 0 if
+ * it was closed normally.
+ *
+ * The implementation of this callback must return 0 if it succeeds.
+ * Returning nonzero value makes the library function which triggered
+ * this callback return :enum:`NGTCP2_ERR_CALLBACK_FAILURE`
+ * immediately.
+ */
+typedef int (*ngtcp2_stream_close)(ngtcp2_conn *conn, uint32_t stream_id,
+                                   uint32_t error_code, void *user_data,
+                                   void *stream_user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_acked_stream_data_offset` is invoked when the stream
+ * data sent to the stream |stream_id| is acknowledged by the remote
+ * endpoint.  The data in the range [|offset|, |offset| + |datalen|)
+ * are acknowledged, and so is all data before |offset|.  In other
+ * words, it reports the acknowledged data from the beginning of the
+ * stream in order, without overlap.  The application can release the
+ * buffers passed to `ngtcp2_conn_submit_stream_datav` and its
+ * friends up to |offset| + |datalen|.  This callback is not called
+ * for stream 0.
+ *
+ * The implementation of this callback must return 0 if it succeeds.
+ * Returning nonzero value makes `ngtcp2_conn_recv` return
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` immediately.
+ */
+typedef int (*ngtcp2_acked_stream_data_offset)(ngtcp2_conn *conn,
+                                               uint32_t stream_id,
+                                               uint64_t offset,
+                                               uint64_t datalen,
+                                               void *user_data,
+                                               void *stream_user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_release_pkt` is invoked when the library no longer
+ * refers to the packet buffer |pkt| passed to `ngtcp2_conn_recv_ref`.
+ * |pkt_user_data| is the pointer given along with it.  The
+ * application can free or reuse the buffer after this callback
+ * returns.  This callback may be called from `ngtcp2_conn_del`.
+ */
+typedef void (*ngtcp2_release_pkt)(ngtcp2_conn *conn, uint8_t *pkt,
+                                   void *pkt_user_data, void *user_data);
+
 typedef struct {
   ngtcp2_send_client_initial send_client_initial;
   ngtcp2_send_client_cleartext send_client_cleartext;
@@ -565,8 +716,316 @@ typedef struct {
   ngtcp2_recv_version_negotiation recv_version_negotiation;
   ngtcp2_encrypt encrypt;
   ngtcp2_decrypt decrypt;
+  ngtcp2_recv_stream_data recv_stream_data;
+  ngtcp2_stream_close stream_close;
+  ngtcp2_acked_stream_data_offset acked_stream_data_offset;
+  ngtcp2_release_pkt release_pkt;
 } ngtcp2_conn_callbacks;
 
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_cc_stat` holds the congestion control state of a
+ * connection.  It is shared between the library and the congestion
+ * controller.  All byte counts are in bytes, and all durations are in
+ * microseconds.
+ */
+typedef struct {
+  /**
+   * cwnd is the congestion window.  The library does not send any
+   * new STREAM data while :member:`bytes_in_flight` is equal to or
+   * larger than this value.
+   */
+  uint64_t cwnd;
+  /**
+   * ssthresh is the slow start threshold.  It is UINT64_MAX
+   * initially.
+   */
+  uint64_t ssthresh;
+  /**
+   * bytes_in_flight is the sum of the length of packets which are
+   * sent, and neither acknowledged nor declared lost.  It is
+   * maintained by the library.
+   */
+  uint64_t bytes_in_flight;
+  /**
+   * latest_rtt is the latest RTT sample.
+   */
+  uint64_t latest_rtt;
+  /**
+   * min_rtt is the minimum RTT seen so far.  It is UINT64_MAX if no
+   * RTT sample is taken yet.
+   */
+  uint64_t min_rtt;
+  /**
+   * smoothed_rtt is the exponentially weighted moving average of RTT.
+   */
+  uint64_t smoothed_rtt;
+  /**
+   * rttvar is the variation of RTT.
+   */
+  uint64_t rttvar;
+} ngtcp2_cc_stat;
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_cc_pkt` describes a packet passed to the congestion
+ * controller.
+ */
+typedef struct {
+  /**
+   * pkt_num is the packet number.
+   */
+  uint64_t pkt_num;
+  /**
+   * pktlen is the length of the packet.
+   */
+  size_t pktlen;
+  /**
+   * ts_sent is the timestamp when the packet was sent.
+   */
+  ngtcp2_tstamp ts_sent;
+} ngtcp2_cc_pkt;
+
+struct ngtcp2_cc;
+
+typedef struct ngtcp2_cc ngtcp2_cc;
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_cc_on_pkt_sent` is invoked when a packet |pkt| which
+ * counts toward bytes in flight is sent.  |ccs|->bytes_in_flight
+ * already includes |pkt|.
+ */
+typedef void (*ngtcp2_cc_on_pkt_sent)(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                      const ngtcp2_cc_pkt *pkt);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_cc_on_pkt_acked` is invoked when a packet |pkt| is
+ * acknowledged at |ts|.  |ccs|->bytes_in_flight already excludes
+ * |pkt|, and RTT estimate has been updated with the ACK frame.
+ */
+typedef void (*ngtcp2_cc_on_pkt_acked)(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                       const ngtcp2_cc_pkt *pkt,
+                                       ngtcp2_tstamp ts);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_cc_congestion_event` is invoked when the library
+ * declares packets lost at |ts|.  |ts_sent| is the timestamp when the
+ * most recently sent packet among them was sent.  It is called at
+ * most once per received ACK frame.
+ */
+typedef void (*ngtcp2_cc_congestion_event)(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                           ngtcp2_tstamp ts_sent,
+                                           ngtcp2_tstamp ts);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_cc_on_rto` is invoked when the retransmission timer
+ * expires at |ts|, and all packets in flight are declared lost.
+ * |ccs|->bytes_in_flight is already 0.  The controller should shrink
+ * :member:`ngtcp2_cc_stat.cwnd` to the minimum, so that the lost
+ * packets are not retransmitted in a burst.  If this callback is
+ * NULL, :type:`ngtcp2_cc_congestion_event` is invoked instead.
+ */
+typedef void (*ngtcp2_cc_on_rto)(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                 ngtcp2_tstamp ts);
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_cc` is the congestion controller interface.  Any
+ * callback may be NULL.  The controller adjusts
+ * :member:`ngtcp2_cc_stat.cwnd` and
+ * :member:`ngtcp2_cc_stat.ssthresh`, which the library initializes
+ * to the initial window and UINT64_MAX respectively.
+ */
+struct ngtcp2_cc {
+  ngtcp2_cc_on_pkt_sent on_pkt_sent;
+  ngtcp2_cc_on_pkt_acked on_pkt_acked;
+  ngtcp2_cc_congestion_event congestion_event;
+  ngtcp2_cc_on_rto on_rto;
+  /**
+   * user_data is an arbitrary pointer for the custom controller.  The
+   * library does not touch it.
+   */
+  void *user_data;
+};
+
+/**
+ * @enum
+ *
+ * :type:`ngtcp2_cc_algo` defines congestion control algorithms.
+ */
+typedef enum {
+  /**
+   * NewReno.
+   */
+  NGTCP2_CC_ALGO_RENO = 0x00,
+  /**
+   * CUBIC.
+   */
+  NGTCP2_CC_ALGO_CUBIC = 0x01,
+  /**
+   * The controller given in :member:`ngtcp2_settings.cc`.
+   */
+  NGTCP2_CC_ALGO_CUSTOM = 0xff
+} ngtcp2_cc_algo;
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_settings` is the set of parameters of a connection
+ * which are fixed when it is created.
+ */
+typedef struct {
+  /**
+   * cc_algo is the congestion control algorithm.
+   */
+  ngtcp2_cc_algo cc_algo;
+  /**
+   * cc is the congestion controller used if :member:`cc_algo` is
+   * :enum:`NGTCP2_CC_ALGO_CUSTOM`.  It is owned by the application,
+   * and must outlive the connection.
+   */
+  ngtcp2_cc *cc;
+  /**
+   * idle_timeout is the duration in microseconds after which the
+   * connection is closed silently if no packet is received.  0
+   * disables idle timeout.
+   */
+  ngtcp2_tstamp idle_timeout;
+  /**
+   * max_stream_data is the initial flow control window of each
+   * stream in bytes.  It also limits the handshake data received in
+   * stream 0.
+   */
+  uint32_t max_stream_data;
+  /**
+   * max_data is the initial connection-level flow control window in
+   * bytes.  Stream 0 does not count toward it.
+   */
+  uint64_t max_data;
+  /**
+   * max_stream_window is the upper limit of the flow control window
+   * of each stream in bytes.  The window grows from
+   * :member:`max_stream_data` up to this value if the application
+   * consumes data as fast as the remote endpoint sends it.  Set it to
+   * :member:`max_stream_data` to disable autotuning.
+   */
+  uint64_t max_stream_window;
+  /**
+   * max_window is the upper limit of the connection-level flow
+   * control window in bytes.
+   */
+  uint64_t max_window;
+  /**
+   * pacing is nonzero to spread the packets over the round trip time
+   * instead of sending the whole congestion window at once.  The
+   * pacing rate is 2 times cwnd / smoothed RTT during slow start, and
+   * 1.25 times after that.  If the application is late, for example
+   * due to the resolution of its timer, the packets for up to 1ms
+   * are sent back to back.
+   */
+  int pacing;
+  /**
+   * ack_eliciting_threshold is the number of packets which require
+   * ACK received before ACK frame is sent.  Fewer packets are
+   * acknowledged after :member:`max_ack_delay`.  If a packet is
+   * received out of order, ACK frame is sent immediately.  ACK frame
+   * is also sent along with the other frames whenever the local
+   * endpoint sends them.  0 and 1 acknowledge every packet
+   * immediately.
+   */
+  size_t ack_eliciting_threshold;
+  /**
+   * max_ack_delay is the maximum duration in microseconds for which
+   * ACK frame is delayed.  0 disables the delay.
+   */
+  ngtcp2_tstamp max_ack_delay;
+  /**
+   * mem is the custom memory allocator used by the connection.
+   * ``NULL`` selects the default allocator which uses malloc() and
+   * its friends.  It must outlive the connection.
+   */
+  ngtcp2_mem *mem;
+  /**
+   * mem_pool is nonzero to recycle the small objects of the
+   * connection, such as the records of packets in flight and the
+   * retransmittable frames, in a per-connection pool.  The pool gets
+   * memory from :member:`mem` in slabs, and `ngtcp2_conn_del`
+   * releases them at once.  Freed objects are kept in the pool until
+   * then, so that the memory held by the connection does not shrink
+   * below its peak.  The memory held by the pool counts toward
+   * :member:`max_mem`.
+   */
+  int mem_pool;
+  /**
+   * max_mem is the memory budget of the connection in bytes.  When
+   * the out-of-order stream data would make the connection exceed
+   * it, the packet which carries the data is discarded without being
+   * acknowledged, and the peer retransmits it later.  If the
+   * connection still exceeds the budget after receiving a packet,
+   * `ngtcp2_conn_recv` returns :enum:`NGTCP2_ERR_MEM_LIMIT`.  0 means
+   * no limit.  See `ngtcp2_conn_get_mem_usage`.
+   */
+  size_t max_mem;
+  /**
+   * reorder_chunk is the size in bytes of each buffer which stream
+   * data received out of order is copied into.  A larger chunk costs
+   * fewer allocations for bulk data, but even a single byte received
+   * out of order holds a whole chunk.  If
+   * :member:`reorder_chunk_adaptive` is nonzero, it is the upper
+   * limit of the size.  It must not be 0.  It can be changed per
+   * stream by `ngtcp2_conn_set_stream_reorder_chunk`.
+   */
+  size_t reorder_chunk;
+  /**
+   * reorder_chunk_adaptive is nonzero to size each buffer to the data
+   * it stores, from 256 bytes up to :member:`reorder_chunk`.  The
+   * buffers for the data which continues the previous buffer double
+   * in size, so that sparse data takes little memory, and bulk data
+   * takes few allocations.
+   */
+  int reorder_chunk_adaptive;
+  /**
+   * max_stream_id is the largest stream ID which the remote endpoint
+   * is allowed to open.  Opening a stream implicitly opens all the
+   * streams of the remote endpoint with smaller ID, and each of them
+   * takes memory until it is closed.  The STREAM frame for a larger
+   * stream ID is a protocol violation.
+   */
+  uint32_t max_stream_id;
+} ngtcp2_settings;
+
+/**
+ * @function
+ *
+ * `ngtcp2_settings_default` initializes |settings| with the default
+ * values.  The default congestion control algorithm is CUBIC, and the
+ * default idle timeout is :macro:`NGTCP2_DEFAULT_IDLE_TIMEOUT`.  The
+ * flow control windows start from
+ * :macro:`NGTCP2_DEFAULT_MAX_STREAM_DATA` and
+ * :macro:`NGTCP2_DEFAULT_MAX_DATA`, and grow up to
+ * :macro:`NGTCP2_DEFAULT_MAX_STREAM_WINDOW` and
+ * :macro:`NGTCP2_DEFAULT_MAX_WINDOW`.  Pacing is enabled.  ACK frame
+ * is sent every :macro:`NGTCP2_DEFAULT_ACK_ELICITING_THRESHOLD`
+ * packets, or delayed for up to
+ * :macro:`NGTCP2_DEFAULT_MAX_ACK_DELAY`.  The default allocator is
+ * used without pool, and memory is not limited.  Stream data
+ * received out of order is buffered in chunks of
+ * :macro:`NGTCP2_DEFAULT_REORDER_CHUNK` bytes.  The remote endpoint
+ * can open streams up to :macro:`NGTCP2_DEFAULT_MAX_STREAM_ID`.
+ */
+NGTCP2_EXTERN void ngtcp2_settings_default(ngtcp2_settings *settings);
+
 /*
  * `ngtcp2_accept` is used by server implementation, and decides
  * whether packet |pkt| of length |pktlen| is acceptable for initial
@@ -582,14 +1041,43 @@ typedef struct {
 NGTCP2_EXTERN int ngtcp2_accept(ngtcp2_pkt_hd *dest, const uint8_t *pkt,
                                 size_t pktlen);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_client_new` creates new client side connection, and
+ * stores it in |*pconn|.  |settings| must be initialized by
+ * `ngtcp2_settings_default`, and then customized if necessary.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     :member:`ngtcp2_settings.cc_algo` is unknown, or it is
+ *     :enum:`NGTCP2_CC_ALGO_CUSTOM`, and :member:`ngtcp2_settings.cc`
+ *     is NULL.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory
+ */
 NGTCP2_EXTERN int ngtcp2_conn_client_new(ngtcp2_conn **pconn, uint64_t conn_id,
                                          uint32_t version,
                                          const ngtcp2_conn_callbacks *callbacks,
+                                         const ngtcp2_settings *settings,
                                          void *user_data);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_server_new` creates new server side connection, and
+ * stores it in |*pconn|.  |settings| is treated in the same way as
+ * `ngtcp2_conn_client_new`.
+ *
+ * This function returns 0 if it succeeds, or one of the negative
+ * error codes listed in `ngtcp2_conn_client_new`.
+ */
 NGTCP2_EXTERN int ngtcp2_conn_server_new(ngtcp2_conn **pconn, uint64_t conn_id,
                                          uint32_t version,
                                          const ngtcp2_conn_callbacks *callbacks,
+                                         const ngtcp2_settings *settings,
                                          void *user_data);
 
 NGTCP2_EXTERN void ngtcp2_conn_del(ngtcp2_conn *conn);
@@ -597,10 +1085,67 @@ NGTCP2_EXTERN void ngtcp2_conn_del(ngtcp2_conn *conn);
 /*
  * |pkt| is intentionally non-const so that we can decrypt packet
  * payload in-place.  We may reconsider this strategy later.
+ *
+ * If |conn| uses more memory than :member:`ngtcp2_settings.max_mem`
+ * after |pkt| is processed, it returns :enum:`NGTCP2_ERR_MEM_LIMIT`.
+ * The application should close |conn| by
+ * `ngtcp2_conn_write_connection_close`.
  */
 NGTCP2_EXTERN int ngtcp2_conn_recv(ngtcp2_conn *conn, uint8_t *pkt,
                                    size_t pktlen, ngtcp2_tstamp ts);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_recv_ref` is like `ngtcp2_conn_recv`, but the
+ * application lends |pkt| to |conn| until
+ * :member:`ngtcp2_conn_callbacks.release_pkt` is called for it.  The
+ * stream data received out of order is then buffered by reference to
+ * the decrypted payload in |pkt| instead of being copied.  The
+ * stream data received in order is delivered from |pkt| directly by
+ * both functions.
+ *
+ * :member:`ngtcp2_conn_callbacks.release_pkt` must be set.  It is
+ * called exactly once for |pkt| with |pkt_user_data|, and it is
+ * called before this function returns if |pkt| is not referred to.
+ * The application must not modify |pkt| until then.  The packet
+ * buffers which are referred to count toward
+ * `ngtcp2_conn_get_mem_usage` as a whole.
+ *
+ * This function returns 0 if it succeeds, or the negative error codes
+ * which `ngtcp2_conn_recv` returns.  If
+ * :member:`ngtcp2_conn_callbacks.release_pkt` is not set, it returns
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`, and |pkt| is not used.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_recv_ref(ngtcp2_conn *conn, uint8_t *pkt,
+                                       size_t pktlen, void *pkt_user_data,
+                                       ngtcp2_tstamp ts);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_send` writes a packet in the buffer pointed by |dest|
+ * of length |destlen|.  The frames in the packets which are declared
+ * lost are retransmitted before new data.  Stream data written by
+ * `ngtcp2_conn_write_stream` are also retransmitted by this function.
+ * A packet is declared lost if 3 packets sent after it are
+ * acknowledged, or a packet sent after it is acknowledged and 9/8 of
+ * round trip time has passed since it was sent.  Stream data is sent
+ * as far as the flow control limits allow, and MAX_DATA and
+ * MAX_STREAM_DATA frames are sent as the application consumes the
+ * data received.
+ *
+ * If pacing is enabled, and it is too early to send the next packet,
+ * only pending ACK is written, and this function may return 0 even
+ * if there is data to send.  In this case, `ngtcp2_conn_get_expiry`
+ * returns the time when the next packet can be sent.  Similarly, ACK
+ * frame is not sent on its own until it is due (see
+ * :member:`ngtcp2_settings.ack_eliciting_threshold`).
+ *
+ * This function returns the number of bytes written in |dest|, or 0
+ * if there is nothing to write.  Otherwise it returns a negative
+ * error code.
+ */
 NGTCP2_EXTERN ssize_t ngtcp2_conn_send(ngtcp2_conn *conn, uint8_t *dest,
                                        size_t destlen, ngtcp2_tstamp ts);
 
@@ -623,6 +1168,403 @@ NGTCP2_EXTERN int ngtcp2_conn_update_rx_keys(ngtcp2_conn *conn,
                                              const uint8_t *key, size_t keylen,
                                              const uint8_t *iv, size_t ivlen);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_open_stream` opens new stream initiated by the local
+ * endpoint.  The stream ID is chosen by the library, and stored in
+ * |*pstream_id|.  |stream_user_data| is associated to the stream, and
+ * is passed to stream related callbacks.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_STREAM_ID`
+ *     Stream ID is exhausted.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory
+ */
+NGTCP2_EXTERN int ngtcp2_conn_open_stream(ngtcp2_conn *conn,
+                                          uint32_t *pstream_id,
+                                          void *stream_user_data);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_stream_user_data` associates |stream_user_data| to
+ * the stream identified by |stream_id|.  This is useful for the
+ * stream initiated by the remote endpoint.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ */
+NGTCP2_EXTERN int ngtcp2_conn_set_stream_user_data(ngtcp2_conn *conn,
+                                                   uint32_t stream_id,
+                                                   void *stream_user_data);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_write_pkts` writes a burst of packets in the contiguous
+ * buffer pointed by |dest| of length |destlen|, and stores the number
+ * of packets written in |*pnpkts|.  Each packet is |pktlen| bytes
+ * long except for the last one, which may be shorter, so that the
+ * whole burst can be passed to the kernel at once with UDP GSO
+ * (segment size |pktlen|), or split at every |pktlen| bytes for
+ * sendmmsg.  At most |destlen| / |pktlen| packets are written.  The
+ * burst ends when there is no more data to send, the congestion
+ * window is full, the pacer holds the next packet, or a packet is
+ * shorter than |pktlen|.  A full packet is padded to |pktlen| bytes
+ * if necessary.
+ *
+ * Before the handshake completes, or while lost handshake data is
+ * retransmitted, at most one packet is written.
+ *
+ * This function returns the total number of bytes written in |dest|,
+ * or 0 if there is nothing to write.  Otherwise it returns one of the
+ * negative error codes returned by `ngtcp2_conn_send`, or the
+ * following error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |pktlen| is 0.
+ * :enum:`NGTCP2_ERR_NOBUF`
+ *     |destlen| is less than |pktlen|, or |pktlen| is too small to
+ *     write a packet.
+ */
+NGTCP2_EXTERN ssize_t ngtcp2_conn_write_pkts(ngtcp2_conn *conn, uint8_t *dest,
+                                             size_t destlen, size_t pktlen,
+                                             size_t *pnpkts, ngtcp2_tstamp ts);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_write_stream` writes a protected packet containing
+ * STREAM frame for a stream |stream_id| in the buffer pointed by
+ * |dest| of length |destlen|.  Pending ACK is also included in the
+ * packet.  |data| of length |datalen| is the stream data to send.  If
+ * |fin| is nonzero, fin bit is set in STREAM frame if all |data| fit
+ * in the packet, and the stream is shut down for writing.
+ *
+ * The number of bytes of |data| written in the packet is stored in
+ * |*pdatalen|.  The application must retry the remaining data with
+ * the subsequent call.  The written data is not copied, and the
+ * application must keep it until it is acknowledged (see
+ * :type:`ngtcp2_acked_stream_data_offset`).  The data written is
+ * limited by the flow control credit of the stream and the
+ * connection, and fin bit is not set if |data| is truncated by it.
+ * If the congestion window is full, the pacer holds the next packet,
+ * or no flow control credit is left, no stream data is written, and
+ * only pending ACK is written if any.  In this case, |*pdatalen| is
+ * 0, and this function may return 0.  The flow control frames,
+ * including the window updates for the data received, are sent by
+ * `ngtcp2_conn_send`.
+ *
+ * This function returns the number of bytes written in |dest| if it
+ * succeeds, or one of the following negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     Handshake has not completed yet, or the stream has data
+ *     submitted by `ngtcp2_conn_submit_stream_data` which are not
+ *     sent yet.
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |stream_id| is 0, which is reserved for the handshake.
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ * :enum:`NGTCP2_ERR_STREAM_SHUT_WR`
+ *     Stream is half closed (local), or fin has been submitted by
+ *     `ngtcp2_conn_submit_stream_data`.
+ * :enum:`NGTCP2_ERR_NOBUF`
+ *     Buffer is too small
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE`
+ *     User callback failed
+ */
+NGTCP2_EXTERN ssize_t ngtcp2_conn_write_stream(ngtcp2_conn *conn, uint8_t *dest,
+                                               size_t destlen, size_t *pdatalen,
+                                               uint32_t stream_id, uint8_t fin,
+                                               const uint8_t *data,
+                                               size_t datalen,
+                                               ngtcp2_tstamp ts);
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_vec` is a buffer of stream data.
+ */
+typedef struct {
+  /**
+   * base points to the data.
+   */
+  const uint8_t *base;
+  /**
+   * len is the length of the data.
+   */
+  size_t len;
+} ngtcp2_vec;
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_submit_stream_datav` queues the data in |datav| of
+ * |datavcnt| buffers to the stream |stream_id|.  If |fin| is
+ * nonzero, the data is the last data of the stream, and the stream
+ * is shut down for writing once it is sent.  The queued data are
+ * sent by `ngtcp2_conn_send` in the order chosen by the stream
+ * scheduler (see `ngtcp2_conn_set_stream_priority`).
+ *
+ * The data is never copied.  The library refers to the buffers while
+ * the data is queued or in flight, and they are retransmitted from
+ * there if lost.  The application must keep them alive until
+ * :type:`ngtcp2_acked_stream_data_offset` reports that they are
+ * acknowledged, or the stream is closed.  The stream is not closed
+ * normally until all data is acknowledged.  |datav| itself can be
+ * freed when this function returns.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |stream_id| is 0, which is reserved for the handshake.
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ * :enum:`NGTCP2_ERR_STREAM_SHUT_WR`
+ *     Stream is half closed (local), or fin has been submitted.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory
+ */
+NGTCP2_EXTERN int ngtcp2_conn_submit_stream_datav(ngtcp2_conn *conn,
+                                                  uint32_t stream_id,
+                                                  uint8_t fin,
+                                                  const ngtcp2_vec *datav,
+                                                  size_t datavcnt);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_submit_stream_data` queues |data| of length |datalen|
+ * to the stream |stream_id|.  It is equivalent to
+ * `ngtcp2_conn_submit_stream_datav` with a single buffer, and the
+ * same rule applies to the lifetime of |data|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |stream_id| is 0, which is reserved for the handshake.
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ * :enum:`NGTCP2_ERR_STREAM_SHUT_WR`
+ *     Stream is half closed (local), or fin has been submitted.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory
+ */
+NGTCP2_EXTERN int ngtcp2_conn_submit_stream_data(ngtcp2_conn *conn,
+                                                 uint32_t stream_id,
+                                                 uint8_t fin,
+                                                 const uint8_t *data,
+                                                 size_t datalen);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_stream_priority` changes the priority of the
+ * stream |stream_id|.  The stream with smaller |urgency| is always
+ * sent first.  The streams of the same |urgency| share the bandwidth
+ * in proportion to their |weight|, and the streams of the same
+ * weight are served in round-robin manner.  |urgency| must be in
+ * [0, :macro:`NGTCP2_MAX_URGENCY`], and |weight| must be in
+ * [:macro:`NGTCP2_MIN_WEIGHT`, :macro:`NGTCP2_MAX_WEIGHT`].  New
+ * stream gets :macro:`NGTCP2_DEFAULT_URGENCY` and
+ * :macro:`NGTCP2_DEFAULT_WEIGHT`.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |urgency| or |weight| is out of range.
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ */
+NGTCP2_EXTERN int ngtcp2_conn_set_stream_priority(ngtcp2_conn *conn,
+                                                  uint32_t stream_id,
+                                                  uint8_t urgency,
+                                                  uint32_t weight);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_stream_reorder_chunk` changes the size of the
+ * buffers which the stream data of the stream |stream_id| received
+ * out of order is copied into.  |chunk| and |adaptive| have the same
+ * meaning as :member:`ngtcp2_settings.reorder_chunk` and
+ * :member:`ngtcp2_settings.reorder_chunk_adaptive`, which new
+ * streams get.  The buffers allocated so far are not resized.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_ARGUMENT`
+ *     |chunk| is 0.
+ * :enum:`NGTCP2_ERR_STREAM_NOT_FOUND`
+ *     Stream does not exist
+ */
+NGTCP2_EXTERN int ngtcp2_conn_set_stream_reorder_chunk(ngtcp2_conn *conn,
+                                                       uint32_t stream_id,
+                                                       size_t chunk,
+                                                       int adaptive);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_write_connection_close` writes a protected packet
+ * containing CONNECTION_CLOSE frame with |error_code| in the buffer
+ * pointed by |dest| of length |destlen|.  After this call, |conn|
+ * enters closing state.
+ *
+ * This function returns the number of bytes written in |dest| if it
+ * succeeds, or one of the following negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     Handshake has not completed yet.
+ * :enum:`NGTCP2_ERR_NOBUF`
+ *     Buffer is too small
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE`
+ *     User callback failed
+ */
+NGTCP2_EXTERN ssize_t ngtcp2_conn_write_connection_close(ngtcp2_conn *conn,
+                                                         uint8_t *dest,
+                                                         size_t destlen,
+                                                         uint32_t error_code,
+                                                         ngtcp2_tstamp ts);
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_transport_params` contains the flow control limits
+ * exchanged in QUIC transport parameters.
+ */
+typedef struct {
+  /**
+   * initial_max_stream_data is the initial flow control limit of each
+   * stream in bytes.
+   */
+  uint32_t initial_max_stream_data;
+  /**
+   * initial_max_data is the initial connection-level flow control
+   * limit in units of 1024 bytes.
+   */
+  uint32_t initial_max_data;
+} ngtcp2_transport_params;
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_get_local_transport_params` stores the transport
+ * parameters which |conn| advertises to the remote endpoint in
+ * |*params|.  They are derived from :type:`ngtcp2_settings`.
+ */
+NGTCP2_EXTERN void
+ngtcp2_conn_get_local_transport_params(ngtcp2_conn *conn,
+                                       ngtcp2_transport_params *params);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_remote_transport_params` sets the transport
+ * parameters received from the remote endpoint.  Until this function
+ * is called, |conn| assumes that the remote endpoint uses the default
+ * values of :type:`ngtcp2_settings`.  Stream 0 is not subject to the
+ * remote flow control limits, since the handshake data is sent
+ * before they are known.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory
+ */
+NGTCP2_EXTERN int
+ngtcp2_conn_set_remote_transport_params(ngtcp2_conn *conn,
+                                        const ngtcp2_transport_params *params);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_get_cc_stat` returns the congestion control state of
+ * |conn|.  The returned pointer is valid until |conn| is deleted.
+ */
+NGTCP2_EXTERN const ngtcp2_cc_stat *ngtcp2_conn_get_cc_stat(ngtcp2_conn *conn);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_get_expiry` returns the earliest time when |conn|
+ * needs `ngtcp2_conn_handle_expiry` to be called.  It covers loss
+ * detection, retransmission timeout, and idle timeout.  If pacing
+ * holds the data to send, it also covers the time when the next
+ * packet can be sent.  If ACK frame is delayed, it also covers the
+ * time when ACK frame is due.  The application should call
+ * `ngtcp2_conn_send` at these times.  It returns UINT64_MAX if there
+ * is no such deadline.
+ *
+ * The application should call this function after each call of
+ * `ngtcp2_conn_recv`, `ngtcp2_conn_send` and
+ * `ngtcp2_conn_handle_expiry`, and rearm its timer accordingly.  The
+ * returned time shares the clock with the timestamps passed to these
+ * functions.
+ */
+NGTCP2_EXTERN ngtcp2_tstamp ngtcp2_conn_get_expiry(ngtcp2_conn *conn);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_get_num_pkts_allowed` returns the number of packets of
+ * length |pktlen| which the congestion window and the pacer allow
+ * |conn| to send at |ts|.  The application which writes a batch of
+ * packets can use it to size the batch.  Packets which only contain
+ * ACK are not limited, and are not counted.
+ */
+NGTCP2_EXTERN size_t ngtcp2_conn_get_num_pkts_allowed(ngtcp2_conn *conn,
+                                                      size_t pktlen,
+                                                      ngtcp2_tstamp ts);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_get_mem_usage` returns the number of bytes of heap
+ * memory which |conn| uses.  It includes |conn| itself, and every
+ * object allocated through the allocator of |conn|, such as streams,
+ * buffered stream data, and the records of packets in flight.  It
+ * also includes the packet buffers which are lent by
+ * `ngtcp2_conn_recv_ref` and not released yet.  If
+ * :member:`ngtcp2_settings.mem_pool` is enabled, it counts the memory
+ * which the pool gets from :member:`ngtcp2_settings.mem`, including
+ * the free objects kept in the pool.
+ */
+NGTCP2_EXTERN size_t ngtcp2_conn_get_mem_usage(ngtcp2_conn *conn);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_handle_expiry` processes the timers of |conn| which
+ * have expired at |ts|.  Packets which are declared lost are queued
+ * for retransmission, and the application should call
+ * `ngtcp2_conn_send` after this function returns 0.  It is safe to
+ * call this function before the deadline; it does nothing in that
+ * case.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_IDLE_CLOSE`
+ *     Idle timeout expired.  The application should delete |conn|
+ *     without sending any packet.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_handle_expiry(ngtcp2_conn *conn,
+                                            ngtcp2_tstamp ts);
+
 /**
  * @function
  *
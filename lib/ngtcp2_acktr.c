@@ -24,59 +24,308 @@
  */
 #include "ngtcp2_acktr.h"
 
-int ngtcp2_acktr_entry_new(ngtcp2_acktr_entry **ent, uint64_t pkt_num,
-                           ngtcp2_tstamp tstamp, ngtcp2_mem *mem) {
-  *ent = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_acktr_entry));
-  if (*ent == NULL) {
-    return NGTCP2_ERR_NOMEM;
+void ngtcp2_acktr_init(ngtcp2_acktr *acktr) {
+  acktr->head = 0;
+  acktr->len = 0;
+  acktr->acks_head = 0;
+  acktr->acks_len = 0;
+  acktr->nack_only = 0;
+  acktr->pending = 0;
+  acktr->nactive = 0;
+  acktr->pending_ts = 0;
+  acktr->largest_active = UINT64_MAX;
+  acktr->immediate = 0;
+}
+
+void ngtcp2_acktr_free(ngtcp2_acktr *acktr) { (void)acktr; }
+
+/*
+ * acktr_at returns |i|-th range counted from the one which has the
+ * largest packet number.
+ */
+static ngtcp2_acktr_entry *acktr_at(ngtcp2_acktr *acktr, size_t i) {
+  return &acktr->ents[(acktr->head + i) & (NGTCP2_ACKTR_MAX_ENTRIES - 1)];
+}
+
+/*
+ * acktr_insert inserts new range which only contains |pkt_num|
+ * received at |ts| at |i|-th position.
+ */
+static void acktr_insert(ngtcp2_acktr *acktr, size_t i, uint64_t pkt_num,
+                         ngtcp2_tstamp ts) {
+  ngtcp2_acktr_entry *ent;
+  size_t j;
+
+  if (acktr->len == NGTCP2_ACKTR_MAX_ENTRIES) {
+    if (i == acktr->len) {
+      return;
+    }
+    --acktr->len;
+  }
+
+  if (i == 0) {
+    acktr->head = (acktr->head + NGTCP2_ACKTR_MAX_ENTRIES - 1) &
+                  (NGTCP2_ACKTR_MAX_ENTRIES - 1);
+  } else {
+    for (j = acktr->len; j > i; --j) {
+      *acktr_at(acktr, j) = *acktr_at(acktr, j - 1);
+    }
   }
 
-  (*ent)->next = NULL;
-  (*ent)->pkt_num = pkt_num;
-  (*ent)->tstamp = tstamp;
+  ++acktr->len;
 
-  return 0;
+  ent = acktr_at(acktr, i);
+  ent->pkt_num = pkt_num;
+  ent->len = 1;
+  ent->tstamp = ts;
 }
 
-void ngtcp2_acktr_entry_del(ngtcp2_acktr_entry *ent, ngtcp2_mem *mem) {
-  ngtcp2_mem_free(mem, ent);
+/*
+ * acktr_remove removes |i|-th range.
+ */
+static void acktr_remove(ngtcp2_acktr *acktr, size_t i) {
+  for (; i + 1 < acktr->len; ++i) {
+    *acktr_at(acktr, i) = *acktr_at(acktr, i + 1);
+  }
+
+  --acktr->len;
 }
 
-void ngtcp2_acktr_init(ngtcp2_acktr *acktr) { acktr->ent = NULL; }
+/*
+ * acktr_add_range adds |pkt_num| received at |ts| to the ranges.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     Same packet number has already been included in |acktr|.
+ */
+static int acktr_add_range(ngtcp2_acktr *acktr, uint64_t pkt_num,
+                           ngtcp2_tstamp ts) {
+  ngtcp2_acktr_entry *ent, *prev;
+  size_t i;
+
+  for (i = 0; i < acktr->len; ++i) {
+    ent = acktr_at(acktr, i);
 
-void ngtcp2_acktr_free(ngtcp2_acktr *acktr) { (void)acktr; }
+    if (ent->pkt_num < pkt_num) {
+      if (ent->pkt_num + 1 == pkt_num) {
+        ent->pkt_num = pkt_num;
+        ent->tstamp = ts;
+        ++ent->len;
 
-int ngtcp2_acktr_add(ngtcp2_acktr *acktr, ngtcp2_acktr_entry *ent) {
-  ngtcp2_acktr_entry **pent;
+        if (i > 0) {
+          prev = acktr_at(acktr, i - 1);
+          if (pkt_num + prev->len == prev->pkt_num) {
+            /* |pkt_num| fills the gap between 2 ranges. */
+            prev->len += ent->len;
+            acktr_remove(acktr, i);
+          }
+        }
 
-  for (pent = &acktr->ent; *pent; pent = &(*pent)->next) {
-    if ((*pent)->pkt_num > ent->pkt_num) {
-      continue;
+        return 0;
+      }
+
+      break;
     }
+
     /* TODO What to do if we receive duplicated packet number? */
-    if ((*pent)->pkt_num == ent->pkt_num) {
+    if (ent->pkt_num - pkt_num < ent->len) {
       return NGTCP2_ERR_INVALID_ARGUMENT;
     }
-    break;
   }
 
-  ent->next = *pent;
-  *pent = ent;
+  if (i > 0) {
+    prev = acktr_at(acktr, i - 1);
+    if (pkt_num + prev->len == prev->pkt_num) {
+      ++prev->len;
+      return 0;
+    }
+  }
+
+  acktr_insert(acktr, i, pkt_num, ts);
+
   return 0;
 }
 
-ngtcp2_acktr_entry *ngtcp2_acktr_get(ngtcp2_acktr *acktr) { return acktr->ent; }
+/*
+ * acktr_in_order returns nonzero if |pkt_num| is larger than
+ * largest_active, and there is no missing packet between them.
+ */
+static int acktr_in_order(ngtcp2_acktr *acktr, uint64_t pkt_num) {
+  ngtcp2_acktr_entry *ent;
+  size_t i;
+
+  if (acktr->largest_active == UINT64_MAX) {
+    return 1;
+  }
+
+  if (pkt_num < acktr->largest_active) {
+    return 0;
+  }
+
+  for (i = 0; i < acktr->len; ++i) {
+    ent = acktr_at(acktr, i);
+    if (ent->pkt_num - pkt_num < ent->len) {
+      /* ent contains pkt_num. */
+      return ent->pkt_num - acktr->largest_active < ent->len;
+    }
+  }
 
-void ngtcp2_acktr_remove(ngtcp2_acktr *acktr, const ngtcp2_acktr_entry *ent) {
-  ngtcp2_acktr_entry **pent;
+  return 0;
+}
+
+int ngtcp2_acktr_add(ngtcp2_acktr *acktr, uint64_t pkt_num, int active_ack,
+                     ngtcp2_tstamp ts) {
+  int rv;
+
+  rv = acktr_add_range(acktr, pkt_num, ts);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (!active_ack) {
+    return 0;
+  }
+
+  if (!acktr_in_order(acktr, pkt_num)) {
+    acktr->immediate = 1;
+  }
+
+  if (acktr->largest_active == UINT64_MAX ||
+      acktr->largest_active < pkt_num) {
+    acktr->largest_active = pkt_num;
+  }
+
+  if (!acktr->pending) {
+    acktr->pending = 1;
+    acktr->pending_ts = ts;
+  }
 
-  for (pent = &acktr->ent; *pent; pent = &(*pent)->next) {
-    if (ent->pkt_num != (*pent)->pkt_num) {
+  ++acktr->nactive;
+
+  return 0;
+}
+
+ngtcp2_acktr_entry *ngtcp2_acktr_get(ngtcp2_acktr *acktr, size_t i) {
+  if (i >= acktr->len) {
+    return NULL;
+  }
+
+  return acktr_at(acktr, i);
+}
+
+void ngtcp2_acktr_add_ack(ngtcp2_acktr *acktr, uint64_t pkt_num,
+                          uint64_t largest_ack, int ack_eliciting) {
+  ngtcp2_acktr_ack_entry *ent;
+
+  acktr->pending = 0;
+  acktr->nactive = 0;
+  acktr->immediate = 0;
+
+  if (!ack_eliciting) {
+    ++acktr->nack_only;
+    return;
+  }
+
+  acktr->nack_only = 0;
+
+  if (acktr->acks_len == NGTCP2_ACKTR_MAX_ACKS) {
+    acktr->acks_head = (acktr->acks_head + 1) & (NGTCP2_ACKTR_MAX_ACKS - 1);
+    --acktr->acks_len;
+  }
+
+  ent = &acktr->acks[(acktr->acks_head + acktr->acks_len) &
+                     (NGTCP2_ACKTR_MAX_ACKS - 1)];
+  ent->pkt_num = pkt_num;
+  ent->largest_ack = largest_ack;
+
+  ++acktr->acks_len;
+}
+
+/*
+ * ack_contains returns nonzero if ACK frame |fr| acknowledges
+ * |pkt_num|.
+ */
+static int ack_contains(const ngtcp2_ack *fr, uint64_t pkt_num) {
+  uint64_t largest = fr->largest_ack, smallest;
+  const ngtcp2_ack_blk *blk;
+  size_t i;
+
+  if (pkt_num > largest) {
+    return 0;
+  }
+
+  smallest = largest - fr->first_ack_blklen;
+  if (pkt_num >= smallest) {
+    return 1;
+  }
+
+  for (i = 0; i < fr->num_blks; ++i) {
+    blk = &fr->blks[i];
+
+    if (blk->blklen == 0) {
+      smallest -= blk->gap;
       continue;
     }
 
-    *pent = (*pent)->next;
+    largest = smallest - blk->gap - 1;
+    smallest = largest - (blk->blklen - 1);
+
+    if (pkt_num > largest) {
+      return 0;
+    }
+    if (pkt_num >= smallest) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * acktr_forget removes packet numbers which are equal to or less
+ * than |pkt_num|.
+ */
+static void acktr_forget(ngtcp2_acktr *acktr, uint64_t pkt_num) {
+  ngtcp2_acktr_entry *ent;
+
+  for (; acktr->len;) {
+    ent = acktr_at(acktr, acktr->len - 1);
+    if (ent->pkt_num <= pkt_num) {
+      --acktr->len;
+      continue;
+    }
+
+    if (ent->pkt_num - pkt_num < ent->len) {
+      ent->len = ent->pkt_num - pkt_num;
+    }
 
     return;
   }
 }
+
+void ngtcp2_acktr_recv_ack(ngtcp2_acktr *acktr, const ngtcp2_ack *fr) {
+  ngtcp2_acktr_ack_entry *ent;
+  size_t i;
+
+  for (i = acktr->acks_len; i > 0; --i) {
+    ent = &acktr->acks[(acktr->acks_head + i - 1) &
+                       (NGTCP2_ACKTR_MAX_ACKS - 1)];
+    if (!ack_contains(fr, ent->pkt_num)) {
+      continue;
+    }
+
+    acktr_forget(acktr, ent->largest_ack);
+
+    /* The older ACK frames acknowledge nothing more. */
+    acktr->acks_head = (acktr->acks_head + i) & (NGTCP2_ACKTR_MAX_ACKS - 1);
+    acktr->acks_len -= i;
+
+    return;
+  }
+}
+
+int ngtcp2_acktr_require_ack_eliciting(ngtcp2_acktr *acktr) {
+  return acktr->len && acktr->nack_only >= NGTCP2_ACKTR_MAX_ACK_ONLY;
+}
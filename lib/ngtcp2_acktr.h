@@ -31,40 +31,90 @@
 
 #include <ngtcp2/ngtcp2.h>
 
-#include "ngtcp2_mem.h"
+/* NGTCP2_ACKTR_MAX_ENTRIES is the maximum number of ranges which
+   ngtcp2_acktr holds.  It must be a power of 2. */
+#define NGTCP2_ACKTR_MAX_ENTRIES 64
 
-struct ngtcp2_acktr_entry;
-typedef struct ngtcp2_acktr_entry ngtcp2_acktr_entry;
+/* NGTCP2_ACKTR_MAX_ACKS is the maximum number of ACK frames sent in
+   ack-eliciting packets which ngtcp2_acktr remembers.  It must be a
+   power of 2. */
+#define NGTCP2_ACKTR_MAX_ACKS 16
+
+/* NGTCP2_ACKTR_MAX_ACK_ONLY is the number of ACK frames sent in a row
+   in the packets which the remote endpoint does not acknowledge.
+   After that, the local endpoint should make the packet carrying ACK
+   frame ack-eliciting, so that the ranges acknowledged are
+   eventually forgotten. */
+#define NGTCP2_ACKTR_MAX_ACK_ONLY 16
 
 /*
- * ngtcp2_acktr_entry is a single packet which needs to be acked.
+ * ngtcp2_acktr_entry is a range of consecutive packet numbers which
+ * need to be acked.
  */
-struct ngtcp2_acktr_entry {
-  ngtcp2_acktr_entry *next;
+typedef struct {
+  /* pkt_num is the largest packet number in the range. */
   uint64_t pkt_num;
+  /* len is the number of packets in the range. */
+  uint64_t len;
+  /* tstamp is the time when the packet pkt_num was received. */
   ngtcp2_tstamp tstamp;
-};
+} ngtcp2_acktr_entry;
 
 /*
- * ngtcp2_acktr_entry_new allocates memory for ent, and initializes it
- * with the given parameters.
+ * ngtcp2_acktr_ack_entry is ACK frame which was sent in an
+ * ack-eliciting packet.
  */
-int ngtcp2_acktr_entry_new(ngtcp2_acktr_entry **ent, uint64_t pkt_num,
-                           ngtcp2_tstamp tstamp, ngtcp2_mem *mem);
-
-/*
- * ngtcp2_acktr_entry_del deallocates memory allocated for |ent|.  It
- * deallocates memory pointed by |ent|.
- */
-void ngtcp2_acktr_entry_del(ngtcp2_acktr_entry *ent, ngtcp2_mem *mem);
+typedef struct {
+  /* pkt_num is the packet number of the packet which carried ACK
+     frame. */
+  uint64_t pkt_num;
+  /* largest_ack is the largest packet number which ACK frame
+     acknowledged. */
+  uint64_t largest_ack;
+} ngtcp2_acktr_ack_entry;
 
 /*
  * ngtcp2_acktr tracks received packets which we have to send ack.
+ * They are stored as the ranges of consecutive packet numbers in the
+ * fixed size ring buffer, so that the packets received in order are
+ * added in constant time without memory allocation.  ACK frame is
+ * created from the ranges each time it is sent, and the ranges are
+ * kept until the remote endpoint acknowledges a packet which carried
+ * ACK frame for them.  Therefore the ranges in the lost ACK frame are
+ * sent again in the next ACK frame.
  */
 typedef struct {
-  /* ent points to the head of list which is ordered by the decreasing
-     order of packet number. */
-  ngtcp2_acktr_entry *ent;
+  /* ents is the ring buffer of the ranges which is ordered by the
+     decreasing order of packet number.  The range which has the
+     largest packet number is at head. */
+  ngtcp2_acktr_entry ents[NGTCP2_ACKTR_MAX_ENTRIES];
+  size_t head;
+  size_t len;
+  /* acks is the ring buffer of ACK frames sent in ack-eliciting
+     packets, which is ordered by the increasing order of packet
+     number. */
+  ngtcp2_acktr_ack_entry acks[NGTCP2_ACKTR_MAX_ACKS];
+  size_t acks_head;
+  size_t acks_len;
+  /* nack_only is the number of ACK frames sent in a row in the
+     packets which are not ack-eliciting. */
+  size_t nack_only;
+  /* pending is nonzero if a packet which requires ACK has been added
+     since ACK frame was sent last. */
+  int pending;
+  /* nactive is the number of packets which require ACK added since
+     ACK frame was sent last, and pending_ts is the time when the
+     first of them was received. */
+  size_t nactive;
+  ngtcp2_tstamp pending_ts;
+  /* largest_active is the largest packet number which required ACK,
+     or UINT64_MAX if there is no such packet yet. */
+  uint64_t largest_active;
+  /* immediate is nonzero if a packet which requires ACK was received
+     out of order since ACK frame was sent last.  Then ACK frame
+     should be sent without delay so that the remote endpoint can
+     detect the loss early. */
+  int immediate;
 } ngtcp2_acktr;
 
 /*
@@ -73,14 +123,21 @@ typedef struct {
 void ngtcp2_acktr_init(ngtcp2_acktr *acktr);
 
 /*
- * ngtcp2_acktr_free frees resources allocated for |acktr|.  It does
- * not free any ngtcp2_acktr_entry directly or indirectly pointed by
- * acktr->ent.
+ * ngtcp2_acktr_free frees resources allocated for |acktr|.
  */
 void ngtcp2_acktr_free(ngtcp2_acktr *acktr);
 
 /*
- * ngtcp2_acktr_add adds |ent|.
+ * ngtcp2_acktr_add adds packet number |pkt_num| which is received at
+ * |ts|.  If |active_ack| is nonzero, ACK frame is made pending, and
+ * if the packet is not the next one of the largest packet number
+ * which required ACK, or there are missing packets between them, ACK
+ * frame is requested immediately.  The packet which does not require
+ * ACK is still added, so that it does not split the ranges.  If
+ * |acktr| is full, and |pkt_num| starts a new range, the range which
+ * has the smallest packet numbers is discarded, or |pkt_num| is
+ * ignored if it is smaller than all of them.  The discarded packets
+ * are not acknowledged.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -88,18 +145,38 @@ void ngtcp2_acktr_free(ngtcp2_acktr *acktr);
  * NGTCP2_ERR_INVALID_ARGUMENT
  *     Same packet number has already been included in |acktr|.
  */
-int ngtcp2_acktr_add(ngtcp2_acktr *acktr, ngtcp2_acktr_entry *ent);
+int ngtcp2_acktr_add(ngtcp2_acktr *acktr, uint64_t pkt_num, int active_ack,
+                     ngtcp2_tstamp ts);
+
+/*
+ * ngtcp2_acktr_get returns |i|-th range counted from the one which
+ * has the largest packet number.  If there is no such range, this
+ * function returns NULL.
+ */
+ngtcp2_acktr_entry *ngtcp2_acktr_get(ngtcp2_acktr *acktr, size_t i);
+
+/*
+ * ngtcp2_acktr_add_ack records that ACK frame which acknowledges up
+ * to |largest_ack| has been sent in the packet |pkt_num|, and clears
+ * the pending ACK and its delay state.  |ack_eliciting| is nonzero if
+ * the packet is acknowledged by the remote endpoint.
+ */
+void ngtcp2_acktr_add_ack(ngtcp2_acktr *acktr, uint64_t pkt_num,
+                          uint64_t largest_ack, int ack_eliciting);
 
 /*
- * ngtcp2_acktr_get returns the entry which has the largest packet
- * number to be acked.  If there is no entry, this function returns
- * NULL.
+ * ngtcp2_acktr_recv_ack processes ACK frame |fr| received from the
+ * remote endpoint.  If it acknowledges a packet recorded by
+ * ngtcp2_acktr_add_ack, the ranges acknowledged by ACK frame in the
+ * packet are no longer needed, and they are removed.  |fr| must be
+ * validated by ngtcp2_rtb_recv_ack.
  */
-ngtcp2_acktr_entry *ngtcp2_acktr_get(ngtcp2_acktr *acktr);
+void ngtcp2_acktr_recv_ack(ngtcp2_acktr *acktr, const ngtcp2_ack *fr);
 
 /*
- * ngtcp2_acktr_remove removes the |ent|.
+ * ngtcp2_acktr_require_ack_eliciting returns nonzero if the next
+ * packet which carries ACK frame should be made ack-eliciting.
  */
-void ngtcp2_acktr_remove(ngtcp2_acktr *acktr, const ngtcp2_acktr_entry *ent);
+int ngtcp2_acktr_require_ack_eliciting(ngtcp2_acktr *acktr);
 
 #endif /* NGTCP2_ACKTR_H */
@@ -0,0 +1,270 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_cc.h"
+
+#include "ngtcp2_macro.h"
+
+void ngtcp2_cc_stat_init(ngtcp2_cc_stat *ccs) {
+  ccs->cwnd = NGTCP2_INITIAL_CWND;
+  ccs->ssthresh = UINT64_MAX;
+  ccs->bytes_in_flight = 0;
+  ccs->latest_rtt = 0;
+  ccs->min_rtt = UINT64_MAX;
+  ccs->smoothed_rtt = 0;
+  ccs->rttvar = 0;
+}
+
+void ngtcp2_cc_stat_update_rtt(ngtcp2_cc_stat *ccs, uint64_t rtt,
+                               uint64_t ack_delay) {
+  uint64_t delta;
+
+  ccs->latest_rtt = rtt;
+
+  if (ccs->min_rtt == UINT64_MAX) {
+    ccs->min_rtt = rtt;
+    ccs->smoothed_rtt = rtt;
+    ccs->rttvar = rtt / 2;
+    return;
+  }
+
+  ccs->min_rtt = ngtcp2_min(ccs->min_rtt, rtt);
+
+  /* Do not let ACK Delay make the sample smaller than min_rtt */
+  if (rtt >= ccs->min_rtt + ack_delay) {
+    rtt -= ack_delay;
+  }
+
+  delta = ccs->smoothed_rtt > rtt ? ccs->smoothed_rtt - rtt
+                                  : rtt - ccs->smoothed_rtt;
+
+  ccs->rttvar = (ccs->rttvar * 3 + delta) / 4;
+  ccs->smoothed_rtt = (ccs->smoothed_rtt * 7 + rtt) / 8;
+}
+
+static int reno_cc_in_recovery(ngtcp2_reno_cc *cc, ngtcp2_tstamp ts_sent) {
+  return cc->in_recovery && ts_sent <= cc->recovery_start_ts;
+}
+
+static void reno_cc_on_pkt_acked(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                                 const ngtcp2_cc_pkt *pkt, ngtcp2_tstamp ts) {
+  ngtcp2_reno_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_reno_cc, cc);
+  (void)ts;
+
+  if (reno_cc_in_recovery(cc, pkt->ts_sent)) {
+    return;
+  }
+
+  if (ccs->cwnd < ccs->ssthresh) {
+    /* Slow start */
+    ccs->cwnd += pkt->pktlen;
+    return;
+  }
+
+  /* Congestion avoidance */
+  ccs->cwnd += NGTCP2_MAX_DGRAM_SIZE * pkt->pktlen / ccs->cwnd;
+}
+
+static void reno_cc_congestion_event(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                                     ngtcp2_tstamp ts_sent, ngtcp2_tstamp ts) {
+  ngtcp2_reno_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_reno_cc, cc);
+
+  /* Only one reduction per window of data */
+  if (reno_cc_in_recovery(cc, ts_sent)) {
+    return;
+  }
+
+  cc->in_recovery = 1;
+  cc->recovery_start_ts = ts;
+
+  ccs->cwnd = ngtcp2_max(ccs->cwnd / 2, NGTCP2_MIN_CWND);
+  ccs->ssthresh = ccs->cwnd;
+}
+
+static void reno_cc_on_rto(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                           ngtcp2_tstamp ts) {
+  ngtcp2_reno_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_reno_cc, cc);
+  (void)ts;
+
+  /* ssthresh is kept on the consecutive timeouts */
+  if (ccs->cwnd > NGTCP2_MIN_CWND) {
+    ccs->ssthresh = ngtcp2_max(ccs->cwnd / 2, NGTCP2_MIN_CWND);
+  }
+
+  ccs->cwnd = NGTCP2_MIN_CWND;
+  cc->in_recovery = 0;
+}
+
+void ngtcp2_reno_cc_init(ngtcp2_reno_cc *cc) {
+  cc->cc.on_pkt_sent = NULL;
+  cc->cc.on_pkt_acked = reno_cc_on_pkt_acked;
+  cc->cc.congestion_event = reno_cc_congestion_event;
+  cc->cc.on_rto = reno_cc_on_rto;
+  cc->cc.user_data = NULL;
+  cc->recovery_start_ts = 0;
+  cc->in_recovery = 0;
+}
+
+/* NGTCP2_CUBIC_C is the scaling constant C of CUBIC in the unit of
+   segments per second cubed. */
+#define NGTCP2_CUBIC_C 0.4
+/* NGTCP2_CUBIC_BETA is the multiplicative decrease factor of CUBIC. */
+#define NGTCP2_CUBIC_BETA 0.7
+
+/*
+ * cubic_cbrt returns the cube root of |x| which must not be
+ * negative.  We avoid cbrt(3) so that the library does not depend on
+ * libm.
+ */
+static double cubic_cbrt(double x) {
+  double y = x > 1 ? x : 1;
+  size_t i;
+
+  for (i = 0; i < 64; ++i) {
+    y = (2 * y + x / (y * y)) / 3;
+  }
+
+  return y;
+}
+
+static int cubic_cc_in_recovery(ngtcp2_cubic_cc *cc, ngtcp2_tstamp ts_sent) {
+  return cc->in_recovery && ts_sent <= cc->recovery_start_ts;
+}
+
+static void cubic_cc_on_pkt_acked(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                                  const ngtcp2_cc_pkt *pkt, ngtcp2_tstamp ts) {
+  ngtcp2_cubic_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_cubic_cc, cc);
+  double t, target, cwnd, mss = NGTCP2_MAX_DGRAM_SIZE;
+  uint64_t min_rtt;
+
+  if (cubic_cc_in_recovery(cc, pkt->ts_sent)) {
+    return;
+  }
+
+  if (ccs->cwnd < ccs->ssthresh) {
+    /* Slow start */
+    ccs->cwnd += pkt->pktlen;
+    return;
+  }
+
+  cwnd = (double)ccs->cwnd;
+
+  if (!cc->in_epoch) {
+    cc->in_epoch = 1;
+    cc->epoch_start = ts;
+    if (ccs->cwnd < cc->w_max) {
+      cc->k = cubic_cbrt((double)(cc->w_max - ccs->cwnd) / mss /
+                         NGTCP2_CUBIC_C);
+      cc->origin = cc->w_max;
+    } else {
+      cc->k = 0;
+      cc->origin = ccs->cwnd;
+    }
+    cc->w_est = cwnd;
+  }
+
+  min_rtt = ccs->min_rtt == UINT64_MAX ? 0 : ccs->min_rtt;
+
+  t = (double)(ts - cc->epoch_start + min_rtt) / 1000000 - cc->k;
+  target = (double)cc->origin + NGTCP2_CUBIC_C * t * t * t * mss;
+  /* Do not grow more than 1.5 times per RTT */
+  target = ngtcp2_min(target, cwnd * 1.5);
+
+  if (target > cwnd) {
+    cwnd += (target - cwnd) * (double)pkt->pktlen / cwnd;
+  } else {
+    cwnd += mss * (double)pkt->pktlen / (100 * cwnd);
+  }
+
+  /* TCP friendly region */
+  cc->w_est += 3 * (1 - NGTCP2_CUBIC_BETA) / (1 + NGTCP2_CUBIC_BETA) * mss *
+               (double)pkt->pktlen / (double)ccs->cwnd;
+
+  ccs->cwnd = (uint64_t)ngtcp2_max(cwnd, cc->w_est);
+}
+
+/*
+ * cubic_cc_update_w_max remembers the congestion window before the
+ * reduction in w_max.
+ */
+static void cubic_cc_update_w_max(ngtcp2_cubic_cc *cc, ngtcp2_cc_stat *ccs) {
+  /* Fast convergence */
+  if (ccs->cwnd < cc->w_max) {
+    cc->w_max = (uint64_t)((double)ccs->cwnd * (1 + NGTCP2_CUBIC_BETA) / 2);
+  } else {
+    cc->w_max = ccs->cwnd;
+  }
+}
+
+static void cubic_cc_congestion_event(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                                      ngtcp2_tstamp ts_sent, ngtcp2_tstamp ts) {
+  ngtcp2_cubic_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_cubic_cc, cc);
+
+  if (cubic_cc_in_recovery(cc, ts_sent)) {
+    return;
+  }
+
+  cc->in_recovery = 1;
+  cc->recovery_start_ts = ts;
+  cc->in_epoch = 0;
+
+  cubic_cc_update_w_max(cc, ccs);
+
+  ccs->cwnd = ngtcp2_max((uint64_t)((double)ccs->cwnd * NGTCP2_CUBIC_BETA),
+                         NGTCP2_MIN_CWND);
+  ccs->ssthresh = ccs->cwnd;
+}
+
+static void cubic_cc_on_rto(ngtcp2_cc *ccx, ngtcp2_cc_stat *ccs,
+                            ngtcp2_tstamp ts) {
+  ngtcp2_cubic_cc *cc = ngtcp2_struct_of(ccx, ngtcp2_cubic_cc, cc);
+  (void)ts;
+
+  /* w_max and ssthresh are kept on the consecutive timeouts */
+  if (ccs->cwnd > NGTCP2_MIN_CWND) {
+    cubic_cc_update_w_max(cc, ccs);
+    ccs->ssthresh = ngtcp2_max(
+        (uint64_t)((double)ccs->cwnd * NGTCP2_CUBIC_BETA), NGTCP2_MIN_CWND);
+  }
+
+  ccs->cwnd = NGTCP2_MIN_CWND;
+  cc->in_recovery = 0;
+  cc->in_epoch = 0;
+}
+
+void ngtcp2_cubic_cc_init(ngtcp2_cubic_cc *cc) {
+  cc->cc.on_pkt_sent = NULL;
+  cc->cc.on_pkt_acked = cubic_cc_on_pkt_acked;
+  cc->cc.congestion_event = cubic_cc_congestion_event;
+  cc->cc.on_rto = cubic_cc_on_rto;
+  cc->cc.user_data = NULL;
+  cc->recovery_start_ts = 0;
+  cc->in_recovery = 0;
+  cc->epoch_start = 0;
+  cc->in_epoch = 0;
+  cc->w_max = 0;
+  cc->origin = 0;
+  cc->k = 0;
+  cc->w_est = 0;
+}
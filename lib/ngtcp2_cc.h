@@ -0,0 +1,105 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_CC_H
+#define NGTCP2_CC_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+/* NGTCP2_MAX_DGRAM_SIZE is the maximum packet size which congestion
+   controller assumes. */
+#define NGTCP2_MAX_DGRAM_SIZE NGTCP2_MAX_PKTLEN_IPV4
+
+/* NGTCP2_INITIAL_CWND is the initial congestion window. */
+#define NGTCP2_INITIAL_CWND (10 * NGTCP2_MAX_DGRAM_SIZE)
+
+/* NGTCP2_MIN_CWND is the minimum congestion window. */
+#define NGTCP2_MIN_CWND (2 * NGTCP2_MAX_DGRAM_SIZE)
+
+/*
+ * ngtcp2_cc_stat_init initializes |ccs| for new connection.
+ */
+void ngtcp2_cc_stat_init(ngtcp2_cc_stat *ccs);
+
+/*
+ * ngtcp2_cc_stat_update_rtt updates RTT estimate in |ccs| with new
+ * RTT sample |rtt| and the ACK Delay |ack_delay| reported by the
+ * remote endpoint.
+ */
+void ngtcp2_cc_stat_update_rtt(ngtcp2_cc_stat *ccs, uint64_t rtt,
+                               uint64_t ack_delay);
+
+/*
+ * ngtcp2_reno_cc is NewReno congestion controller.
+ */
+typedef struct {
+  ngtcp2_cc cc;
+  /* recovery_start_ts is the timestamp when the current recovery
+     period started.  It is only meaningful if in_recovery is
+     nonzero. */
+  ngtcp2_tstamp recovery_start_ts;
+  int in_recovery;
+} ngtcp2_reno_cc;
+
+/*
+ * ngtcp2_reno_cc_init initializes |cc|.
+ */
+void ngtcp2_reno_cc_init(ngtcp2_reno_cc *cc);
+
+/*
+ * ngtcp2_cubic_cc is CUBIC congestion controller described in RFC
+ * 8312.
+ */
+typedef struct {
+  ngtcp2_cc cc;
+  ngtcp2_tstamp recovery_start_ts;
+  int in_recovery;
+  /* epoch_start is the timestamp when the current congestion
+     avoidance stage started.  It is only meaningful if in_epoch is
+     nonzero. */
+  ngtcp2_tstamp epoch_start;
+  int in_epoch;
+  /* w_max is the congestion window just before the last reduction. */
+  uint64_t w_max;
+  /* origin is the congestion window at the plateau of the cubic
+     function of this epoch. */
+  uint64_t origin;
+  /* k is the time period in seconds which the cubic function takes
+     to increase the window to origin. */
+  double k;
+  /* w_est is the window which standard TCP would reach in this
+     epoch. */
+  double w_est;
+} ngtcp2_cubic_cc;
+
+/*
+ * ngtcp2_cubic_cc_init initializes |cc|.
+ */
+void ngtcp2_cubic_cc_init(ngtcp2_cubic_cc *cc);
+
+#endif /* NGTCP2_CC_H */
@@ -109,34 +109,231 @@ static int conn_call_handshake_completed(ngtcp2_conn *conn) {
   return 0;
 }
 
+static int conn_call_recv_stream_data(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                      uint8_t fin, const uint8_t *data,
+                                      size_t datalen) {
+  int rv;
+
+  if (strm->stream_id == 0) {
+    rv = conn->callbacks.recv_handshake_data(conn, data, datalen,
+                                             conn->user_data);
+    if (rv != 0) {
+      return NGTCP2_ERR_CALLBACK_FAILURE;
+    }
+
+    return 0;
+  }
+
+  conn->rx_delivered += datalen;
+
+  if (fin) {
+    ngtcp2_strm_shutdown(strm, NGTCP2_STRM_FLAG_SHUT_RD);
+  }
+
+  if (!conn->callbacks.recv_stream_data) {
+    return 0;
+  }
+
+  rv = conn->callbacks.recv_stream_data(conn, strm->stream_id, fin, data,
+                                        datalen, conn->user_data,
+                                        strm->stream_user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+static int conn_call_stream_close(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                  uint32_t error_code) {
+  int rv;
+
+  if (!conn->callbacks.stream_close) {
+    return 0;
+  }
+
+  rv = conn->callbacks.stream_close(conn, strm->stream_id, error_code,
+                                    conn->user_data, strm->stream_user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+static int conn_call_acked_stream_data_offset(ngtcp2_conn *conn,
+                                              ngtcp2_strm *strm,
+                                              uint64_t offset,
+                                              uint64_t datalen) {
+  int rv;
+
+  if (!conn->callbacks.acked_stream_data_offset) {
+    return 0;
+  }
+
+  rv = conn->callbacks.acked_stream_data_offset(
+      conn, strm->stream_id, offset, datalen, conn->user_data,
+      strm->stream_user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+static int strm_less(const void *lhs, const void *rhs) {
+  ngtcp2_strm *ls = ngtcp2_struct_of(lhs, ngtcp2_strm, pe);
+  ngtcp2_strm *rs = ngtcp2_struct_of(rhs, ngtcp2_strm, pe);
+
+  if (ls->urgency != rs->urgency) {
+    return ls->urgency < rs->urgency;
+  }
+
+  if (ls->cycle != rs->cycle) {
+    return ls->cycle < rs->cycle;
+  }
+
+  return ls->stream_id < rs->stream_id;
+}
+
+void ngtcp2_settings_default(ngtcp2_settings *settings) {
+  settings->cc_algo = NGTCP2_CC_ALGO_CUBIC;
+  settings->cc = NULL;
+  settings->idle_timeout = NGTCP2_DEFAULT_IDLE_TIMEOUT;
+  settings->max_stream_data = NGTCP2_DEFAULT_MAX_STREAM_DATA;
+  settings->max_data = NGTCP2_DEFAULT_MAX_DATA;
+  settings->max_stream_window = NGTCP2_DEFAULT_MAX_STREAM_WINDOW;
+  settings->max_window = NGTCP2_DEFAULT_MAX_WINDOW;
+  settings->pacing = 1;
+  settings->ack_eliciting_threshold = NGTCP2_DEFAULT_ACK_ELICITING_THRESHOLD;
+  settings->max_ack_delay = NGTCP2_DEFAULT_MAX_ACK_DELAY;
+  settings->mem = NULL;
+  settings->mem_pool = 0;
+  settings->max_mem = 0;
+  settings->reorder_chunk = NGTCP2_DEFAULT_REORDER_CHUNK;
+  settings->reorder_chunk_adaptive = 0;
+  settings->max_stream_id = NGTCP2_DEFAULT_MAX_STREAM_ID;
+}
+
 static int conn_new(ngtcp2_conn **pconn, uint64_t conn_id, uint32_t version,
-                    const ngtcp2_conn_callbacks *callbacks, void *user_data) {
+                    const ngtcp2_conn_callbacks *callbacks,
+                    const ngtcp2_settings *settings, void *user_data) {
   int rv;
-  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_mem *parent_mem = settings->mem ? settings->mem : ngtcp2_mem_default();
+  ngtcp2_mem *mem;
+
+  switch (settings->cc_algo) {
+  case NGTCP2_CC_ALGO_RENO:
+  case NGTCP2_CC_ALGO_CUBIC:
+    break;
+  case NGTCP2_CC_ALGO_CUSTOM:
+    if (settings->cc == NULL) {
+      return NGTCP2_ERR_INVALID_ARGUMENT;
+    }
+    break;
+  default:
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  if (settings->reorder_chunk == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
 
-  *pconn = ngtcp2_mem_calloc(mem, 1, sizeof(ngtcp2_conn));
+  *pconn = ngtcp2_mem_calloc(parent_mem, 1, sizeof(ngtcp2_conn));
   if (*pconn == NULL) {
     rv = NGTCP2_ERR_NOMEM;
     goto fail_conn;
   }
 
-  rv = ngtcp2_strm_init(&(*pconn)->strm0, mem);
+  (*pconn)->parent_mem = parent_mem;
+  ngtcp2_mem_acct_init(&(*pconn)->acct, parent_mem);
+  ngtcp2_mem_pool_init(&(*pconn)->pool, &(*pconn)->acct.mem);
+  mem = settings->mem_pool ? &(*pconn)->pool.mem : &(*pconn)->acct.mem;
+
+  rv = ngtcp2_map_init(&(*pconn)->strms, mem);
+  if (rv != 0) {
+    goto fail_strms_init;
+  }
+
+  rv = ngtcp2_pq_init(&(*pconn)->tx_pq, strm_less, mem);
+  if (rv != 0) {
+    goto fail_tx_pq_init;
+  }
+
+  (*pconn)->strm0 = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_strm));
+  if ((*pconn)->strm0 == NULL) {
+    rv = NGTCP2_ERR_NOMEM;
+    goto fail_strm0_malloc;
+  }
+
+  (*pconn)->mem = mem;
+  (*pconn)->reorder_chunk = settings->reorder_chunk;
+  (*pconn)->reorder_chunk_adaptive = settings->reorder_chunk_adaptive;
+
+  ngtcp2_frame_queue_init(&(*pconn)->frq);
+
+  (*pconn)->max_rx_offset = settings->max_data;
+  (*pconn)->rx_window = settings->max_data;
+  (*pconn)->max_rx_window =
+      ngtcp2_max(settings->max_window, settings->max_data);
+  (*pconn)->rx_window_ts = UINT64_MAX;
+  (*pconn)->stream_rx_window = settings->max_stream_data;
+  (*pconn)->max_stream_rx_window =
+      ngtcp2_max(settings->max_stream_window, settings->max_stream_data);
+  /* Until the transport parameters arrive, assume that the remote
+     endpoint uses the default limits. */
+  (*pconn)->max_tx_offset = NGTCP2_DEFAULT_MAX_DATA;
+  (*pconn)->tx_blocked_offset = UINT64_MAX;
+  (*pconn)->remote_max_stream_data = NGTCP2_DEFAULT_MAX_STREAM_DATA;
+
+  rv = ngtcp2_conn_init_stream(*pconn, (*pconn)->strm0, 0, NULL);
   if (rv != 0) {
-    goto fail_strm_init;
+    goto fail_strm0_init;
   }
 
   ngtcp2_acktr_init(&(*pconn)->acktr);
+  ngtcp2_rtb_init(&(*pconn)->rtb, mem);
+  ngtcp2_cc_stat_init(&(*pconn)->ccs);
+
+  switch (settings->cc_algo) {
+  case NGTCP2_CC_ALGO_RENO:
+    ngtcp2_reno_cc_init(&(*pconn)->ccimpl.reno);
+    (*pconn)->cc = &(*pconn)->ccimpl.reno.cc;
+    break;
+  case NGTCP2_CC_ALGO_CUBIC:
+    ngtcp2_cubic_cc_init(&(*pconn)->ccimpl.cubic);
+    (*pconn)->cc = &(*pconn)->ccimpl.cubic.cc;
+    break;
+  default:
+    (*pconn)->cc = settings->cc;
+  }
+
+  (*pconn)->pacing = settings->pacing;
+  (*pconn)->ack_eliciting_threshold = settings->ack_eliciting_threshold;
+  (*pconn)->max_ack_delay = settings->max_ack_delay;
+  (*pconn)->max_mem = settings->max_mem;
+  (*pconn)->max_remote_stream_id = settings->max_stream_id;
+
+  (*pconn)->idle_timeout = settings->idle_timeout;
+  (*pconn)->idle_ts = UINT64_MAX;
+  (*pconn)->restart_idle = 1;
 
   (*pconn)->callbacks = *callbacks;
   (*pconn)->conn_id = conn_id;
   (*pconn)->version = version;
-  (*pconn)->mem = mem;
   (*pconn)->user_data = user_data;
 
   return 0;
 
-fail_strm_init:
-  ngtcp2_mem_free(mem, *pconn);
+fail_strm0_init:
+  ngtcp2_mem_free(mem, (*pconn)->strm0);
+fail_strm0_malloc:
+  ngtcp2_pq_free(&(*pconn)->tx_pq);
+fail_tx_pq_init:
+  ngtcp2_map_free(&(*pconn)->strms);
+fail_strms_init:
+  ngtcp2_mem_pool_free(&(*pconn)->pool);
+  ngtcp2_mem_free(parent_mem, *pconn);
 fail_conn:
   return rv;
 }
@@ -144,15 +341,16 @@ fail_conn:
 int ngtcp2_conn_client_new(ngtcp2_conn **pconn, uint64_t conn_id,
                            uint32_t version,
                            const ngtcp2_conn_callbacks *callbacks,
-                           void *user_data) {
+                           const ngtcp2_settings *settings, void *user_data) {
   int rv;
 
-  rv = conn_new(pconn, conn_id, version, callbacks, user_data);
+  rv = conn_new(pconn, conn_id, version, callbacks, settings, user_data);
   if (rv != 0) {
     return rv;
   }
 
   (*pconn)->state = NGTCP2_CS_CLIENT_INITIAL;
+  (*pconn)->next_local_stream_id = 1;
 
   return 0;
 }
@@ -160,28 +358,29 @@ int ngtcp2_conn_client_new(ngtcp2_conn **pconn, uint64_t conn_id,
 int ngtcp2_conn_server_new(ngtcp2_conn **pconn, uint64_t conn_id,
                            uint32_t version,
                            const ngtcp2_conn_callbacks *callbacks,
-                           void *user_data) {
+                           const ngtcp2_settings *settings, void *user_data) {
   int rv;
 
-  rv = conn_new(pconn, conn_id, version, callbacks, user_data);
+  rv = conn_new(pconn, conn_id, version, callbacks, settings, user_data);
   if (rv != 0) {
     return rv;
   }
 
   (*pconn)->state = NGTCP2_CS_SERVER_INITIAL;
   (*pconn)->server = 1;
+  (*pconn)->next_local_stream_id = 2;
 
   return 0;
 }
 
-static void delete_acktr_entry(ngtcp2_acktr_entry *ent, ngtcp2_mem *mem) {
-  ngtcp2_acktr_entry *next;
+static int delete_strms_each(ngtcp2_map_entry *ent, void *ptr) {
+  ngtcp2_mem *mem = ptr;
+  ngtcp2_strm *s = ngtcp2_struct_of(ent, ngtcp2_strm, me);
 
-  for (; ent;) {
-    next = ent->next;
-    ngtcp2_acktr_entry_del(ent, mem);
-    ent = next;
-  }
+  ngtcp2_strm_free(s);
+  ngtcp2_mem_free(mem, s);
+
+  return 0;
 }
 
 void ngtcp2_conn_del(ngtcp2_conn *conn) {
@@ -189,98 +388,426 @@ void ngtcp2_conn_del(ngtcp2_conn *conn) {
     return;
   }
 
-  delete_acktr_entry(conn->acktr.ent, conn->mem);
   ngtcp2_acktr_free(&conn->acktr);
+  ngtcp2_rtb_free(&conn->rtb);
+  ngtcp2_frame_queue_free(&conn->frq, conn->mem);
 
   ngtcp2_crypto_km_del(conn->rx_ckm, conn->mem);
   ngtcp2_crypto_km_del(conn->tx_ckm, conn->mem);
 
-  ngtcp2_strm_free(&conn->strm0);
+  ngtcp2_pq_free(&conn->tx_pq);
+  ngtcp2_map_each_free(&conn->strms, delete_strms_each, conn->mem);
+  ngtcp2_map_free(&conn->strms);
+
+  ngtcp2_mem_free(conn->mem, conn->rx_pkt_spare);
+
+  ngtcp2_mem_pool_free(&conn->pool);
+
+  ngtcp2_mem_free(conn->parent_mem, conn);
+}
+
+/*
+ * conn_ack_expiry returns the time when the pending ACK frame is due,
+ * or UINT64_MAX if there is no pending ACK.  It is due immediately if
+ * a packet was received out of order, or ack_eliciting_threshold
+ * packets which require ACK have been received.  Otherwise it is
+ * delayed by max_ack_delay since the first of them was received.
+ */
+static ngtcp2_tstamp conn_ack_expiry(ngtcp2_conn *conn) {
+  ngtcp2_acktr *acktr = &conn->acktr;
+
+  if (!acktr->pending) {
+    return UINT64_MAX;
+  }
+
+  if (acktr->immediate || acktr->nactive >= conn->ack_eliciting_threshold) {
+    return acktr->pending_ts;
+  }
 
-  ngtcp2_mem_free(conn->mem, conn);
+  return acktr->pending_ts + conn->max_ack_delay;
 }
 
+/*
+ * conn_create_ack_frame fills |ack| with the ranges of the received
+ * packets if ACK frame is pending, and it is due at |ts| or
+ * |piggyback| is nonzero.  |piggyback| should be nonzero if the
+ * packet carries other frames anyway.  Otherwise |ack| is left
+ * untouched.  The ranges are not removed from acktr, so that they are
+ * sent again until the remote endpoint acknowledges a packet which
+ * carries them.  If the gap between 2 ranges is larger than 255
+ * packets, it is extended by the blocks of length 0.  The number of
+ * blocks is limited to NGTCP2_MAX_ACK_BLKS, and the older ranges which
+ * do not fit are not acknowledged.  The blocks are stored in
+ * conn->tx_ack_blks, so that |ack| is only valid until the next call.
+ *
+ * It currently always returns 0.
+ */
 static int conn_create_ack_frame(ngtcp2_conn *conn, ngtcp2_ack *ack,
-                                 ngtcp2_tstamp ts) {
-  uint64_t first_pkt_num;
-  ngtcp2_tstamp ack_delay;
+                                 int piggyback, ngtcp2_tstamp ts) {
   uint64_t last_pkt_num;
   ngtcp2_ack_blk *blk;
-  int initial = 1;
   uint64_t gap;
   ngtcp2_acktr_entry *rpkt;
+  size_t i;
 
-  rpkt = ngtcp2_acktr_get(&conn->acktr);
-  if (rpkt == NULL) {
+  if (!conn->acktr.pending || (!piggyback && conn_ack_expiry(conn) > ts)) {
     return 0;
   }
 
-  first_pkt_num = last_pkt_num = rpkt->pkt_num;
-  ack_delay = ts - rpkt->tstamp;
-
-  ngtcp2_acktr_remove(&conn->acktr, rpkt);
-  ngtcp2_acktr_entry_del(rpkt, conn->mem);
+  rpkt = ngtcp2_acktr_get(&conn->acktr, 0);
+  if (rpkt == NULL) {
+    return 0;
+  }
 
   ack->type = NGTCP2_FRAME_ACK;
   ack->num_ts = 0;
   ack->num_blks = 0;
+  ack->blks = conn->tx_ack_blks;
+  ack->largest_ack = rpkt->pkt_num;
+  ack->ack_delay = (uint16_t)ngtcp2_min(ts - rpkt->tstamp, 0xffff);
+  ack->first_ack_blklen = rpkt->len - 1;
 
-  for (; (rpkt = ngtcp2_acktr_get(&conn->acktr));) {
-    if (rpkt->pkt_num + 1 == last_pkt_num) {
-      last_pkt_num = rpkt->pkt_num;
-      ngtcp2_acktr_remove(&conn->acktr, rpkt);
-      ngtcp2_acktr_entry_del(rpkt, conn->mem);
-      continue;
+  last_pkt_num = rpkt->pkt_num - (rpkt->len - 1);
+
+  for (i = 1; ack->num_blks < NGTCP2_MAX_ACK_BLKS; ++i) {
+    rpkt = ngtcp2_acktr_get(&conn->acktr, i);
+    if (rpkt == NULL) {
+      break;
     }
 
-    if (initial) {
-      initial = 0;
-      ack->largest_ack = first_pkt_num;
-      ack->ack_delay = (uint16_t)ack_delay;
-      ack->first_ack_blklen = first_pkt_num - last_pkt_num;
-    } else {
+    gap = last_pkt_num - rpkt->pkt_num - 1;
+    for (; gap > 255 && ack->num_blks < NGTCP2_MAX_ACK_BLKS;) {
       blk = &ack->blks[ack->num_blks++];
-      blk->gap = (uint8_t)gap;
-      blk->blklen = first_pkt_num - last_pkt_num;
+      blk->gap = 255;
+      blk->blklen = 0;
+      gap -= 255;
     }
 
-    gap = last_pkt_num - rpkt->pkt_num;
-    if (gap > 255) {
-      /* TODO We need to encode next ack in the separate ACK frame or
-         use the trick of 0 length ACK Block Length (not sure it is
-         OK.  Anyway, this implementation will be rewritten soon, so
-         we don't optimize this at the moment. */
+    if (ack->num_blks == NGTCP2_MAX_ACK_BLKS) {
       break;
     }
 
-    first_pkt_num = last_pkt_num = rpkt->pkt_num;
+    blk = &ack->blks[ack->num_blks++];
+    blk->gap = (uint8_t)gap;
+    blk->blklen = rpkt->len;
+
+    last_pkt_num = rpkt->pkt_num - (rpkt->len - 1);
+  }
 
-    ngtcp2_acktr_remove(&conn->acktr, rpkt);
-    ngtcp2_acktr_entry_del(rpkt, conn->mem);
+  return 0;
+}
 
-    if (ack->num_blks == 255) {
-      break;
+/*
+ * conn_pacing_interval returns the interval between the packets of
+ * length |pktlen| at the current pacing rate.  The rate is 2 times
+ * cwnd / smoothed RTT during slow start so that the window can
+ * double every round trip, and 1.25 times after that.  It returns 0
+ * if pacing is disabled or RTT has not been measured yet.
+ */
+static ngtcp2_tstamp conn_pacing_interval(ngtcp2_conn *conn, size_t pktlen) {
+  ngtcp2_cc_stat *ccs = &conn->ccs;
+
+  if (!conn->pacing || ccs->min_rtt == UINT64_MAX || ccs->cwnd == 0) {
+    return 0;
+  }
+
+  if (ccs->cwnd < ccs->ssthresh) {
+    return pktlen * ccs->smoothed_rtt / (ccs->cwnd * 2);
+  }
+
+  return pktlen * ccs->smoothed_rtt * 4 / (ccs->cwnd * 5);
+}
+
+/*
+ * conn_pacing_base returns the time from which the next packet is
+ * paced at |ts|.  The sender which is late, or has been idle, catches
+ * up at most NGTCP2_PACING_GRANULARITY, so that a burst of ACKs does
+ * not release a burst of packets.
+ */
+static ngtcp2_tstamp conn_pacing_base(ngtcp2_conn *conn, ngtcp2_tstamp ts) {
+  return ngtcp2_max(conn->tx_pacing_ts,
+                    ts - ngtcp2_min(ts, NGTCP2_PACING_GRANULARITY));
+}
+
+/*
+ * conn_cwnd_avail returns nonzero if the congestion window and the
+ * pacer allow |conn| to send a packet in flight at |ts|.
+ */
+static int conn_cwnd_avail(ngtcp2_conn *conn, ngtcp2_tstamp ts) {
+  return conn->ccs.bytes_in_flight < conn->ccs.cwnd &&
+         ts >= conn->tx_pacing_ts;
+}
+
+/*
+ * conn_on_pkt_sent records the packet |pkt_num| of length |pktlen|
+ * sent at |ts| so that it counts toward bytes in flight until it is
+ * acknowledged or declared lost.  |frc| is the list of frames in the
+ * packet, which are retransmitted if the packet is lost.  This
+ * function takes the ownership of |frc| even if it fails.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_on_pkt_sent(ngtcp2_conn *conn, uint64_t pkt_num,
+                            size_t pktlen, ngtcp2_frame_chain *frc,
+                            ngtcp2_tstamp ts) {
+  int rv;
+  ngtcp2_rtb_entry *ent;
+  ngtcp2_cc_pkt pkt;
+  ngtcp2_tstamp interval;
+
+  rv = ngtcp2_rtb_entry_new(&ent, pkt_num, ts, pktlen, frc, conn->mem);
+  if (rv != 0) {
+    ngtcp2_frame_chain_list_del(frc, conn->mem);
+    return rv;
+  }
+
+  ngtcp2_rtb_add(&conn->rtb, ent);
+
+  conn->ccs.bytes_in_flight += pktlen;
+
+  interval = conn_pacing_interval(conn, pktlen);
+  if (interval) {
+    conn->tx_pacing_ts = conn_pacing_base(conn, ts) + interval;
+  }
+
+  if (conn->restart_idle) {
+    conn->idle_ts = ts;
+    conn->restart_idle = 0;
+  }
+
+  if (conn->cc->on_pkt_sent) {
+    pkt.pkt_num = pkt_num;
+    pkt.pktlen = pktlen;
+    pkt.ts_sent = ts;
+
+    conn->cc->on_pkt_sent(conn->cc, &conn->ccs, &pkt);
+  }
+
+  return 0;
+}
+
+/*
+ * conn_frame_obsolete returns nonzero if |frc| no longer needs to be
+ * sent.  STREAM frame is obsolete if its stream is already closed.  A
+ * stream is closed before all its data is acknowledged only if it is
+ * reset, and the application may have released the data since then.
+ * MAX_STREAM_DATA frame is obsolete if its stream is closed, or the
+ * final offset is known.  BLOCKED and STREAM_BLOCKED frames are
+ * obsolete once the remote endpoint extends the limit.  PING frame is
+ * never retransmitted.
+ */
+static int conn_frame_obsolete(ngtcp2_conn *conn,
+                               const ngtcp2_frame_chain *frc) {
+  ngtcp2_strm *strm;
+
+  switch (frc->fr.type) {
+  case NGTCP2_FRAME_STREAM:
+    return ngtcp2_conn_find_stream(conn, frc->fr.stream.stream_id) == NULL;
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    strm = ngtcp2_conn_find_stream(conn, frc->fr.max_stream_data.stream_id);
+    return strm == NULL || (strm->flags & NGTCP2_STRM_FLAG_RECV_FIN);
+  case NGTCP2_FRAME_BLOCKED:
+    return conn->tx_offset < conn->max_tx_offset;
+  case NGTCP2_FRAME_STREAM_BLOCKED:
+    strm = ngtcp2_conn_find_stream(conn, frc->fr.stream_blocked.stream_id);
+    return strm == NULL || strm->tx_offset < strm->max_tx_offset;
+  case NGTCP2_FRAME_PING:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * conn_discard_frames frees the obsolete frames at the head of |q|.
+ */
+static void conn_discard_frames(ngtcp2_conn *conn, ngtcp2_frame_queue *q) {
+  ngtcp2_frame_chain *frc;
+
+  for (; !ngtcp2_frame_queue_empty(q);) {
+    frc = ngtcp2_frame_queue_top(q);
+    if (!conn_frame_obsolete(conn, frc)) {
+      return;
     }
+    ngtcp2_frame_queue_pop(q);
+    ngtcp2_frame_chain_del(frc, conn->mem);
   }
+}
 
-  if (initial) {
-    ack->largest_ack = first_pkt_num;
-    ack->ack_delay = (uint16_t)ack_delay;
-    ack->first_ack_blklen = first_pkt_num - last_pkt_num;
+/*
+ * conn_queue_ctrl_frame queues the flow control frame of type |type|
+ * in frq.  |stream_id| is used by MAX_STREAM_DATA and STREAM_BLOCKED
+ * frames.  The value of MAX_DATA and MAX_STREAM_DATA frames is filled
+ * when the frame is written.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_queue_ctrl_frame(ngtcp2_conn *conn, uint8_t type,
+                                 uint32_t stream_id) {
+  int rv;
+  ngtcp2_frame_chain *frc;
+
+  rv = ngtcp2_frame_chain_new(&frc, conn->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  frc->fr.type = type;
+
+  switch (type) {
+  case NGTCP2_FRAME_MAX_DATA:
+    frc->fr.max_data.max_data = 0;
+    break;
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    frc->fr.max_stream_data.stream_id = stream_id;
+    frc->fr.max_stream_data.max_stream_data = 0;
+    break;
+  case NGTCP2_FRAME_STREAM_BLOCKED:
+    frc->fr.stream_blocked.stream_id = stream_id;
+    break;
+  }
+
+  ngtcp2_frame_queue_push(&conn->frq, frc);
+
+  return 0;
+}
+
+/*
+ * conn_write_ctrl_frame writes the flow control frame at the head of
+ * |q| to |ppe|.  MAX_DATA and MAX_STREAM_DATA frames carry the
+ * current limit, even if they are retransmitted.  The frame is
+ * removed from |q|, and appended to |*ppfrc|, so that it is
+ * retransmitted if the packet is lost.  The head of |q| must not be
+ * obsolete.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOBUF
+ *     No room to write the frame.  It is left in |q|.
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_write_ctrl_frame(ngtcp2_conn *conn, ngtcp2_ppe *ppe,
+                                 const ngtcp2_pkt_hd *hd,
+                                 ngtcp2_frame_chain ***ppfrc,
+                                 ngtcp2_frame_queue *q) {
+  int rv;
+  ngtcp2_frame_chain *frc = ngtcp2_frame_queue_top(q);
+  ngtcp2_strm *strm = NULL;
+  ngtcp2_frame fr;
+
+  switch (frc->fr.type) {
+  case NGTCP2_FRAME_MAX_DATA:
+    frc->fr.max_data.max_data = conn->max_rx_offset / NGTCP2_MAX_DATA_UNIT;
+    fr.max_data = frc->fr.max_data;
+    break;
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    strm = ngtcp2_conn_find_stream(conn, frc->fr.max_stream_data.stream_id);
+    assert(strm);
+    frc->fr.max_stream_data.max_stream_data = strm->max_rx_offset;
+    fr.max_stream_data = frc->fr.max_stream_data;
+    break;
+  case NGTCP2_FRAME_BLOCKED:
+    fr.blocked = frc->fr.blocked;
+    break;
+  case NGTCP2_FRAME_STREAM_BLOCKED:
+    fr.stream_blocked = frc->fr.stream_blocked;
+    break;
+  default:
+    assert(0);
+  }
+
+  rv = ngtcp2_ppe_encode_frame(ppe, &fr);
+  if (rv != 0) {
+    return rv;
+  }
+
+  switch (frc->fr.type) {
+  case NGTCP2_FRAME_MAX_DATA:
+    conn->max_data_pending = 0;
+    break;
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    strm->flags &= (uint32_t)~NGTCP2_STRM_FLAG_MAX_STREAM_DATA_PENDING;
+    break;
+  }
+
+  ngtcp2_frame_queue_pop(q);
+  **ppfrc = frc;
+  *ppfrc = &frc->next;
+
+  return conn_call_send_frame(conn, hd, &fr);
+}
+
+/*
+ * conn_pop_lost_frame removes STREAM frame from the head of |q|, and
+ * assigns it to |*pfrc|.  If the data of the frame is longer than
+ * |left| - NGTCP2_STREAM_OVERHEAD bytes, the frame is split, and only
+ * its leading part is removed.  The caller takes the ownership of
+ * |*pfrc|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOBUF
+ *     No data can be written in |left| bytes.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_pop_lost_frame(ngtcp2_conn *conn, ngtcp2_frame_chain **pfrc,
+                               ngtcp2_frame_queue *q, size_t left) {
+  int rv;
+  ngtcp2_frame_chain *frc = ngtcp2_frame_queue_top(q);
+  ngtcp2_stream *fr = &frc->fr.stream;
+  ngtcp2_stream nfr;
+  size_t ndatalen;
+
+  if (left < NGTCP2_STREAM_OVERHEAD + (fr->datalen ? 1 : 0)) {
+    return NGTCP2_ERR_NOBUF;
+  }
+
+  ndatalen = left - NGTCP2_STREAM_OVERHEAD;
+  if (fr->datalen <= ndatalen) {
+    ngtcp2_frame_queue_pop(q);
+    *pfrc = frc;
+    return 0;
+  }
+
+  nfr = *fr;
+  nfr.fin = 0;
+  nfr.datalen = ndatalen;
+
+  rv = ngtcp2_frame_chain_stream_new(pfrc, &nfr, conn->mem);
+  if (rv != 0) {
+    return rv;
   }
 
+  fr->offset += ndatalen;
+  fr->data += ndatalen;
+  fr->datalen -= ndatalen;
+
   return 0;
 }
 
 static ssize_t conn_encode_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
                                          size_t destlen, uint8_t type,
                                          const ngtcp2_frame *ackfr,
-                                         ngtcp2_buf *tx_buf) {
+                                         ngtcp2_buf *tx_buf, ngtcp2_tstamp ts) {
   int rv;
   ngtcp2_upe upe;
   ngtcp2_pkt_hd hd;
   ngtcp2_frame fr;
   size_t nwrite;
+  size_t pktlen;
+  ngtcp2_frame_chain *frc = NULL, **pfrc = &frc;
 
   ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_LONG_FORM, type, conn->conn_id,
                      conn->next_tx_pkt_num, conn->version);
@@ -312,6 +839,8 @@ static ssize_t conn_encode_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
 
   if (ngtcp2_upe_left(&upe) < NGTCP2_STREAM_OVERHEAD + 1) {
     if (ackfr) {
+      ngtcp2_acktr_add_ack(&conn->acktr, hd.pkt_num, ackfr->ack.largest_ack,
+                           0);
       ++conn->next_tx_pkt_num;
       return (ssize_t)ngtcp2_upe_final(&upe, NULL);
     }
@@ -319,8 +848,36 @@ static ssize_t conn_encode_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
     return NGTCP2_ERR_NOBUF;
   }
 
-  nwrite = ngtcp2_min(ngtcp2_buf_len(tx_buf),
-                      ngtcp2_upe_left(&upe) - NGTCP2_STREAM_OVERHEAD);
+  /* Lost handshake data is retransmitted before new data. */
+  for (; !ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq);) {
+    rv = conn_pop_lost_frame(conn, pfrc, &conn->rtb.hs_lostq,
+                             ngtcp2_upe_left(&upe));
+    if (rv == NGTCP2_ERR_NOBUF) {
+      break;
+    }
+    if (rv != 0) {
+      goto fail;
+    }
+
+    fr.stream = (*pfrc)->fr.stream;
+    pfrc = &(*pfrc)->next;
+
+    rv = ngtcp2_upe_encode_frame(&upe, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    rv = conn_call_send_frame(conn, &hd, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+  }
+
+  nwrite = 0;
+  if (ngtcp2_upe_left(&upe) >= NGTCP2_STREAM_OVERHEAD + 1) {
+    nwrite = ngtcp2_min(ngtcp2_buf_len(tx_buf),
+                        ngtcp2_upe_left(&upe) - NGTCP2_STREAM_OVERHEAD);
+  }
 
   if (nwrite > 0) {
     /* TODO Make a function to create STREAM frame */
@@ -328,22 +885,27 @@ static ssize_t conn_encode_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
     fr.stream.flags = 0;
     fr.stream.fin = 0;
     fr.stream.stream_id = 0;
-    fr.stream.offset = conn->strm0.tx_offset;
+    fr.stream.offset = conn->strm0->tx_offset;
     fr.stream.datalen = nwrite;
     fr.stream.data = tx_buf->pos;
 
+    rv = ngtcp2_frame_chain_stream_new(pfrc, &fr.stream, conn->mem);
+    if (rv != 0) {
+      goto fail;
+    }
+
     rv = ngtcp2_upe_encode_frame(&upe, &fr);
     if (rv != 0) {
-      return rv;
+      goto fail;
     }
 
     rv = conn_call_send_frame(conn, &hd, &fr);
     if (rv != 0) {
-      return rv;
+      goto fail;
     }
 
     tx_buf->pos += nwrite;
-    conn->strm0.tx_offset += nwrite;
+    conn->strm0->tx_offset += nwrite;
   }
 
   if (type == NGTCP2_PKT_CLIENT_INITIAL) {
@@ -352,22 +914,41 @@ static ssize_t conn_encode_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
     if (fr.padding.len > 0) {
       rv = conn_call_send_frame(conn, &hd, &fr);
       if (rv != 0) {
-        return rv;
+        goto fail;
       }
     }
   }
 
-  ++conn->next_tx_pkt_num;
+  pktlen = ngtcp2_upe_final(&upe, NULL);
 
-  return (ssize_t)ngtcp2_upe_final(&upe, NULL);
-}
+  if (ackfr) {
+    ngtcp2_acktr_add_ack(&conn->acktr, hd.pkt_num, ackfr->ack.largest_ack,
+                         frc != NULL);
+  }
 
-static ssize_t conn_send_client_initial(ngtcp2_conn *conn, uint8_t *dest,
-                                        size_t destlen) {
+  if (frc) {
+    rv = conn_on_pkt_sent(conn, hd.pkt_num, pktlen, frc, ts);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  ++conn->next_tx_pkt_num;
+
+  return (ssize_t)pktlen;
+
+fail:
+  ngtcp2_frame_chain_list_del(frc, conn->mem);
+
+  return rv;
+}
+
+static ssize_t conn_send_client_initial(ngtcp2_conn *conn, uint8_t *dest,
+                                        size_t destlen, ngtcp2_tstamp ts) {
   uint64_t pkt_num = 0;
   const uint8_t *payload;
   ssize_t payloadlen;
-  ngtcp2_buf *tx_buf = &conn->strm0.tx_buf;
+  ngtcp2_buf *tx_buf = &conn->strm0->tx_buf;
 
   payloadlen = conn->callbacks.send_client_initial(
       conn, NGTCP2_CONN_FLAG_NONE, &pkt_num, &payload, conn->user_data);
@@ -382,7 +963,7 @@ static ssize_t conn_send_client_initial(ngtcp2_conn *conn, uint8_t *dest,
   conn->next_tx_pkt_num = pkt_num;
 
   return conn_encode_handshake_pkt(conn, dest, destlen,
-                                   NGTCP2_PKT_CLIENT_INITIAL, NULL, tx_buf);
+                                   NGTCP2_PKT_CLIENT_INITIAL, NULL, tx_buf, ts);
 }
 
 static ssize_t conn_send_client_cleartext(ngtcp2_conn *conn, uint8_t *dest,
@@ -390,11 +971,12 @@ static ssize_t conn_send_client_cleartext(ngtcp2_conn *conn, uint8_t *dest,
   const uint8_t *payload;
   ssize_t payloadlen;
   ngtcp2_frame ackfr;
-  ngtcp2_buf *tx_buf = &conn->strm0.tx_buf;
+  ngtcp2_buf *tx_buf = &conn->strm0->tx_buf;
   int rv;
 
+  /* ACK frame is not delayed during handshake. */
   ackfr.type = 0;
-  rv = conn_create_ack_frame(conn, &ackfr.ack, ts);
+  rv = conn_create_ack_frame(conn, &ackfr.ack, 1, ts);
   if (rv != 0) {
     return rv;
   }
@@ -407,7 +989,8 @@ static ssize_t conn_send_client_cleartext(ngtcp2_conn *conn, uint8_t *dest,
       return NGTCP2_ERR_CALLBACK_FAILURE;
     }
 
-    if (payloadlen == 0 && ackfr.type == 0) {
+    if (payloadlen == 0 && ackfr.type == 0 &&
+        ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq)) {
       return 0;
     }
 
@@ -417,7 +1000,8 @@ static ssize_t conn_send_client_cleartext(ngtcp2_conn *conn, uint8_t *dest,
 
   return conn_encode_handshake_pkt(conn, dest, destlen,
                                    NGTCP2_PKT_CLIENT_CLEARTEXT,
-                                   ackfr.type == 0 ? NULL : &ackfr, tx_buf);
+                                   ackfr.type == 0 ? NULL : &ackfr, tx_buf,
+                                   ts);
 }
 
 static ssize_t conn_send_server_cleartext(ngtcp2_conn *conn, uint8_t *dest,
@@ -427,11 +1011,12 @@ static ssize_t conn_send_server_cleartext(ngtcp2_conn *conn, uint8_t *dest,
   const uint8_t *payload;
   ssize_t payloadlen;
   ngtcp2_frame ackfr;
-  ngtcp2_buf *tx_buf = &conn->strm0.tx_buf;
+  ngtcp2_buf *tx_buf = &conn->strm0->tx_buf;
   int rv;
 
+  /* ACK frame is not delayed during handshake. */
   ackfr.type = 0;
-  rv = conn_create_ack_frame(conn, &ackfr.ack, ts);
+  rv = conn_create_ack_frame(conn, &ackfr.ack, 1, ts);
   if (rv != 0) {
     return rv;
   }
@@ -449,7 +1034,7 @@ static ssize_t conn_send_server_cleartext(ngtcp2_conn *conn, uint8_t *dest,
       if (initial) {
         return NGTCP2_ERR_CALLBACK_FAILURE;
       }
-      if (ackfr.type == 0) {
+      if (ackfr.type == 0 && ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq)) {
         return 0;
       }
     }
@@ -464,25 +1049,84 @@ static ssize_t conn_send_server_cleartext(ngtcp2_conn *conn, uint8_t *dest,
 
   return conn_encode_handshake_pkt(conn, dest, destlen,
                                    NGTCP2_PKT_SERVER_CLEARTEXT,
-                                   ackfr.type == 0 ? NULL : &ackfr, tx_buf);
+                                   ackfr.type == 0 ? NULL : &ackfr, tx_buf,
+                                   ts);
 }
 
-static ssize_t conn_send_connection_close(ngtcp2_conn *conn, uint8_t *dest,
-                                          size_t destlen, ngtcp2_tstamp ts) {
+/*
+ * conn_retransmit_handshake_pkt writes a handshake packet of type
+ * |type| which carries the lost handshake data, and the handshake
+ * data which are not sent yet.  It is used after the packet carrying
+ * them was sent, and they cannot be sent along with the regular
+ * handshake flow.
+ *
+ * This function returns the number of bytes written in |dest|, or 0
+ * if there is nothing to write.  Otherwise it returns one of the
+ * following negative error codes:
+ *
+ * NGTCP2_ERR_NOBUF
+ *     Buffer is too small
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static ssize_t conn_retransmit_handshake_pkt(ngtcp2_conn *conn, uint8_t *dest,
+                                             size_t destlen, uint8_t type,
+                                             ngtcp2_tstamp ts) {
+  ngtcp2_buf *tx_buf = &conn->strm0->tx_buf;
+
+  if (ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq) &&
+      ngtcp2_buf_len(tx_buf) == 0) {
+    return 0;
+  }
+
+  return conn_encode_handshake_pkt(conn, dest, destlen, type, NULL, tx_buf,
+                                   ts);
+}
+
+/*
+ * conn_write_protected_pkt writes a protected packet in the buffer
+ * pointed by |dest| of length |destlen|.  Pending ACK is written
+ * first.  If |fr| is not NULL, it is written next.  If |strm| is not
+ * NULL, STREAM frame which carries |data| of length |datalen| is
+ * written as much as the buffer allows, and the number of bytes of
+ * |data| written is stored in |*pdatalen|.  The fin bit is set only
+ * if |fin| is nonzero and all |data| are written.
+ *
+ * This function returns the number of bytes written in |dest|, or 0
+ * if there is nothing to write.  Otherwise it returns one of the
+ * following negative error codes:
+ *
+ * NGTCP2_ERR_NOBUF
+ *     Buffer is too small
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static ssize_t conn_write_protected_pkt(ngtcp2_conn *conn, uint8_t *dest,
+                                        size_t destlen, const ngtcp2_frame *fr,
+                                        ngtcp2_strm *strm, uint8_t fin,
+                                        const uint8_t *data, size_t datalen,
+                                        size_t *pdatalen, ngtcp2_tstamp ts) {
   int rv;
   ngtcp2_ppe ppe;
   ngtcp2_pkt_hd hd;
-  ngtcp2_frame fr;
-  ngtcp2_frame ackfr;
+  ngtcp2_frame ackfr, strmfr;
   ssize_t nwrite;
   ngtcp2_crypto_ctx ctx;
+  size_t left, ndatalen;
+  ngtcp2_frame_chain *frc = NULL;
 
   ackfr.type = 0;
-  rv = conn_create_ack_frame(conn, &ackfr.ack, ts);
+  rv = conn_create_ack_frame(conn, &ackfr.ack, fr || strm, ts);
   if (rv != 0) {
     return rv;
   }
 
+  if (ackfr.type == 0 && fr == NULL && strm == NULL) {
+    return 0;
+  }
+
   /* TODO Choose appropriate packet number size */
   ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID, NGTCP2_PKT_03, conn->conn_id,
                      conn->next_tx_pkt_num, conn->version);
@@ -516,244 +1160,714 @@ static ssize_t conn_send_connection_close(ngtcp2_conn *conn, uint8_t *dest,
     }
   }
 
-  /* TODO CONNECTION_CLOSE cannot be sent if ACK frame is too
-     large. */
-
-  fr.type = NGTCP2_FRAME_CONNECTION_CLOSE;
-  fr.connection_close.error_code = NGTCP2_QUIC_INTERNAL_ERROR;
-  fr.connection_close.reasonlen = 0;
-  fr.connection_close.reason = NULL;
+  /* TODO The frame cannot be sent if ACK frame is too large. */
+  if (fr) {
+    rv = ngtcp2_ppe_encode_frame(&ppe, fr);
+    if (rv != 0) {
+      return rv;
+    }
 
-  rv = ngtcp2_ppe_encode_frame(&ppe, &fr);
-  if (rv != 0) {
-    return rv;
+    rv = conn_call_send_frame(conn, &hd, fr);
+    if (rv != 0) {
+      return rv;
+    }
   }
 
-  rv = conn_call_send_frame(conn, &hd, &fr);
-  if (rv != 0) {
-    return rv;
+  if (strm) {
+    *pdatalen = 0;
+
+    left = ngtcp2_ppe_left(&ppe);
+    if (left < NGTCP2_STREAM_OVERHEAD + (datalen ? 1 : 0)) {
+      if (ackfr.type == 0 && fr == NULL) {
+        return NGTCP2_ERR_NOBUF;
+      }
+    } else {
+      /* Data Length field is 16 bits long */
+      ndatalen =
+          ngtcp2_min(ngtcp2_min(datalen, left - NGTCP2_STREAM_OVERHEAD), 0xffff);
+
+      strmfr.type = NGTCP2_FRAME_STREAM;
+      strmfr.stream.flags = 0;
+      strmfr.stream.fin = fin && ndatalen == datalen;
+      strmfr.stream.stream_id = strm->stream_id;
+      strmfr.stream.offset = strm->tx_offset;
+      strmfr.stream.datalen = ndatalen;
+      strmfr.stream.data = data;
+
+      rv = ngtcp2_frame_chain_stream_new(&frc, &strmfr.stream, conn->mem);
+      if (rv != 0) {
+        return rv;
+      }
+
+      rv = ngtcp2_ppe_encode_frame(&ppe, &strmfr);
+      if (rv != 0) {
+        goto fail;
+      }
+
+      rv = conn_call_send_frame(conn, &hd, &strmfr);
+      if (rv != 0) {
+        goto fail;
+      }
+
+      strm->tx_offset += ndatalen;
+      conn->tx_offset += ndatalen;
+      *pdatalen = ndatalen;
+
+      if (strmfr.stream.fin) {
+        ngtcp2_strm_shutdown(strm, NGTCP2_STRM_FLAG_SHUT_WR);
+      }
+    }
   }
 
   nwrite = ngtcp2_ppe_final(&ppe, NULL);
   if (nwrite < 0) {
-    return nwrite;
+    rv = (int)nwrite;
+    goto fail;
+  }
+
+  if (ackfr.type) {
+    ngtcp2_acktr_add_ack(&conn->acktr, hd.pkt_num, ackfr.ack.largest_ack,
+                         frc != NULL);
+  }
+
+  if (frc) {
+    rv = conn_on_pkt_sent(conn, hd.pkt_num, (size_t)nwrite, frc, ts);
+    if (rv != 0) {
+      return rv;
+    }
   }
 
   ++conn->next_tx_pkt_num;
 
   return nwrite;
-}
 
-ssize_t ngtcp2_conn_send(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
-                         ngtcp2_tstamp ts) {
-  ssize_t nwrite = 0;
-  int rv;
+fail:
+  ngtcp2_frame_chain_list_del(frc, conn->mem);
 
-  switch (conn->state) {
-  case NGTCP2_CS_CLIENT_INITIAL:
-    nwrite = conn_send_client_initial(conn, dest, destlen);
-    if (nwrite < 0) {
-      break;
-    }
-    conn->state = NGTCP2_CS_CLIENT_CI_SENT;
-    break;
-  case NGTCP2_CS_CLIENT_SC_RECVED:
-    nwrite = conn_send_client_cleartext(conn, dest, destlen, ts);
-    if (nwrite < 0) {
-      break;
-    }
-    if (conn->handshake_completed) {
-      rv = conn_call_handshake_completed(conn);
-      if (rv != 0) {
-        return rv;
-      }
-      conn->state = NGTCP2_CS_POST_HANDSHAKE;
-    }
-    break;
-  case NGTCP2_CS_SERVER_CI_RECVED:
-    nwrite = conn_send_server_cleartext(conn, dest, destlen, 1, ts);
-    if (nwrite < 0) {
-      break;
-    }
-    conn->state = NGTCP2_CS_SERVER_SC_SENT;
-    break;
-  case NGTCP2_CS_SERVER_SC_SENT:
-    nwrite = conn_send_server_cleartext(conn, dest, destlen, 0, ts);
-    if (nwrite < 0) {
-      break;
-    }
-    break;
-  case NGTCP2_CS_POST_HANDSHAKE:
-    nwrite = conn_send_connection_close(conn, dest, destlen, ts);
-    if (nwrite < 0) {
-      break;
-    }
-    conn->state = NGTCP2_CS_CLOSE_WAIT;
-    break;
+  return rv;
+}
+
+/*
+ * conn_sched_strm puts |strm| in the stream scheduler unless it is
+ * already there.  The stream which becomes active starts from the
+ * virtual finish time of the stream scheduled last, so that it
+ * cannot claim the bandwidth which it did not use while it was idle.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_sched_strm(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  if (strm->pe.index != NGTCP2_PQ_BAD_INDEX) {
+    return 0;
   }
 
-  return nwrite;
+  strm->cycle = ngtcp2_max(strm->cycle, conn->last_cycle);
+
+  return ngtcp2_pq_push(&conn->tx_pq, &strm->pe);
 }
 
-static int conn_on_version_negotiation(ngtcp2_conn *conn,
-                                       const ngtcp2_pkt_hd *hd,
-                                       const uint8_t *pkt, size_t pktlen) {
-  uint32_t sv[16];
-  uint32_t *p;
-  int rv;
-  size_t nsv;
+int ngtcp2_conn_set_stream_reorder_chunk(ngtcp2_conn *conn,
+                                         uint32_t stream_id, size_t chunk,
+                                         int adaptive) {
+  ngtcp2_strm *strm;
 
-  if (pktlen % sizeof(uint32_t)) {
-    return NGTCP2_ERR_PROTO;
+  if (chunk == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
   }
 
-  if (!conn->callbacks.recv_version_negotiation) {
-    return 0;
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+  if (strm == NULL) {
+    return NGTCP2_ERR_STREAM_NOT_FOUND;
   }
 
-  if (pktlen > sizeof(sv)) {
-    p = ngtcp2_mem_malloc(conn->mem, pktlen);
-    if (p == NULL) {
-      return NGTCP2_ERR_NOMEM;
-    }
-  } else {
-    p = sv;
+  ngtcp2_rob_set_chunk(&strm->rob, chunk, adaptive);
+
+  return 0;
+}
+
+/*
+ * conn_unsched_strm removes |strm| from the stream scheduler if it
+ * is there.
+ */
+static void conn_unsched_strm(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  if (strm->pe.index == NGTCP2_PQ_BAD_INDEX) {
+    return;
   }
 
-  nsv = ngtcp2_pkt_decode_version_negotiation(p, pkt, pktlen);
+  ngtcp2_pq_remove(&conn->tx_pq, &strm->pe);
+}
 
-  rv = conn->callbacks.recv_version_negotiation(conn, hd, sv, nsv,
-                                                conn->user_data);
+/*
+ * conn_write_ctrl_frames writes the flow control frames in frq to
+ * |ppe| as many as it can hold.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_write_ctrl_frames(ngtcp2_conn *conn, ngtcp2_ppe *ppe,
+                                  const ngtcp2_pkt_hd *hd,
+                                  ngtcp2_frame_chain ***ppfrc) {
+  int rv;
 
-  if (p != sv) {
-    ngtcp2_mem_free(conn->mem, p);
-  }
+  for (;;) {
+    conn_discard_frames(conn, &conn->frq);
+    if (ngtcp2_frame_queue_empty(&conn->frq)) {
+      return 0;
+    }
 
-  if (rv != 0) {
-    return NGTCP2_ERR_CALLBACK_FAILURE;
+    rv = conn_write_ctrl_frame(conn, ppe, hd, ppfrc, &conn->frq);
+    if (rv == NGTCP2_ERR_NOBUF) {
+      return 0;
+    }
+    if (rv != 0) {
+      return rv;
+    }
   }
+}
 
-  return 0;
+/*
+ * tx_credit returns the number of bytes which can be sent beyond
+ * |offset| under the flow control limit |max_offset|.
+ */
+static uint64_t tx_credit(uint64_t offset, uint64_t max_offset) {
+  return offset < max_offset ? max_offset - offset : 0;
 }
 
-static int conn_recv_cleartext(ngtcp2_conn *conn, uint8_t exptype,
-                               const uint8_t *pkt, size_t pktlen, int server,
-                               int initial, ngtcp2_tstamp ts) {
-  ssize_t nread;
-  ngtcp2_pkt_hd hd;
-  ngtcp2_frame fr;
+/*
+ * conn_write_pkt writes a protected packet in the buffer pointed by
+ * |dest| of length |destlen|.  The packet contains pending ACK, and
+ * STREAM frames of the streams chosen by the stream scheduler as long
+ * as the buffer allows.  ACK frame alone is written only if it is due
+ * (see conn_ack_expiry).  Lost STREAM frames are retransmitted before
+ * new data.  Each time a stream is served, its virtual finish time is
+ * advanced by the number of bytes it has consumed divided by its
+ * weight.  No frame other than ACK is written while bytes in flight
+ * is not less than congestion window, or the pacer holds the packet
+ * (see conn_cwnd_avail).  New stream data is limited by the flow
+ * control credit of the stream and the connection.  If a stream or
+ * the connection runs out of credit, STREAM_BLOCKED or BLOCKED frame
+ * is queued.  The queued flow control frames are written before the
+ * lost frames.  If the packet would carry ACK frame only, and too
+ * many such packets have been sent in a row, PING frame is added to
+ * have the packet acknowledged (see
+ * ngtcp2_acktr_require_ack_eliciting).  If |pad| is nonzero, and the
+ * packet has no room for another STREAM frame, the rest of the packet
+ * is filled with PADDING frames so that the packet is exactly
+ * |destlen| bytes long.
+ *
+ * This function returns the number of bytes written in |dest|, or 0
+ * if there is nothing to write.  Otherwise it returns one of the
+ * following negative error codes:
+ *
+ * NGTCP2_ERR_NOBUF
+ *     Buffer is too small
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static ssize_t conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                              int pad, ngtcp2_tstamp ts) {
   int rv;
-  int require_ack = 0;
-  uint64_t rx_offset;
+  ngtcp2_ppe ppe;
+  ngtcp2_pkt_hd hd;
+  ngtcp2_frame ackfr, fr;
+  ssize_t nwrite;
+  ngtcp2_crypto_ctx ctx;
+  ngtcp2_strm *strm;
+  const uint8_t *data;
+  size_t left, datalen, ndatalen;
+  uint64_t strm_credit, conn_credit;
+  ngtcp2_frame_chain *frc = NULL, **pfrc = &frc;
+  int cwnd_avail = conn_cwnd_avail(conn, ts);
+  int tx_avail;
+
+  conn_discard_frames(conn, &conn->frq);
+  conn_discard_frames(conn, &conn->rtb.lostq);
+
+  tx_avail = !ngtcp2_pq_empty(&conn->tx_pq);
+  if (tx_avail && conn->tx_offset >= conn->max_tx_offset) {
+    tx_avail = 0;
+    if (conn->tx_blocked_offset != conn->max_tx_offset) {
+      rv = conn_queue_ctrl_frame(conn, NGTCP2_FRAME_BLOCKED, 0);
+      if (rv != 0) {
+        return rv;
+      }
+      conn->tx_blocked_offset = conn->max_tx_offset;
+    }
+  }
 
-  if (!(pkt[0] & NGTCP2_HEADER_FORM_BIT)) {
-    return NGTCP2_ERR_PROTO;
+  tx_avail = cwnd_avail &&
+             (tx_avail || !ngtcp2_frame_queue_empty(&conn->frq) ||
+              !ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+
+  ackfr.type = 0;
+  rv = conn_create_ack_frame(conn, &ackfr.ack, tx_avail, ts);
+  if (rv != 0) {
+    return rv;
   }
 
-  nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
-  if (nread < 0) {
-    return (int)nread;
+  if (ackfr.type == 0 && !tx_avail) {
+    return 0;
   }
 
-  pkt += nread;
-  pktlen -= (size_t)nread;
+  /* TODO Choose appropriate packet number size */
+  ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID, NGTCP2_PKT_03, conn->conn_id,
+                     conn->next_tx_pkt_num, conn->version);
 
-  hd.pkt_num = ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num, 32);
+  ctx.ckm = conn->tx_ckm;
+  ctx.aead_overhead = conn->aead_overhead;
+  ctx.encrypt = conn->callbacks.encrypt;
+  ctx.user_data = conn;
 
-  rv = conn_call_recv_pkt(conn, &hd);
+  ngtcp2_ppe_init(&ppe, dest, destlen, &ctx, conn->mem);
+
+  rv = ngtcp2_ppe_encode_hd(&ppe, &hd);
   if (rv != 0) {
     return rv;
   }
 
-  if (!initial) {
-    if (conn->conn_id != hd.conn_id) {
-      return NGTCP2_ERR_PROTO;
-    }
-  } else if (!server) {
-    conn->conn_id = hd.conn_id;
+  rv = conn_call_send_pkt(conn, &hd);
+  if (rv != 0) {
+    return rv;
   }
 
-  if (!server && hd.type == NGTCP2_PKT_VERSION_NEGOTIATION) {
-    rv = conn_on_version_negotiation(conn, &hd, pkt, pktlen);
+  if (ackfr.type) {
+    rv = ngtcp2_ppe_encode_frame(&ppe, &ackfr);
     if (rv != 0) {
       return rv;
     }
-  }
 
-  if (exptype != hd.type) {
-    return NGTCP2_ERR_PROTO;
+    rv = conn_call_send_frame(conn, &hd, &ackfr);
+    if (rv != 0) {
+      return rv;
+    }
   }
 
-  if (conn->version != hd.version) {
-    return NGTCP2_ERR_PROTO;
+  if (cwnd_avail) {
+    rv = conn_write_ctrl_frames(conn, &ppe, &hd, &pfrc);
+    if (rv != 0) {
+      goto fail;
+    }
   }
 
-  for (; pktlen;) {
-    nread = ngtcp2_pkt_decode_frame(&fr, pkt, pktlen, conn->max_rx_pkt_num);
-    if (nread < 0) {
-      return (int)nread;
+  for (; cwnd_avail;) {
+    conn_discard_frames(conn, &conn->rtb.lostq);
+    if (ngtcp2_frame_queue_empty(&conn->rtb.lostq)) {
+      break;
     }
 
-    pkt += nread;
-    pktlen -= (size_t)nread;
-
-    rv = conn_call_recv_frame(conn, &hd, &fr);
-    if (rv != 0) {
-      return rv;
+    if (ngtcp2_frame_queue_top(&conn->rtb.lostq)->fr.type !=
+        NGTCP2_FRAME_STREAM) {
+      rv = conn_write_ctrl_frame(conn, &ppe, &hd, &pfrc, &conn->rtb.lostq);
+      if (rv == NGTCP2_ERR_NOBUF) {
+        break;
+      }
+      if (rv != 0) {
+        goto fail;
+      }
+      continue;
     }
 
-    /* We don't ack packet which contains ACK and CONNECTION_CLOSE
-       only. */
-    /* TODO What about packet with PADDING frames only? */
-    require_ack |=
-        fr.type != NGTCP2_FRAME_ACK && fr.type != NGTCP2_FRAME_CONNECTION_CLOSE;
+    rv = conn_pop_lost_frame(conn, pfrc, &conn->rtb.lostq,
+                             ngtcp2_ppe_left(&ppe));
+    if (rv == NGTCP2_ERR_NOBUF) {
+      break;
+    }
+    if (rv != 0) {
+      goto fail;
+    }
 
-    if (fr.type != NGTCP2_FRAME_STREAM || fr.stream.stream_id != 0 ||
-        fr.stream.datalen == 0) {
-      continue;
+    fr.stream = (*pfrc)->fr.stream;
+    pfrc = &(*pfrc)->next;
+
+    rv = ngtcp2_ppe_encode_frame(&ppe, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    rv = conn_call_send_frame(conn, &hd, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+  }
+
+  for (; cwnd_avail && !ngtcp2_pq_empty(&conn->tx_pq);) {
+    strm = ngtcp2_struct_of(ngtcp2_pq_top(&conn->tx_pq), ngtcp2_strm, pe);
+
+    datalen = ngtcp2_strm_txq_peek(strm, &data);
+
+    if (datalen) {
+      strm_credit = tx_credit(strm->tx_offset, strm->max_tx_offset);
+      if (strm_credit == 0) {
+        /* The stream is rescheduled when MAX_STREAM_DATA arrives. */
+        ngtcp2_pq_pop(&conn->tx_pq);
+        if (strm->tx_blocked_offset != strm->max_tx_offset) {
+          rv = conn_queue_ctrl_frame(conn, NGTCP2_FRAME_STREAM_BLOCKED,
+                                     strm->stream_id);
+          if (rv != 0) {
+            goto fail;
+          }
+          strm->tx_blocked_offset = strm->max_tx_offset;
+        }
+        continue;
+      }
+
+      conn_credit = tx_credit(conn->tx_offset, conn->max_tx_offset);
+      if (conn_credit == 0) {
+        break;
+      }
+
+      datalen = (size_t)ngtcp2_min(datalen,
+                                   ngtcp2_min(strm_credit, conn_credit));
+    }
+
+    left = ngtcp2_ppe_left(&ppe);
+    if (left < NGTCP2_STREAM_OVERHEAD + (datalen ? 1 : 0)) {
+      break;
+    }
+
+    /* Data Length field is 16 bits long */
+    ndatalen =
+        ngtcp2_min(ngtcp2_min(datalen, left - NGTCP2_STREAM_OVERHEAD), 0xffff);
+
+    fr.type = NGTCP2_FRAME_STREAM;
+    fr.stream.flags = 0;
+    fr.stream.fin = (strm->flags & NGTCP2_STRM_FLAG_TX_FIN) &&
+                    ndatalen == strm->txq_len;
+    fr.stream.stream_id = strm->stream_id;
+    fr.stream.offset = strm->tx_offset;
+    fr.stream.datalen = ndatalen;
+    fr.stream.data = data;
+
+    rv = ngtcp2_frame_chain_stream_new(pfrc, &fr.stream, conn->mem);
+    if (rv != 0) {
+      goto fail;
+    }
+    pfrc = &(*pfrc)->next;
+
+    rv = ngtcp2_ppe_encode_frame(&ppe, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    rv = conn_call_send_frame(conn, &hd, &fr);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    if (ndatalen) {
+      ngtcp2_strm_txq_pop(strm, ndatalen);
     }
+    strm->tx_offset += ndatalen;
+    conn->tx_offset += ndatalen;
 
-    rx_offset = ngtcp2_strm_rx_offset(&conn->strm0);
-    if (rx_offset >= fr.stream.offset + fr.stream.datalen) {
+    ngtcp2_pq_pop(&conn->tx_pq);
+
+    conn->last_cycle = strm->cycle;
+    strm->cycle += (ndatalen + NGTCP2_STREAM_OVERHEAD) * NGTCP2_MAX_WEIGHT /
+                   strm->weight;
+
+    if (fr.stream.fin) {
+      ngtcp2_strm_shutdown(strm, NGTCP2_STRM_FLAG_SHUT_WR);
       continue;
     }
 
-    /* TODO Refused to receive stream data which is more than 128KiB
-       for now.  We can ditch this if flow control is implemented. */
-    if (fr.stream.offset > 128 * 1024) {
-      return NGTCP2_ERR_INTERNAL;
+    if (strm->txq_len) {
+      rv = ngtcp2_pq_push(&conn->tx_pq, &strm->pe);
+      if (rv != 0) {
+        goto fail;
+      }
     }
+  }
 
-    if (fr.stream.offset <= rx_offset) {
-      size_t ncut = (rx_offset - fr.stream.offset);
-      const uint8_t *data = fr.stream.data + ncut;
-      size_t datalen = fr.stream.datalen - ncut;
+  /* STREAM_BLOCKED frames queued above */
+  if (cwnd_avail) {
+    rv = conn_write_ctrl_frames(conn, &ppe, &hd, &pfrc);
+    if (rv != 0) {
+      goto fail;
+    }
+  }
 
-      ngtcp2_rob_remove_prefix(&conn->strm0.rob, rx_offset + datalen);
+  /* The packet which only carries ACK frame is not acknowledged.
+     Make it ack-eliciting once in a while, so that the ranges which
+     the remote endpoint has seen can be forgotten. */
+  if (ackfr.type && frc == NULL && cwnd_avail &&
+      ngtcp2_acktr_require_ack_eliciting(&conn->acktr)) {
+    fr.type = NGTCP2_FRAME_PING;
 
-      rv = conn->callbacks.recv_handshake_data(conn, data, datalen,
-                                               conn->user_data);
+    rv = ngtcp2_ppe_encode_frame(&ppe, &fr);
+    if (rv != 0 && rv != NGTCP2_ERR_NOBUF) {
+      return rv;
+    }
+    if (rv == 0) {
+      rv = ngtcp2_frame_chain_new(pfrc, conn->mem);
       if (rv != 0) {
         return rv;
       }
+      (*pfrc)->fr.ping = fr.ping;
 
-      rv = ngtcp2_conn_emit_pending_recv_handshake(conn, &conn->strm0,
-                                                   rx_offset + datalen);
+      rv = conn_call_send_frame(conn, &hd, &fr);
       if (rv != 0) {
-        return rv;
+        goto fail;
       }
-    } else {
-      rv = ngtcp2_strm_recv_reordering(&conn->strm0, &fr.stream);
+    }
+  }
+
+  if (ackfr.type == 0 && frc == NULL) {
+    return NGTCP2_ERR_NOBUF;
+  }
+
+  if (pad && frc && ngtcp2_ppe_left(&ppe) < NGTCP2_STREAM_OVERHEAD + 1) {
+    fr.type = NGTCP2_FRAME_PADDING;
+    fr.padding.len = ngtcp2_ppe_padding(&ppe);
+    if (fr.padding.len > 0) {
+      rv = conn_call_send_frame(conn, &hd, &fr);
+      if (rv != 0) {
+        goto fail;
+      }
+    }
+  }
+
+  nwrite = ngtcp2_ppe_final(&ppe, NULL);
+  if (nwrite < 0) {
+    rv = (int)nwrite;
+    goto fail;
+  }
+
+  if (ackfr.type) {
+    ngtcp2_acktr_add_ack(&conn->acktr, hd.pkt_num, ackfr.ack.largest_ack,
+                         frc != NULL);
+  }
+
+  if (frc) {
+    rv = conn_on_pkt_sent(conn, hd.pkt_num, (size_t)nwrite, frc, ts);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  ++conn->next_tx_pkt_num;
+
+  return nwrite;
+
+fail:
+  ngtcp2_frame_chain_list_del(frc, conn->mem);
+
+  return rv;
+}
+
+ssize_t ngtcp2_conn_send(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                         ngtcp2_tstamp ts) {
+  ssize_t nwrite = 0;
+  int rv;
+
+  switch (conn->state) {
+  case NGTCP2_CS_CLIENT_INITIAL:
+    nwrite = conn_send_client_initial(conn, dest, destlen, ts);
+    if (nwrite < 0) {
+      break;
+    }
+    conn->state = NGTCP2_CS_CLIENT_CI_SENT;
+    break;
+  case NGTCP2_CS_CLIENT_CI_SENT:
+    nwrite = conn_retransmit_handshake_pkt(conn, dest, destlen,
+                                           NGTCP2_PKT_CLIENT_INITIAL, ts);
+    break;
+  case NGTCP2_CS_CLIENT_SC_RECVED:
+    nwrite = conn_send_client_cleartext(conn, dest, destlen, ts);
+    if (nwrite < 0) {
+      break;
+    }
+    if (conn->handshake_completed) {
+      rv = conn_call_handshake_completed(conn);
       if (rv != 0) {
         return rv;
       }
+      conn->state = NGTCP2_CS_POST_HANDSHAKE;
+    }
+    break;
+  case NGTCP2_CS_SERVER_CI_RECVED:
+    nwrite = conn_send_server_cleartext(conn, dest, destlen, 1, ts);
+    if (nwrite < 0) {
+      break;
+    }
+    conn->state = NGTCP2_CS_SERVER_SC_SENT;
+    break;
+  case NGTCP2_CS_SERVER_SC_SENT:
+    nwrite = conn_send_server_cleartext(conn, dest, destlen, 0, ts);
+    if (nwrite < 0) {
+      break;
+    }
+    break;
+  case NGTCP2_CS_POST_HANDSHAKE:
+    nwrite = conn_retransmit_handshake_pkt(
+        conn, dest, destlen,
+        conn->server ? NGTCP2_PKT_SERVER_CLEARTEXT : NGTCP2_PKT_CLIENT_CLEARTEXT,
+        ts);
+    if (nwrite != 0) {
+      break;
     }
+    nwrite = conn_write_pkt(conn, dest, destlen, 0, ts);
+    break;
   }
 
-  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd.pkt_num);
+  return nwrite;
+}
+
+static int conn_on_version_negotiation(ngtcp2_conn *conn,
+                                       const ngtcp2_pkt_hd *hd,
+                                       const uint8_t *pkt, size_t pktlen) {
+  uint32_t sv[16];
+  uint32_t *p;
+  int rv;
+  size_t nsv;
+
+  if (pktlen % sizeof(uint32_t)) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  if (!conn->callbacks.recv_version_negotiation) {
+    return 0;
+  }
+
+  if (pktlen > sizeof(sv)) {
+    p = ngtcp2_mem_malloc(conn->mem, pktlen);
+    if (p == NULL) {
+      return NGTCP2_ERR_NOMEM;
+    }
+  } else {
+    p = sv;
+  }
+
+  nsv = ngtcp2_pkt_decode_version_negotiation(p, pkt, pktlen);
+
+  rv = conn->callbacks.recv_version_negotiation(conn, hd, sv, nsv,
+                                                conn->user_data);
+
+  if (p != sv) {
+    ngtcp2_mem_free(conn->mem, p);
+  }
+
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+/*
+ * conn_local_stream returns nonzero if |stream_id| denotes the stream
+ * initiated by the local endpoint.  Client initiates odd numbered
+ * streams, and server initiates even numbered streams.  Stream 0 is
+ * not considered to be initiated by either endpoint.
+ */
+static int conn_local_stream(ngtcp2_conn *conn, uint32_t stream_id) {
+  return stream_id != 0 && (stream_id & 1) == (conn->server ? 0 : 1);
+}
+
+/*
+ * conn_on_stream_data_acked marks the data of STREAM frame |fr|
+ * acknowledged.  If the data acknowledged from the beginning of the
+ * stream grows, it calls acked_stream_data_offset callback.  The
+ * stream is closed if it is shut down in both directions, and all
+ * data is acknowledged.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_on_stream_data_acked(ngtcp2_conn *conn,
+                                     const ngtcp2_stream *fr) {
+  int rv;
+  ngtcp2_strm *strm;
+  uint64_t prev_offset, offset;
+
+  if (fr->stream_id == 0) {
+    return 0;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, fr->stream_id);
+  if (strm == NULL) {
+    return 0;
+  }
+
+  prev_offset = ngtcp2_gaptr_first_gap_offset(&strm->acked_tx_offset);
+
+  rv = ngtcp2_gaptr_push(&strm->acked_tx_offset, fr->offset, fr->datalen);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (fr->fin) {
+    strm->flags |= NGTCP2_STRM_FLAG_FIN_ACKED;
+  }
+
+  offset = ngtcp2_gaptr_first_gap_offset(&strm->acked_tx_offset);
+  if (offset > prev_offset) {
+    rv = conn_call_acked_stream_data_offset(conn, strm, prev_offset,
+                                            offset - prev_offset);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return ngtcp2_conn_close_stream_if_shut_rdwr(conn, strm);
+}
+
+/*
+ * conn_recv_ack processes ACK frame |fr| received at |ts|.  The
+ * acknowledged packets are removed from the sent packets, and the
+ * congestion controller is notified of the acknowledgement and loss.
+ * The application is notified of the acknowledged stream data.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_PROTO
+ *     ACK frame acknowledges a packet which has not been sent.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_recv_ack(ngtcp2_conn *conn, const ngtcp2_ack *fr,
+                         ngtcp2_tstamp ts) {
+  int rv;
+  ngtcp2_frame_queue *q = &conn->rtb.ackedq;
+  ngtcp2_frame_chain *frc;
+
+  if (fr->largest_ack >= conn->next_tx_pkt_num) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  rv = ngtcp2_rtb_recv_ack(&conn->rtb, fr, conn->cc, &conn->ccs, ts);
+  if (rv != 0) {
+    return rv;
+  }
 
-  if (require_ack) {
-    rv = ngtcp2_conn_sched_ack(conn, hd.pkt_num, ts);
+  ngtcp2_acktr_recv_ack(&conn->acktr, fr);
+
+  for (; !ngtcp2_frame_queue_empty(q);) {
+    frc = ngtcp2_frame_queue_top(q);
+    ngtcp2_frame_queue_pop(q);
+
+    if (frc->fr.type == NGTCP2_FRAME_STREAM) {
+      rv = conn_on_stream_data_acked(conn, &frc->fr.stream);
+    } else {
+      rv = 0;
+    }
+    ngtcp2_frame_chain_del(frc, conn->mem);
     if (rv != 0) {
       return rv;
     }
@@ -762,322 +1876,1421 @@ static int conn_recv_cleartext(ngtcp2_conn *conn, uint8_t exptype,
   return 0;
 }
 
-static ssize_t conn_decrypt_packet(ngtcp2_conn *conn, uint8_t *dest,
-                                   size_t destlen, const uint8_t *pkt,
-                                   size_t pktlen, const uint8_t *ad,
-                                   size_t adlen, uint64_t pkt_num) {
-  uint8_t nonce[64];
-  ngtcp2_crypto_km *ckm = conn->rx_ckm;
-  ssize_t nwrite;
+/*
+ * conn_tune_window doubles the receive window |*pwindow| up to
+ * |max_window| if the previous window update, which happened at
+ * |*pts|, was less than 2 RTTs before |ts|.  It means that the
+ * application consumes data as fast as the window allows, and the
+ * window limits the throughput.  |*pts| is updated to |ts|.
+ */
+static void conn_tune_window(ngtcp2_conn *conn, uint64_t *pwindow,
+                             ngtcp2_tstamp *pts, uint64_t max_window,
+                             ngtcp2_tstamp ts) {
+  if (*pts != UINT64_MAX && conn->ccs.min_rtt != UINT64_MAX &&
+      ts - *pts < 2 * conn->ccs.smoothed_rtt) {
+    *pwindow = ngtcp2_min(*pwindow * 2, max_window);
+  }
 
-  assert(sizeof(nonce) >= ckm->ivlen);
+  *pts = ts;
+}
+
+/*
+ * conn_update_rx_window extends the flow control limits of |strm|
+ * and the connection after stream data is delivered at |ts|.  The
+ * limit is extended by the receive window beyond the data consumed
+ * when less than half of the window is left, and MAX_STREAM_DATA or
+ * MAX_DATA frame is queued.  The limit of stream 0 simply slides
+ * along with the data consumed, and is not advertised.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_update_rx_window(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                 ngtcp2_tstamp ts) {
+  int rv;
+  uint64_t consumed = ngtcp2_strm_rx_offset(strm);
+
+  if (strm->stream_id == 0) {
+    strm->max_rx_offset = consumed + strm->rx_window;
+    return 0;
+  }
+
+  if (!(strm->flags & NGTCP2_STRM_FLAG_RECV_FIN) &&
+      strm->max_rx_offset - consumed <= strm->rx_window / 2) {
+    conn_tune_window(conn, &strm->rx_window, &strm->rx_window_ts,
+                     conn->max_stream_rx_window, ts);
+    strm->max_rx_offset = consumed + strm->rx_window;
+
+    /* The connection window must be larger than the stream window,
+       or a single stream is throttled by it. */
+    conn->rx_window = ngtcp2_max(
+        conn->rx_window,
+        ngtcp2_min(strm->rx_window + strm->rx_window / 2, conn->max_rx_window));
+
+    if (!(strm->flags & NGTCP2_STRM_FLAG_MAX_STREAM_DATA_PENDING)) {
+      rv = conn_queue_ctrl_frame(conn, NGTCP2_FRAME_MAX_STREAM_DATA,
+                                 strm->stream_id);
+      if (rv != 0) {
+        return rv;
+      }
+      strm->flags |= NGTCP2_STRM_FLAG_MAX_STREAM_DATA_PENDING;
+    }
+  }
+
+  if (conn->max_rx_offset - conn->rx_delivered <= conn->rx_window / 2) {
+    conn_tune_window(conn, &conn->rx_window, &conn->rx_window_ts,
+                     conn->max_rx_window, ts);
+    conn->max_rx_offset = conn->rx_delivered + conn->rx_window;
+
+    if (!conn->max_data_pending) {
+      rv = conn_queue_ctrl_frame(conn, NGTCP2_FRAME_MAX_DATA, 0);
+      if (rv != 0) {
+        return rv;
+      }
+      conn->max_data_pending = 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * conn_rx_buffer_allowed returns nonzero if |conn| can buffer
+ * |datalen| bytes of out-of-order data of |strm| without exceeding
+ * its memory budget.  The reassembly buffer might need a new chunk
+ * for each end of the data.  If the budget is short, the large
+ * buffers kept in the pool are released first.
+ */
+static int conn_rx_buffer_allowed(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                  size_t datalen) {
+  size_t usage, need = datalen + 2 * strm->rob.chunk;
+
+  if (conn->max_mem == 0) {
+    return 1;
+  }
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+  if (usage <= conn->max_mem && conn->max_mem - usage >= need) {
+    return 1;
+  }
+
+  if (conn->pool.nlarge == 0) {
+    return 0;
+  }
+
+  ngtcp2_mem_pool_trim(&conn->pool);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  return usage <= conn->max_mem && conn->max_mem - usage >= need;
+}
+
+/*
+ * conn_open_remote_streams opens the streams initiated by the remote
+ * endpoint up to |stream_id|, which have not been opened yet.  The
+ * remote endpoint opens its streams in order, and sending a frame on
+ * a stream implicitly opens the streams with smaller ID.  It returns
+ * the stream identified by |stream_id| in |*pstrm|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_PROTO
+ *     |stream_id| exceeds max_remote_stream_id.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_open_remote_streams(ngtcp2_conn *conn, ngtcp2_strm **pstrm,
+                                    uint32_t stream_id) {
+  int rv;
+  ngtcp2_strm *strm = NULL;
+  uint32_t id;
+
+  if (stream_id > conn->max_remote_stream_id) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  if (conn->last_remote_stream_id == 0) {
+    id = conn->server ? 1 : 2;
+  } else {
+    id = conn->last_remote_stream_id + 2;
+  }
+
+  for (; id <= stream_id; id += 2) {
+    strm = ngtcp2_mem_malloc(conn->mem, sizeof(ngtcp2_strm));
+    if (strm == NULL) {
+      return NGTCP2_ERR_NOMEM;
+    }
+
+    rv = ngtcp2_conn_init_stream(conn, strm, id, NULL);
+    if (rv != 0) {
+      ngtcp2_mem_free(conn->mem, strm);
+      return rv;
+    }
+
+    conn->last_remote_stream_id = id;
+  }
+
+  *pstrm = strm;
+
+  return 0;
+}
+
+/*
+ * conn_recv_stream handles STREAM frame |fr| received at |ts|.  If
+ * the stream has not been opened yet, and it is initiated by the
+ * remote endpoint, it is opened implicitly along with the streams of
+ * the remote endpoint with smaller ID.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_PROTO
+ *     STREAM frame is not allowed, or the final offset is violated.
+ * NGTCP2_ERR_FLOW_CONTROL
+ *     STREAM frame exceeds the flow control limit of the stream or
+ *     the connection.
+ * NGTCP2_ERR_MEM_LIMIT
+ *     Buffering out-of-order data exceeds the memory budget.  The
+ *     packet must be discarded without being acknowledged.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_recv_stream(ngtcp2_conn *conn, const ngtcp2_stream *fr,
+                            ngtcp2_tstamp ts) {
+  int rv;
+  ngtcp2_strm *strm;
+  uint64_t rx_offset, fr_end_offset;
+
+  if (fr->datalen == 0 && !fr->fin) {
+    return 0;
+  }
+
+  if (fr->stream_id == 0 && fr->fin) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, fr->stream_id);
+  if (strm == NULL) {
+    if (conn_local_stream(conn, fr->stream_id)) {
+      if (fr->stream_id >= conn->next_local_stream_id) {
+        return NGTCP2_ERR_PROTO;
+      }
+      /* The stream has been closed. */
+      return 0;
+    }
+
+    /* All streams up to last_remote_stream_id have been opened, and
+       the stream which is not found has been closed. */
+    if (fr->stream_id <= conn->last_remote_stream_id) {
+      return 0;
+    }
+
+    rv = conn_open_remote_streams(conn, &strm, fr->stream_id);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  if (strm->flags & NGTCP2_STRM_FLAG_SHUT_RD) {
+    return 0;
+  }
+
+  if (strm->max_rx_offset < fr->datalen ||
+      fr->offset > strm->max_rx_offset - fr->datalen) {
+    return NGTCP2_ERR_FLOW_CONTROL;
+  }
+
+  fr_end_offset = fr->offset + fr->datalen;
+
+  if (strm->rx_high_offset < fr_end_offset) {
+    if (fr->stream_id != 0) {
+      if (conn->max_rx_offset - conn->rx_offset <
+          fr_end_offset - strm->rx_high_offset) {
+        return NGTCP2_ERR_FLOW_CONTROL;
+      }
+      conn->rx_offset += fr_end_offset - strm->rx_high_offset;
+    }
+    strm->rx_high_offset = fr_end_offset;
+  }
+
+  if (strm->flags & NGTCP2_STRM_FLAG_RECV_FIN) {
+    if (fr_end_offset > strm->last_rx_offset ||
+        (fr->fin && fr_end_offset != strm->last_rx_offset)) {
+      return NGTCP2_ERR_PROTO;
+    }
+  } else if (fr->fin) {
+    strm->flags |= NGTCP2_STRM_FLAG_RECV_FIN;
+    strm->last_rx_offset = fr_end_offset;
+  }
+
+  rx_offset = ngtcp2_strm_rx_offset(strm);
+
+  if (rx_offset < fr_end_offset) {
+    if (fr->offset <= rx_offset) {
+      size_t ncut = (size_t)(rx_offset - fr->offset);
+      const uint8_t *data = fr->data + ncut;
+      size_t datalen = fr->datalen - ncut;
+      uint8_t fin = (strm->flags & NGTCP2_STRM_FLAG_RECV_FIN) &&
+                    rx_offset + datalen == strm->last_rx_offset;
+
+      ngtcp2_rob_remove_prefix(&strm->rob, rx_offset + datalen);
+
+      rv = conn_call_recv_stream_data(conn, strm, fin, data, datalen);
+      if (rv != 0) {
+        return rv;
+      }
+
+      rv = ngtcp2_conn_emit_pending_recv_stream(conn, strm,
+                                                rx_offset + datalen);
+      if (rv != 0) {
+        return rv;
+      }
+
+      rv = conn_update_rx_window(conn, strm, ts);
+      if (rv != 0) {
+        return rv;
+      }
+    } else {
+      if (!conn_rx_buffer_allowed(conn, strm, fr->datalen)) {
+        return NGTCP2_ERR_MEM_LIMIT;
+      }
+
+      rv = ngtcp2_strm_recv_reordering(strm, fr, conn->rx_rcbuf);
+      if (rv != 0) {
+        return rv;
+      }
+    }
+  }
+
+  /* fin might be received by the empty STREAM frame. */
+  if ((strm->flags & NGTCP2_STRM_FLAG_RECV_FIN) &&
+      !(strm->flags & NGTCP2_STRM_FLAG_SHUT_RD) &&
+      ngtcp2_strm_rx_offset(strm) == strm->last_rx_offset) {
+    rv = conn_call_recv_stream_data(conn, strm, 1, NULL, 0);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return ngtcp2_conn_close_stream_if_shut_rdwr(conn, strm);
+}
+
+/*
+ * conn_recv_rst_stream handles RST_STREAM frame |fr|.  The stream is
+ * closed immediately.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_PROTO
+ *     RST_STREAM frame is not allowed.
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+static int conn_recv_rst_stream(ngtcp2_conn *conn,
+                                const ngtcp2_rst_stream *fr) {
+  ngtcp2_strm *strm;
+
+  if (fr->stream_id == 0) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, fr->stream_id);
+  if (strm == NULL) {
+    if (conn_local_stream(conn, fr->stream_id)) {
+      if (fr->stream_id >= conn->next_local_stream_id) {
+        return NGTCP2_ERR_PROTO;
+      }
+    } else if (fr->stream_id > conn->max_remote_stream_id) {
+      return NGTCP2_ERR_PROTO;
+    }
+    return 0;
+  }
+
+  return ngtcp2_conn_close_stream(conn, strm, fr->error_code);
+}
+
+/*
+ * conn_recv_max_data handles MAX_DATA frame |fr|.  The limit never
+ * shrinks.
+ */
+static void conn_recv_max_data(ngtcp2_conn *conn, const ngtcp2_max_data *fr) {
+  uint64_t max_tx_offset;
+
+  if (fr->max_data > UINT64_MAX / NGTCP2_MAX_DATA_UNIT) {
+    max_tx_offset = UINT64_MAX;
+  } else {
+    max_tx_offset = fr->max_data * NGTCP2_MAX_DATA_UNIT;
+  }
+
+  conn->max_tx_offset = ngtcp2_max(conn->max_tx_offset, max_tx_offset);
+}
+
+/*
+ * conn_resched_strm puts |strm| back in the stream scheduler if it
+ * has data or fin to send.  It is used when the flow control credit
+ * of |strm| is extended.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_resched_strm(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  if (strm->txq_len == 0 && (!(strm->flags & NGTCP2_STRM_FLAG_TX_FIN) ||
+                             (strm->flags & NGTCP2_STRM_FLAG_SHUT_WR))) {
+    return 0;
+  }
+
+  return conn_sched_strm(conn, strm);
+}
+
+/*
+ * conn_recv_max_stream_data handles MAX_STREAM_DATA frame |fr|.  The
+ * limit never shrinks.  Stream 0 is not subject to flow control on
+ * sending side, and the frame for it is ignored.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_recv_max_stream_data(ngtcp2_conn *conn,
+                                     const ngtcp2_max_stream_data *fr) {
+  ngtcp2_strm *strm;
+
+  if (fr->stream_id == 0) {
+    return 0;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, fr->stream_id);
+  if (strm == NULL || strm->max_tx_offset >= fr->max_stream_data) {
+    return 0;
+  }
+
+  strm->max_tx_offset = fr->max_stream_data;
+
+  return conn_resched_strm(conn, strm);
+}
+
+/*
+ * conn_skip_frame returns nonzero if the frame of type |type| does not
+ * have to be decoded, because neither the library nor the application
+ * looks at it.  |cleartext| is nonzero if the frame is included in
+ * cleartext packet, where only ACK and STREAM frames are processed.
+ */
+static int conn_skip_frame(ngtcp2_conn *conn, uint8_t type, int cleartext) {
+  if (conn->callbacks.recv_frame) {
+    return 0;
+  }
+
+  switch (type) {
+  case NGTCP2_FRAME_ACK:
+  case NGTCP2_FRAME_STREAM:
+    return 0;
+  case NGTCP2_FRAME_RST_STREAM:
+  case NGTCP2_FRAME_MAX_DATA:
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    return cleartext;
+  default:
+    return 1;
+  }
+}
+
+static int conn_recv_cleartext(ngtcp2_conn *conn, uint8_t exptype,
+                               const uint8_t *pkt, size_t pktlen, int server,
+                               int initial, ngtcp2_tstamp ts) {
+  ssize_t nread;
+  ngtcp2_pkt_hd hd;
+  ngtcp2_frame_iter it;
+  ngtcp2_frame_view fv;
+  ngtcp2_frame fr;
+  int rv;
+  int require_ack = 0;
+  int ci_retransmitted;
+
+  if (!(pkt[0] & NGTCP2_HEADER_FORM_BIT)) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
+  if (nread < 0) {
+    return (int)nread;
+  }
+
+  pkt += nread;
+  pktlen -= (size_t)nread;
+
+  hd.pkt_num = ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num, 32);
+
+  rv = conn_call_recv_pkt(conn, &hd);
+  if (rv != 0) {
+    return rv;
+  }
+
+  /* Client retransmits Client Initial if it has not received Server
+     Cleartext.  It still carries the connection ID chosen by
+     client. */
+  ci_retransmitted = server && !initial && hd.type == NGTCP2_PKT_CLIENT_INITIAL;
+
+  if (!initial) {
+    if (conn->conn_id != hd.conn_id && !ci_retransmitted) {
+      return NGTCP2_ERR_PROTO;
+    }
+  } else if (!server) {
+    conn->conn_id = hd.conn_id;
+  }
+
+  if (!server && hd.type == NGTCP2_PKT_VERSION_NEGOTIATION) {
+    rv = conn_on_version_negotiation(conn, &hd, pkt, pktlen);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  if (exptype != hd.type && !ci_retransmitted) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  if (conn->version != hd.version) {
+    return NGTCP2_ERR_PROTO;
+  }
+
+  ngtcp2_frame_iter_init(&it, pkt, pktlen);
+
+  for (;;) {
+    nread = ngtcp2_frame_iter_next(&it, &fv);
+    if (nread < 0) {
+      return (int)nread;
+    }
+    if (nread == 0) {
+      break;
+    }
+
+    /* We don't ack packet which contains ACK and CONNECTION_CLOSE
+       only. */
+    /* TODO What about packet with PADDING frames only? */
+    require_ack |=
+        fv.type != NGTCP2_FRAME_ACK && fv.type != NGTCP2_FRAME_CONNECTION_CLOSE;
+
+    if (conn_skip_frame(conn, fv.type, 1)) {
+      continue;
+    }
+
+    nread = ngtcp2_pkt_decode_frame(&fr, conn->rx_ack_blks, fv.data,
+                                    fv.datalen, conn->max_rx_pkt_num);
+    if (nread < 0) {
+      return (int)nread;
+    }
+
+    rv = conn_call_recv_frame(conn, &hd, &fr);
+    if (rv != 0) {
+      return rv;
+    }
+
+    if (fr.type == NGTCP2_FRAME_ACK) {
+      rv = conn_recv_ack(conn, &fr.ack, ts);
+      if (rv != 0) {
+        return rv;
+      }
+      continue;
+    }
+
+    /* Only stream 0 is allowed in cleartext packets. */
+    if (fr.type != NGTCP2_FRAME_STREAM || fr.stream.stream_id != 0) {
+      continue;
+    }
+
+    rv = conn_recv_stream(conn, &fr.stream, ts);
+    if (rv == NGTCP2_ERR_MEM_LIMIT) {
+      /* The peer retransmits the data later. */
+      return 0;
+    }
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd.pkt_num);
+
+  rv = ngtcp2_conn_sched_ack(conn, hd.pkt_num, require_ack, ts);
+  if (rv != 0) {
+    return rv;
+  }
+
+  return 0;
+}
+
+static ssize_t conn_decrypt_packet(ngtcp2_conn *conn, uint8_t *dest,
+                                   size_t destlen, const uint8_t *pkt,
+                                   size_t pktlen, const uint8_t *ad,
+                                   size_t adlen, uint64_t pkt_num) {
+  uint8_t nonce[64];
+  ngtcp2_crypto_km *ckm = conn->rx_ckm;
+  ssize_t nwrite;
+
+  assert(sizeof(nonce) >= ckm->ivlen);
+
+  ngtcp2_crypto_create_nonce(nonce, ckm->iv, ckm->ivlen, pkt_num);
+
+  nwrite = conn->callbacks.decrypt(conn, dest, destlen, pkt, pktlen, ckm->key,
+                                   ckm->keylen, nonce, ckm->ivlen, ad, adlen,
+                                   conn->user_data);
+
+  if (nwrite < 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return nwrite;
+}
+
+static int conn_recv_packet(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
+                            ngtcp2_tstamp ts) {
+  ngtcp2_pkt_hd hd;
+  size_t pkt_num_bits;
+  int encrypted = 0;
+  int rv = 0;
+  const uint8_t *hdpkt = pkt;
+  ssize_t nread, nwrite;
+  ngtcp2_frame_iter it;
+  ngtcp2_frame_view fv;
+  ngtcp2_frame fr;
+  int require_ack = 0;
+
+  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
+    nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
+  } else {
+    nread = ngtcp2_pkt_decode_hd_short(&hd, pkt, pktlen);
+  }
+  if (nread < 0) {
+    return (int)nread;
+  }
+
+  pkt += nread;
+  pktlen -= (size_t)nread;
+
+  if (hd.flags & NGTCP2_PKT_FLAG_LONG_FORM) {
+    pkt_num_bits = 32;
+    if (hd.type == NGTCP2_PKT_1RTT_PROTECTED_K0) {
+      encrypted = 1;
+    }
+  } else {
+    switch (hd.type) {
+    case NGTCP2_PKT_01:
+      pkt_num_bits = 8;
+      break;
+    case NGTCP2_PKT_02:
+      pkt_num_bits = 16;
+      break;
+    case NGTCP2_PKT_03:
+      pkt_num_bits = 32;
+      break;
+    default:
+      assert(0);
+    }
+    if (!(hd.flags & NGTCP2_PKT_FLAG_KEY_PHASE)) {
+      encrypted = 1;
+    }
+  }
+
+  hd.pkt_num =
+      ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num, pkt_num_bits);
+
+  rv = conn_call_recv_pkt(conn, &hd);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (encrypted) {
+    nwrite = conn_decrypt_packet(conn, pkt, pktlen, pkt, pktlen, hdpkt,
+                                 (size_t)nread, hd.pkt_num);
+    if (nwrite < 0) {
+      return (int)nwrite;
+    }
+    pktlen = (size_t)nwrite;
+  }
+
+  ngtcp2_frame_iter_init(&it, pkt, pktlen);
+
+  for (;;) {
+    nread = ngtcp2_frame_iter_next(&it, &fv);
+    if (nread < 0) {
+      return (int)nread;
+    }
+    if (nread == 0) {
+      break;
+    }
+
+    /* We don't ack packet which contains ACK and CONNECTION_CLOSE
+       only. */
+    /* TODO What about packet with PADDING frames only? */
+    require_ack |=
+        fv.type != NGTCP2_FRAME_ACK && fv.type != NGTCP2_FRAME_CONNECTION_CLOSE;
+
+    if (conn_skip_frame(conn, fv.type, 0)) {
+      continue;
+    }
+
+    nread = ngtcp2_pkt_decode_frame(&fr, conn->rx_ack_blks, fv.data,
+                                    fv.datalen, conn->max_rx_pkt_num);
+    if (nread < 0) {
+      return (int)nread;
+    }
+
+    rv = conn_call_recv_frame(conn, &hd, &fr);
+    if (rv != 0) {
+      return rv;
+    }
+
+    switch (fr.type) {
+    case NGTCP2_FRAME_ACK:
+      rv = conn_recv_ack(conn, &fr.ack, ts);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_STREAM:
+      rv = conn_recv_stream(conn, &fr.stream, ts);
+      if (rv == NGTCP2_ERR_MEM_LIMIT) {
+        /* The peer retransmits the data later. */
+        return 0;
+      }
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_RST_STREAM:
+      rv = conn_recv_rst_stream(conn, &fr.rst_stream);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_MAX_DATA:
+      conn_recv_max_data(conn, &fr.max_data);
+      break;
+    case NGTCP2_FRAME_MAX_STREAM_DATA:
+      rv = conn_recv_max_stream_data(conn, &fr.max_stream_data);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    }
+  }
+
+  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd.pkt_num);
+
+  rv = ngtcp2_conn_sched_ack(conn, hd.pkt_num, require_ack, ts);
+  if (rv != 0) {
+    return rv;
+  }
+
+  return 0;
+}
+
+/*
+ * conn_recv is the implementation of ngtcp2_conn_recv and
+ * ngtcp2_conn_recv_ref except for the check of the memory budget.
+ */
+static int conn_recv(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
+                     ngtcp2_tstamp ts) {
+  int rv = 0;
+
+  if (pktlen == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
+    if (ngtcp2_pkt_verify(pkt, pktlen) != 0) {
+      return NGTCP2_ERR_BAD_PKT_HASH;
+    }
+    pktlen -= NGTCP2_PKT_MDLEN;
+  }
+
+  switch (conn->state) {
+  case NGTCP2_CS_CLIENT_CI_SENT:
+    /* TODO Handle Version Negotiation */
+    rv = conn_recv_cleartext(conn, NGTCP2_PKT_SERVER_CLEARTEXT, pkt, pktlen, 0,
+                             1, ts);
+    if (rv < 0) {
+      break;
+    }
+    conn->state = NGTCP2_CS_CLIENT_SC_RECVED;
+    break;
+  case NGTCP2_CS_CLIENT_SC_RECVED:
+    rv = conn_recv_cleartext(conn, NGTCP2_PKT_SERVER_CLEARTEXT, pkt, pktlen, 0,
+                             0, ts);
+    if (rv < 0) {
+      break;
+    }
+    break;
+  case NGTCP2_CS_SERVER_INITIAL:
+    rv = conn_recv_cleartext(conn, NGTCP2_PKT_CLIENT_INITIAL, pkt, pktlen, 1, 1,
+                             ts);
+    if (rv < 0) {
+      break;
+    }
+    if (ngtcp2_strm_rx_offset(conn->strm0) == 0) {
+      return NGTCP2_ERR_PROTO;
+    }
+    conn->state = NGTCP2_CS_SERVER_CI_RECVED;
+    break;
+  case NGTCP2_CS_SERVER_SC_SENT:
+    rv = conn_recv_cleartext(conn, NGTCP2_PKT_CLIENT_CLEARTEXT, pkt, pktlen, 1,
+                             0, ts);
+    if (rv < 0) {
+      break;
+    }
+    if (conn->handshake_completed) {
+      rv = conn_call_handshake_completed(conn);
+      if (rv != 0) {
+        return rv;
+      }
+      conn->state = NGTCP2_CS_POST_HANDSHAKE;
+    }
+    break;
+  case NGTCP2_CS_POST_HANDSHAKE:
+  case NGTCP2_CS_CLOSE_WAIT:
+    rv = conn_recv_packet(conn, pkt, pktlen, ts);
+    if (rv < 0) {
+      break;
+    }
+    break;
+  }
+
+  if (rv != 0) {
+    return rv;
+  }
+
+  conn->idle_ts = ts;
+  conn->restart_idle = 1;
+
+  return 0;
+}
+
+/*
+ * conn_check_mem_limit returns NGTCP2_ERR_MEM_LIMIT if |conn| uses
+ * more memory than its budget.  Otherwise it returns 0.
+ */
+static int conn_check_mem_limit(ngtcp2_conn *conn) {
+  if (conn->max_mem && ngtcp2_conn_get_mem_usage(conn) > conn->max_mem) {
+    return NGTCP2_ERR_MEM_LIMIT;
+  }
+
+  return 0;
+}
+
+int ngtcp2_conn_recv(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
+                     ngtcp2_tstamp ts) {
+  int rv;
+
+  rv = conn_recv(conn, pkt, pktlen, ts);
+  if (rv != 0) {
+    return rv;
+  }
+
+  return conn_check_mem_limit(conn);
+}
+
+/*
+ * conn_release_rx_pkt returns the packet buffer of |rcbuf| to the
+ * application.
+ */
+static void conn_release_rx_pkt(ngtcp2_rcbuf *rcbuf) {
+  ngtcp2_rx_pkt *rp = ngtcp2_struct_of(rcbuf, ngtcp2_rx_pkt, rcbuf);
+  ngtcp2_conn *conn = rp->conn;
+  uint8_t *pkt = rcbuf->base;
+  void *pkt_user_data = rp->pkt_user_data;
+
+  conn->rx_lent -= rcbuf->len;
+
+  ngtcp2_mem_free(conn->mem, rp);
+
+  conn->callbacks.release_pkt(conn, pkt, pkt_user_data, conn->user_data);
+}
+
+int ngtcp2_conn_recv_ref(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
+                         void *pkt_user_data, ngtcp2_tstamp ts) {
+  int rv;
+  ngtcp2_rx_pkt *rp;
+
+  if (conn->callbacks.release_pkt == NULL) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  if (conn->rx_pkt_spare) {
+    rp = conn->rx_pkt_spare;
+    conn->rx_pkt_spare = NULL;
+  } else {
+    rp = ngtcp2_mem_malloc(conn->mem, sizeof(ngtcp2_rx_pkt));
+    if (rp == NULL) {
+      conn->callbacks.release_pkt(conn, pkt, pkt_user_data, conn->user_data);
+      return NGTCP2_ERR_NOMEM;
+    }
+  }
+
+  ngtcp2_rcbuf_init(&rp->rcbuf, pkt, pktlen, conn_release_rx_pkt);
+  rp->conn = conn;
+  rp->pkt_user_data = pkt_user_data;
+
+  conn->rx_lent += pktlen;
+
+  /* The reorder buffer takes its own references to rx_rcbuf. */
+  conn->rx_rcbuf = &rp->rcbuf;
+  rv = conn_recv(conn, pkt, pktlen, ts);
+  conn->rx_rcbuf = NULL;
+
+  if (rp->rcbuf.ref == 1) {
+    /* Most packets are not referred to.  Keep rp for the next one. */
+    conn->rx_lent -= pktlen;
+    conn->rx_pkt_spare = rp;
+    conn->callbacks.release_pkt(conn, pkt, pkt_user_data, conn->user_data);
+  } else {
+    ngtcp2_rcbuf_decref(&rp->rcbuf);
+  }
+
+  if (rv != 0) {
+    return rv;
+  }
+
+  return conn_check_mem_limit(conn);
+}
+
+int ngtcp2_conn_emit_pending_recv_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                         uint64_t rx_offset) {
+  size_t datalen;
+  const uint8_t *data;
+  int rv;
+  uint8_t fin;
+
+  for (;;) {
+    datalen = ngtcp2_rob_data_at(&strm->rob, &data, rx_offset);
+    if (datalen == 0) {
+      assert(rx_offset == ngtcp2_strm_rx_offset(strm));
+      return 0;
+    }
+
+    rx_offset += datalen;
+
+    fin = (strm->flags & NGTCP2_STRM_FLAG_RECV_FIN) &&
+          rx_offset == strm->last_rx_offset;
+
+    rv = conn_call_recv_stream_data(conn, strm, fin, data, datalen);
+    if (rv != 0) {
+      return rv;
+    }
+
+    ngtcp2_rob_pop(&strm->rob, rx_offset - datalen, datalen);
+  }
+}
+
+void ngtcp2_conn_handshake_completed(ngtcp2_conn *conn) {
+  conn->handshake_completed = 1;
+}
+
+int ngtcp2_conn_sched_ack(ngtcp2_conn *conn, uint64_t pkt_num,
+                          int active_ack, ngtcp2_tstamp ts) {
+  /* TODO Ignore error for now */
+  ngtcp2_acktr_add(&conn->acktr, pkt_num, active_ack, ts);
+
+  return 0;
+}
+
+int ngtcp2_accept(ngtcp2_pkt_hd *dest, const uint8_t *pkt, size_t pktlen) {
+  ssize_t nread;
+  ngtcp2_pkt_hd hd, *p;
+
+  if (dest) {
+    p = dest;
+  } else {
+    p = &hd;
+  }
+
+  if (pktlen == 0 || (pkt[0] & NGTCP2_HEADER_FORM_BIT) == 0) {
+    return -1;
+  }
+
+  nread = ngtcp2_pkt_decode_hd_long(p, pkt, pktlen);
+  if (nread < 0) {
+    return -1;
+  }
+
+  if (p->type != NGTCP2_PKT_CLIENT_INITIAL) {
+    return -1;
+  }
+
+  if (p->version != NGTCP2_PROTO_VERSION) {
+    return 1;
+  }
+
+  return 0;
+}
+
+void ngtcp2_conn_set_aead_overhead(ngtcp2_conn *conn, size_t aead_overhead) {
+  conn->aead_overhead = aead_overhead;
+}
+
+int ngtcp2_conn_update_tx_keys(ngtcp2_conn *conn, const uint8_t *key,
+                               size_t keylen, const uint8_t *iv, size_t ivlen) {
+  if (conn->tx_ckm) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
+
+  return ngtcp2_crypto_km_new(&conn->tx_ckm, key, keylen, iv, ivlen, conn->mem);
+}
+
+int ngtcp2_conn_update_rx_keys(ngtcp2_conn *conn, const uint8_t *key,
+                               size_t keylen, const uint8_t *iv, size_t ivlen) {
+  if (conn->rx_ckm) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
+
+  return ngtcp2_crypto_km_new(&conn->rx_ckm, key, keylen, iv, ivlen, conn->mem);
+}
+
+ngtcp2_strm *ngtcp2_conn_find_stream(ngtcp2_conn *conn, uint32_t stream_id) {
+  ngtcp2_map_entry *me;
+
+  me = ngtcp2_map_find(&conn->strms, stream_id);
+  if (me == NULL) {
+    return NULL;
+  }
+
+  return ngtcp2_struct_of(me, ngtcp2_strm, me);
+}
+
+int ngtcp2_conn_init_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                            uint32_t stream_id, void *stream_user_data) {
+  int rv;
+
+  rv = ngtcp2_strm_init(strm, stream_id, stream_user_data, conn->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  strm->max_rx_offset = strm->rx_window = conn->stream_rx_window;
+  ngtcp2_rob_set_chunk(&strm->rob, conn->reorder_chunk,
+                       conn->reorder_chunk_adaptive);
+  /* Stream 0 carries the handshake which precedes the exchange of
+     the flow control limits. */
+  strm->max_tx_offset =
+      stream_id == 0 ? UINT64_MAX : conn->remote_max_stream_data;
+
+  rv = ngtcp2_map_insert(&conn->strms, &strm->me);
+  if (rv != 0) {
+    ngtcp2_strm_free(strm);
+    return rv;
+  }
+
+  return 0;
+}
+
+int ngtcp2_conn_close_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                             uint32_t error_code) {
+  int rv;
+
+  rv = ngtcp2_map_remove(&conn->strms, strm->me.key);
+  if (rv != 0) {
+    return rv;
+  }
+
+  conn_unsched_strm(conn, strm);
+
+  rv = conn_call_stream_close(conn, strm, error_code);
+
+  ngtcp2_strm_free(strm);
+  ngtcp2_mem_free(conn->mem, strm);
+
+  return rv;
+}
+
+int ngtcp2_conn_close_stream_if_shut_rdwr(ngtcp2_conn *conn,
+                                         ngtcp2_strm *strm) {
+  if ((strm->flags & NGTCP2_STRM_FLAG_SHUT_RDWR) ==
+          NGTCP2_STRM_FLAG_SHUT_RDWR &&
+      ngtcp2_strm_is_all_tx_data_acked(strm)) {
+    return ngtcp2_conn_close_stream(conn, strm, 0);
+  }
+
+  return 0;
+}
+
+int ngtcp2_conn_open_stream(ngtcp2_conn *conn, uint32_t *pstream_id,
+                            void *stream_user_data) {
+  int rv;
+  ngtcp2_strm *strm;
+
+  if (conn->next_local_stream_id > UINT32_MAX) {
+    return NGTCP2_ERR_STREAM_ID;
+  }
+
+  strm = ngtcp2_mem_malloc(conn->mem, sizeof(ngtcp2_strm));
+  if (strm == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  rv = ngtcp2_conn_init_stream(conn, strm, (uint32_t)conn->next_local_stream_id,
+                               stream_user_data);
+  if (rv != 0) {
+    ngtcp2_mem_free(conn->mem, strm);
+    return rv;
+  }
+
+  *pstream_id = strm->stream_id;
+  conn->next_local_stream_id += 2;
+
+  return 0;
+}
+
+int ngtcp2_conn_set_stream_user_data(ngtcp2_conn *conn, uint32_t stream_id,
+                                     void *stream_user_data) {
+  ngtcp2_strm *strm;
+
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+  if (strm == NULL) {
+    return NGTCP2_ERR_STREAM_NOT_FOUND;
+  }
+
+  strm->stream_user_data = stream_user_data;
+
+  return 0;
+}
+
+ssize_t ngtcp2_conn_write_stream(ngtcp2_conn *conn, uint8_t *dest,
+                                 size_t destlen, size_t *pdatalen,
+                                 uint32_t stream_id, uint8_t fin,
+                                 const uint8_t *data, size_t datalen,
+                                 ngtcp2_tstamp ts) {
+  ngtcp2_strm *strm;
+  uint64_t credit;
+
+  if (conn->state != NGTCP2_CS_POST_HANDSHAKE) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
+
+  /* Stream 0 is driven by the handshake callbacks. */
+  if (stream_id == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+  if (strm == NULL) {
+    return NGTCP2_ERR_STREAM_NOT_FOUND;
+  }
+
+  if (strm->flags & (NGTCP2_STRM_FLAG_SHUT_WR | NGTCP2_STRM_FLAG_TX_FIN)) {
+    return NGTCP2_ERR_STREAM_SHUT_WR;
+  }
+
+  if (strm->txq_len) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
 
-  ngtcp2_crypto_create_nonce(nonce, ckm->iv, ckm->ivlen, pkt_num);
+  credit = ngtcp2_min(tx_credit(strm->tx_offset, strm->max_tx_offset),
+                      tx_credit(conn->tx_offset, conn->max_tx_offset));
 
-  nwrite = conn->callbacks.decrypt(conn, dest, destlen, pkt, pktlen, ckm->key,
-                                   ckm->keylen, nonce, ckm->ivlen, ad, adlen,
-                                   conn->user_data);
+  if (!conn_cwnd_avail(conn, ts) || (datalen && credit == 0)) {
+    *pdatalen = 0;
+    /* Congestion window is full, the pacer holds the packet, or flow
+       control blocks the stream.  Only ACK can be sent. */
+    return conn_write_protected_pkt(conn, dest, destlen, NULL, NULL, 0, NULL,
+                                    0, NULL, ts);
+  }
 
-  if (nwrite < 0) {
-    return NGTCP2_ERR_CALLBACK_FAILURE;
+  if (datalen > credit) {
+    datalen = (size_t)credit;
+    fin = 0;
   }
 
-  return nwrite;
+  return conn_write_protected_pkt(conn, dest, destlen, NULL, strm, fin, data,
+                                  datalen, pdatalen, ts);
 }
 
-static int conn_recv_packet(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
-                            ngtcp2_tstamp ts) {
-  ngtcp2_pkt_hd hd;
-  size_t pkt_num_bits;
-  int encrypted = 0;
-  int rv = 0;
-  const uint8_t *hdpkt = pkt;
-  ssize_t nread, nwrite;
-  ngtcp2_frame fr;
-  int require_ack = 0;
+int ngtcp2_conn_submit_stream_datav(ngtcp2_conn *conn, uint32_t stream_id,
+                                    uint8_t fin, const ngtcp2_vec *datav,
+                                    size_t datavcnt) {
+  int rv;
+  ngtcp2_strm *strm;
+  size_t i;
 
-  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
-    nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
-  } else {
-    nread = ngtcp2_pkt_decode_hd_short(&hd, pkt, pktlen);
+  if (stream_id == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
   }
-  if (nread < 0) {
-    return (int)nread;
+
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+  if (strm == NULL) {
+    return NGTCP2_ERR_STREAM_NOT_FOUND;
   }
 
-  pkt += nread;
-  pktlen -= (size_t)nread;
+  if (strm->flags & (NGTCP2_STRM_FLAG_SHUT_WR | NGTCP2_STRM_FLAG_TX_FIN)) {
+    return NGTCP2_ERR_STREAM_SHUT_WR;
+  }
 
-  if (hd.flags & NGTCP2_PKT_FLAG_LONG_FORM) {
-    pkt_num_bits = 32;
-    if (hd.type == NGTCP2_PKT_1RTT_PROTECTED_K0) {
-      encrypted = 1;
-    }
-  } else {
-    switch (hd.type) {
-    case NGTCP2_PKT_01:
-      pkt_num_bits = 8;
-      break;
-    case NGTCP2_PKT_02:
-      pkt_num_bits = 16;
-      break;
-    case NGTCP2_PKT_03:
-      pkt_num_bits = 32;
-      break;
-    default:
-      assert(0);
+  for (i = 0; i < datavcnt; ++i) {
+    if (datav[i].len == 0) {
+      continue;
     }
-    if (!(hd.flags & NGTCP2_PKT_FLAG_KEY_PHASE)) {
-      encrypted = 1;
+    rv = ngtcp2_strm_txq_push(strm, datav[i].base, datav[i].len);
+    if (rv != 0) {
+      return rv;
     }
   }
 
-  hd.pkt_num =
-      ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num, pkt_num_bits);
+  if (fin) {
+    strm->flags |= NGTCP2_STRM_FLAG_TX_FIN;
+  }
 
-  rv = conn_call_recv_pkt(conn, &hd);
-  if (rv != 0) {
-    return rv;
+  if (strm->txq_len == 0 && !fin) {
+    return 0;
   }
 
-  if (encrypted) {
-    nwrite = conn_decrypt_packet(conn, pkt, pktlen, pkt, pktlen, hdpkt,
-                                 (size_t)nread, hd.pkt_num);
-    if (nwrite < 0) {
-      return (int)nwrite;
-    }
-    pktlen = (size_t)nwrite;
+  return conn_sched_strm(conn, strm);
+}
+
+int ngtcp2_conn_submit_stream_data(ngtcp2_conn *conn, uint32_t stream_id,
+                                   uint8_t fin, const uint8_t *data,
+                                   size_t datalen) {
+  ngtcp2_vec vec = {data, datalen};
+
+  return ngtcp2_conn_submit_stream_datav(conn, stream_id, fin, &vec, 1);
+}
+
+int ngtcp2_conn_set_stream_priority(ngtcp2_conn *conn, uint32_t stream_id,
+                                    uint8_t urgency, uint32_t weight) {
+  ngtcp2_strm *strm;
+
+  if (urgency > NGTCP2_MAX_URGENCY || weight < NGTCP2_MIN_WEIGHT ||
+      weight > NGTCP2_MAX_WEIGHT) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
   }
 
-  for (; pktlen;) {
-    nread = ngtcp2_pkt_decode_frame(&fr, pkt, pktlen, conn->max_rx_pkt_num);
-    if (nread < 0) {
-      return (int)nread;
-    }
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+  if (strm == NULL) {
+    return NGTCP2_ERR_STREAM_NOT_FOUND;
+  }
 
-    pkt += nread;
-    pktlen -= (size_t)nread;
+  if (strm->pe.index == NGTCP2_PQ_BAD_INDEX) {
+    strm->urgency = urgency;
+    strm->weight = weight;
+    return 0;
+  }
 
-    rv = conn_call_recv_frame(conn, &hd, &fr);
-    if (rv != 0) {
-      return rv;
-    }
+  ngtcp2_pq_remove(&conn->tx_pq, &strm->pe);
 
-    /* We don't ack packet which contains ACK and CONNECTION_CLOSE
-       only. */
-    /* TODO What about packet with PADDING frames only? */
-    require_ack |=
-        fr.type != NGTCP2_FRAME_ACK && fr.type != NGTCP2_FRAME_CONNECTION_CLOSE;
+  strm->urgency = urgency;
+  strm->weight = weight;
+
+  return ngtcp2_pq_push(&conn->tx_pq, &strm->pe);
+}
+
+ssize_t ngtcp2_conn_write_connection_close(ngtcp2_conn *conn, uint8_t *dest,
+                                           size_t destlen, uint32_t error_code,
+                                           ngtcp2_tstamp ts) {
+  ssize_t nwrite;
+  ngtcp2_frame fr;
+
+  if (conn->state != NGTCP2_CS_POST_HANDSHAKE) {
+    return NGTCP2_ERR_INVALID_STATE;
   }
 
-  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd.pkt_num);
+  fr.type = NGTCP2_FRAME_CONNECTION_CLOSE;
+  fr.connection_close.error_code = error_code;
+  fr.connection_close.reasonlen = 0;
+  fr.connection_close.reason = NULL;
 
-  if (require_ack) {
-    rv = ngtcp2_conn_sched_ack(conn, hd.pkt_num, ts);
-    if (rv != 0) {
-      return rv;
-    }
+  nwrite = conn_write_protected_pkt(conn, dest, destlen, &fr, NULL, 0, NULL, 0,
+                                    NULL, ts);
+  if (nwrite < 0) {
+    return nwrite;
   }
 
-  return rv;
+  conn->state = NGTCP2_CS_CLOSE_WAIT;
+
+  return nwrite;
 }
 
-int ngtcp2_conn_recv(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
-                     ngtcp2_tstamp ts) {
-  int rv = 0;
+ssize_t ngtcp2_conn_write_pkts(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                               size_t pktlen, size_t *pnpkts,
+                               ngtcp2_tstamp ts) {
+  uint8_t *p = dest;
+  ssize_t nwrite;
+  size_t npkts = 0;
+
+  *pnpkts = 0;
 
   if (pktlen == 0) {
     return NGTCP2_ERR_INVALID_ARGUMENT;
   }
 
-  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
-    if (ngtcp2_pkt_verify(pkt, pktlen) != 0) {
-      return NGTCP2_ERR_BAD_PKT_HASH;
-    }
-    pktlen -= NGTCP2_PKT_MDLEN;
+  if (destlen < pktlen) {
+    return NGTCP2_ERR_NOBUF;
   }
 
-  switch (conn->state) {
-  case NGTCP2_CS_CLIENT_CI_SENT:
-    /* TODO Handle Version Negotiation */
-    rv = conn_recv_cleartext(conn, NGTCP2_PKT_SERVER_CLEARTEXT, pkt, pktlen, 0,
-                             1, ts);
-    if (rv < 0) {
-      break;
-    }
-    conn->state = NGTCP2_CS_CLIENT_SC_RECVED;
-    break;
-  case NGTCP2_CS_CLIENT_SC_RECVED:
-    rv = conn_recv_cleartext(conn, NGTCP2_PKT_SERVER_CLEARTEXT, pkt, pktlen, 0,
-                             0, ts);
-    if (rv < 0) {
-      break;
-    }
-    break;
-  case NGTCP2_CS_SERVER_INITIAL:
-    rv = conn_recv_cleartext(conn, NGTCP2_PKT_CLIENT_INITIAL, pkt, pktlen, 1, 1,
-                             ts);
-    if (rv < 0) {
-      break;
+  if (conn->state != NGTCP2_CS_POST_HANDSHAKE ||
+      !ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq)) {
+    /* Handshake packets are not coalesced. */
+    nwrite = ngtcp2_conn_send(conn, dest, pktlen, ts);
+    if (nwrite > 0) {
+      *pnpkts = 1;
     }
-    if (ngtcp2_strm_rx_offset(&conn->strm0) == 0) {
-      return NGTCP2_ERR_PROTO;
+    return nwrite;
+  }
+
+  for (; (size_t)(dest + destlen - p) >= pktlen;) {
+    nwrite = conn_write_pkt(conn, p, pktlen, 1, ts);
+    if (nwrite < 0) {
+      return nwrite;
     }
-    conn->state = NGTCP2_CS_SERVER_CI_RECVED;
-    break;
-  case NGTCP2_CS_SERVER_SC_SENT:
-    rv = conn_recv_cleartext(conn, NGTCP2_PKT_CLIENT_CLEARTEXT, pkt, pktlen, 1,
-                             0, ts);
-    if (rv < 0) {
+    if (nwrite == 0) {
       break;
     }
-    if (conn->handshake_completed) {
-      rv = conn_call_handshake_completed(conn);
-      if (rv != 0) {
-        return rv;
-      }
-      conn->state = NGTCP2_CS_POST_HANDSHAKE;
-    }
-    break;
-  case NGTCP2_CS_POST_HANDSHAKE:
-  case NGTCP2_CS_CLOSE_WAIT:
-    rv = conn_recv_packet(conn, pkt, pktlen, ts);
-    if (rv < 0) {
+
+    p += nwrite;
+    ++npkts;
+
+    /* Only the last packet can be shorter than pktlen. */
+    if ((size_t)nwrite < pktlen) {
       break;
     }
-    break;
   }
 
-  return rv;
+  *pnpkts = npkts;
+
+  return p - dest;
 }
 
-int ngtcp2_conn_emit_pending_recv_handshake(ngtcp2_conn *conn,
-                                            ngtcp2_strm *strm,
-                                            uint64_t rx_offset) {
-  size_t datalen;
-  const uint8_t *data;
-  int rv;
+void ngtcp2_conn_get_local_transport_params(ngtcp2_conn *conn,
+                                            ngtcp2_transport_params *params) {
+  params->initial_max_stream_data =
+      (uint32_t)ngtcp2_min(conn->stream_rx_window, UINT32_MAX);
+  params->initial_max_data = (uint32_t)ngtcp2_min(
+      conn->rx_window / NGTCP2_MAX_DATA_UNIT, UINT32_MAX);
+}
 
-  for (;;) {
-    datalen = ngtcp2_rob_data_at(&strm->rob, &data, rx_offset);
-    if (datalen == 0) {
-      assert(rx_offset == ngtcp2_strm_rx_offset(strm));
-      return 0;
-    }
+static int update_max_tx_offset_each(ngtcp2_map_entry *ent, void *ptr) {
+  ngtcp2_conn *conn = ptr;
+  ngtcp2_strm *strm = ngtcp2_struct_of(ent, ngtcp2_strm, me);
 
-    rx_offset += datalen;
+  if (strm->stream_id == 0) {
+    return 0;
+  }
 
-    rv = conn->callbacks.recv_handshake_data(conn, data, datalen,
-                                             conn->user_data);
-    if (rv != 0) {
-      return rv;
-    }
+  strm->max_tx_offset = conn->remote_max_stream_data;
 
-    ngtcp2_rob_pop(&strm->rob, rx_offset - datalen, datalen);
-  }
+  return conn_resched_strm(conn, strm);
 }
 
-void ngtcp2_conn_handshake_completed(ngtcp2_conn *conn) {
-  conn->handshake_completed = 1;
-}
+int ngtcp2_conn_set_remote_transport_params(
+    ngtcp2_conn *conn, const ngtcp2_transport_params *params) {
+  conn->remote_max_stream_data = params->initial_max_stream_data;
+  conn->max_tx_offset =
+      (uint64_t)params->initial_max_data * NGTCP2_MAX_DATA_UNIT;
 
-int ngtcp2_strm_init(ngtcp2_strm *strm, ngtcp2_mem *mem) {
-  int rv;
+  return ngtcp2_map_each(&conn->strms, update_max_tx_offset_each, conn);
+}
 
-  strm->tx_offset = 0;
-  strm->nbuffered = 0;
-  strm->mem = mem;
-  memset(&strm->tx_buf, 0, sizeof(strm->tx_buf));
+const ngtcp2_cc_stat *ngtcp2_conn_get_cc_stat(ngtcp2_conn *conn) {
+  return &conn->ccs;
+}
 
-  rv = ngtcp2_rob_init(&strm->rob, 8 * 1024, mem);
-  if (rv != 0) {
-    goto fail_rob_init;
+/*
+ * conn_idle_expiry returns the time when idle timeout expires, or
+ * UINT64_MAX if idle timeout is disabled or not started yet.
+ */
+static ngtcp2_tstamp conn_idle_expiry(ngtcp2_conn *conn) {
+  if (conn->idle_timeout == 0 || conn->idle_ts == UINT64_MAX) {
+    return UINT64_MAX;
   }
 
-fail_rob_init:
-  return rv;
+  return conn->idle_ts + conn->idle_timeout;
 }
 
-void ngtcp2_strm_free(ngtcp2_strm *strm) {
-  if (strm == NULL) {
-    return;
+/*
+ * conn_pacing_expiry returns the time when the pacer allows the next
+ * packet to be sent if |conn| has data to send, and only the pacer
+ * holds it.  Otherwise it returns UINT64_MAX.
+ */
+static ngtcp2_tstamp conn_pacing_expiry(ngtcp2_conn *conn) {
+  if (conn->tx_pacing_ts == 0 || conn->state != NGTCP2_CS_POST_HANDSHAKE ||
+      conn->ccs.bytes_in_flight >= conn->ccs.cwnd) {
+    return UINT64_MAX;
   }
 
-  ngtcp2_rob_free(&strm->rob);
-}
+  if ((ngtcp2_pq_empty(&conn->tx_pq) ||
+       conn->tx_offset >= conn->max_tx_offset) &&
+      ngtcp2_frame_queue_empty(&conn->frq) &&
+      ngtcp2_frame_queue_empty(&conn->rtb.lostq)) {
+    return UINT64_MAX;
+  }
 
-uint64_t ngtcp2_strm_rx_offset(ngtcp2_strm *strm) {
-  return ngtcp2_rob_first_gap_offset(&strm->rob);
+  return conn->tx_pacing_ts;
 }
 
-int ngtcp2_strm_recv_reordering(ngtcp2_strm *strm, ngtcp2_stream *fr) {
-  return ngtcp2_rob_push(&strm->rob, fr->offset, fr->data, fr->datalen);
-}
+ngtcp2_tstamp ngtcp2_conn_get_expiry(ngtcp2_conn *conn) {
+  ngtcp2_tstamp expiry = ngtcp2_min(
+      ngtcp2_rtb_get_expiry(&conn->rtb, &conn->ccs), conn_idle_expiry(conn));
 
-int ngtcp2_conn_sched_ack(ngtcp2_conn *conn, uint64_t pkt_num,
-                          ngtcp2_tstamp ts) {
-  ngtcp2_acktr_entry *rpkt;
-  int rv;
+  expiry = ngtcp2_min(expiry, conn_pacing_expiry(conn));
 
-  rv = ngtcp2_acktr_entry_new(&rpkt, pkt_num, ts, conn->mem);
-  if (rv != 0) {
-    return rv;
+  if (conn->state == NGTCP2_CS_POST_HANDSHAKE) {
+    expiry = ngtcp2_min(expiry, conn_ack_expiry(conn));
   }
 
-  /* TODO Ignore error for now */
-  ngtcp2_acktr_add(&conn->acktr, rpkt);
-
-  return 0;
+  return expiry;
 }
 
-int ngtcp2_accept(ngtcp2_pkt_hd *dest, const uint8_t *pkt, size_t pktlen) {
-  ssize_t nread;
-  ngtcp2_pkt_hd hd, *p;
+size_t ngtcp2_conn_get_mem_usage(ngtcp2_conn *conn) {
+  return sizeof(ngtcp2_conn) + conn->acct.usage + conn->rx_lent;
+}
 
-  if (dest) {
-    p = dest;
-  } else {
-    p = &hd;
-  }
+size_t ngtcp2_conn_get_num_pkts_allowed(ngtcp2_conn *conn, size_t pktlen,
+                                        ngtcp2_tstamp ts) {
+  ngtcp2_cc_stat *ccs = &conn->ccs;
+  uint64_t n;
+  ngtcp2_tstamp interval, base;
 
-  if (pktlen == 0 || (pkt[0] & NGTCP2_HEADER_FORM_BIT) == 0) {
-    return -1;
+  if (pktlen == 0 || ccs->bytes_in_flight >= ccs->cwnd) {
+    return 0;
   }
 
-  nread = ngtcp2_pkt_decode_hd_long(p, pkt, pktlen);
-  if (nread < 0) {
-    return -1;
-  }
+  /* A packet can be sent as long as bytes in flight is less than
+     cwnd. */
+  n = (ccs->cwnd - ccs->bytes_in_flight + pktlen - 1) / pktlen;
 
-  if (p->type != NGTCP2_PKT_CLIENT_INITIAL) {
-    return -1;
+  interval = conn_pacing_interval(conn, pktlen);
+  if (interval == 0) {
+    return (size_t)ngtcp2_min(n, SIZE_MAX);
   }
 
-  if (p->version != NGTCP2_PROTO_VERSION) {
-    return 1;
+  base = conn_pacing_base(conn, ts);
+  if (base > ts) {
+    return 0;
   }
 
-  return 0;
-}
-
-void ngtcp2_conn_set_aead_overhead(ngtcp2_conn *conn, size_t aead_overhead) {
-  conn->aead_overhead = aead_overhead;
+  return (size_t)ngtcp2_min(n, (ts - base) / interval + 1);
 }
 
-int ngtcp2_conn_update_tx_keys(ngtcp2_conn *conn, const uint8_t *key,
-                               size_t keylen, const uint8_t *iv, size_t ivlen) {
-  if (conn->tx_ckm) {
-    return NGTCP2_ERR_INVALID_STATE;
+int ngtcp2_conn_handle_expiry(ngtcp2_conn *conn, ngtcp2_tstamp ts) {
+  if (conn_idle_expiry(conn) <= ts) {
+    return NGTCP2_ERR_IDLE_CLOSE;
   }
 
-  return ngtcp2_crypto_km_new(&conn->tx_ckm, key, keylen, iv, ivlen, conn->mem);
-}
+  if (ngtcp2_rtb_get_expiry(&conn->rtb, &conn->ccs) > ts) {
+    return 0;
+  }
 
-int ngtcp2_conn_update_rx_keys(ngtcp2_conn *conn, const uint8_t *key,
-                               size_t keylen, const uint8_t *iv, size_t ivlen) {
-  if (conn->rx_ckm) {
-    return NGTCP2_ERR_INVALID_STATE;
+  if (conn->rtb.loss_time) {
+    ngtcp2_rtb_detect_lost(&conn->rtb, conn->cc, &conn->ccs, ts);
+  } else {
+    ngtcp2_rtb_on_rto(&conn->rtb, conn->cc, &conn->ccs, ts);
   }
 
-  return ngtcp2_crypto_km_new(&conn->rx_ckm, key, keylen, iv, ivlen, conn->mem);
+  return 0;
 }
@@ -36,6 +36,26 @@
 #include "ngtcp2_rob.h"
 #include "ngtcp2_crypto.h"
 #include "ngtcp2_acktr.h"
+#include "ngtcp2_strm.h"
+#include "ngtcp2_map.h"
+#include "ngtcp2_pq.h"
+#include "ngtcp2_rtb.h"
+#include "ngtcp2_cc.h"
+
+/* NGTCP2_MAX_DATA_UNIT is the unit of the value of MAX_DATA frame
+   and initial_max_data transport parameter in bytes. */
+#define NGTCP2_MAX_DATA_UNIT 1024
+
+/* NGTCP2_PACING_GRANULARITY is the duration in microseconds by which
+   the pacer lets the sender catch up when it is late, for example due
+   to the resolution of the application timer.  The packets for this
+   duration can be sent back to back. */
+#define NGTCP2_PACING_GRANULARITY 1000
+
+/* NGTCP2_MAX_ACK_BLKS is the maximum number of additional ACK blocks
+   in ACK frame which the local endpoint sends.  It keeps ACK frame
+   small enough to leave room for other frames in a packet. */
+#define NGTCP2_MAX_ACK_BLKS 128
 
 typedef enum {
   /* Client specific handshake states */
@@ -56,43 +76,149 @@ typedef enum {
   NGTCP2_CS_CLOSE_WAIT,
 } ngtcp2_conn_state;
 
-typedef struct {
-  uint64_t tx_offset;
-  ngtcp2_rob rob;
-  ngtcp2_mem *mem;
-  size_t nbuffered;
-  ngtcp2_buf tx_buf;
-} ngtcp2_strm;
-
-int ngtcp2_strm_init(ngtcp2_strm *strm, ngtcp2_mem *mem);
-
-void ngtcp2_strm_free(ngtcp2_strm *strm);
-
-uint64_t ngtcp2_strm_rx_offset(ngtcp2_strm *strm);
-
 /*
- * ngtcp2_strm_recv_reordering handles reordered STREAM frame |fr|.
- *
- * It returns 0 if it succeeds, or one of the following negative error
- * codes:
- *
- * NGTCP2_ERR_INTERNAL_ERROR
- *     There are too many buffered data
- * NGTCP2_ERR_NOMEM
- *     Out of memory
+ * ngtcp2_rx_pkt is the packet buffer lent by ngtcp2_conn_recv_ref.
  */
-int ngtcp2_strm_recv_reordering(ngtcp2_strm *strm, ngtcp2_stream *fr);
+typedef struct {
+  ngtcp2_rcbuf rcbuf;
+  ngtcp2_conn *conn;
+  void *pkt_user_data;
+} ngtcp2_rx_pkt;
 
 struct ngtcp2_conn {
   int state;
   ngtcp2_conn_callbacks callbacks;
-  ngtcp2_strm strm0;
+  /* strm0 is the stream for the cryptographic handshake.  It is
+     also stored in strms. */
+  ngtcp2_strm *strm0;
+  /* strms stores all open streams keyed by stream ID. */
+  ngtcp2_map strms;
+  /* tx_pq is the stream scheduler.  It contains the streams which
+     have data submitted by ngtcp2_conn_submit_stream_data to send,
+     ordered by urgency, and then virtual finish time. */
+  ngtcp2_pq tx_pq;
+  /* last_cycle is the virtual finish time of the stream scheduled
+     last.  The stream which becomes active starts from here. */
+  uint64_t last_cycle;
   uint64_t conn_id;
   uint64_t next_tx_pkt_num;
   uint64_t max_rx_pkt_num;
+  /* next_local_stream_id is the stream ID which the local endpoint
+     assigns to the stream it opens next. */
+  uint64_t next_local_stream_id;
+  /* last_remote_stream_id is the largest stream ID opened by the
+     remote endpoint so far, or 0 if it has not opened any stream.
+     All streams of the remote endpoint up to it have been opened. */
+  uint32_t last_remote_stream_id;
+  /* max_remote_stream_id is the largest stream ID which the remote
+     endpoint is allowed to open. */
+  uint32_t max_remote_stream_id;
+  /* mem is the allocator for the objects owned by the connection.
+     It points to pool.mem if the pool is enabled, or acct.mem
+     otherwise.  The pool allocates its slabs from acct.mem, so that
+     acct counts all memory which the connection gets from
+     parent_mem. */
   ngtcp2_mem *mem;
+  /* parent_mem is the allocator given by the application.  The
+     connection itself is allocated by it directly. */
+  ngtcp2_mem *parent_mem;
+  ngtcp2_mem_pool pool;
+  ngtcp2_mem_acct acct;
+  /* max_mem is the memory budget of the connection in bytes.  0 means
+     no limit. */
+  size_t max_mem;
+  /* rx_rcbuf is the packet buffer being processed by
+     ngtcp2_conn_recv_ref, or NULL if the packet is processed by
+     ngtcp2_conn_recv. */
+  ngtcp2_rcbuf *rx_rcbuf;
+  /* rx_lent is the total length of the packet buffers lent by
+     ngtcp2_conn_recv_ref which have not been released yet. */
+  size_t rx_lent;
+  /* rx_pkt_spare is the object for the next packet passed to
+     ngtcp2_conn_recv_ref.  It is kept if the last packet was not
+     referred to, so that most packets need no allocation. */
+  ngtcp2_rx_pkt *rx_pkt_spare;
+  /* reorder_chunk and reorder_chunk_adaptive are the chunk size of
+     the reorder buffer of new streams, and whether it is adaptive. */
+  size_t reorder_chunk;
+  int reorder_chunk_adaptive;
   void *user_data;
   ngtcp2_acktr acktr;
+  /* rx_ack_blks stores the additional ACK blocks of ACK frame being
+     received, and tx_ack_blks stores those of ACK frame being sent.
+     They are kept here so that ngtcp2_frame stays small. */
+  ngtcp2_ack_blk rx_ack_blks[NGTCP2_MAX_NUM_ACK_BLK];
+  ngtcp2_ack_blk tx_ack_blks[NGTCP2_MAX_ACK_BLKS];
+  /* rtb tracks the packets sent which count toward bytes in
+     flight, and holds the frames to retransmit. */
+  ngtcp2_rtb rtb;
+  /* frq contains the flow control frames waiting to be sent.  Their
+     values are refreshed when they are written. */
+  ngtcp2_frame_queue frq;
+  /* max_rx_offset is the connection-level flow control limit which
+     the local endpoint allows the remote endpoint to send.  Stream 0
+     does not count toward it. */
+  uint64_t max_rx_offset;
+  /* rx_offset is the sum of the largest offset received in each
+     stream. */
+  uint64_t rx_offset;
+  /* rx_delivered is the number of bytes of stream data delivered to
+     the application. */
+  uint64_t rx_delivered;
+  /* rx_window is the current connection-level receive window, and
+     max_rx_window is its upper limit. */
+  uint64_t rx_window;
+  uint64_t max_rx_window;
+  /* rx_window_ts is the time when max_rx_offset was extended last,
+     or UINT64_MAX if it has never been extended. */
+  ngtcp2_tstamp rx_window_ts;
+  /* stream_rx_window is the initial receive window of each stream,
+     and max_stream_rx_window is its upper limit. */
+  uint64_t stream_rx_window;
+  uint64_t max_stream_rx_window;
+  /* max_tx_offset is the connection-level flow control limit which
+     the remote endpoint allows to send. */
+  uint64_t max_tx_offset;
+  /* tx_offset is the number of bytes of new stream data sent. */
+  uint64_t tx_offset;
+  /* tx_blocked_offset is the value of max_tx_offset when BLOCKED
+     frame was sent last, or UINT64_MAX if it has not been sent. */
+  uint64_t tx_blocked_offset;
+  /* remote_max_stream_data is the initial flow control limit of each
+     stream which the remote endpoint allows to send. */
+  uint64_t remote_max_stream_data;
+  /* max_data_pending is nonzero if MAX_DATA frame is queued in frq,
+     and it has not been sent yet. */
+  int max_data_pending;
+  ngtcp2_cc_stat ccs;
+  /* pacing is nonzero if pacing is enabled. */
+  int pacing;
+  /* tx_pacing_ts is the earliest time when the pacer allows the next
+     packet to be sent.  It is 0 until the first packet is paced. */
+  ngtcp2_tstamp tx_pacing_ts;
+  /* ack_eliciting_threshold is the number of packets which require
+     ACK received before ACK frame is sent, and max_ack_delay is the
+     maximum duration for which ACK frame is delayed. */
+  size_t ack_eliciting_threshold;
+  ngtcp2_tstamp max_ack_delay;
+  /* idle_timeout is the idle timeout in microseconds.  0 disables
+     it. */
+  ngtcp2_tstamp idle_timeout;
+  /* idle_ts is the time when idle timer starts.  It is UINT64_MAX if
+     the timer has not started yet. */
+  ngtcp2_tstamp idle_ts;
+  /* restart_idle is nonzero if the idle timer restarts when the next
+     packet in flight is sent.  It is set when a packet is received,
+     so that the timer does not keep restarting while the peer is
+     unresponsive. */
+  int restart_idle;
+  /* cc is the congestion controller in use.  It points to either one
+     of ccimpl, or the custom controller given by the application. */
+  ngtcp2_cc *cc;
+  union {
+    ngtcp2_reno_cc reno;
+    ngtcp2_cubic_cc cubic;
+  } ccimpl;
   uint32_t version;
   int handshake_completed;
   int server;
@@ -102,8 +228,10 @@ struct ngtcp2_conn {
 };
 
 /*
- * ngtcp2_conn_emit_pending_recv_handshake delivers pending stream
- * data to the application due to packet reordering.
+ * ngtcp2_conn_emit_pending_recv_stream delivers pending stream data
+ * to the application due to packet reordering.  The data of stream 0
+ * is delivered via recv_handshake_data callback, and the other
+ * streams via recv_stream_data callback.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -111,22 +239,69 @@ struct ngtcp2_conn {
  * NGTCP2_ERR_CALLBACK_FAILURE
  *     User callback failed
  */
-int ngtcp2_conn_emit_pending_recv_handshake(ngtcp2_conn *conn,
-                                            ngtcp2_strm *strm, uint64_t offset);
+int ngtcp2_conn_emit_pending_recv_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                                         uint64_t rx_offset);
 
 /*
- * ngtcp2_conn_sched_ack stores packet number |pkt_num| and its
- * reception timestamp |ts| in order to send its ACK.
+ * ngtcp2_conn_find_stream returns a stream whose stream ID is
+ * |stream_id|.  If no such stream is found, it returns NULL.
+ */
+ngtcp2_strm *ngtcp2_conn_find_stream(ngtcp2_conn *conn, uint32_t stream_id);
+
+/*
+ * ngtcp2_conn_init_stream initializes |strm| with |stream_id| and
+ * |stream_user_data|, and adds it to the stream table of |conn|.
  *
- * It returns 0 if it succeeds, or one of the following negative error
- * codes:
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
  *
- * NGTCP2_ERR_INTERNAL_ERROR
- *     There are too many unacked packets
  * NGTCP2_ERR_NOMEM
  *     Out of memory
  */
+int ngtcp2_conn_init_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                            uint32_t stream_id, void *stream_user_data);
+
+/*
+ * ngtcp2_conn_close_stream closes stream |strm| with |error_code|.
+ * It calls stream_close callback, removes |strm| from the stream
+ * table, and frees it.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+int ngtcp2_conn_close_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
+                             uint32_t error_code);
+
+/*
+ * ngtcp2_conn_close_stream_if_shut_rdwr closes |strm| by
+ * ngtcp2_conn_close_stream if it is shut down in both directions,
+ * and all stream data sent is acknowledged.  The stream is kept open
+ * until then, because the unacknowledged data refers to the
+ * application buffer.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed
+ */
+int ngtcp2_conn_close_stream_if_shut_rdwr(ngtcp2_conn *conn,
+                                          ngtcp2_strm *strm);
+
+/*
+ * ngtcp2_conn_sched_ack stores packet number |pkt_num| and its
+ * reception timestamp |ts| in order to send its ACK.  |active_ack|
+ * is nonzero if the packet requires ACK.  Otherwise the packet is
+ * only acknowledged along with the other packets.  If there are too
+ * many gaps in the packets to acknowledge, the oldest packets are not
+ * acknowledged (see ngtcp2_acktr_add).
+ *
+ * It currently always returns 0.
+ */
 int ngtcp2_conn_sched_ack(ngtcp2_conn *conn, uint64_t pkt_num,
-                          ngtcp2_tstamp ts);
+                          int active_ack, ngtcp2_tstamp ts);
 
 #endif /* NGTCP2_CONN_H */
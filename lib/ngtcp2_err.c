@@ -38,6 +38,18 @@ const char *ngtcp2_strerror(int liberr) {
     return "ERR_PROTO";
   case NGTCP2_ERR_INVALID_STATE:
     return "ERR_INVALID_STATE";
+  case NGTCP2_ERR_STREAM_ID:
+    return "ERR_STREAM_ID";
+  case NGTCP2_ERR_STREAM_NOT_FOUND:
+    return "ERR_STREAM_NOT_FOUND";
+  case NGTCP2_ERR_STREAM_SHUT_WR:
+    return "ERR_STREAM_SHUT_WR";
+  case NGTCP2_ERR_IDLE_CLOSE:
+    return "ERR_IDLE_CLOSE";
+  case NGTCP2_ERR_FLOW_CONTROL:
+    return "ERR_FLOW_CONTROL";
+  case NGTCP2_ERR_MEM_LIMIT:
+    return "ERR_MEM_LIMIT";
   case NGTCP2_ERR_NOMEM:
     return "ERR_NOMEM";
   case NGTCP2_ERR_CALLBACK_FAILURE:
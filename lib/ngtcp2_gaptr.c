@@ -0,0 +1,106 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_gaptr.h"
+
+static int gaptr_gap_new(ngtcp2_gaptr_gap **pg, uint64_t begin, uint64_t end,
+                         ngtcp2_mem *mem) {
+  *pg = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_gaptr_gap));
+  if (*pg == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  ngtcp2_range_init(&(*pg)->range, begin, end);
+  (*pg)->next = NULL;
+
+  return 0;
+}
+
+int ngtcp2_gaptr_init(ngtcp2_gaptr *gaptr, ngtcp2_mem *mem) {
+  gaptr->mem = mem;
+
+  return gaptr_gap_new(&gaptr->gap, 0, UINT64_MAX, mem);
+}
+
+void ngtcp2_gaptr_free(ngtcp2_gaptr *gaptr) {
+  ngtcp2_gaptr_gap *g, *next;
+
+  if (gaptr == NULL) {
+    return;
+  }
+
+  for (g = gaptr->gap; g;) {
+    next = g->next;
+    ngtcp2_mem_free(gaptr->mem, g);
+    g = next;
+  }
+}
+
+int ngtcp2_gaptr_push(ngtcp2_gaptr *gaptr, uint64_t offset, size_t datalen) {
+  int rv;
+  ngtcp2_gaptr_gap **pg, *g, *ng;
+  ngtcp2_range m, l, r, q = {offset, offset + datalen};
+
+  for (pg = &gaptr->gap; *pg;) {
+    g = *pg;
+    m = ngtcp2_range_intersect(&q, &g->range);
+    if (ngtcp2_range_len(&m)) {
+      if (ngtcp2_range_equal(&g->range, &m)) {
+        *pg = g->next;
+        ngtcp2_mem_free(gaptr->mem, g);
+        continue;
+      }
+      ngtcp2_range_cut(&l, &r, &g->range, &m);
+      if (ngtcp2_range_len(&l)) {
+        g->range = l;
+
+        if (ngtcp2_range_len(&r)) {
+          rv = gaptr_gap_new(&ng, r.begin, r.end, gaptr->mem);
+          if (rv != 0) {
+            return rv;
+          }
+          ng->next = g->next;
+          g->next = ng;
+          /* q ends inside the original gap. */
+          return 0;
+        }
+      } else if (ngtcp2_range_len(&r)) {
+        g->range = r;
+      }
+    }
+    if (ngtcp2_range_not_after(&q, &g->range)) {
+      break;
+    }
+    pg = &g->next;
+  }
+
+  return 0;
+}
+
+uint64_t ngtcp2_gaptr_first_gap_offset(ngtcp2_gaptr *gaptr) {
+  if (gaptr->gap) {
+    return gaptr->gap->range.begin;
+  }
+  return UINT64_MAX;
+}
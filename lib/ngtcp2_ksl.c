@@ -0,0 +1,214 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_ksl.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+void ngtcp2_ksl_init(ngtcp2_ksl *ksl, ngtcp2_mem *mem) {
+  size_t i;
+
+  for (i = 0; i < NGTCP2_KSL_MAX_LEVEL; ++i) {
+    ksl->head[i] = NULL;
+  }
+
+  ksl->mem = mem;
+  ksl->len = 0;
+  ksl->level = 1;
+  ksl->rand = 0x9e3779b9u;
+}
+
+void ngtcp2_ksl_free(ngtcp2_ksl *ksl) {
+  ngtcp2_ksl_node *node, *next;
+
+  for (node = ksl->head[0]; node; node = next) {
+    next = node->next[0];
+    ngtcp2_mem_free(ksl->mem, node);
+  }
+
+  ngtcp2_ksl_init(ksl, ksl->mem);
+}
+
+/*
+ * ksl_random_level returns the level of a new node.  Each level is
+ * chosen with the probability of 1/4 of the level below.
+ */
+static size_t ksl_random_level(ngtcp2_ksl *ksl) {
+  uint32_t x = ksl->rand;
+  size_t level = 1;
+
+  /* xorshift32 */
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ksl->rand = x;
+
+  for (; level < NGTCP2_KSL_MAX_LEVEL && (x & 3) == 0; x >>= 2) {
+    ++level;
+  }
+
+  return level;
+}
+
+/*
+ * ksl_find_prev fills |prev| with the pointers to the links, one per
+ * level in use, which lead to the first node whose key is equal to or
+ * greater than |key|.
+ */
+static void ksl_find_prev(ngtcp2_ksl *ksl, ngtcp2_ksl_node **prev[],
+                          uint64_t key) {
+  /* NULL stands for the head. */
+  ngtcp2_ksl_node *node = NULL;
+  ngtcp2_ksl_node **link;
+  size_t i;
+
+  for (i = ksl->level; i > 0; --i) {
+    link = node ? &node->next[i - 1] : &ksl->head[i - 1];
+    for (; *link && (*link)->key < key; link = &node->next[i - 1]) {
+      node = *link;
+    }
+    prev[i - 1] = link;
+  }
+}
+
+int ngtcp2_ksl_insert(ngtcp2_ksl *ksl, ngtcp2_ksl_node **pnode, uint64_t key,
+                      void *data) {
+  ngtcp2_ksl_node **prev[NGTCP2_KSL_MAX_LEVEL];
+  ngtcp2_ksl_node *node;
+  size_t level, i;
+
+  ksl_find_prev(ksl, prev, key);
+
+  if (*prev[0] && (*prev[0])->key == key) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  level = ksl_random_level(ksl);
+
+  node = ngtcp2_mem_malloc(ksl->mem, offsetof(ngtcp2_ksl_node, next) +
+                                         sizeof(ngtcp2_ksl_node *) * level);
+  if (node == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  node->key = key;
+  node->data = data;
+  node->level = level;
+
+  for (; ksl->level < level; ++ksl->level) {
+    prev[ksl->level] = &ksl->head[ksl->level];
+  }
+
+  for (i = 0; i < level; ++i) {
+    node->next[i] = *prev[i];
+    *prev[i] = node;
+  }
+
+  ++ksl->len;
+
+  if (pnode) {
+    *pnode = node;
+  }
+
+  return 0;
+}
+
+int ngtcp2_ksl_remove(ngtcp2_ksl *ksl, uint64_t key) {
+  ngtcp2_ksl_node **prev[NGTCP2_KSL_MAX_LEVEL];
+  ngtcp2_ksl_node *node;
+  size_t i;
+
+  ksl_find_prev(ksl, prev, key);
+
+  node = *prev[0];
+  if (node == NULL || node->key != key) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  for (i = 0; i < node->level; ++i) {
+    *prev[i] = node->next[i];
+  }
+
+  ngtcp2_mem_free(ksl->mem, node);
+
+  --ksl->len;
+
+  return 0;
+}
+
+void ngtcp2_ksl_pop_front(ngtcp2_ksl *ksl) {
+  ngtcp2_ksl_node *node = ksl->head[0];
+  size_t i;
+
+  assert(node);
+
+  /* The first node is the first one in all levels it is in. */
+  for (i = 0; i < node->level; ++i) {
+    ksl->head[i] = node->next[i];
+  }
+
+  ngtcp2_mem_free(ksl->mem, node);
+
+  --ksl->len;
+}
+
+void ngtcp2_ksl_update_key(ngtcp2_ksl *ksl, ngtcp2_ksl_node *node,
+                           uint64_t key) {
+  (void)ksl;
+
+  assert(node->next[0] == NULL || key < node->next[0]->key);
+
+  node->key = key;
+}
+
+ngtcp2_ksl_node *ngtcp2_ksl_lower_bound(ngtcp2_ksl *ksl, uint64_t key) {
+  ngtcp2_ksl_node **prev[NGTCP2_KSL_MAX_LEVEL];
+
+  ksl_find_prev(ksl, prev, key);
+
+  return *prev[0];
+}
+
+ngtcp2_ksl_node *ngtcp2_ksl_floor(ngtcp2_ksl *ksl, uint64_t key) {
+  /* NULL stands for the head. */
+  ngtcp2_ksl_node *node = NULL, *next;
+  size_t i;
+
+  for (i = ksl->level; i > 0; --i) {
+    for (;;) {
+      next = node ? node->next[i - 1] : ksl->head[i - 1];
+      if (next == NULL || next->key > key) {
+        break;
+      }
+      node = next;
+    }
+  }
+
+  return node;
+}
+
+ngtcp2_ksl_node *ngtcp2_ksl_front(ngtcp2_ksl *ksl) { return ksl->head[0]; }
+
+size_t ngtcp2_ksl_len(ngtcp2_ksl *ksl) { return ksl->len; }
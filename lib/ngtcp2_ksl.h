@@ -0,0 +1,155 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_KSL_H
+#define NGTCP2_KSL_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "ngtcp2_mem.h"
+
+/* Implementation of skip list keyed by uint64_t */
+
+/* NGTCP2_KSL_MAX_LEVEL is the maximum height of the tower of a node.
+   Each level holds a quarter of the nodes of the level below, so
+   that the search stays logarithmic up to about 16 million
+   nodes. */
+#define NGTCP2_KSL_MAX_LEVEL 12
+
+struct ngtcp2_ksl_node;
+typedef struct ngtcp2_ksl_node ngtcp2_ksl_node;
+
+/*
+ * ngtcp2_ksl_node is a node of ngtcp2_ksl.
+ */
+struct ngtcp2_ksl_node {
+  uint64_t key;
+  /* data is the pointer to the item associated with key. */
+  void *data;
+  /* level is the number of the pointers in next. */
+  size_t level;
+  /* next[i] points to the next node in level i.  next[0] links all
+     nodes in the increasing order of key. */
+  ngtcp2_ksl_node *next[];
+};
+
+/*
+ * ngtcp2_ksl is a sorted set of the unique keys, each of which is
+ * associated with a pointer.  Lookup, insertion and removal take
+ * O(log n) on average.  The nodes are allocated by ngtcp2_ksl, but
+ * the items they point to are owned by the caller.
+ */
+typedef struct {
+  /* head[i] points to the first node in level i. */
+  ngtcp2_ksl_node *head[NGTCP2_KSL_MAX_LEVEL];
+  ngtcp2_mem *mem;
+  /* len is the number of nodes. */
+  size_t len;
+  /* level is the number of the levels in use. */
+  size_t level;
+  /* rand is the state of the pseudo random number generator which
+     decides the level of a new node. */
+  uint32_t rand;
+} ngtcp2_ksl;
+
+/*
+ * ngtcp2_ksl_init initializes |ksl| which allocates memory by |mem|.
+ */
+void ngtcp2_ksl_init(ngtcp2_ksl *ksl, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_ksl_free frees all nodes of |ksl|.  It does not free the
+ * items which they point to.
+ */
+void ngtcp2_ksl_free(ngtcp2_ksl *ksl);
+
+/*
+ * ngtcp2_ksl_insert inserts |data| with |key|.  If |pnode| is not
+ * NULL, the new node is assigned to it.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     |key| already exists.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_ksl_insert(ngtcp2_ksl *ksl, ngtcp2_ksl_node **pnode, uint64_t key,
+                      void *data);
+
+/*
+ * ngtcp2_ksl_remove removes the node of |key|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     |key| does not exist.
+ */
+int ngtcp2_ksl_remove(ngtcp2_ksl *ksl, uint64_t key);
+
+/*
+ * ngtcp2_ksl_pop_front removes the first node.  |ksl| must not be
+ * empty.
+ */
+void ngtcp2_ksl_pop_front(ngtcp2_ksl *ksl);
+
+/*
+ * ngtcp2_ksl_update_key changes the key of |node| to |key|.  |key|
+ * must be greater than the key of the previous node, and less than
+ * that of the next node, so that the order of the nodes does not
+ * change.
+ */
+void ngtcp2_ksl_update_key(ngtcp2_ksl *ksl, ngtcp2_ksl_node *node,
+                           uint64_t key);
+
+/*
+ * ngtcp2_ksl_lower_bound returns the first node whose key is equal
+ * to or greater than |key|.  If there is no such node, it returns
+ * NULL.
+ */
+ngtcp2_ksl_node *ngtcp2_ksl_lower_bound(ngtcp2_ksl *ksl, uint64_t key);
+
+/*
+ * ngtcp2_ksl_floor returns the last node whose key is equal to or
+ * less than |key|.  If there is no such node, it returns NULL.
+ */
+ngtcp2_ksl_node *ngtcp2_ksl_floor(ngtcp2_ksl *ksl, uint64_t key);
+
+/*
+ * ngtcp2_ksl_front returns the first node, or NULL if |ksl| is empty.
+ */
+ngtcp2_ksl_node *ngtcp2_ksl_front(ngtcp2_ksl *ksl);
+
+/*
+ * ngtcp2_ksl_len returns the number of nodes in |ksl|.
+ */
+size_t ngtcp2_ksl_len(ngtcp2_ksl *ksl);
+
+#endif /* NGTCP2_KSL_H */
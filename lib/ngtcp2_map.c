@@ -0,0 +1,202 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ * Copyright (c) 2012 nghttp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_map.h"
+
+#include <string.h>
+
+#define INITIAL_TABLE_LENBITS 4
+#define INITIAL_TABLE_LEN (1 << INITIAL_TABLE_LENBITS)
+
+int ngtcp2_map_init(ngtcp2_map *map, ngtcp2_mem *mem) {
+  map->mem = mem;
+  map->tablelen = INITIAL_TABLE_LEN;
+  map->tablelenbits = INITIAL_TABLE_LENBITS;
+  map->table =
+      ngtcp2_mem_calloc(mem, map->tablelen, sizeof(ngtcp2_map_entry *));
+  if (map->table == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  map->size = 0;
+
+  return 0;
+}
+
+void ngtcp2_map_free(ngtcp2_map *map) {
+  if (map == NULL) {
+    return;
+  }
+
+  ngtcp2_mem_free(map->mem, map->table);
+}
+
+void ngtcp2_map_each_free(ngtcp2_map *map,
+                          int (*func)(ngtcp2_map_entry *entry, void *ptr),
+                          void *ptr) {
+  uint32_t i;
+  ngtcp2_map_entry *entry, *next;
+
+  for (i = 0; i < map->tablelen; ++i) {
+    for (entry = map->table[i]; entry;) {
+      next = entry->next;
+      func(entry, ptr);
+      entry = next;
+    }
+    map->table[i] = NULL;
+  }
+}
+
+int ngtcp2_map_each(ngtcp2_map *map,
+                    int (*func)(ngtcp2_map_entry *entry, void *ptr),
+                    void *ptr) {
+  int rv;
+  uint32_t i;
+  ngtcp2_map_entry *entry, *next;
+
+  for (i = 0; i < map->tablelen; ++i) {
+    for (entry = map->table[i]; entry;) {
+      next = entry->next;
+      rv = func(entry, ptr);
+      if (rv != 0) {
+        return rv;
+      }
+      entry = next;
+    }
+  }
+  return 0;
+}
+
+void ngtcp2_map_entry_init(ngtcp2_map_entry *entry, key_type key) {
+  entry->key = key;
+  entry->next = NULL;
+}
+
+/* Fibonacci hashing: the multiplier is 2^64 divided by the golden
+   ratio.  The top |bits| bits of the product are well mixed even if
+   keys are sequential, like stream IDs. */
+static uint32_t hash(key_type key, uint32_t bits) {
+  return (uint32_t)((key * 11400714819323198485llu) >> (64 - bits));
+}
+
+static int insert(ngtcp2_map_entry **table, uint32_t tablelenbits,
+                  ngtcp2_map_entry *entry) {
+  uint32_t h = hash(entry->key, tablelenbits);
+  if (table[h] == NULL) {
+    table[h] = entry;
+  } else {
+    ngtcp2_map_entry *p;
+    /* We won't allow duplicated key, so check it out. */
+    for (p = table[h]; p; p = p->next) {
+      if (p->key == entry->key) {
+        return NGTCP2_ERR_INVALID_ARGUMENT;
+      }
+    }
+    entry->next = table[h];
+    table[h] = entry;
+  }
+  return 0;
+}
+
+/* new_tablelen must be power of 2 and new_tablelen == (1 <<
+   new_tablelenbits) must hold. */
+static int resize(ngtcp2_map *map, uint32_t new_tablelen,
+                  uint32_t new_tablelenbits) {
+  uint32_t i;
+  ngtcp2_map_entry **new_table;
+
+  new_table =
+      ngtcp2_mem_calloc(map->mem, new_tablelen, sizeof(ngtcp2_map_entry *));
+  if (new_table == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  for (i = 0; i < map->tablelen; ++i) {
+    ngtcp2_map_entry *entry;
+    for (entry = map->table[i]; entry;) {
+      ngtcp2_map_entry *next = entry->next;
+      entry->next = NULL;
+      /* This function must succeed */
+      insert(new_table, new_tablelenbits, entry);
+      entry = next;
+    }
+  }
+  ngtcp2_mem_free(map->mem, map->table);
+  map->tablelen = new_tablelen;
+  map->tablelenbits = new_tablelenbits;
+  map->table = new_table;
+
+  return 0;
+}
+
+int ngtcp2_map_insert(ngtcp2_map *map, ngtcp2_map_entry *new_entry) {
+  int rv;
+
+  /* Load factor is 3/4 */
+  if ((map->size + 1) * 4 > map->tablelen * 3) {
+    rv = resize(map, map->tablelen * 2, map->tablelenbits + 1);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+  rv = insert(map->table, map->tablelenbits, new_entry);
+  if (rv != 0) {
+    return rv;
+  }
+  ++map->size;
+  return 0;
+}
+
+ngtcp2_map_entry *ngtcp2_map_find(ngtcp2_map *map, key_type key) {
+  uint32_t h;
+  ngtcp2_map_entry *entry;
+  h = hash(key, map->tablelenbits);
+  for (entry = map->table[h]; entry; entry = entry->next) {
+    if (entry->key == key) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+int ngtcp2_map_remove(ngtcp2_map *map, key_type key) {
+  uint32_t h;
+  ngtcp2_map_entry **dst;
+
+  h = hash(key, map->tablelenbits);
+
+  for (dst = &map->table[h]; *dst; dst = &(*dst)->next) {
+    if ((*dst)->key != key) {
+      continue;
+    }
+
+    *dst = (*dst)->next;
+    --map->size;
+    return 0;
+  }
+  return NGTCP2_ERR_INVALID_ARGUMENT;
+}
+
+size_t ngtcp2_map_size(ngtcp2_map *map) { return map->size; }
@@ -25,6 +25,8 @@
  */
 #include "ngtcp2_mem.h"
 
+#include <string.h>
+
 static void *default_malloc(size_t size, void *mem_user_data) {
   (void)mem_user_data;
 
@@ -73,3 +75,284 @@ void *ngtcp2_mem_calloc(ngtcp2_mem *mem, size_t nmemb, size_t size) {
 void *ngtcp2_mem_realloc(ngtcp2_mem *mem, void *ptr, size_t size) {
   return mem->realloc(ptr, size, mem->mem_user_data);
 }
+
+/*
+ * mem_pool_class returns the size class of the object of |size|
+ * bytes, or NGTCP2_MEM_POOL_NUM_CLASSES if it is too large for any
+ * class.
+ */
+static size_t mem_pool_class(size_t size) {
+  size_t cls = 0;
+  size_t clssize = 32;
+
+  for (; cls < NGTCP2_MEM_POOL_NUM_CLASSES && clssize < size; ++cls) {
+    clssize *= 2;
+  }
+
+  return cls;
+}
+
+/*
+ * mem_pool_add_slab allocates new slab, and adds the objects of size
+ * class |cls| carved from it to the free list.
+ *
+ * This function returns 0 if it succeeds, or -1 if it fails to
+ * allocate memory.
+ */
+static int mem_pool_add_slab(ngtcp2_mem_pool *pool, size_t cls) {
+  ngtcp2_mem_pool_obj *slab, *obj;
+  size_t size = (size_t)32 << cls;
+  size_t objlen = sizeof(ngtcp2_mem_pool_obj) + size;
+  uint8_t *p, *end;
+
+  slab = ngtcp2_mem_malloc(pool->parent, NGTCP2_MEM_POOL_SLABLEN);
+  if (slab == NULL) {
+    return -1;
+  }
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+
+  p = (uint8_t *)(slab + 1);
+  end = (uint8_t *)slab + NGTCP2_MEM_POOL_SLABLEN;
+
+  for (; (size_t)(end - p) >= objlen; p += objlen) {
+    obj = (ngtcp2_mem_pool_obj *)(void *)p;
+    obj->size = size;
+    obj->next = pool->freelist[cls];
+    pool->freelist[cls] = obj;
+  }
+
+  return 0;
+}
+
+static void *mem_pool_malloc(size_t size, void *mem_user_data) {
+  ngtcp2_mem_pool *pool = mem_user_data;
+  ngtcp2_mem_pool_obj *obj, **pobj;
+  size_t cls = mem_pool_class(size);
+
+  if (cls == NGTCP2_MEM_POOL_NUM_CLASSES) {
+    for (pobj = &pool->large; *pobj; pobj = &(*pobj)->next) {
+      if ((*pobj)->size == size) {
+        obj = *pobj;
+        *pobj = obj->next;
+        --pool->nlarge;
+        return obj + 1;
+      }
+    }
+
+    obj = ngtcp2_mem_malloc(pool->parent, sizeof(ngtcp2_mem_pool_obj) + size);
+    if (obj == NULL) {
+      return NULL;
+    }
+    obj->size = size;
+    return obj + 1;
+  }
+
+  if (pool->freelist[cls] == NULL && mem_pool_add_slab(pool, cls) != 0) {
+    return NULL;
+  }
+
+  obj = pool->freelist[cls];
+  pool->freelist[cls] = obj->next;
+
+  return obj + 1;
+}
+
+static void mem_pool_free(void *ptr, void *mem_user_data) {
+  ngtcp2_mem_pool *pool = mem_user_data;
+  ngtcp2_mem_pool_obj *obj;
+  size_t cls;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  obj = (ngtcp2_mem_pool_obj *)ptr - 1;
+  cls = mem_pool_class(obj->size);
+
+  if (cls < NGTCP2_MEM_POOL_NUM_CLASSES) {
+    obj->next = pool->freelist[cls];
+    pool->freelist[cls] = obj;
+    return;
+  }
+
+  if (pool->nlarge == NGTCP2_MEM_POOL_MAX_LARGE) {
+    ngtcp2_mem_free(pool->parent, obj);
+    return;
+  }
+
+  obj->next = pool->large;
+  pool->large = obj;
+  ++pool->nlarge;
+}
+
+static void *mem_pool_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  void *p;
+
+  if (size && nmemb > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  p = mem_pool_malloc(nmemb * size, mem_user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  return memset(p, 0, nmemb * size);
+}
+
+static void *mem_pool_realloc(void *ptr, size_t size, void *mem_user_data) {
+  ngtcp2_mem_pool_obj *obj;
+  void *p;
+
+  if (ptr == NULL) {
+    return mem_pool_malloc(size, mem_user_data);
+  }
+
+  obj = (ngtcp2_mem_pool_obj *)ptr - 1;
+
+  if (size <= obj->size &&
+      mem_pool_class(obj->size) < NGTCP2_MEM_POOL_NUM_CLASSES) {
+    return ptr;
+  }
+
+  p = mem_pool_malloc(size, mem_user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memcpy(p, ptr, obj->size < size ? obj->size : size);
+  mem_pool_free(ptr, mem_user_data);
+
+  return p;
+}
+
+void ngtcp2_mem_pool_init(ngtcp2_mem_pool *pool, ngtcp2_mem *parent) {
+  size_t i;
+
+  pool->mem.mem_user_data = pool;
+  pool->mem.malloc = mem_pool_malloc;
+  pool->mem.free = mem_pool_free;
+  pool->mem.calloc = mem_pool_calloc;
+  pool->mem.realloc = mem_pool_realloc;
+  pool->parent = parent;
+
+  for (i = 0; i < NGTCP2_MEM_POOL_NUM_CLASSES; ++i) {
+    pool->freelist[i] = NULL;
+  }
+
+  pool->slabs = NULL;
+  pool->large = NULL;
+  pool->nlarge = 0;
+}
+
+void ngtcp2_mem_pool_free(ngtcp2_mem_pool *pool) {
+  ngtcp2_mem_pool_obj *obj, *next;
+
+  for (obj = pool->slabs; obj; obj = next) {
+    next = obj->next;
+    ngtcp2_mem_free(pool->parent, obj);
+  }
+
+  ngtcp2_mem_pool_trim(pool);
+
+  ngtcp2_mem_pool_init(pool, pool->parent);
+}
+
+void ngtcp2_mem_pool_trim(ngtcp2_mem_pool *pool) {
+  ngtcp2_mem_pool_obj *obj, *next;
+
+  for (obj = pool->large; obj; obj = next) {
+    next = obj->next;
+    ngtcp2_mem_free(pool->parent, obj);
+  }
+
+  pool->large = NULL;
+  pool->nlarge = 0;
+}
+
+static void *mem_acct_malloc(size_t size, void *mem_user_data) {
+  ngtcp2_mem_acct *acct = mem_user_data;
+  ngtcp2_mem_acct_hd *hd;
+
+  if (size > SIZE_MAX - sizeof(ngtcp2_mem_acct_hd)) {
+    return NULL;
+  }
+
+  hd = ngtcp2_mem_malloc(acct->parent, sizeof(ngtcp2_mem_acct_hd) + size);
+  if (hd == NULL) {
+    return NULL;
+  }
+
+  hd->size = size;
+  acct->usage += sizeof(ngtcp2_mem_acct_hd) + size;
+
+  return hd + 1;
+}
+
+static void mem_acct_free(void *ptr, void *mem_user_data) {
+  ngtcp2_mem_acct *acct = mem_user_data;
+  ngtcp2_mem_acct_hd *hd;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  hd = (ngtcp2_mem_acct_hd *)ptr - 1;
+  acct->usage -= sizeof(ngtcp2_mem_acct_hd) + hd->size;
+
+  ngtcp2_mem_free(acct->parent, hd);
+}
+
+static void *mem_acct_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  void *p;
+
+  if (size && nmemb > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  p = mem_acct_malloc(nmemb * size, mem_user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  return memset(p, 0, nmemb * size);
+}
+
+static void *mem_acct_realloc(void *ptr, size_t size, void *mem_user_data) {
+  ngtcp2_mem_acct *acct = mem_user_data;
+  ngtcp2_mem_acct_hd *hd;
+  size_t oldsize;
+
+  if (ptr == NULL) {
+    return mem_acct_malloc(size, mem_user_data);
+  }
+
+  if (size > SIZE_MAX - sizeof(ngtcp2_mem_acct_hd)) {
+    return NULL;
+  }
+
+  hd = (ngtcp2_mem_acct_hd *)ptr - 1;
+  oldsize = hd->size;
+
+  hd = ngtcp2_mem_realloc(acct->parent, hd, sizeof(ngtcp2_mem_acct_hd) + size);
+  if (hd == NULL) {
+    return NULL;
+  }
+
+  hd->size = size;
+  acct->usage = acct->usage - oldsize + size;
+
+  return hd + 1;
+}
+
+void ngtcp2_mem_acct_init(ngtcp2_mem_acct *acct, ngtcp2_mem *parent) {
+  acct->mem.mem_user_data = acct;
+  acct->mem.malloc = mem_acct_malloc;
+  acct->mem.free = mem_acct_free;
+  acct->mem.calloc = mem_acct_calloc;
+  acct->mem.realloc = mem_acct_realloc;
+  acct->parent = parent;
+  acct->usage = 0;
+}
@@ -43,4 +43,113 @@ void ngtcp2_mem_free2(ngtcp2_free free_func, void *ptr, void *mem_user_data);
 void *ngtcp2_mem_calloc(ngtcp2_mem *mem, size_t nmemb, size_t size);
 void *ngtcp2_mem_realloc(ngtcp2_mem *mem, void *ptr, size_t size);
 
+/* NGTCP2_MEM_POOL_NUM_CLASSES is the number of size classes of
+   ngtcp2_mem_pool.  The usable size of the smallest class is 32
+   bytes, and each class doubles it, so that the objects up to 512
+   bytes are pooled. */
+#define NGTCP2_MEM_POOL_NUM_CLASSES 5
+
+/* NGTCP2_MEM_POOL_SLABLEN is the number of bytes which ngtcp2_mem_pool
+   allocates at once to carve the objects of a size class. */
+#define NGTCP2_MEM_POOL_SLABLEN 4096
+
+/* NGTCP2_MEM_POOL_MAX_LARGE is the maximum number of freed objects
+   larger than the size classes which ngtcp2_mem_pool keeps for
+   reuse. */
+#define NGTCP2_MEM_POOL_MAX_LARGE 4
+
+struct ngtcp2_mem_pool_obj;
+typedef struct ngtcp2_mem_pool_obj ngtcp2_mem_pool_obj;
+
+/*
+ * ngtcp2_mem_pool_obj is the header which precedes each object
+ * allocated by ngtcp2_mem_pool.
+ */
+struct ngtcp2_mem_pool_obj {
+  /* next points to the next free object while this object is in a
+     free list. */
+  ngtcp2_mem_pool_obj *next;
+  /* size is the usable size of the object. */
+  size_t size;
+};
+
+/*
+ * ngtcp2_mem_pool is an allocator which recycles the small objects
+ * of a connection, such as the entries of rtb, the frame chains, and
+ * the reassembly buffers.  It carves the objects of each size class
+ * from slabs allocated by the parent allocator, and freed objects go
+ * back to the free list of their class instead of the parent.  The
+ * objects larger than the size classes are allocated by the parent,
+ * but a few of them are kept after they are freed, which lets the
+ * same sized buffers be reused.  All slabs are released at once by
+ * ngtcp2_mem_pool_free.
+ *
+ * The pool itself is exposed as ngtcp2_mem by its mem field, so that
+ * the code which takes ngtcp2_mem uses it unchanged.  It is not
+ * thread safe.
+ */
+typedef struct {
+  ngtcp2_mem mem;
+  ngtcp2_mem *parent;
+  ngtcp2_mem_pool_obj *freelist[NGTCP2_MEM_POOL_NUM_CLASSES];
+  /* slabs is the list of slabs.  Each slab starts with
+     ngtcp2_mem_pool_obj whose next field links them. */
+  ngtcp2_mem_pool_obj *slabs;
+  /* large is the list of freed objects larger than the size classes,
+     and nlarge is the number of them. */
+  ngtcp2_mem_pool_obj *large;
+  size_t nlarge;
+} ngtcp2_mem_pool;
+
+/*
+ * ngtcp2_mem_pool_init initializes |pool| which allocates memory by
+ * |parent|.  No memory is allocated until the first object is
+ * requested.
+ */
+void ngtcp2_mem_pool_init(ngtcp2_mem_pool *pool, ngtcp2_mem *parent);
+
+/*
+ * ngtcp2_mem_pool_free releases all memory allocated by |pool|.  The
+ * objects in the size classes which are still in use are released as
+ * well, but the larger objects must be freed before this call.
+ */
+void ngtcp2_mem_pool_free(ngtcp2_mem_pool *pool);
+
+/*
+ * ngtcp2_mem_pool_trim releases the freed objects larger than the
+ * size classes which |pool| keeps for reuse.  The slabs are kept.
+ */
+void ngtcp2_mem_pool_trim(ngtcp2_mem_pool *pool);
+
+/*
+ * ngtcp2_mem_acct_hd is the header which precedes each object
+ * allocated by ngtcp2_mem_acct.  The union keeps the object aligned
+ * as strictly as the parent allocator does.
+ */
+typedef union {
+  size_t size;
+  long double align;
+} ngtcp2_mem_acct_hd;
+
+/*
+ * ngtcp2_mem_acct is an allocator which counts the bytes allocated
+ * through it by the parent allocator.  It records the size of each
+ * object in a header, so that free knows how much to subtract.  It
+ * never refuses an allocation by itself; the limit is enforced by
+ * its user.
+ */
+typedef struct {
+  ngtcp2_mem mem;
+  ngtcp2_mem *parent;
+  /* usage is the number of bytes currently allocated, including the
+     headers. */
+  size_t usage;
+} ngtcp2_mem_acct;
+
+/*
+ * ngtcp2_mem_acct_init initializes |acct| which allocates memory by
+ * |parent|.
+ */
+void ngtcp2_mem_acct_init(ngtcp2_mem_acct *acct, ngtcp2_mem *parent);
+
 #endif /* NGTCP2_MEM_H */
@@ -246,8 +246,9 @@ ssize_t ngtcp2_pkt_encode_hd_short(uint8_t *out, size_t outlen,
 
 static int has_mask(uint8_t b, uint8_t mask) { return (b & mask) == mask; }
 
-ssize_t ngtcp2_pkt_decode_frame(ngtcp2_frame *dest, const uint8_t *payload,
-                                size_t payloadlen, uint64_t max_rx_pkt_num) {
+ssize_t ngtcp2_pkt_decode_frame(ngtcp2_frame *dest, ngtcp2_ack_blk *ack_blks,
+                                const uint8_t *payload, size_t payloadlen,
+                                uint64_t max_rx_pkt_num) {
   uint8_t type;
 
   if (payloadlen == 0) {
@@ -261,8 +262,8 @@ ssize_t ngtcp2_pkt_decode_frame(ngtcp2_frame *dest, const uint8_t *payload,
   }
 
   if (has_mask(type, NGTCP2_FRAME_ACK)) {
-    return ngtcp2_pkt_decode_ack_frame(&dest->ack, payload, payloadlen,
-                                       max_rx_pkt_num);
+    return ngtcp2_pkt_decode_ack_frame(&dest->ack, ack_blks, payload,
+                                       payloadlen, max_rx_pkt_num);
   }
 
   switch (type) {
@@ -303,6 +304,176 @@ ssize_t ngtcp2_pkt_decode_frame(ngtcp2_frame *dest, const uint8_t *payload,
   }
 }
 
+void ngtcp2_frame_iter_init(ngtcp2_frame_iter *it, const uint8_t *payload,
+                            size_t payloadlen) {
+  it->payload = payload;
+  it->payloadlen = payloadlen;
+}
+
+/*
+ * stream_frame_len returns the length of STREAM frame which starts
+ * at |payload|.  It returns 0 if |payloadlen| is too short to tell
+ * the length.
+ */
+static size_t stream_frame_len(const uint8_t *payload, size_t payloadlen) {
+  uint8_t type = payload[0];
+  size_t len = 1;
+  uint8_t b;
+
+  len += (size_t)(((type & NGTCP2_STREAM_SS_MASK) >> 3) + 1);
+
+  b = (uint8_t)((type & NGTCP2_STREAM_OO_MASK) >> 1);
+  if (b) {
+    len += (size_t)(1 << b);
+  }
+
+  if (!(type & NGTCP2_STREAM_D_BIT)) {
+    /* The frame extends to the end of the packet. */
+    return len <= payloadlen ? payloadlen : 0;
+  }
+
+  len += 2;
+
+  if (payloadlen < len) {
+    return 0;
+  }
+
+  return len + ngtcp2_get_uint16(&payload[len - 2]);
+}
+
+/*
+ * ack_frame_len returns the length of ACK frame which starts at
+ * |payload|.  It returns 0 if |payloadlen| is too short to tell the
+ * length.
+ */
+static size_t ack_frame_len(const uint8_t *payload, size_t payloadlen) {
+  uint8_t type = payload[0];
+  size_t num_blks = 0;
+  size_t num_ts;
+  size_t abllen;
+  size_t len = 4; /* type + NumTS + ACK Delay(2) */
+  const uint8_t *p = &payload[1];
+
+  if (type & NGTCP2_ACK_N_BIT) {
+    ++len;
+  }
+
+  if (payloadlen < len) {
+    return 0;
+  }
+
+  if (type & NGTCP2_ACK_N_BIT) {
+    num_blks = *p++;
+  }
+
+  num_ts = *p;
+
+  abllen = (size_t)(1 << (type & NGTCP2_ACK_MM_MASK));
+
+  len += (size_t)(1 << ((type & NGTCP2_ACK_LL_MASK) >> 2));
+  len += abllen + num_blks * (1 + abllen);
+
+  if (num_ts > 0) {
+    len += num_ts * 3 + 2;
+  }
+
+  return len;
+}
+
+/*
+ * padding_len returns the length of contiguous PADDING frames at the
+ * beginning of |payload| of length |payloadlen|.
+ */
+static size_t padding_len(const uint8_t *payload, size_t payloadlen) {
+  size_t i = 0;
+  uint64_t w;
+
+  /* PADDING frame is a single 0 byte, so that 8 of them are compared
+     at once. */
+  for (; i + sizeof(w) <= payloadlen; i += sizeof(w)) {
+    memcpy(&w, payload + i, sizeof(w));
+    if (w) {
+      break;
+    }
+  }
+
+  for (; i < payloadlen && payload[i] == NGTCP2_FRAME_PADDING; ++i)
+    ;
+
+  return i;
+}
+
+ssize_t ngtcp2_frame_iter_next(ngtcp2_frame_iter *it, ngtcp2_frame_view *dest) {
+  const uint8_t *p = it->payload;
+  uint8_t type;
+  size_t len;
+
+  if (it->payloadlen == 0) {
+    return 0;
+  }
+
+  type = p[0];
+
+  if (has_mask(type, NGTCP2_FRAME_STREAM)) {
+    type = NGTCP2_FRAME_STREAM;
+    len = stream_frame_len(p, it->payloadlen);
+  } else if (has_mask(type, NGTCP2_FRAME_ACK)) {
+    type = NGTCP2_FRAME_ACK;
+    len = ack_frame_len(p, it->payloadlen);
+  } else {
+    switch (type) {
+    case NGTCP2_FRAME_PADDING:
+      len = padding_len(p, it->payloadlen);
+      break;
+    case NGTCP2_FRAME_RST_STREAM:
+      len = 1 + 4 + 4 + 8;
+      break;
+    case NGTCP2_FRAME_CONNECTION_CLOSE:
+      len = 1 + 4 + 2;
+      if (it->payloadlen >= len) {
+        len += ngtcp2_get_uint16(p + 1 + 4);
+      }
+      break;
+    case NGTCP2_FRAME_GOAWAY:
+      len = 1 + 4 + 4;
+      break;
+    case NGTCP2_FRAME_MAX_DATA:
+      len = 1 + 8;
+      break;
+    case NGTCP2_FRAME_MAX_STREAM_DATA:
+      len = 1 + 4 + 8;
+      break;
+    case NGTCP2_FRAME_MAX_STREAM_ID:
+    case NGTCP2_FRAME_STREAM_BLOCKED:
+      len = 1 + 4;
+      break;
+    case NGTCP2_FRAME_PING:
+    case NGTCP2_FRAME_BLOCKED:
+    case NGTCP2_FRAME_STREAM_ID_NEEDED:
+      len = 1;
+      break;
+    case NGTCP2_FRAME_NEW_CONNECTION_ID:
+      len = 1 + 2 + 8;
+      break;
+    default:
+      return NGTCP2_ERR_INVALID_ARGUMENT;
+    }
+  }
+
+  if (len == 0 || it->payloadlen < len) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  dest->type = type;
+  dest->data = it->payload;
+  dest->datalen = len;
+
+  it->payload += len;
+  it->payloadlen -= len;
+
+  return (ssize_t)len;
+}
+
 ssize_t ngtcp2_pkt_decode_stream_frame(ngtcp2_stream *dest,
                                        const uint8_t *payload,
                                        size_t payloadlen) {
@@ -404,8 +575,8 @@ ssize_t ngtcp2_pkt_decode_stream_frame(ngtcp2_stream *dest,
   }
 }
 
-ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
-                                    size_t payloadlen,
+ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, ngtcp2_ack_blk *blks,
+                                    const uint8_t *payload, size_t payloadlen,
                                     uint64_t max_rx_pkt_num) {
   uint8_t type;
   size_t num_blks = 0;
@@ -488,6 +659,7 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
   dest->type = NGTCP2_FRAME_ACK;
   dest->flags = (uint8_t)(type & ~NGTCP2_FRAME_ACK);
   dest->num_blks = num_blks;
+  dest->blks = blks;
   dest->num_ts = num_ts;
 
   switch (lalen) {
@@ -516,7 +688,7 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
   case 1:
     dest->first_ack_blklen = *p++;
     for (i = 0; i < num_blks; ++i) {
-      blk = &dest->blks[i];
+      blk = &blks[i];
       blk->gap = *p++;
       blk->blklen = *p++;
     }
@@ -525,7 +697,7 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
     dest->first_ack_blklen = ngtcp2_get_uint16(p);
     p += abllen;
     for (i = 0; i < num_blks; ++i) {
-      blk = &dest->blks[i];
+      blk = &blks[i];
       blk->gap = *p++;
       blk->blklen = ngtcp2_get_uint16(p);
       p += abllen;
@@ -535,7 +707,7 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
     dest->first_ack_blklen = ngtcp2_get_uint32(p);
     p += abllen;
     for (i = 0; i < num_blks; ++i) {
-      blk = &dest->blks[i];
+      blk = &blks[i];
       blk->gap = *p++;
       blk->blklen = ngtcp2_get_uint32(p);
       p += abllen;
@@ -545,7 +717,7 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
     dest->first_ack_blklen = ngtcp2_get_uint64(p);
     p += abllen;
     for (i = 0; i < num_blks; ++i) {
-      blk = &dest->blks[i];
+      blk = &blks[i];
       blk->gap = *p++;
       blk->blklen = ngtcp2_get_uint64(p);
       p += abllen;
@@ -567,22 +739,18 @@ ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
 ssize_t ngtcp2_pkt_decode_padding_frame(ngtcp2_padding *dest,
                                         const uint8_t *payload,
                                         size_t payloadlen) {
-  const uint8_t *p, *ep;
+  size_t len;
 
   if (payloadlen == 0 || payload[0] != NGTCP2_FRAME_PADDING) {
     return NGTCP2_ERR_INVALID_ARGUMENT;
   }
 
-  p = payload + 1;
-  ep = payload + payloadlen;
-
-  for (; p != ep && *p == NGTCP2_FRAME_PADDING; ++p)
-    ;
+  len = padding_len(payload, payloadlen);
 
   dest->type = NGTCP2_FRAME_PADDING;
-  dest->len = (size_t)(p - payload);
+  dest->len = len;
 
-  return p - payload;
+  return (ssize_t)len;
 }
 
 ssize_t ngtcp2_pkt_decode_rst_stream_frame(ngtcp2_rst_stream *dest,
@@ -130,6 +130,51 @@ size_t ngtcp2_pkt_decode_version_negotiation(uint32_t *dest,
                                              const uint8_t *payload,
                                              size_t payloadlen);
 
+/*
+ * ngtcp2_frame_iter iterates over the frames in a decrypted packet
+ * payload without decoding them.  It only reads the fields which are
+ * required to find the end of each frame, so that the frames which
+ * nobody looks at cost little more than a bounds check.
+ */
+typedef struct {
+  const uint8_t *payload;
+  size_t payloadlen;
+} ngtcp2_frame_iter;
+
+/*
+ * ngtcp2_frame_view refers to a frame found by ngtcp2_frame_iter.
+ */
+typedef struct {
+  /* type is the frame type with the flag bits of STREAM and ACK
+     frames cleared.  It is one of ngtcp2_frame_type. */
+  uint8_t type;
+  /* data points to the first byte of the frame, and datalen is the
+     length of the frame.  ngtcp2_pkt_decode_frame decodes it. */
+  const uint8_t *data;
+  size_t datalen;
+} ngtcp2_frame_view;
+
+/*
+ * ngtcp2_frame_iter_init initializes |it| to iterate over the frames
+ * in |payload| of length |payloadlen|.  |payload| must outlive |it|.
+ */
+void ngtcp2_frame_iter_init(ngtcp2_frame_iter *it, const uint8_t *payload,
+                            size_t payloadlen);
+
+/*
+ * ngtcp2_frame_iter_next finds the next frame, and stores it in
+ * |dest|.  Contiguous PADDING frames are returned as one frame.
+ *
+ * This function returns the length of the frame if it succeeds, 0 if
+ * there are no frames left, or one of the following negative error
+ * codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     Frame type is unknown; or payload is too short to include the
+ *     frame
+ */
+ssize_t ngtcp2_frame_iter_next(ngtcp2_frame_iter *it, ngtcp2_frame_view *dest);
+
 /*
  * ngtcp2_pkt_decode_stream_frame decodes STREAM frame from |payload|
  * of length |payloadlen|.  The result is stored in the object pointed
@@ -149,7 +194,9 @@ ssize_t ngtcp2_pkt_decode_stream_frame(ngtcp2_stream *dest,
 /*
  * ngtcp2_pkt_decode_ack_frame decodes ACK frame from |payload| of
  * length |payloadlen|.  The result is stored in the object pointed by
- * |dest|.  ACK frame must start at `payload[0]`.  This function
+ * |dest|, and its additional ACK blocks are written to |blks| which
+ * must have room for NGTCP2_MAX_NUM_ACK_BLK blocks.  dest->blks is
+ * set to |blks|.  ACK frame must start at `payload[0]`.  This function
  * returns when it decodes one ACK frame, and returns the exact number
  * of bytes for one ACK frame if it succeeds, or one of the following
  * negative error codes:
@@ -158,8 +205,9 @@ ssize_t ngtcp2_pkt_decode_stream_frame(ngtcp2_stream *dest,
  *     Type indicates that payload does not include ACK frame; or
  *     Payload is too short to include ACK frame
  */
-ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, const uint8_t *payload,
-                                    size_t payloadlen, uint64_t max_rx_pkt_num);
+ssize_t ngtcp2_pkt_decode_ack_frame(ngtcp2_ack *dest, ngtcp2_ack_blk *blks,
+                                    const uint8_t *payload, size_t payloadlen,
+                                    uint64_t max_rx_pkt_num);
 
 /*
  * ngtcp2_pkt_decode_padding_frame decodes contiguous PADDING frames
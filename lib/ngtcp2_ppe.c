@@ -23,6 +23,9 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #include "ngtcp2_ppe.h"
+
+#include <string.h>
+
 #include "ngtcp2_pkt.h"
 #include "ngtcp2_str.h"
 #include "ngtcp2_conv.h"
@@ -64,7 +67,7 @@ int ngtcp2_ppe_encode_frame(ngtcp2_ppe *ppe, const ngtcp2_frame *fr) {
   ssize_t rv;
   ngtcp2_buf *buf = &ppe->buf;
 
-  rv = ngtcp2_pkt_encode_frame(buf->last, ngtcp2_buf_left(buf), fr);
+  rv = ngtcp2_pkt_encode_frame(buf->last, ngtcp2_ppe_left(ppe), fr);
   if (rv < 0) {
     return (int)rv;
   }
@@ -102,3 +105,23 @@ ssize_t ngtcp2_ppe_final(ngtcp2_ppe *ppe, const uint8_t **ppkt) {
 
   return (ssize_t)ngtcp2_buf_len(buf);
 }
+
+size_t ngtcp2_ppe_left(ngtcp2_ppe *ppe) {
+  ngtcp2_crypto_ctx *ctx = ppe->ctx;
+
+  if (ngtcp2_buf_left(&ppe->buf) < ctx->aead_overhead) {
+    return 0;
+  }
+
+  return ngtcp2_buf_left(&ppe->buf) - ctx->aead_overhead;
+}
+
+size_t ngtcp2_ppe_padding(ngtcp2_ppe *ppe) {
+  ngtcp2_buf *buf = &ppe->buf;
+  size_t len = ngtcp2_ppe_left(ppe);
+
+  memset(buf->last, 0, len);
+  buf->last += len;
+
+  return len;
+}
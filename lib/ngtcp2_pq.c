@@ -117,11 +117,15 @@ static void bubble_down(ngtcp2_pq *pq, size_t index) {
 }
 
 void ngtcp2_pq_pop(ngtcp2_pq *pq) {
+  ngtcp2_pq_entry *top;
+
   if (pq->length > 0) {
+    top = pq->q[0];
     pq->q[0] = pq->q[pq->length - 1];
     pq->q[0]->index = 0;
     --pq->length;
     bubble_down(pq, 0);
+    top->index = NGTCP2_PQ_BAD_INDEX;
   }
 }
 
@@ -135,6 +139,7 @@ void ngtcp2_pq_remove(ngtcp2_pq *pq, ngtcp2_pq_entry *item) {
 
   if (item->index == pq->length - 1) {
     --pq->length;
+    item->index = NGTCP2_PQ_BAD_INDEX;
     return;
   }
 
@@ -147,6 +152,8 @@ void ngtcp2_pq_remove(ngtcp2_pq *pq, ngtcp2_pq_entry *item) {
   } else {
     bubble_up(pq, item->index);
   }
+
+  item->index = NGTCP2_PQ_BAD_INDEX;
 }
 
 int ngtcp2_pq_empty(ngtcp2_pq *pq) { return pq->length == 0; }
@@ -39,6 +39,10 @@
 /* "less" function, return nonzero if |lhs| is less than |rhs|. */
 typedef int (*ngtcp2_less)(const void *lhs, const void *rhs);
 
+/* NGTCP2_PQ_BAD_INDEX is the index assigned to the item which is not
+   in priority queue. */
+#define NGTCP2_PQ_BAD_INDEX SIZE_MAX
+
 typedef struct { size_t index; } ngtcp2_pq_entry;
 
 typedef struct {
@@ -91,7 +95,8 @@ ngtcp2_pq_entry *ngtcp2_pq_top(ngtcp2_pq *pq);
 
 /*
  * Pops item at the top of the queue |pq|. The popped item is not
- * freed by this function.
+ * freed by this function.  The index of popped item is set to
+ * NGTCP2_PQ_BAD_INDEX.
  */
 void ngtcp2_pq_pop(ngtcp2_pq *pq);
 
@@ -125,7 +130,8 @@ void ngtcp2_pq_update(ngtcp2_pq *pq, ngtcp2_pq_item_cb fun, void *arg);
 int ngtcp2_pq_each(ngtcp2_pq *pq, ngtcp2_pq_item_cb fun, void *arg);
 
 /*
- * Removes |item| from priority queue.
+ * Removes |item| from priority queue.  The index of |item| is set to
+ * NGTCP2_PQ_BAD_INDEX.
  */
 void ngtcp2_pq_remove(ngtcp2_pq *pq, ngtcp2_pq_entry *item);
 
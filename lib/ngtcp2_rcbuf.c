@@ -0,0 +1,45 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_rcbuf.h"
+
+#include <assert.h>
+
+void ngtcp2_rcbuf_init(ngtcp2_rcbuf *rcbuf, uint8_t *base, size_t len,
+                       ngtcp2_rcbuf_free free) {
+  rcbuf->base = base;
+  rcbuf->len = len;
+  rcbuf->ref = 1;
+  rcbuf->free = free;
+}
+
+void ngtcp2_rcbuf_incref(ngtcp2_rcbuf *rcbuf) { ++rcbuf->ref; }
+
+void ngtcp2_rcbuf_decref(ngtcp2_rcbuf *rcbuf) {
+  assert(rcbuf->ref > 0);
+
+  if (--rcbuf->ref == 0) {
+    rcbuf->free(rcbuf);
+  }
+}
@@ -0,0 +1,79 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_RCBUF_H
+#define NGTCP2_RCBUF_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+struct ngtcp2_rcbuf;
+typedef struct ngtcp2_rcbuf ngtcp2_rcbuf;
+
+/*
+ * ngtcp2_rcbuf_free is called when the last reference to |rcbuf| is
+ * dropped.  It must release the buffer and |rcbuf| itself.
+ */
+typedef void (*ngtcp2_rcbuf_free)(ngtcp2_rcbuf *rcbuf);
+
+/*
+ * ngtcp2_rcbuf is a reference counted buffer which is owned by
+ * someone else.  It lets the objects which point into the buffer
+ * keep it alive without copying.  It is usually embedded in a larger
+ * object which knows how to release the buffer.
+ */
+struct ngtcp2_rcbuf {
+  /* base points to the buffer. */
+  uint8_t *base;
+  /* len is the length of the buffer. */
+  size_t len;
+  /* ref is the reference count. */
+  size_t ref;
+  ngtcp2_rcbuf_free free;
+};
+
+/*
+ * ngtcp2_rcbuf_init initializes |rcbuf| with the buffer pointed by
+ * |base| of length |len|.  The reference count starts from 1.
+ * |free| is called when it drops to 0.
+ */
+void ngtcp2_rcbuf_init(ngtcp2_rcbuf *rcbuf, uint8_t *base, size_t len,
+                       ngtcp2_rcbuf_free free);
+
+/*
+ * ngtcp2_rcbuf_incref increments the reference count of |rcbuf|.
+ */
+void ngtcp2_rcbuf_incref(ngtcp2_rcbuf *rcbuf);
+
+/*
+ * ngtcp2_rcbuf_decref decrements the reference count of |rcbuf|, and
+ * calls rcbuf->free if it drops to 0.  |rcbuf| must not be used after
+ * that.
+ */
+void ngtcp2_rcbuf_decref(ngtcp2_rcbuf *rcbuf);
+
+#endif /* NGTCP2_RCBUF_H */
@@ -37,7 +37,6 @@ int ngtcp2_rob_gap_new(ngtcp2_rob_gap **pg, uint64_t begin, uint64_t end,
   }
 
   ngtcp2_range_init(&(*pg)->range, begin, end);
-  (*pg)->next = NULL;
 
   return 0;
 }
@@ -56,208 +55,407 @@ int ngtcp2_rob_data_new(ngtcp2_rob_data **pd, uint64_t offset, size_t chunk,
   (*pd)->begin = (uint8_t *)(*pd) + sizeof(ngtcp2_rob_data);
   (*pd)->end = (*pd)->begin + chunk;
   (*pd)->offset = offset;
-  (*pd)->next = NULL;
+  (*pd)->rcbuf = NULL;
+
+  return 0;
+}
+
+int ngtcp2_rob_data_ref_new(ngtcp2_rob_data **pd, uint64_t offset,
+                            const uint8_t *data, size_t datalen,
+                            ngtcp2_rcbuf *rcbuf, ngtcp2_mem *mem) {
+  assert(rcbuf->base <= data);
+  assert(datalen <= rcbuf->len - (size_t)(data - rcbuf->base));
+
+  *pd = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_rob_data));
+  if (*pd == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  (*pd)->begin = rcbuf->base + (data - rcbuf->base);
+  (*pd)->end = (*pd)->begin + datalen;
+  (*pd)->offset = offset;
+  (*pd)->rcbuf = rcbuf;
+
+  ngtcp2_rcbuf_incref(rcbuf);
 
   return 0;
 }
 
 void ngtcp2_rob_data_del(ngtcp2_rob_data *d, ngtcp2_mem *mem) {
+  if (d->rcbuf) {
+    ngtcp2_rcbuf_decref(d->rcbuf);
+  }
   ngtcp2_mem_free(mem, d);
 }
 
+/*
+ * rob_data_end returns the stream offset one beyond the last byte of
+ * the buffer of |d|.
+ */
+static uint64_t rob_data_end(const ngtcp2_rob_data *d) {
+  return d->offset + (size_t)(d->end - d->begin);
+}
+
 int ngtcp2_rob_init(ngtcp2_rob *rob, size_t chunk, ngtcp2_mem *mem) {
   int rv;
+  ngtcp2_rob_gap *g;
 
-  rv = ngtcp2_rob_gap_new(&rob->gap, 0, UINT64_MAX, mem);
+  ngtcp2_ksl_init(&rob->gapksl, mem);
+  ngtcp2_ksl_init(&rob->dataksl, mem);
+
+  rv = ngtcp2_rob_gap_new(&g, 0, UINT64_MAX, mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = ngtcp2_ksl_insert(&rob->gapksl, NULL, g->range.end, g);
   if (rv != 0) {
+    ngtcp2_rob_gap_del(g, mem);
     return rv;
   }
 
-  rob->data = NULL;
   rob->chunk = chunk;
+  rob->adaptive = 0;
   rob->mem = mem;
+  rob->seg = 0;
 
   return 0;
 }
 
+void ngtcp2_rob_set_chunk(ngtcp2_rob *rob, size_t chunk, int adaptive) {
+  rob->chunk = chunk;
+  rob->adaptive = adaptive;
+}
+
 void ngtcp2_rob_free(ngtcp2_rob *rob) {
-  ngtcp2_rob_gap *g, *ng;
-  ngtcp2_rob_data *d, *nd;
+  ngtcp2_ksl_node *node;
 
   if (rob == NULL) {
     return;
   }
 
-  for (g = rob->gap; g;) {
-    ng = g->next;
-    ngtcp2_rob_gap_del(g, rob->mem);
-    g = ng;
+  for (node = ngtcp2_ksl_front(&rob->gapksl); node; node = node->next[0]) {
+    ngtcp2_rob_gap_del(node->data, rob->mem);
   }
-  for (d = rob->data; d;) {
-    nd = d->next;
-    ngtcp2_rob_data_del(d, rob->mem);
-    d = nd;
+  for (node = ngtcp2_ksl_front(&rob->dataksl); node; node = node->next[0]) {
+    ngtcp2_rob_data_del(node->data, rob->mem);
   }
+
+  ngtcp2_ksl_free(&rob->gapksl);
+  ngtcp2_ksl_free(&rob->dataksl);
 }
 
-static void insert_gap(ngtcp2_rob_gap **pg, ngtcp2_rob_gap *g) {
-  g->next = (*pg)->next;
-  (*pg)->next = g;
+/*
+ * rob_write_seg adds a segment which holds |data| of length |len| at
+ * stream offset |offset|.  If |rcbuf| is not NULL, the segment
+ * refers to |data| in it.  Otherwise, |data| is copied.
+ */
+static int rob_write_seg(ngtcp2_rob *rob, uint64_t offset,
+                         const uint8_t *data, size_t len,
+                         ngtcp2_rcbuf *rcbuf) {
+  int rv;
+  ngtcp2_rob_data *d;
+
+  if (rcbuf) {
+    rv = ngtcp2_rob_data_ref_new(&d, offset, data, len, rcbuf, rob->mem);
+    if (rv != 0) {
+      return rv;
+    }
+  } else {
+    rv = ngtcp2_rob_data_new(&d, offset, len, rob->mem);
+    if (rv != 0) {
+      return rv;
+    }
+    memcpy(d->begin, data, len);
+  }
+
+  /* offset was in a gap, so that no other segment starts there. */
+  rv = ngtcp2_ksl_insert(&rob->dataksl, NULL, offset, d);
+  if (rv != 0) {
+    ngtcp2_rob_data_del(d, rob->mem);
+    return rv;
+  }
+
+  return 0;
 }
 
-static void remove_gap(ngtcp2_rob_gap **pg, ngtcp2_mem *mem) {
-  ngtcp2_rob_gap *g = *pg;
-  *pg = g->next;
-  ngtcp2_rob_gap_del(g, mem);
+/*
+ * rob_chunk_size returns the size of a new chunk which starts to
+ * store |len| bytes of data at stream offset |offset|.  |prev| is the
+ * chunk before |offset|, or NULL.
+ *
+ * If adaptive sizing is enabled, the chunk is just large enough for
+ * the data, so that sparse data does not waste memory.  The chunk
+ * which continues the previous one is twice as large as that, so
+ * that bulk data is stored in fewer, larger chunks.
+ */
+static size_t rob_chunk_size(ngtcp2_rob *rob, ngtcp2_ksl_node *prev,
+                             uint64_t offset, size_t len) {
+  size_t size = NGTCP2_ROB_MIN_CHUNK;
+  ngtcp2_rob_data *d;
+
+  if (!rob->adaptive) {
+    return rob->chunk;
+  }
+
+  for (; size < len && size < rob->chunk; size <<= 1)
+    ;
+
+  if (prev) {
+    d = prev->data;
+    if (rob_data_end(d) == offset) {
+      size = ngtcp2_max(size, (size_t)(d->end - d->begin) * 2);
+    }
+  }
+
+  return ngtcp2_min(size, rob->chunk);
 }
 
-static void remove_data(ngtcp2_rob_data **pd, ngtcp2_mem *mem) {
-  ngtcp2_rob_data *d = *pd;
-  *pd = d->next;
-  ngtcp2_rob_data_del(d, mem);
+/*
+ * rob_new_chunk allocates a chunk which stores data at stream offset
+ * |offset|, and assigns its node to |*pnode|.  |prev| is the chunk
+ * before |offset|, or NULL.  The chunk is aligned to its size, but
+ * it is trimmed so that it does not overlap the other chunks.
+ */
+static int rob_new_chunk(ngtcp2_rob *rob, ngtcp2_ksl_node **pnode,
+                         ngtcp2_ksl_node *prev, uint64_t offset, size_t len) {
+  int rv;
+  ngtcp2_rob_data *d;
+  ngtcp2_ksl_node *next =
+      prev ? prev->next[0] : ngtcp2_ksl_front(&rob->dataksl);
+  size_t size = rob_chunk_size(rob, prev, offset, len);
+  uint64_t begin = offset - offset % size, end;
+
+  if (prev) {
+    begin = ngtcp2_max(begin, rob_data_end(prev->data));
+  }
+
+  end = begin + size;
+  if (next) {
+    end = ngtcp2_min(end, next->key);
+  }
+
+  rv = ngtcp2_rob_data_new(&d, begin, (size_t)(end - begin), rob->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = ngtcp2_ksl_insert(&rob->dataksl, pnode, begin, d);
+  if (rv != 0) {
+    ngtcp2_rob_data_del(d, rob->mem);
+    return rv;
+  }
+
+  return 0;
 }
 
-static int rob_write_data(ngtcp2_rob *rob, ngtcp2_rob_data **pd,
-                          uint64_t offset, const uint8_t *data, size_t len) {
+/*
+ * rob_write_data stores |data| of length |len| at stream offset
+ * |offset|.  It is copied to the chunks, which are allocated if they
+ * do not exist, unless |rob| holds segments.
+ */
+static int rob_write_data(ngtcp2_rob *rob, uint64_t offset,
+                          const uint8_t *data, size_t len,
+                          ngtcp2_rcbuf *rcbuf) {
   size_t n;
   int rv;
-  ngtcp2_rob_data *nd;
+  ngtcp2_rob_data *d;
+  ngtcp2_ksl_node *node, *prev = NULL;
+
+  if (ngtcp2_ksl_len(&rob->dataksl) == 0) {
+    rob->seg = rcbuf != NULL;
+  }
+
+  if (rob->seg) {
+    return rob_write_seg(rob, offset, data, len, rcbuf);
+  }
+
+  /* The chunks may have different sizes, and the one which contains
+     offset, if any, is the last one which starts at or before it. */
+  node = ngtcp2_ksl_floor(&rob->dataksl, offset);
+  if (node && rob_data_end(node->data) <= offset) {
+    prev = node;
+    node = NULL;
+  }
 
   for (;;) {
-    if (*pd == NULL || offset < (*pd)->offset) {
-      rv = ngtcp2_rob_data_new(&nd, (offset / rob->chunk) * rob->chunk,
-                               rob->chunk, rob->mem);
+    if (node == NULL) {
+      rv = rob_new_chunk(rob, &node, prev, offset, len);
       if (rv != 0) {
         return rv;
       }
-      /* insert before *pd */
-      nd->next = *pd;
-      *pd = nd;
-    } else if ((*pd)->offset + rob->chunk < offset) {
-      pd = &(*pd)->next;
-      continue;
     }
-    n = ngtcp2_min(len, (*pd)->offset + rob->chunk - offset);
-    memcpy((*pd)->begin + (offset - (*pd)->offset), data, n);
+
+    d = node->data;
+    n = ngtcp2_min(len, rob_data_end(d) - offset);
+    memcpy(d->begin + (offset - d->offset), data, n);
     offset += n;
     data += n;
     len -= n;
     if (len == 0) {
       return 0;
     }
-    pd = &(*pd)->next;
-  }
 
-  return 0;
+    prev = node;
+    node = node->next[0];
+    if (node && node->key != offset) {
+      node = NULL;
+    }
+  }
 }
 
-int ngtcp2_rob_push(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
-                    size_t datalen) {
+/*
+ * rob_push is the implementation of ngtcp2_rob_push and
+ * ngtcp2_rob_push_ref.  |rcbuf| is NULL if the data is copied.
+ */
+static int rob_push(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
+                    size_t datalen, ngtcp2_rcbuf *rcbuf) {
   int rv;
-  ngtcp2_rob_gap **pg;
+  ngtcp2_rob_gap *g, *ng;
+  ngtcp2_ksl_node *node, *next;
   ngtcp2_range m, l, r, q = {offset, offset + datalen};
-  ngtcp2_rob_data **pd = &rob->data;
-
-  for (pg = &rob->gap; *pg;) {
-    m = ngtcp2_range_intersect(&q, &(*pg)->range);
-    if (ngtcp2_range_len(&m)) {
-      if (ngtcp2_range_equal(&(*pg)->range, &m)) {
-        remove_gap(pg, rob->mem);
-        rv = rob_write_data(rob, pd, m.begin, data + (m.begin - offset),
-                            ngtcp2_range_len(&m));
+
+  if (datalen == 0) {
+    return 0;
+  }
+
+  /* The first gap which can overlap the data is the first one which
+     ends after offset. */
+  for (node = ngtcp2_ksl_lower_bound(&rob->gapksl, offset + 1); node;
+       node = next) {
+    g = node->data;
+    next = node->next[0];
+
+    m = ngtcp2_range_intersect(&q, &g->range);
+    if (!ngtcp2_range_len(&m)) {
+      break;
+    }
+
+    if (ngtcp2_range_equal(&g->range, &m)) {
+      ngtcp2_ksl_remove(&rob->gapksl, node->key);
+      ngtcp2_rob_gap_del(g, rob->mem);
+      rv = rob_write_data(rob, m.begin, data + (m.begin - offset),
+                          ngtcp2_range_len(&m), rcbuf);
+      if (rv != 0) {
+        return rv;
+      }
+      continue;
+    }
+
+    ngtcp2_range_cut(&l, &r, &g->range, &m);
+    if (ngtcp2_range_len(&l)) {
+      if (ngtcp2_range_len(&r)) {
+        /* The gap is split into 2.  The right one keeps the key. */
+        rv = ngtcp2_rob_gap_new(&ng, l.begin, l.end, rob->mem);
         if (rv != 0) {
           return rv;
         }
-        continue;
-      }
-      ngtcp2_range_cut(&l, &r, &(*pg)->range, &m);
-      if (ngtcp2_range_len(&l)) {
-        (*pg)->range = l;
-
-        if (ngtcp2_range_len(&r)) {
-          ngtcp2_rob_gap *ng;
-          rv = ngtcp2_rob_gap_new(&ng, r.begin, r.end, rob->mem);
-          if (rv != 0) {
-            return rv;
-          }
-          insert_gap(pg, ng);
-          pg = &((*pg)->next);
+        rv = ngtcp2_ksl_insert(&rob->gapksl, NULL, l.end, ng);
+        if (rv != 0) {
+          ngtcp2_rob_gap_del(ng, rob->mem);
+          return rv;
         }
-      } else if (ngtcp2_range_len(&r)) {
-        (*pg)->range = r;
-      }
-      rv = rob_write_data(rob, pd, m.begin, data + (m.begin - offset),
-                          ngtcp2_range_len(&m));
-      if (rv != 0) {
-        return rv;
+        g->range = r;
+      } else {
+        g->range = l;
+        ngtcp2_ksl_update_key(&rob->gapksl, node, l.end);
       }
+    } else if (ngtcp2_range_len(&r)) {
+      g->range = r;
+    }
+
+    rv = rob_write_data(rob, m.begin, data + (m.begin - offset),
+                        ngtcp2_range_len(&m), rcbuf);
+    if (rv != 0) {
+      return rv;
     }
-    if (ngtcp2_range_not_after(&q, &(*pg)->range)) {
+
+    if (ngtcp2_range_not_after(&q, &g->range)) {
       break;
     }
-    pg = &((*pg)->next);
   }
+
   return 0;
 }
 
+int ngtcp2_rob_push(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
+                    size_t datalen) {
+  return rob_push(rob, offset, data, datalen, NULL);
+}
+
+int ngtcp2_rob_push_ref(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
+                        size_t datalen, ngtcp2_rcbuf *rcbuf) {
+  return rob_push(rob, offset, data, datalen, rcbuf);
+}
+
 void ngtcp2_rob_remove_prefix(ngtcp2_rob *rob, uint64_t offset) {
-  ngtcp2_rob_gap **pg;
-  ngtcp2_rob_data **pd;
+  ngtcp2_ksl_node *node;
+  ngtcp2_rob_gap *g;
+  ngtcp2_rob_data *d;
 
-  for (pg = &rob->gap; *pg;) {
-    if (offset <= (*pg)->range.begin) {
+  for (; (node = ngtcp2_ksl_front(&rob->gapksl)) != NULL;) {
+    g = node->data;
+    if (offset <= g->range.begin) {
       break;
     }
-    if (offset < (*pg)->range.end) {
-      (*pg)->range.begin = offset;
+    if (offset < g->range.end) {
+      g->range.begin = offset;
       break;
     }
-    remove_gap(pg, rob->mem);
+    ngtcp2_rob_gap_del(g, rob->mem);
+    ngtcp2_ksl_pop_front(&rob->gapksl);
   }
 
-  for (pd = &rob->data; *pd;) {
-    if (offset <= (*pd)->offset) {
-      return;
-    }
-    if (offset < (*pd)->offset + rob->chunk) {
+  for (; (node = ngtcp2_ksl_front(&rob->dataksl)) != NULL;) {
+    d = node->data;
+    if (offset < rob_data_end(d)) {
       return;
     }
-    remove_data(pd, rob->mem);
+    ngtcp2_rob_data_del(d, rob->mem);
+    ngtcp2_ksl_pop_front(&rob->dataksl);
   }
 }
 
 size_t ngtcp2_rob_data_at(ngtcp2_rob *rob, const uint8_t **pdest,
                           uint64_t offset) {
-  ngtcp2_rob_gap *g = rob->gap;
-  ngtcp2_rob_data *d = rob->data;
+  ngtcp2_rob_gap *g = ngtcp2_ksl_front(&rob->gapksl)->data;
+  ngtcp2_rob_data *d;
 
   if (g->range.begin <= offset) {
     return 0;
   }
 
+  d = ngtcp2_ksl_front(&rob->dataksl)->data;
+
   assert(d->offset <= offset);
-  assert(offset < d->offset + rob->chunk);
+  assert(offset < rob_data_end(d));
 
   *pdest = d->begin + (offset - d->offset);
 
-  return ngtcp2_min(g->range.begin, d->offset + rob->chunk) - offset;
+  return ngtcp2_min(g->range.begin, rob_data_end(d)) - offset;
 }
 
 void ngtcp2_rob_pop(ngtcp2_rob *rob, uint64_t offset, size_t len) {
-  ngtcp2_rob_data **pd = &rob->data;
+  ngtcp2_ksl_node *node = ngtcp2_ksl_front(&rob->dataksl);
+  ngtcp2_rob_data *d;
+
+  assert(node);
 
-  assert(*pd);
+  d = node->data;
 
-  if (offset + len < (*pd)->offset + rob->chunk) {
+  if (offset + len < rob_data_end(d)) {
     return;
   }
 
-  remove_data(pd, rob->mem);
+  ngtcp2_rob_data_del(d, rob->mem);
+  ngtcp2_ksl_pop_front(&rob->dataksl);
 }
 
 uint64_t ngtcp2_rob_first_gap_offset(ngtcp2_rob *rob) {
-  if (rob->gap) {
-    return rob->gap->range.begin;
+  ngtcp2_ksl_node *node = ngtcp2_ksl_front(&rob->gapksl);
+
+  if (node) {
+    return ((ngtcp2_rob_gap *)node->data)->range.begin;
   }
   return UINT64_MAX;
 }
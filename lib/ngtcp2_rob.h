@@ -33,6 +33,12 @@
 
 #include "ngtcp2_mem.h"
 #include "ngtcp2_range.h"
+#include "ngtcp2_ksl.h"
+#include "ngtcp2_rcbuf.h"
+
+/* NGTCP2_ROB_MIN_CHUNK is the size of the smallest chunk which is
+   allocated if the chunk size is adaptive. */
+#define NGTCP2_ROB_MIN_CHUNK 256
 
 struct ngtcp2_rob_gap;
 typedef struct ngtcp2_rob_gap ngtcp2_rob_gap;
@@ -42,10 +48,6 @@ typedef struct ngtcp2_rob_gap ngtcp2_rob_gap;
  * data that is not received yet.
  */
 struct ngtcp2_rob_gap {
-  /* next points to the next gap.  This singly linked list is ordered
-     by range.begin in the increasing order, and they never
-     overlap. */
-  ngtcp2_rob_gap *next;
   /* range is the range of this gap. */
   ngtcp2_range range;
 };
@@ -79,15 +81,15 @@ typedef struct ngtcp2_rob_data ngtcp2_rob_data;
  * ngtcp2_rob_data holds the buffered stream data.
  */
 struct ngtcp2_rob_data {
-  /* next points to the next data.  This singly linked list is ordered
-     by offset in the increasing order, and they never overlap. */
-  ngtcp2_rob_data *next;
   /* begin points to the buffer. */
   uint8_t *begin;
   /* end points to the one beyond of the last byte of the buffer */
   uint8_t *end;
   /* offset is a stream offset of begin. */
   uint64_t offset;
+  /* rcbuf is the packet buffer which begin points into, or NULL if
+     the buffer is allocated with this object. */
+  ngtcp2_rcbuf *rcbuf;
 };
 
 /*
@@ -95,8 +97,8 @@ struct ngtcp2_rob_data {
  * assigns its pointer to |*pd|.  The caller should call
  * ngtcp2_rob_data_del to delete it when it is no longer used.
  * |offset| is the stream offset of the first byte of this data.
- * |chunk| is the size of the buffer.  |offset| must be multiple of
- * |chunk|.  |mem| is custom memory allocator to allocate memory.
+ * |chunk| is the size of the buffer.  |mem| is custom memory
+ * allocator to allocate memory.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -107,28 +109,60 @@ struct ngtcp2_rob_data {
 int ngtcp2_rob_data_new(ngtcp2_rob_data **pd, uint64_t offset, size_t chunk,
                         ngtcp2_mem *mem);
 
+/*
+ * ngtcp2_rob_data_ref_new allocates new ngtcp2_rob_data object which
+ * refers to |data| of length |datalen| in |rcbuf| instead of copying
+ * it, and assigns its pointer to |*pd|.  It takes a reference to
+ * |rcbuf|.  |offset| is the stream offset of the first byte of
+ * |data|.  |mem| is custom memory allocator to allocate memory.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory.
+ */
+int ngtcp2_rob_data_ref_new(ngtcp2_rob_data **pd, uint64_t offset,
+                            const uint8_t *data, size_t datalen,
+                            ngtcp2_rcbuf *rcbuf, ngtcp2_mem *mem);
+
 /*
  * ngtcp2_rob_data_del deallocates |d|.  It deallocates the memory
- * pointed by |d| itself.  |mem| is custom memory allocator to
- * deallocate memory.
+ * pointed by |d| itself, and drops the reference to d->rcbuf if any.
+ * |mem| is custom memory allocator to deallocate memory.
  */
 void ngtcp2_rob_data_del(ngtcp2_rob_data *d, ngtcp2_mem *mem);
 
 /*
  * ngtcp2_rob is the reorder buffer which reassembles stream data
- * received in out of order.
+ * received in out of order.  The gaps and the buffers are kept in
+ * skip lists, so that the position of new data is found in O(log n)
+ * even if the data is heavily reordered.
  */
 typedef struct {
-  /* gap maintains the range of offset which is not received
-     yet. Initially, its range is [0, UINT64_MAX). */
-  ngtcp2_rob_gap *gap;
-  /* data maintains the list of buffers which store received data
-     ordered by stream offset. */
-  ngtcp2_rob_data *data;
+  /* gapksl maintains the ranges of offset which are not received
+     yet.  They never overlap, and each of them is keyed by
+     range.end, so that the first gap which ends after an offset is
+     found by a single lookup.  Initially, it contains [0,
+     UINT64_MAX). */
+  ngtcp2_ksl gapksl;
+  /* dataksl maintains the buffers which store received data, keyed
+     by their stream offset.  They are either chunks of chunk bytes
+     which the data is copied into, or segments which hold exactly
+     the data received (see seg). */
+  ngtcp2_ksl dataksl;
   /* mem is custom memory allocator */
   ngtcp2_mem *mem;
-  /* chunk is the size of each buffer in data field */
+  /* chunk is the size of each chunk in dataksl.  If adaptive is
+     nonzero, it is the upper limit of the size, and the chunks are
+     sized to fit the data. */
   size_t chunk;
+  int adaptive;
+  /* seg is nonzero if dataksl holds segments instead of chunks.  The
+     two are never mixed.  It is decided by the first data pushed
+     into the empty dataksl: segments are used if it is pushed by
+     ngtcp2_rob_push_ref. */
+  int seg;
 } ngtcp2_rob;
 
 /*
@@ -143,6 +177,14 @@ typedef struct {
  */
 int ngtcp2_rob_init(ngtcp2_rob *rob, size_t chunk, ngtcp2_mem *mem);
 
+/*
+ * ngtcp2_rob_set_chunk changes the size of the chunks allocated after
+ * this call to |chunk|.  If |adaptive| is nonzero, each chunk is
+ * sized between NGTCP2_ROB_MIN_CHUNK and |chunk| depending on the
+ * data it stores.  The chunks allocated so far are kept as they are.
+ */
+void ngtcp2_rob_set_chunk(ngtcp2_rob *rob, size_t chunk, int adaptive);
+
 /*
  * ngtcp2_rob_free frees resources allocated for |rob|.
  */
@@ -150,7 +192,8 @@ void ngtcp2_rob_free(ngtcp2_rob *rob);
 
 /*
  * ngtcp2_rob_push adds new data of length |datalen| at the stream
- * offset |offset|.
+ * offset |offset|.  The data is copied into the chunks, or into a
+ * segment of its own if |rob| holds segments.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -161,6 +204,21 @@ void ngtcp2_rob_free(ngtcp2_rob *rob);
 int ngtcp2_rob_push(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
                     size_t datalen);
 
+/*
+ * ngtcp2_rob_push_ref is like ngtcp2_rob_push, but it refers to
+ * |data| in |rcbuf| instead of copying it if |rob| has no data
+ * buffered in chunks.  |data| must point into rcbuf->base.  A
+ * reference to |rcbuf| is kept while the data is buffered.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_rob_push_ref(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
+                        size_t datalen, ngtcp2_rcbuf *rcbuf);
+
 /*
  * ngtcp2_rob_remove_prefix removes gap up to |offset|, exclusive.  It
  * also removes data buffer if it is completely included in |offset|.
@@ -0,0 +1,449 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_rtb.h"
+
+#include <string.h>
+
+#include "ngtcp2_cc.h"
+#include "ngtcp2_macro.h"
+
+int ngtcp2_frame_chain_new(ngtcp2_frame_chain **pfrc, ngtcp2_mem *mem) {
+  *pfrc = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_frame_chain));
+  if (*pfrc == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  (*pfrc)->next = NULL;
+
+  return 0;
+}
+
+int ngtcp2_frame_chain_stream_new(ngtcp2_frame_chain **pfrc,
+                                  const ngtcp2_stream *fr, ngtcp2_mem *mem) {
+  uint8_t *data;
+  size_t datalen = fr->stream_id == 0 ? fr->datalen : 0;
+
+  *pfrc = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_frame_chain) + datalen);
+  if (*pfrc == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  (*pfrc)->next = NULL;
+  (*pfrc)->fr.stream = *fr;
+
+  if (datalen) {
+    data = (uint8_t *)(*pfrc) + sizeof(ngtcp2_frame_chain);
+    memcpy(data, fr->data, datalen);
+    (*pfrc)->fr.stream.data = data;
+  }
+
+  return 0;
+}
+
+void ngtcp2_frame_chain_del(ngtcp2_frame_chain *frc, ngtcp2_mem *mem) {
+  ngtcp2_mem_free(mem, frc);
+}
+
+void ngtcp2_frame_chain_list_del(ngtcp2_frame_chain *frc, ngtcp2_mem *mem) {
+  ngtcp2_frame_chain *next;
+
+  for (; frc;) {
+    next = frc->next;
+    ngtcp2_frame_chain_del(frc, mem);
+    frc = next;
+  }
+}
+
+void ngtcp2_frame_queue_init(ngtcp2_frame_queue *q) {
+  q->head = q->tail = NULL;
+}
+
+void ngtcp2_frame_queue_free(ngtcp2_frame_queue *q, ngtcp2_mem *mem) {
+  ngtcp2_frame_chain_list_del(q->head, mem);
+  q->head = q->tail = NULL;
+}
+
+void ngtcp2_frame_queue_push(ngtcp2_frame_queue *q, ngtcp2_frame_chain *frc) {
+  frc->next = NULL;
+
+  if (q->tail) {
+    q->tail->next = frc;
+  } else {
+    q->head = frc;
+  }
+  q->tail = frc;
+}
+
+ngtcp2_frame_chain *ngtcp2_frame_queue_top(ngtcp2_frame_queue *q) {
+  return q->head;
+}
+
+void ngtcp2_frame_queue_pop(ngtcp2_frame_queue *q) {
+  ngtcp2_frame_chain *frc = q->head;
+
+  q->head = frc->next;
+  if (q->head == NULL) {
+    q->tail = NULL;
+  }
+  frc->next = NULL;
+}
+
+int ngtcp2_frame_queue_empty(ngtcp2_frame_queue *q) { return q->head == NULL; }
+
+int ngtcp2_rtb_entry_new(ngtcp2_rtb_entry **pent, uint64_t pkt_num,
+                         ngtcp2_tstamp ts, size_t pktlen,
+                         ngtcp2_frame_chain *frc, ngtcp2_mem *mem) {
+  *pent = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_rtb_entry));
+  if (*pent == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  (*pent)->next = NULL;
+  (*pent)->frc = frc;
+  (*pent)->pkt_num = pkt_num;
+  (*pent)->ts = ts;
+  (*pent)->pktlen = pktlen;
+
+  return 0;
+}
+
+void ngtcp2_rtb_entry_del(ngtcp2_rtb_entry *ent, ngtcp2_mem *mem) {
+  if (ent == NULL) {
+    return;
+  }
+
+  ngtcp2_frame_chain_list_del(ent->frc, mem);
+  ngtcp2_mem_free(mem, ent);
+}
+
+void ngtcp2_rtb_init(ngtcp2_rtb *rtb, ngtcp2_mem *mem) {
+  rtb->head = rtb->tail = NULL;
+  ngtcp2_frame_queue_init(&rtb->hs_lostq);
+  ngtcp2_frame_queue_init(&rtb->lostq);
+  ngtcp2_frame_queue_init(&rtb->ackedq);
+  rtb->largest_acked = -1;
+  rtb->loss_time = 0;
+  rtb->rto_count = 0;
+  rtb->num_entries = 0;
+  rtb->mem = mem;
+}
+
+void ngtcp2_rtb_free(ngtcp2_rtb *rtb) {
+  ngtcp2_rtb_entry *ent, *next;
+
+  for (ent = rtb->head; ent;) {
+    next = ent->next;
+    ngtcp2_rtb_entry_del(ent, rtb->mem);
+    ent = next;
+  }
+
+  ngtcp2_frame_queue_free(&rtb->hs_lostq, rtb->mem);
+  ngtcp2_frame_queue_free(&rtb->lostq, rtb->mem);
+  ngtcp2_frame_queue_free(&rtb->ackedq, rtb->mem);
+}
+
+void ngtcp2_rtb_add(ngtcp2_rtb *rtb, ngtcp2_rtb_entry *ent) {
+  ent->next = NULL;
+
+  if (rtb->tail) {
+    rtb->tail->next = ent;
+  } else {
+    rtb->head = ent;
+  }
+  rtb->tail = ent;
+
+  ++rtb->num_entries;
+}
+
+/*
+ * rtb_range is a range of packet numbers [start, end] acknowledged by
+ * a single ACK Block.
+ */
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+} rtb_range;
+
+/*
+ * rtb_on_pkt_acked moves the frames in |ent| to ackedq, and frees
+ * |ent|.
+ */
+static void rtb_on_pkt_acked(ngtcp2_rtb *rtb, ngtcp2_rtb_entry *ent,
+                             ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                             ngtcp2_tstamp ts) {
+  ngtcp2_cc_pkt pkt;
+  ngtcp2_frame_chain *frc, *next;
+
+  ccs->bytes_in_flight -= ent->pktlen;
+
+  if (cc->on_pkt_acked) {
+    pkt.pkt_num = ent->pkt_num;
+    pkt.pktlen = ent->pktlen;
+    pkt.ts_sent = ent->ts;
+
+    cc->on_pkt_acked(cc, ccs, &pkt, ts);
+  }
+
+  for (frc = ent->frc; frc;) {
+    next = frc->next;
+    ngtcp2_frame_queue_push(&rtb->ackedq, frc);
+    frc = next;
+  }
+  ent->frc = NULL;
+
+  ngtcp2_rtb_entry_del(ent, rtb->mem);
+}
+
+/*
+ * rtb_on_pkt_lost moves the frames in |ent| to the queue for
+ * retransmission, and frees |ent|.
+ */
+static void rtb_on_pkt_lost(ngtcp2_rtb *rtb, ngtcp2_rtb_entry *ent,
+                            ngtcp2_cc_stat *ccs) {
+  ngtcp2_frame_chain *frc, *next;
+
+  ccs->bytes_in_flight -= ent->pktlen;
+
+  for (frc = ent->frc; frc;) {
+    next = frc->next;
+    if (frc->fr.type == NGTCP2_FRAME_STREAM &&
+        frc->fr.stream.stream_id == 0) {
+      ngtcp2_frame_queue_push(&rtb->hs_lostq, frc);
+    } else {
+      ngtcp2_frame_queue_push(&rtb->lostq, frc);
+    }
+    frc = next;
+  }
+  ent->frc = NULL;
+
+  ngtcp2_rtb_entry_del(ent, rtb->mem);
+}
+
+/*
+ * rtb_loss_delay returns the time threshold of loss detection.
+ */
+static ngtcp2_tstamp rtb_loss_delay(ngtcp2_cc_stat *ccs) {
+  uint64_t rtt = ngtcp2_max(ccs->smoothed_rtt, ccs->latest_rtt);
+
+  return ngtcp2_max(rtt * NGTCP2_TIME_THRESHOLD_NUM / NGTCP2_TIME_THRESHOLD_DEN,
+                    NGTCP2_MIN_LOSS_DELAY);
+}
+
+void ngtcp2_rtb_detect_lost(ngtcp2_rtb *rtb, ngtcp2_cc *cc,
+                            ngtcp2_cc_stat *ccs, ngtcp2_tstamp ts) {
+  ngtcp2_rtb_entry *ent;
+  ngtcp2_tstamp ts_sent = 0;
+  ngtcp2_tstamp loss_delay = rtb_loss_delay(ccs);
+  int lost = 0;
+
+  /* Entries are sorted by packet number, and therefore by the time
+     they are sent.  The lost packets are always at the head of the
+     list. */
+  for (; rtb->head && (int64_t)rtb->head->pkt_num < rtb->largest_acked;) {
+    ent = rtb->head;
+    if ((int64_t)(ent->pkt_num + NGTCP2_PKT_THRESHOLD) > rtb->largest_acked &&
+        ent->ts + loss_delay > ts) {
+      break;
+    }
+
+    rtb->head = ent->next;
+    if (rtb->head == NULL) {
+      rtb->tail = NULL;
+    }
+    --rtb->num_entries;
+
+    lost = 1;
+    ts_sent = ngtcp2_max(ts_sent, ent->ts);
+
+    rtb_on_pkt_lost(rtb, ent, ccs);
+  }
+
+  if (rtb->head && (int64_t)rtb->head->pkt_num < rtb->largest_acked) {
+    rtb->loss_time = rtb->head->ts + loss_delay;
+  } else {
+    rtb->loss_time = 0;
+  }
+
+  if (lost && cc->congestion_event) {
+    cc->congestion_event(cc, ccs, ts_sent, ts);
+  }
+}
+
+int ngtcp2_rtb_recv_ack(ngtcp2_rtb *rtb, const ngtcp2_ack *fr, ngtcp2_cc *cc,
+                        ngtcp2_cc_stat *ccs, ngtcp2_tstamp ts) {
+  rtb_range ranges[256];
+  size_t nranges = 0, i;
+  uint64_t largest, smallest;
+  const ngtcp2_ack_blk *blk;
+  ngtcp2_rtb_entry *ent, *prev = NULL, *next;
+  ngtcp2_rtb_entry *acked = NULL, **packed = &acked;
+  ngtcp2_rtb_entry *largest_ent = NULL;
+
+  largest = fr->largest_ack;
+  if (fr->first_ack_blklen > largest) {
+    return NGTCP2_ERR_PROTO;
+  }
+  smallest = largest - fr->first_ack_blklen;
+
+  ranges[nranges].start = smallest;
+  ranges[nranges].end = largest;
+  ++nranges;
+
+  for (i = 0; i < fr->num_blks; ++i) {
+    blk = &fr->blks[i];
+    /* Gap is the number of missing packets, and ACK Block Length is
+       the number of packets in the block.  The block of length 0
+       only extends the gap beyond 255. */
+    if (smallest < (uint64_t)blk->gap + 1) {
+      return NGTCP2_ERR_PROTO;
+    }
+    if (blk->blklen == 0) {
+      smallest -= blk->gap;
+      continue;
+    }
+    largest = smallest - blk->gap - 1;
+    if (largest + 1 < blk->blklen) {
+      return NGTCP2_ERR_PROTO;
+    }
+    smallest = largest - (blk->blklen - 1);
+
+    ranges[nranges].start = smallest;
+    ranges[nranges].end = largest;
+    ++nranges;
+  }
+
+  /* Both entries and ranges are sorted, so that they are merged in a
+     single pass.  ranges is in descending order. */
+  for (ent = rtb->head, i = nranges; ent && i > 0;) {
+    if (ent->pkt_num > ranges[i - 1].end) {
+      --i;
+      continue;
+    }
+
+    next = ent->next;
+
+    if (ent->pkt_num < ranges[i - 1].start) {
+      prev = ent;
+      ent = next;
+      continue;
+    }
+
+    if (prev) {
+      prev->next = next;
+    } else {
+      rtb->head = next;
+    }
+    if (rtb->tail == ent) {
+      rtb->tail = prev;
+    }
+    --rtb->num_entries;
+
+    if (ent->pkt_num == fr->largest_ack) {
+      largest_ent = ent;
+    }
+
+    ent->next = NULL;
+    *packed = ent;
+    packed = &ent->next;
+
+    ent = next;
+  }
+
+  if (largest_ent && ts >= largest_ent->ts) {
+    ngtcp2_cc_stat_update_rtt(ccs, ts - largest_ent->ts, fr->ack_delay);
+  }
+
+  rtb->largest_acked =
+      ngtcp2_max(rtb->largest_acked, (int64_t)fr->largest_ack);
+
+  if (acked) {
+    rtb->rto_count = 0;
+  }
+
+  for (ent = acked; ent;) {
+    next = ent->next;
+    rtb_on_pkt_acked(rtb, ent, cc, ccs, ts);
+    ent = next;
+  }
+
+  ngtcp2_rtb_detect_lost(rtb, cc, ccs, ts);
+
+  return 0;
+}
+
+/*
+ * rtb_rto returns the retransmission timeout before backoff.
+ */
+static ngtcp2_tstamp rtb_rto(ngtcp2_cc_stat *ccs) {
+  if (ccs->min_rtt == UINT64_MAX) {
+    return NGTCP2_DEFAULT_INITIAL_RTO;
+  }
+
+  return ngtcp2_max(ccs->smoothed_rtt + 4 * ccs->rttvar, NGTCP2_MIN_RTO);
+}
+
+ngtcp2_tstamp ngtcp2_rtb_get_expiry(ngtcp2_rtb *rtb, ngtcp2_cc_stat *ccs) {
+  size_t backoff;
+
+  if (rtb->loss_time) {
+    return rtb->loss_time;
+  }
+
+  if (rtb->tail == NULL) {
+    return UINT64_MAX;
+  }
+
+  backoff = ngtcp2_min(rtb->rto_count, NGTCP2_MAX_RTO_BACKOFF);
+
+  return rtb->tail->ts + (rtb_rto(ccs) << backoff);
+}
+
+void ngtcp2_rtb_on_rto(ngtcp2_rtb *rtb, ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                       ngtcp2_tstamp ts) {
+  ngtcp2_rtb_entry *ent, *next;
+  ngtcp2_tstamp ts_sent = 0;
+
+  if (rtb->head == NULL) {
+    return;
+  }
+
+  for (ent = rtb->head; ent;) {
+    next = ent->next;
+    ts_sent = ngtcp2_max(ts_sent, ent->ts);
+    rtb_on_pkt_lost(rtb, ent, ccs);
+    ent = next;
+  }
+
+  rtb->head = rtb->tail = NULL;
+  rtb->num_entries = 0;
+  rtb->loss_time = 0;
+  ++rtb->rto_count;
+
+  if (cc->on_rto) {
+    cc->on_rto(cc, ccs, ts);
+  } else if (cc->congestion_event) {
+    cc->congestion_event(cc, ccs, ts_sent, ts);
+  }
+}
@@ -0,0 +1,299 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_RTB_H
+#define NGTCP2_RTB_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "ngtcp2_mem.h"
+
+/* NGTCP2_PKT_THRESHOLD is the number of packets which are acked after
+   a packet before it is declared lost. */
+#define NGTCP2_PKT_THRESHOLD 3
+
+/* NGTCP2_TIME_THRESHOLD_NUM and NGTCP2_TIME_THRESHOLD_DEN define
+   the time threshold of loss detection.  A packet is declared lost if
+   a packet sent later is acknowledged, and it is sent earlier than
+   NGTCP2_TIME_THRESHOLD_NUM / NGTCP2_TIME_THRESHOLD_DEN times RTT
+   ago. */
+#define NGTCP2_TIME_THRESHOLD_NUM 9
+#define NGTCP2_TIME_THRESHOLD_DEN 8
+
+/* NGTCP2_MIN_LOSS_DELAY is the minimum time threshold of loss
+   detection in microseconds. */
+#define NGTCP2_MIN_LOSS_DELAY 1000
+
+/* NGTCP2_MIN_RTO is the minimum retransmission timeout in
+   microseconds. */
+#define NGTCP2_MIN_RTO 200000
+
+/* NGTCP2_DEFAULT_INITIAL_RTO is the retransmission timeout in
+   microseconds before RTT is measured. */
+#define NGTCP2_DEFAULT_INITIAL_RTO 1000000
+
+/* NGTCP2_MAX_RTO_BACKOFF is the maximum number of times the
+   retransmission timeout is doubled. */
+#define NGTCP2_MAX_RTO_BACKOFF 6
+
+struct ngtcp2_frame_chain;
+typedef struct ngtcp2_frame_chain ngtcp2_frame_chain;
+
+/*
+ * ngtcp2_frame_chain is a retransmittable frame which is retained
+ * until it is acknowledged.  STREAM frame and the flow control frames
+ * are retransmitted.  PING frame is retained only to make the packet
+ * count toward bytes in flight, and it is not retransmitted.  The
+ * data of stream 0 is copied to the memory following this object,
+ * because the handshake data given by the callback may not outlive
+ * the call.  The data of the other streams refers to the application
+ * buffer, which must be kept until it is acknowledged.
+ */
+struct ngtcp2_frame_chain {
+  ngtcp2_frame_chain *next;
+  union {
+    uint8_t type;
+    ngtcp2_stream stream;
+    ngtcp2_max_data max_data;
+    ngtcp2_max_stream_data max_stream_data;
+    ngtcp2_blocked blocked;
+    ngtcp2_stream_blocked stream_blocked;
+    ngtcp2_ping ping;
+  } fr;
+};
+
+/*
+ * ngtcp2_frame_chain_new allocates memory for new frame chain.  The
+ * frame is left uninitialized.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_frame_chain_new(ngtcp2_frame_chain **pfrc, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_frame_chain_stream_new allocates memory for new STREAM frame
+ * chain, and copies |fr| to it.  The data is also copied if it
+ * belongs to stream 0.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_frame_chain_stream_new(ngtcp2_frame_chain **pfrc,
+                                  const ngtcp2_stream *fr, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_frame_chain_del deallocates memory allocated for |frc|.
+ */
+void ngtcp2_frame_chain_del(ngtcp2_frame_chain *frc, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_frame_chain_list_del deallocates |frc| and all frame chains
+ * linked from it.
+ */
+void ngtcp2_frame_chain_list_del(ngtcp2_frame_chain *frc, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_frame_queue is FIFO queue of ngtcp2_frame_chain.
+ */
+typedef struct {
+  ngtcp2_frame_chain *head;
+  ngtcp2_frame_chain *tail;
+} ngtcp2_frame_queue;
+
+/*
+ * ngtcp2_frame_queue_init initializes |q|.
+ */
+void ngtcp2_frame_queue_init(ngtcp2_frame_queue *q);
+
+/*
+ * ngtcp2_frame_queue_free deallocates all frame chains in |q|.
+ */
+void ngtcp2_frame_queue_free(ngtcp2_frame_queue *q, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_frame_queue_push appends |frc| to the end of |q|.
+ */
+void ngtcp2_frame_queue_push(ngtcp2_frame_queue *q, ngtcp2_frame_chain *frc);
+
+/*
+ * ngtcp2_frame_queue_top returns the first frame chain in |q|, or
+ * NULL if |q| is empty.
+ */
+ngtcp2_frame_chain *ngtcp2_frame_queue_top(ngtcp2_frame_queue *q);
+
+/*
+ * ngtcp2_frame_queue_pop removes the first frame chain from |q|.  |q|
+ * must not be empty.  The caller takes the ownership of the removed
+ * frame chain.
+ */
+void ngtcp2_frame_queue_pop(ngtcp2_frame_queue *q);
+
+/*
+ * ngtcp2_frame_queue_empty returns nonzero if |q| is empty.
+ */
+int ngtcp2_frame_queue_empty(ngtcp2_frame_queue *q);
+
+struct ngtcp2_rtb_entry;
+typedef struct ngtcp2_rtb_entry ngtcp2_rtb_entry;
+
+/*
+ * ngtcp2_rtb_entry is a packet which is sent, and is neither
+ * acknowledged nor declared lost yet.
+ */
+struct ngtcp2_rtb_entry {
+  ngtcp2_rtb_entry *next;
+  /* frc is the list of retransmittable frames in this packet. */
+  ngtcp2_frame_chain *frc;
+  uint64_t pkt_num;
+  ngtcp2_tstamp ts;
+  size_t pktlen;
+};
+
+/*
+ * ngtcp2_rtb_entry_new allocates memory for ent, and initializes it
+ * with the given parameters.  It takes the ownership of |frc|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_rtb_entry_new(ngtcp2_rtb_entry **pent, uint64_t pkt_num,
+                         ngtcp2_tstamp ts, size_t pktlen,
+                         ngtcp2_frame_chain *frc, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_rtb_entry_del deallocates memory allocated for |ent|, and
+ * the frames it has.
+ */
+void ngtcp2_rtb_entry_del(ngtcp2_rtb_entry *ent, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_rtb tracks sent packets in the ascending order of packet
+ * number, and feeds acknowledgements and losses to the congestion
+ * controller.  The frames in the lost packets are queued for
+ * retransmission.
+ */
+typedef struct {
+  ngtcp2_rtb_entry *head;
+  ngtcp2_rtb_entry *tail;
+  /* hs_lostq contains the lost STREAM frames of stream 0, which must
+     be retransmitted in handshake packets. */
+  ngtcp2_frame_queue hs_lostq;
+  /* lostq contains the other lost frames. */
+  ngtcp2_frame_queue lostq;
+  /* ackedq contains the frames in the acknowledged packets.  The
+     connection drains it after processing ACK frame to notify the
+     application of the acknowledged stream data. */
+  ngtcp2_frame_queue ackedq;
+  /* largest_acked is the largest packet number acknowledged so far,
+     or -1 if no packet has been acknowledged yet. */
+  int64_t largest_acked;
+  /* loss_time is the time when the oldest packet sent before the
+     largest acknowledged packet is declared lost by time threshold.
+     It is 0 if there is no such packet. */
+  ngtcp2_tstamp loss_time;
+  /* rto_count is the number of consecutive retransmission timeouts
+     without any acknowledgement. */
+  size_t rto_count;
+  /* num_entries is the number of entries in this buffer. */
+  size_t num_entries;
+  ngtcp2_mem *mem;
+} ngtcp2_rtb;
+
+/*
+ * ngtcp2_rtb_init initializes |rtb|.
+ */
+void ngtcp2_rtb_init(ngtcp2_rtb *rtb, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_rtb_free deallocates resources allocated for |rtb|,
+ * including the entries and the lost frames it holds.
+ */
+void ngtcp2_rtb_free(ngtcp2_rtb *rtb);
+
+/*
+ * ngtcp2_rtb_add appends |ent| to |rtb|.  The packet number of |ent|
+ * must be larger than those of the entries already in |rtb|.
+ */
+void ngtcp2_rtb_add(ngtcp2_rtb *rtb, ngtcp2_rtb_entry *ent);
+
+/*
+ * ngtcp2_rtb_recv_ack removes the packets acknowledged by ACK frame
+ * |fr| from |rtb|, and then detects lost packets by
+ * ngtcp2_rtb_detect_lost.  |ccs| and |cc| are updated and notified
+ * accordingly.  |ts| is the time when |fr| is received.  The frames
+ * in the acknowledged packets are moved to ackedq.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_PROTO
+ *     ACK frame is malformed.
+ */
+int ngtcp2_rtb_recv_ack(ngtcp2_rtb *rtb, const ngtcp2_ack *fr, ngtcp2_cc *cc,
+                        ngtcp2_cc_stat *ccs, ngtcp2_tstamp ts);
+
+/*
+ * ngtcp2_rtb_detect_lost declares the packets sent before the largest
+ * acknowledged packet lost if NGTCP2_PKT_THRESHOLD packets sent later
+ * are acknowledged, or they are sent earlier than the time threshold
+ * before |ts|.  The frames in the lost packets are moved to hs_lostq
+ * or lostq.  It also updates loss_time.
+ */
+void ngtcp2_rtb_detect_lost(ngtcp2_rtb *rtb, ngtcp2_cc *cc,
+                            ngtcp2_cc_stat *ccs, ngtcp2_tstamp ts);
+
+/*
+ * ngtcp2_rtb_get_expiry returns the time when the loss detection
+ * timer of |rtb| expires.  It is loss_time if it is set.  Otherwise,
+ * if there are packets in flight, it is the retransmission timeout
+ * after the last packet is sent.  The retransmission timeout is
+ * doubled for each consecutive timeout.  If there is no packet in
+ * flight, it returns UINT64_MAX.
+ */
+ngtcp2_tstamp ngtcp2_rtb_get_expiry(ngtcp2_rtb *rtb, ngtcp2_cc_stat *ccs);
+
+/*
+ * ngtcp2_rtb_on_rto declares all packets in flight lost on
+ * retransmission timeout.  The frames in them are moved to hs_lostq
+ * or lostq.  cc collapses the congestion window, so that they are
+ * retransmitted in slow start.
+ */
+void ngtcp2_rtb_on_rto(ngtcp2_rtb *rtb, ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                       ngtcp2_tstamp ts);
+
+#endif /* NGTCP2_RTB_H */
@@ -0,0 +1,169 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_strm.h"
+
+#include <string.h>
+#include <assert.h>
+
+int ngtcp2_strm_init(ngtcp2_strm *strm, uint32_t stream_id,
+                     void *stream_user_data, ngtcp2_mem *mem) {
+  int rv;
+
+  strm->tx_offset = 0;
+  strm->max_tx_offset = 0;
+  strm->tx_blocked_offset = UINT64_MAX;
+  strm->nbuffered = 0;
+  strm->last_rx_offset = 0;
+  strm->max_rx_offset = 0;
+  strm->rx_high_offset = 0;
+  strm->rx_window = 0;
+  strm->rx_window_ts = UINT64_MAX;
+  strm->stream_id = stream_id;
+  strm->stream_user_data = stream_user_data;
+  strm->flags = NGTCP2_STRM_FLAG_NONE;
+  strm->pe.index = NGTCP2_PQ_BAD_INDEX;
+  strm->cycle = 0;
+  strm->txq_head = strm->txq_tail = NULL;
+  strm->txq_len = 0;
+  strm->weight = NGTCP2_DEFAULT_WEIGHT;
+  strm->urgency = NGTCP2_DEFAULT_URGENCY;
+  strm->mem = mem;
+  memset(&strm->tx_buf, 0, sizeof(strm->tx_buf));
+
+  ngtcp2_map_entry_init(&strm->me, stream_id);
+
+  rv = ngtcp2_gaptr_init(&strm->acked_tx_offset, mem);
+  if (rv != 0) {
+    goto fail_gaptr_init;
+  }
+
+  rv = ngtcp2_rob_init(&strm->rob, NGTCP2_DEFAULT_REORDER_CHUNK, mem);
+  if (rv != 0) {
+    goto fail_rob_init;
+  }
+
+  return 0;
+
+fail_rob_init:
+  ngtcp2_gaptr_free(&strm->acked_tx_offset);
+fail_gaptr_init:
+  return rv;
+}
+
+void ngtcp2_strm_free(ngtcp2_strm *strm) {
+  ngtcp2_strm_txbuf *txbuf, *next;
+
+  if (strm == NULL) {
+    return;
+  }
+
+  for (txbuf = strm->txq_head; txbuf;) {
+    next = txbuf->next;
+    ngtcp2_mem_free(strm->mem, txbuf);
+    txbuf = next;
+  }
+
+  ngtcp2_rob_free(&strm->rob);
+  ngtcp2_gaptr_free(&strm->acked_tx_offset);
+}
+
+uint64_t ngtcp2_strm_rx_offset(ngtcp2_strm *strm) {
+  return ngtcp2_rob_first_gap_offset(&strm->rob);
+}
+
+int ngtcp2_strm_recv_reordering(ngtcp2_strm *strm, const ngtcp2_stream *fr,
+                                ngtcp2_rcbuf *rcbuf) {
+  if (rcbuf) {
+    return ngtcp2_rob_push_ref(&strm->rob, fr->offset, fr->data, fr->datalen,
+                               rcbuf);
+  }
+  return ngtcp2_rob_push(&strm->rob, fr->offset, fr->data, fr->datalen);
+}
+
+int ngtcp2_strm_txq_push(ngtcp2_strm *strm, const uint8_t *data,
+                         size_t datalen) {
+  ngtcp2_strm_txbuf *txbuf;
+
+  txbuf = ngtcp2_mem_malloc(strm->mem, sizeof(ngtcp2_strm_txbuf));
+  if (txbuf == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  txbuf->next = NULL;
+  txbuf->base = data;
+  txbuf->len = datalen;
+
+  if (strm->txq_tail) {
+    strm->txq_tail->next = txbuf;
+  } else {
+    strm->txq_head = txbuf;
+  }
+  strm->txq_tail = txbuf;
+  strm->txq_len += datalen;
+
+  return 0;
+}
+
+size_t ngtcp2_strm_txq_peek(ngtcp2_strm *strm, const uint8_t **pdata) {
+  if (strm->txq_head == NULL) {
+    *pdata = NULL;
+    return 0;
+  }
+
+  *pdata = strm->txq_head->base;
+  return strm->txq_head->len;
+}
+
+void ngtcp2_strm_txq_pop(ngtcp2_strm *strm, size_t len) {
+  ngtcp2_strm_txbuf *txbuf = strm->txq_head;
+
+  assert(txbuf);
+  assert(len <= txbuf->len);
+
+  strm->txq_len -= len;
+
+  if (txbuf->len > len) {
+    txbuf->base += len;
+    txbuf->len -= len;
+    return;
+  }
+
+  strm->txq_head = txbuf->next;
+  if (strm->txq_head == NULL) {
+    strm->txq_tail = NULL;
+  }
+
+  ngtcp2_mem_free(strm->mem, txbuf);
+}
+
+int ngtcp2_strm_is_all_tx_data_acked(ngtcp2_strm *strm) {
+  return (strm->flags & NGTCP2_STRM_FLAG_FIN_ACKED) &&
+         ngtcp2_gaptr_first_gap_offset(&strm->acked_tx_offset) >=
+             strm->tx_offset;
+}
+
+void ngtcp2_strm_shutdown(ngtcp2_strm *strm, uint32_t flags) {
+  strm->flags |= flags & NGTCP2_STRM_FLAG_SHUT_RDWR;
+}
@@ -0,0 +1,217 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_STRM_H
+#define NGTCP2_STRM_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "ngtcp2_rob.h"
+#include "ngtcp2_buf.h"
+#include "ngtcp2_map.h"
+#include "ngtcp2_pq.h"
+#include "ngtcp2_gaptr.h"
+
+typedef enum {
+  NGTCP2_STRM_FLAG_NONE = 0,
+  /* NGTCP2_STRM_FLAG_SHUT_RD indicates that further reception of
+     stream data is not allowed. */
+  NGTCP2_STRM_FLAG_SHUT_RD = 0x01,
+  /* NGTCP2_STRM_FLAG_SHUT_WR indicates that further transmission of
+     stream data is not allowed. */
+  NGTCP2_STRM_FLAG_SHUT_WR = 0x02,
+  NGTCP2_STRM_FLAG_SHUT_RDWR =
+      NGTCP2_STRM_FLAG_SHUT_RD | NGTCP2_STRM_FLAG_SHUT_WR,
+  /* NGTCP2_STRM_FLAG_RECV_FIN indicates that STREAM frame with fin
+     bit set has been received, and the final offset is known. */
+  NGTCP2_STRM_FLAG_RECV_FIN = 0x04,
+  /* NGTCP2_STRM_FLAG_TX_FIN indicates that the application has
+     submitted the last stream data, and no more data can be
+     submitted. */
+  NGTCP2_STRM_FLAG_TX_FIN = 0x08,
+  /* NGTCP2_STRM_FLAG_FIN_ACKED indicates that the STREAM frame with
+     fin bit set has been acknowledged. */
+  NGTCP2_STRM_FLAG_FIN_ACKED = 0x10,
+  /* NGTCP2_STRM_FLAG_MAX_STREAM_DATA_PENDING indicates that
+     MAX_STREAM_DATA frame for this stream is queued, and it has not
+     been sent yet. */
+  NGTCP2_STRM_FLAG_MAX_STREAM_DATA_PENDING = 0x20,
+} ngtcp2_strm_flags;
+
+struct ngtcp2_strm_txbuf;
+typedef struct ngtcp2_strm_txbuf ngtcp2_strm_txbuf;
+
+/*
+ * ngtcp2_strm_txbuf refers to the stream data submitted by the
+ * application.  The data is not copied.
+ */
+struct ngtcp2_strm_txbuf {
+  ngtcp2_strm_txbuf *next;
+  const uint8_t *base;
+  size_t len;
+};
+
+struct ngtcp2_strm;
+typedef struct ngtcp2_strm ngtcp2_strm;
+
+struct ngtcp2_strm {
+  /* me is the entry for ngtcp2_conn.strms. */
+  ngtcp2_map_entry me;
+  /* pe is the entry for ngtcp2_conn.tx_pq. */
+  ngtcp2_pq_entry pe;
+  /* cycle is the virtual finish time of this stream used by the
+     scheduler. */
+  uint64_t cycle;
+  /* txq_head and txq_tail are the head and tail of the queue of
+     stream data which are waiting to be sent. */
+  ngtcp2_strm_txbuf *txq_head, *txq_tail;
+  /* txq_len is the number of bytes queued in txq_head. */
+  size_t txq_len;
+  uint64_t tx_offset;
+  /* max_tx_offset is the flow control limit of stream data which the
+     remote endpoint allows to send. */
+  uint64_t max_tx_offset;
+  /* tx_blocked_offset is the value of max_tx_offset when
+     STREAM_BLOCKED frame was sent last, or UINT64_MAX if it has not
+     been sent. */
+  uint64_t tx_blocked_offset;
+  /* acked_tx_offset tracks the stream data acknowledged by the remote
+     endpoint.  The application is notified of the data acknowledged
+     from the beginning of the stream, so that it can release the
+     buffer it submitted. */
+  ngtcp2_gaptr acked_tx_offset;
+  ngtcp2_rob rob;
+  ngtcp2_mem *mem;
+  size_t nbuffered;
+  ngtcp2_buf tx_buf;
+  /* last_rx_offset is the final offset of the stream.  It is only
+     meaningful if NGTCP2_STRM_FLAG_RECV_FIN is set. */
+  uint64_t last_rx_offset;
+  /* max_rx_offset is the flow control limit of stream data which the
+     local endpoint allows the remote endpoint to send. */
+  uint64_t max_rx_offset;
+  /* rx_high_offset is the largest offset of stream data received so
+     far. */
+  uint64_t rx_high_offset;
+  /* rx_window is the current receive window.  max_rx_offset is
+     extended to this much ahead of the data consumed. */
+  uint64_t rx_window;
+  /* rx_window_ts is the time when max_rx_offset was extended last,
+     or UINT64_MAX if it has never been extended. */
+  ngtcp2_tstamp rx_window_ts;
+  void *stream_user_data;
+  uint32_t stream_id;
+  uint32_t flags;
+  /* weight is the weight of this stream.  Streams of the same
+     urgency share the bandwidth in proportion to their weight. */
+  uint32_t weight;
+  /* urgency is the urgency level of this stream.  The stream with
+     lower value is always served first. */
+  uint8_t urgency;
+};
+
+/*
+ * ngtcp2_strm_init initializes |strm| with stream ID |stream_id|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_strm_init(ngtcp2_strm *strm, uint32_t stream_id,
+                     void *stream_user_data, ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_strm_free deallocates memory allocated for strm.  This
+ * function does not free the memory pointed by |strm| itself.
+ */
+void ngtcp2_strm_free(ngtcp2_strm *strm);
+
+/*
+ * ngtcp2_strm_rx_offset returns the minimum offset of stream data
+ * which is not received yet.
+ */
+uint64_t ngtcp2_strm_rx_offset(ngtcp2_strm *strm);
+
+/*
+ * ngtcp2_strm_recv_reordering handles reordered STREAM frame |fr|.
+ * If |rcbuf| is not NULL, it is the packet buffer which fr->data
+ * points into, and the data may be buffered by reference to it.
+ *
+ * It returns 0 if it succeeds, or one of the following negative error
+ * codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_strm_recv_reordering(ngtcp2_strm *strm, const ngtcp2_stream *fr,
+                                ngtcp2_rcbuf *rcbuf);
+
+/*
+ * ngtcp2_strm_txq_push appends |data| of length |datalen| to the end
+ * of the transmission queue of |strm|.  |data| is not copied.
+ *
+ * It returns 0 if it succeeds, or one of the following negative error
+ * codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+int ngtcp2_strm_txq_push(ngtcp2_strm *strm, const uint8_t *data,
+                         size_t datalen);
+
+/*
+ * ngtcp2_strm_txq_peek assigns the pointer to the first contiguous
+ * stream data in the transmission queue to |*pdata|, and returns its
+ * length.  If the queue is empty, it returns 0.
+ */
+size_t ngtcp2_strm_txq_peek(ngtcp2_strm *strm, const uint8_t **pdata);
+
+/*
+ * ngtcp2_strm_txq_pop removes |len| bytes from the head of the
+ * transmission queue.  |len| must not exceed the return value of the
+ * preceding call of ngtcp2_strm_txq_peek.
+ */
+void ngtcp2_strm_txq_pop(ngtcp2_strm *strm, size_t len);
+
+/*
+ * ngtcp2_strm_is_all_tx_data_acked returns nonzero if fin has been
+ * sent, and all stream data sent, including fin, have been
+ * acknowledged.
+ */
+int ngtcp2_strm_is_all_tx_data_acked(ngtcp2_strm *strm);
+
+/*
+ * ngtcp2_strm_shutdown shuts down stream in the direction indicated
+ * by |flags|, which is the bitwise OR of NGTCP2_STRM_FLAG_SHUT_RD and
+ * NGTCP2_STRM_FLAG_SHUT_WR.
+ */
+void ngtcp2_strm_shutdown(ngtcp2_strm *strm, uint32_t flags);
+
+#endif /* NGTCP2_STRM_H */
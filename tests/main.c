@@ -36,6 +36,12 @@
 #include "ngtcp2_range_test.h"
 #include "ngtcp2_rob_test.h"
 #include "ngtcp2_acktr_test.h"
+#include "ngtcp2_map_test.h"
+#include "ngtcp2_rtb_test.h"
+#include "ngtcp2_gaptr_test.h"
+#include "ngtcp2_mem_test.h"
+#include "ngtcp2_ksl_test.h"
+#include "ngtcp2_conn_test.h"
 
 static int init_suite1(void) { return 0; }
 
@@ -94,6 +100,7 @@ int main() {
                    test_ngtcp2_pkt_encode_new_connection_id_frame) ||
       !CU_add_test(pSuite, "pkt_adjust_pkt_num",
                    test_ngtcp2_pkt_adjust_pkt_num) ||
+      !CU_add_test(pSuite, "frame_iter", test_ngtcp2_frame_iter) ||
       !CU_add_test(pSuite, "upe_encode", test_ngtcp2_upe_encode) ||
       !CU_add_test(pSuite, "upe_encode_version_negotiation",
                    test_ngtcp2_upe_encode_version_negotiation) ||
@@ -104,7 +111,73 @@ int main() {
       !CU_add_test(pSuite, "rob_data_at", test_ngtcp2_rob_data_at) ||
       !CU_add_test(pSuite, "rob_remove_prefix",
                    test_ngtcp2_rob_remove_prefix) ||
-      !CU_add_test(pSuite, "acktr_add", test_ngtcp2_acktr_add)) {
+      !CU_add_test(pSuite, "rob_random_reordering",
+                   test_ngtcp2_rob_random_reordering) ||
+      !CU_add_test(pSuite, "rob_push_ref", test_ngtcp2_rob_push_ref) ||
+      !CU_add_test(pSuite, "rob_adaptive_chunk",
+                   test_ngtcp2_rob_adaptive_chunk) ||
+      !CU_add_test(pSuite, "acktr_add", test_ngtcp2_acktr_add) ||
+      !CU_add_test(pSuite, "acktr_ranges", test_ngtcp2_acktr_ranges) ||
+      !CU_add_test(pSuite, "acktr_recv_ack", test_ngtcp2_acktr_recv_ack) ||
+      !CU_add_test(pSuite, "acktr_require_ack_eliciting",
+                   test_ngtcp2_acktr_require_ack_eliciting) ||
+      !CU_add_test(pSuite, "acktr_pkt_num_zero",
+                   test_ngtcp2_acktr_pkt_num_zero) ||
+      !CU_add_test(pSuite, "map", test_ngtcp2_map) ||
+      !CU_add_test(pSuite, "map_functional", test_ngtcp2_map_functional) ||
+      !CU_add_test(pSuite, "map_each_free", test_ngtcp2_map_each_free) ||
+      !CU_add_test(pSuite, "rtb_recv_ack", test_ngtcp2_rtb_recv_ack) ||
+      !CU_add_test(pSuite, "rtb_recv_ack_malformed",
+                   test_ngtcp2_rtb_recv_ack_malformed) ||
+      !CU_add_test(pSuite, "rtb_detect_lost", test_ngtcp2_rtb_detect_lost) ||
+      !CU_add_test(pSuite, "rtb_on_rto", test_ngtcp2_rtb_on_rto) ||
+      !CU_add_test(pSuite, "gaptr_push", test_ngtcp2_gaptr_push) ||
+      !CU_add_test(pSuite, "mem_pool", test_ngtcp2_mem_pool) ||
+      !CU_add_test(pSuite, "mem_pool_large", test_ngtcp2_mem_pool_large) ||
+      !CU_add_test(pSuite, "mem_acct", test_ngtcp2_mem_acct) ||
+      !CU_add_test(pSuite, "ksl_insert", test_ngtcp2_ksl_insert) ||
+      !CU_add_test(pSuite, "ksl_random", test_ngtcp2_ksl_random) ||
+      !CU_add_test(pSuite, "conn_stream_open_close",
+                   test_ngtcp2_conn_stream_open_close) ||
+      !CU_add_test(pSuite, "conn_stream_rx_reordering",
+                   test_ngtcp2_conn_stream_rx_reordering) ||
+      !CU_add_test(pSuite, "conn_recv_rst_stream",
+                   test_ngtcp2_conn_recv_rst_stream) ||
+      !CU_add_test(pSuite, "conn_many_streams",
+                   test_ngtcp2_conn_many_streams) ||
+      !CU_add_test(pSuite, "conn_implicit_stream_open",
+                   test_ngtcp2_conn_implicit_stream_open) ||
+      !CU_add_test(pSuite, "conn_stream_scheduling",
+                   test_ngtcp2_conn_stream_scheduling) ||
+      !CU_add_test(pSuite, "conn_cc_lossy_link",
+                   test_ngtcp2_conn_cc_lossy_link) ||
+      !CU_add_test(pSuite, "conn_cc_custom", test_ngtcp2_conn_cc_custom) ||
+      !CU_add_test(pSuite, "conn_retransmission",
+                   test_ngtcp2_conn_retransmission) ||
+      !CU_add_test(pSuite, "conn_expiry", test_ngtcp2_conn_expiry) ||
+      !CU_add_test(pSuite, "conn_write_pkts", test_ngtcp2_conn_write_pkts) ||
+      !CU_add_test(pSuite, "conn_acked_stream_data_offset",
+                   test_ngtcp2_conn_acked_stream_data_offset) ||
+      !CU_add_test(pSuite, "conn_recv_flow_control",
+                   test_ngtcp2_conn_recv_flow_control) ||
+      !CU_add_test(pSuite, "conn_tx_flow_control",
+                   test_ngtcp2_conn_tx_flow_control) ||
+      !CU_add_test(pSuite, "conn_rx_window_autotune",
+                   test_ngtcp2_conn_rx_window_autotune) ||
+      !CU_add_test(pSuite, "conn_pacing", test_ngtcp2_conn_pacing) ||
+      !CU_add_test(pSuite, "conn_pacing_shallow_buffer",
+                   test_ngtcp2_conn_pacing_shallow_buffer) ||
+      !CU_add_test(pSuite, "conn_ack_retention",
+                   test_ngtcp2_conn_ack_retention) ||
+      !CU_add_test(pSuite, "conn_delayed_ack",
+                   test_ngtcp2_conn_delayed_ack) ||
+      !CU_add_test(pSuite, "conn_mem_pool", test_ngtcp2_conn_mem_pool) ||
+      !CU_add_test(pSuite, "conn_mem_limit", test_ngtcp2_conn_mem_limit) ||
+      !CU_add_test(pSuite, "conn_mem_limit_pool",
+                   test_ngtcp2_conn_mem_limit_pool) ||
+      !CU_add_test(pSuite, "conn_recv_ref", test_ngtcp2_conn_recv_ref) ||
+      !CU_add_test(pSuite, "conn_reorder_chunk",
+                   test_ngtcp2_conn_reorder_chunk)) {
     CU_cleanup_registry();
     return CU_get_error();
   }
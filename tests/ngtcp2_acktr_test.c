@@ -31,52 +31,317 @@
 
 void test_ngtcp2_acktr_add(void) {
   ngtcp2_acktr acktr;
-  ngtcp2_acktr_entry ents[] = {
-      {NULL, 1, 1000}, {NULL, 5, 1001}, {NULL, 7, 1002}, {NULL, 4, 1003},
-      {NULL, 6, 1004}, {NULL, 2, 1005}, {NULL, 3, 1006},
-  };
+  uint64_t pkt_nums[] = {1, 5, 7, 4, 6, 2, 3};
   uint64_t max_pkt_num[] = {1, 5, 7, 7, 7, 7, 7};
+  size_t nents[] = {1, 2, 3, 3, 2, 2, 1};
   ngtcp2_acktr_entry *ent;
   size_t i;
   int rv;
 
   ngtcp2_acktr_init(&acktr);
 
-  for (i = 0; i < arraylen(ents); ++i) {
-    rv = ngtcp2_acktr_add(&acktr, &ents[i]);
+  CU_ASSERT(NULL == ngtcp2_acktr_get(&acktr, 0));
+  CU_ASSERT(!acktr.pending);
+
+  for (i = 0; i < arraylen(pkt_nums); ++i) {
+    rv = ngtcp2_acktr_add(&acktr, pkt_nums[i], 1, 1000 + i);
 
     CU_ASSERT(0 == rv);
+    CU_ASSERT(acktr.pending);
 
-    ent = ngtcp2_acktr_get(&acktr);
+    ent = ngtcp2_acktr_get(&acktr, 0);
 
     CU_ASSERT(max_pkt_num[i] == ent->pkt_num);
+    CU_ASSERT(nents[i] == acktr.len);
+  }
+
+  ent = ngtcp2_acktr_get(&acktr, 0);
+
+  CU_ASSERT(7 == ent->pkt_num);
+  CU_ASSERT(7 == ent->len);
+  CU_ASSERT(1002 == ent->tstamp);
+  CU_ASSERT(NULL == ngtcp2_acktr_get(&acktr, 1));
+
+  ngtcp2_acktr_free(&acktr);
+
+  /* Check duplicates */
+  ngtcp2_acktr_init(&acktr);
+
+  for (i = 0; i < arraylen(pkt_nums); ++i) {
+    if (pkt_nums[i] == 3) {
+      continue;
+    }
+
+    rv = ngtcp2_acktr_add(&acktr, pkt_nums[i], 1, 1000 + i);
+
+    CU_ASSERT(0 == rv);
   }
 
-  for (i = 0; i < arraylen(ents); ++i) {
-    ent = ngtcp2_acktr_get(&acktr);
-    ngtcp2_acktr_remove(&acktr, ent);
+  ngtcp2_acktr_add_ack(&acktr, 100, 7, 0);
+
+  /* The packet which does not require ACK still joins the ranges. */
+  rv = ngtcp2_acktr_add(&acktr, 8, 0, 2000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(!acktr.pending);
+  CU_ASSERT(8 == ngtcp2_acktr_get(&acktr, 0)->pkt_num);
+  CU_ASSERT(5 == ngtcp2_acktr_get(&acktr, 0)->len);
 
-    ent = ngtcp2_acktr_get(&acktr);
+  for (i = 0; i < arraylen(pkt_nums); ++i) {
+    rv = ngtcp2_acktr_add(&acktr, pkt_nums[i], 1, 2000);
 
-    if (i != arraylen(ents) - 1) {
-      CU_ASSERT(arraylen(ents) - i - 1 == ent->pkt_num);
+    if (pkt_nums[i] == 3) {
+      CU_ASSERT(0 == rv);
+      CU_ASSERT(acktr.pending);
     } else {
-      CU_ASSERT(NULL == ent);
+      /* Duplicated packet does not make ACK frame pending. */
+      CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+      CU_ASSERT(!acktr.pending);
     }
   }
 
   ngtcp2_acktr_free(&acktr);
+}
+
+void test_ngtcp2_acktr_ranges(void) {
+  ngtcp2_acktr acktr;
+  ngtcp2_acktr_entry *ent;
+  uint64_t i;
+  int rv;
+
+  ngtcp2_acktr_init(&acktr);
+
+  /* Packets received in order are merged into a single range. */
+  for (i = 0; i < 1000; ++i) {
+    rv = ngtcp2_acktr_add(&acktr, i, 1, i);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(1 == acktr.len);
+
+  ent = ngtcp2_acktr_get(&acktr, 0);
+
+  CU_ASSERT(999 == ent->pkt_num);
+  CU_ASSERT(1000 == ent->len);
+  CU_ASSERT(999 == ent->tstamp);
+
+  ngtcp2_acktr_free(&acktr);
+  ngtcp2_acktr_init(&acktr);
+
+  /* Every other packet is lost until acktr is full. */
+  for (i = 0; i < NGTCP2_ACKTR_MAX_ENTRIES; ++i) {
+    rv = ngtcp2_acktr_add(&acktr, 1000 + i * 2, 1, 0);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(NGTCP2_ACKTR_MAX_ENTRIES == acktr.len);
+
+  /* New range discards the oldest one. */
+  rv = ngtcp2_acktr_add(&acktr, 1000 + NGTCP2_ACKTR_MAX_ENTRIES * 2, 1, 0);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGTCP2_ACKTR_MAX_ENTRIES == acktr.len);
+
+  /* The packet older than all ranges is ignored. */
+  rv = ngtcp2_acktr_add(&acktr, 1000, 1, 0);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGTCP2_ACKTR_MAX_ENTRIES == acktr.len);
+
+  /* The retransmitted packet fills the gap, and merges 2 ranges. */
+  rv = ngtcp2_acktr_add(&acktr, 1005, 1, 0);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGTCP2_ACKTR_MAX_ENTRIES - 1 == acktr.len);
+
+  ent = ngtcp2_acktr_get(&acktr, NGTCP2_ACKTR_MAX_ENTRIES - 3);
+
+  CU_ASSERT(1006 == ent->pkt_num);
+  CU_ASSERT(3 == ent->len);
+
+  ent = ngtcp2_acktr_get(&acktr, NGTCP2_ACKTR_MAX_ENTRIES - 2);
+
+  CU_ASSERT(1002 == ent->pkt_num);
+  CU_ASSERT(1 == ent->len);
+  CU_ASSERT(NULL == ngtcp2_acktr_get(&acktr, NGTCP2_ACKTR_MAX_ENTRIES - 1));
+
+  ngtcp2_acktr_free(&acktr);
+}
+
+void test_ngtcp2_acktr_recv_ack(void) {
+  ngtcp2_acktr acktr;
+  ngtcp2_acktr_entry *ent;
+  ngtcp2_ack fr;
+  ngtcp2_ack_blk blks[4];
+  uint64_t i;
+  int rv;
+
+  ngtcp2_acktr_init(&acktr);
+
+  for (i = 0; i < 10; ++i) {
+    rv = ngtcp2_acktr_add(&acktr, i, 1, 0);
+
+    CU_ASSERT(0 == rv);
+
+    rv = ngtcp2_acktr_add(&acktr, 20 + i, 1, 0);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(2 == acktr.len);
+
+  /* ACK frame is sent in an ack-eliciting packet */
+  ngtcp2_acktr_add_ack(&acktr, 100, 29, 1);
+
+  CU_ASSERT(!acktr.pending);
+  CU_ASSERT(1 == acktr.acks_len);
+
+  rv = ngtcp2_acktr_add(&acktr, 30, 1, 0);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(acktr.pending);
+
+  /* The packet which only carries ACK frame is not remembered. */
+  ngtcp2_acktr_add_ack(&acktr, 101, 30, 0);
+
+  CU_ASSERT(1 == acktr.acks_len);
+  CU_ASSERT(1 == acktr.nack_only);
+
+  /* ACK of packet 101 changes nothing. */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.largest_ack = 101;
+  fr.ack_delay = 0;
+  fr.first_ack_blklen = 0;
+  fr.num_blks = 0;
+
+  ngtcp2_acktr_recv_ack(&acktr, &fr);
+
+  CU_ASSERT(2 == acktr.len);
+  CU_ASSERT(1 == acktr.acks_len);
+
+  /* ACK of packet 100 removes the ranges up to 29. */
+  fr.largest_ack = 100;
+
+  ngtcp2_acktr_recv_ack(&acktr, &fr);
+
+  CU_ASSERT(1 == acktr.len);
+  CU_ASSERT(0 == acktr.acks_len);
+
+  ent = ngtcp2_acktr_get(&acktr, 0);
+
+  CU_ASSERT(30 == ent->pkt_num);
+  CU_ASSERT(1 == ent->len);
+
+  /* The range is partially removed. */
+  for (i = 31; i < 36; ++i) {
+    rv = ngtcp2_acktr_add(&acktr, i, 1, 0);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  ngtcp2_acktr_add_ack(&acktr, 500, 33, 1);
+  ngtcp2_acktr_add_ack(&acktr, 700, 35, 1);
+
+  CU_ASSERT(2 == acktr.acks_len);
+  CU_ASSERT(0 == acktr.nack_only);
+
+  /* Acknowledge packet 500 beyond the gap extended by the block of
+     length 0. */
+  fr.largest_ack = 1000;
+  fr.first_ack_blklen = 0;
+  fr.num_blks = 3;
+  fr.blks = blks;
+  fr.blks[0].gap = 255;
+  fr.blks[0].blklen = 0;
+  fr.blks[1].gap = 230;
+  fr.blks[1].blklen = 10;
+  fr.blks[2].gap = 4;
+  fr.blks[2].blklen = 1;
+
+  ngtcp2_acktr_recv_ack(&acktr, &fr);
+
+  CU_ASSERT(1 == acktr.len);
+  CU_ASSERT(1 == acktr.acks_len);
+
+  ent = ngtcp2_acktr_get(&acktr, 0);
+
+  CU_ASSERT(35 == ent->pkt_num);
+  CU_ASSERT(2 == ent->len);
+
+  ngtcp2_acktr_free(&acktr);
+}
+
+void test_ngtcp2_acktr_require_ack_eliciting(void) {
+  ngtcp2_acktr acktr;
+  size_t i;
+  int rv;
 
-  /* Check duplicates */
   ngtcp2_acktr_init(&acktr);
 
-  rv = ngtcp2_acktr_add(&acktr, &ents[0]);
+  for (i = 0; i < NGTCP2_ACKTR_MAX_ACK_ONLY; ++i) {
+    ngtcp2_acktr_add_ack(&acktr, i, 0, 0);
+  }
+
+  /* Nothing to acknowledge */
+  CU_ASSERT(!ngtcp2_acktr_require_ack_eliciting(&acktr));
+
+  rv = ngtcp2_acktr_add(&acktr, 0, 1, 0);
 
   CU_ASSERT(0 == rv);
+  CU_ASSERT(ngtcp2_acktr_require_ack_eliciting(&acktr));
+
+  ngtcp2_acktr_add_ack(&acktr, NGTCP2_ACKTR_MAX_ACK_ONLY, 0, 1);
+
+  CU_ASSERT(!ngtcp2_acktr_require_ack_eliciting(&acktr));
+
+  ngtcp2_acktr_free(&acktr);
+}
+
+void test_ngtcp2_acktr_pkt_num_zero(void) {
+  ngtcp2_acktr acktr;
+  ngtcp2_acktr_entry *ent;
+  ngtcp2_ack fr;
+  uint64_t i;
+  int rv;
+
+  ngtcp2_acktr_init(&acktr);
+
+  /* Packets received in order from packet 0 do not need an immediate
+     acknowledgement. */
+  for (i = 0; i < 6; ++i) {
+    rv = ngtcp2_acktr_add(&acktr, i, 1, 0);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(!acktr.immediate);
+  }
+
+  CU_ASSERT(1 == acktr.len);
+
+  ent = ngtcp2_acktr_get(&acktr, 0);
+
+  CU_ASSERT(5 == ent->pkt_num);
+  CU_ASSERT(6 == ent->len);
+
+  /* Acknowledging up to packet 2 trims the range which starts at
+     packet 0. */
+  ngtcp2_acktr_add_ack(&acktr, 100, 2, 1);
+
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.largest_ack = 100;
+  fr.ack_delay = 0;
+  fr.first_ack_blklen = 0;
+  fr.num_blks = 0;
+
+  ngtcp2_acktr_recv_ack(&acktr, &fr);
+
+  CU_ASSERT(1 == acktr.len);
 
-  rv = ngtcp2_acktr_add(&acktr, &ents[0]);
+  ent = ngtcp2_acktr_get(&acktr, 0);
 
-  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(5 == ent->pkt_num);
+  CU_ASSERT(3 == ent->len);
 
   ngtcp2_acktr_free(&acktr);
 }
@@ -30,5 +30,9 @@
 #endif /* HAVE_CONFIG_H */
 
 void test_ngtcp2_acktr_add(void);
+void test_ngtcp2_acktr_ranges(void);
+void test_ngtcp2_acktr_recv_ack(void);
+void test_ngtcp2_acktr_require_ack_eliciting(void);
+void test_ngtcp2_acktr_pkt_num_zero(void);
 
 #endif /* NGTCP2_ACKTR_TEST_H */
@@ -0,0 +1,2524 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_conn_test.h"
+
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_conn.h"
+#include "ngtcp2_pkt.h"
+#include "ngtcp2_test_helper.h"
+
+static ssize_t null_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                            const uint8_t *plaintext, size_t plaintextlen,
+                            const uint8_t *key, size_t keylen,
+                            const uint8_t *nonce, size_t noncelen,
+                            const uint8_t *ad, size_t adlen, void *user_data) {
+  (void)conn;
+  (void)key;
+  (void)keylen;
+  (void)nonce;
+  (void)noncelen;
+  (void)ad;
+  (void)adlen;
+  (void)user_data;
+
+  if (destlen < plaintextlen) {
+    return -1;
+  }
+
+  memmove(dest, plaintext, plaintextlen);
+
+  return (ssize_t)plaintextlen;
+}
+
+static ssize_t null_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                            const uint8_t *ciphertext, size_t ciphertextlen,
+                            const uint8_t *key, size_t keylen,
+                            const uint8_t *nonce, size_t noncelen,
+                            const uint8_t *ad, size_t adlen, void *user_data) {
+  return null_encrypt(conn, dest, destlen, ciphertext, ciphertextlen, key,
+                      keylen, nonce, noncelen, ad, adlen, user_data);
+}
+
+typedef struct {
+  uint32_t stream_id;
+  uint8_t fin;
+  size_t nfin;
+  uint8_t data[4096];
+  size_t datalen;
+  /* nrecv is the total number of bytes of stream data received. */
+  uint64_t nrecv;
+  size_t nclose;
+  uint32_t close_error_code;
+  /* sent_strms records the stream ID of each STREAM frame sent */
+  uint32_t sent_strms[256];
+  uint8_t sent_fin[256];
+  size_t nsent;
+  /* acked_offset is the end of stream data reported acknowledged by
+     acked_stream_data_offset callback. */
+  uint64_t acked_offset;
+  size_t nacked;
+  /* nsent_types counts the frames sent by type, except for STREAM
+     frame. */
+  size_t nsent_types[16];
+  /* max_data and max_stream_data are the values of MAX_DATA and
+     MAX_STREAM_DATA frames sent last. */
+  uint64_t max_data;
+  uint64_t max_stream_data;
+  /* ack is ACK frame sent last, and nsent_acks is the number of ACK
+     frames sent.  The blocks of ack are copied to ack_blks. */
+  ngtcp2_ack ack;
+  ngtcp2_ack_blk ack_blks[NGTCP2_MAX_NUM_ACK_BLK];
+  size_t nsent_acks;
+  /* nrelease is the number of packet buffers released by release_pkt
+     callback, and released_pkt is the last one of them. */
+  size_t nrelease;
+  uint8_t *released_pkt;
+} my_user_data;
+
+static int send_frame(ngtcp2_conn *conn, const ngtcp2_pkt_hd *hd,
+                      const ngtcp2_frame *fr, void *user_data) {
+  my_user_data *ud = user_data;
+  (void)conn;
+  (void)hd;
+
+  switch (fr->type) {
+  case NGTCP2_FRAME_MAX_DATA:
+    ud->max_data = fr->max_data.max_data;
+    break;
+  case NGTCP2_FRAME_MAX_STREAM_DATA:
+    ud->max_stream_data = fr->max_stream_data.max_stream_data;
+    break;
+  case NGTCP2_FRAME_ACK:
+    ud->ack = fr->ack;
+    memcpy(ud->ack_blks, fr->ack.blks,
+           sizeof(ngtcp2_ack_blk) * fr->ack.num_blks);
+    ud->ack.blks = ud->ack_blks;
+    ++ud->nsent_acks;
+    break;
+  }
+
+  if (fr->type < arraylen(ud->nsent_types)) {
+    ++ud->nsent_types[fr->type];
+  }
+
+  if (fr->type != NGTCP2_FRAME_STREAM || ud->nsent == arraylen(ud->sent_strms)) {
+    return 0;
+  }
+
+  ud->sent_strms[ud->nsent] = fr->stream.stream_id;
+  ud->sent_fin[ud->nsent] = fr->stream.fin;
+  ++ud->nsent;
+
+  return 0;
+}
+
+static int recv_stream_data(ngtcp2_conn *conn, uint32_t stream_id, uint8_t fin,
+                            const uint8_t *data, size_t datalen,
+                            void *user_data, void *stream_user_data) {
+  my_user_data *ud = user_data;
+  (void)conn;
+  (void)stream_user_data;
+
+  ud->stream_id = stream_id;
+  ud->fin = fin;
+  if (fin) {
+    ++ud->nfin;
+  }
+  ud->nrecv += datalen;
+  if (datalen && ud->datalen + datalen <= sizeof(ud->data)) {
+    memcpy(ud->data + ud->datalen, data, datalen);
+    ud->datalen += datalen;
+  }
+
+  return 0;
+}
+
+static int stream_close(ngtcp2_conn *conn, uint32_t stream_id,
+                        uint32_t error_code, void *user_data,
+                        void *stream_user_data) {
+  my_user_data *ud = user_data;
+  (void)conn;
+  (void)stream_user_data;
+
+  ud->stream_id = stream_id;
+  ud->close_error_code = error_code;
+  ++ud->nclose;
+
+  return 0;
+}
+
+static int acked_stream_data_offset(ngtcp2_conn *conn, uint32_t stream_id,
+                                    uint64_t offset, uint64_t datalen,
+                                    void *user_data, void *stream_user_data) {
+  my_user_data *ud = user_data;
+  (void)conn;
+  (void)stream_user_data;
+
+  /* Acknowledged data is reported in order without overlap */
+  CU_ASSERT(ud->acked_offset == offset);
+  CU_ASSERT(datalen > 0);
+
+  ud->stream_id = stream_id;
+  ud->acked_offset = offset + datalen;
+  ++ud->nacked;
+
+  return 0;
+}
+
+static void release_pkt(ngtcp2_conn *conn, uint8_t *pkt, void *pkt_user_data,
+                        void *user_data) {
+  my_user_data *ud = user_data;
+  (void)conn;
+
+  /* The tests pass the packet buffer itself as pkt_user_data. */
+  CU_ASSERT(pkt == pkt_user_data);
+
+  ud->released_pkt = pkt;
+  ++ud->nrelease;
+}
+
+static const uint8_t null_key[16];
+static const uint8_t null_iv[16];
+
+static void setup_conn_settings(ngtcp2_conn **pconn, int server,
+                                const ngtcp2_settings *settings,
+                                void *user_data) {
+  ngtcp2_conn_callbacks cb;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.encrypt = null_encrypt;
+  cb.decrypt = null_decrypt;
+  cb.recv_stream_data = recv_stream_data;
+  cb.stream_close = stream_close;
+  cb.acked_stream_data_offset = acked_stream_data_offset;
+  cb.send_frame = send_frame;
+  cb.release_pkt = release_pkt;
+
+  if (server) {
+    ngtcp2_conn_server_new(pconn, 0x1, NGTCP2_PROTO_VERSION, &cb, settings,
+                           user_data);
+  } else {
+    ngtcp2_conn_client_new(pconn, 0x1, NGTCP2_PROTO_VERSION, &cb, settings,
+                           user_data);
+  }
+  ngtcp2_conn_update_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
+                             sizeof(null_iv));
+  ngtcp2_conn_update_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
+                             sizeof(null_iv));
+  (*pconn)->state = NGTCP2_CS_POST_HANDSHAKE;
+}
+
+static void setup_conn(ngtcp2_conn **pconn, int server, void *user_data) {
+  ngtcp2_settings settings;
+
+  ngtcp2_settings_default(&settings);
+
+  setup_conn_settings(pconn, server, &settings, user_data);
+}
+
+/*
+ * write_single_frame_pkt writes a protected packet which contains a
+ * single frame |fr| into |out|.
+ */
+static size_t write_single_frame_pkt(uint8_t *out, size_t outlen,
+                                     uint64_t pkt_num, ngtcp2_frame *fr) {
+  ngtcp2_pkt_hd hd;
+  ssize_t n;
+  size_t len;
+
+  ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID, NGTCP2_PKT_03, 0x1, pkt_num,
+                     NGTCP2_PROTO_VERSION);
+
+  n = ngtcp2_pkt_encode_hd_short(out, outlen, &hd);
+  len = (size_t)n;
+  n = ngtcp2_pkt_encode_frame(out + len, outlen - len, fr);
+  len += (size_t)n;
+
+  return len;
+}
+
+void test_ngtcp2_conn_stream_open_close(void) {
+  ngtcp2_conn *client, *server;
+  my_user_data cud, sud;
+  uint8_t buf[2048];
+  ssize_t spktlen, reqpktlen;
+  size_t ndatalen;
+  uint32_t stream_id;
+  int rv;
+  const uint8_t req[] = "GET /";
+  const uint8_t resp[] = "200 OK";
+
+  memset(&cud, 0, sizeof(cud));
+  memset(&sud, 0, sizeof(sud));
+
+  setup_conn(&client, 0, &cud);
+  setup_conn(&server, 1, &sud);
+
+  rv = ngtcp2_conn_open_stream(client, &stream_id, NULL);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == stream_id);
+
+  rv = ngtcp2_conn_open_stream(client, &stream_id, NULL);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == stream_id);
+
+  rv = ngtcp2_conn_open_stream(server, &stream_id, NULL);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == stream_id);
+
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 1, 1,
+                                     req, strsize(req), 1);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(strsize(req) == ndatalen);
+
+  reqpktlen = spktlen;
+
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 1, 0,
+                                     req, strsize(req), 1);
+
+  CU_ASSERT(NGTCP2_ERR_STREAM_SHUT_WR == spktlen);
+
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 5, 0,
+                                     req, strsize(req), 1);
+
+  CU_ASSERT(NGTCP2_ERR_STREAM_NOT_FOUND == spktlen);
+
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 0, 0,
+                                     req, strsize(req), 1);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == spktlen);
+
+  rv = ngtcp2_conn_recv(server, buf, (size_t)reqpktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == sud.stream_id);
+  CU_ASSERT(1 == sud.nfin);
+  CU_ASSERT(strsize(req) == sud.datalen);
+  CU_ASSERT(0 == memcmp(req, sud.data, strsize(req)));
+  CU_ASSERT(NULL != ngtcp2_conn_find_stream(server, 1));
+  CU_ASSERT(1 == server->last_remote_stream_id);
+
+  spktlen = ngtcp2_conn_write_stream(server, buf, sizeof(buf), &ndatalen, 1, 1,
+                                     resp, strsize(resp), 3);
+
+  CU_ASSERT(spktlen > 0);
+  /* Both directions are shut down, but the response is not
+     acknowledged yet. */
+  CU_ASSERT(0 == sud.nclose);
+  CU_ASSERT(NULL != ngtcp2_conn_find_stream(server, 1));
+
+  /* The response also acknowledges the request. */
+  rv = ngtcp2_conn_recv(client, buf, (size_t)spktlen, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == cud.nfin);
+  CU_ASSERT(strsize(resp) == cud.datalen);
+  CU_ASSERT(0 == memcmp(resp, cud.data, strsize(resp)));
+  CU_ASSERT(1 == cud.nclose);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(client, 1));
+
+  /* ACK is delayed */
+  spktlen = ngtcp2_conn_send(client, buf, sizeof(buf), 4);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(4 + NGTCP2_DEFAULT_MAX_ACK_DELAY == ngtcp2_conn_get_expiry(client));
+
+  spktlen = ngtcp2_conn_send(client, buf, sizeof(buf),
+                             4 + NGTCP2_DEFAULT_MAX_ACK_DELAY);
+
+  CU_ASSERT(spktlen > 0);
+
+  rv = ngtcp2_conn_recv(server, buf, (size_t)spktlen, 5);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == sud.nclose);
+  CU_ASSERT(0 == sud.close_error_code);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(server, 1));
+
+  spktlen = ngtcp2_conn_write_connection_close(server, buf, sizeof(buf),
+                                               NGTCP2_QUIC_INTERNAL_ERROR, 5);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(NGTCP2_CS_CLOSE_WAIT == server->state);
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+}
+
+void test_ngtcp2_conn_stream_rx_reordering(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t data[256];
+  size_t pktlen;
+  ngtcp2_frame fr;
+  int rv;
+  size_t i;
+
+  for (i = 0; i < sizeof(data); ++i) {
+    data[i] = (uint8_t)i;
+  }
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.flags = 0;
+  fr.stream.stream_id = 1;
+
+  /* Last portion with fin arrives first */
+  fr.stream.fin = 1;
+  fr.stream.offset = 200;
+  fr.stream.datalen = 56;
+  fr.stream.data = data + 200;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ud.datalen);
+
+  fr.stream.fin = 0;
+  fr.stream.offset = 100;
+  fr.stream.datalen = 100;
+  fr.stream.data = data + 100;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ud.datalen);
+
+  /* fin offset must not be exceeded */
+  fr.stream.offset = 250;
+  fr.stream.datalen = 10;
+  fr.stream.data = data;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 3, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+
+  fr.stream.offset = 0;
+  fr.stream.datalen = 100;
+  fr.stream.data = data;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 4, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(sizeof(data) == ud.datalen);
+  CU_ASSERT(0 == memcmp(data, ud.data, sizeof(data)));
+  CU_ASSERT(1 == ud.nfin);
+  CU_ASSERT(ngtcp2_conn_find_stream(conn, 1)->flags &
+            NGTCP2_STRM_FLAG_SHUT_RD);
+
+  /* Retransmitted data after fin is ignored */
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 5, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 5);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(sizeof(data) == ud.datalen);
+  CU_ASSERT(1 == ud.nfin);
+
+  ngtcp2_conn_del(conn);
+
+  /* fin carried by empty STREAM frame */
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  fr.stream.fin = 0;
+  fr.stream.offset = 0;
+  fr.stream.datalen = 100;
+  fr.stream.data = data;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ud.nfin);
+
+  fr.stream.fin = 1;
+  fr.stream.offset = 100;
+  fr.stream.datalen = 0;
+  fr.stream.data = data;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(100 == ud.datalen);
+  CU_ASSERT(1 == ud.nfin);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_recv_rst_stream(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ngtcp2_frame fr;
+  uint32_t stream_id;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+
+  CU_ASSERT(2 == stream_id);
+
+  fr.type = NGTCP2_FRAME_RST_STREAM;
+  fr.rst_stream.stream_id = 2;
+  fr.rst_stream.error_code = 0xf;
+  fr.rst_stream.final_offset = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.nclose);
+  CU_ASSERT(2 == ud.stream_id);
+  CU_ASSERT(0xf == ud.close_error_code);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 2));
+
+  /* Server has not opened stream 4 yet */
+  fr.rst_stream.stream_id = 4;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_many_streams(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint32_t stream_id;
+  uint32_t i;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 0, &ud);
+
+  for (i = 0; i < 10000; ++i) {
+    rv = ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(i * 2 + 1 == stream_id);
+  }
+
+  /* Plus stream 0 */
+  CU_ASSERT(10001 == ngtcp2_map_size(&conn->strms));
+
+  for (i = 0; i < 10000; ++i) {
+    CU_ASSERT(i * 2 + 1 == ngtcp2_conn_find_stream(conn, i * 2 + 1)->stream_id);
+    CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, i * 2 + 2));
+  }
+
+  for (i = 0; i < 10000; i += 2) {
+    rv = ngtcp2_conn_close_stream(
+        conn, ngtcp2_conn_find_stream(conn, i * 2 + 1), 0);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(5001 == ngtcp2_map_size(&conn->strms));
+  CU_ASSERT(5000 == ud.nclose);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_implicit_stream_open(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ngtcp2_frame fr;
+  int rv;
+  const uint8_t data[] = "hello";
+
+  memset(&ud, 0, sizeof(ud));
+  ngtcp2_settings_default(&settings);
+  settings.max_stream_id = 7;
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.flags = 0;
+  fr.stream.fin = 0;
+  fr.stream.stream_id = 3;
+  fr.stream.offset = 0;
+  fr.stream.datalen = 5;
+  fr.stream.data = data;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == ud.stream_id);
+  CU_ASSERT(5 == ud.nrecv);
+  CU_ASSERT(3 == conn->last_remote_stream_id);
+  /* Stream 1 is opened implicitly. */
+  CU_ASSERT(NULL != ngtcp2_conn_find_stream(conn, 1));
+
+  fr.stream.stream_id = 1;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.stream_id);
+  CU_ASSERT(10 == ud.nrecv);
+  CU_ASSERT(3 == conn->last_remote_stream_id);
+
+  /* The data on the closed stream is ignored. */
+  rv = ngtcp2_conn_close_stream(conn, ngtcp2_conn_find_stream(conn, 1), 0);
+
+  CU_ASSERT(0 == rv);
+
+  fr.stream.offset = 5;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 3, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(10 == ud.nrecv);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 1));
+
+  /* Stream ID exceeds the limit. */
+  fr.stream.stream_id = 9;
+  fr.stream.offset = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 4, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 4);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 9));
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 5));
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_stream_scheduling(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t data[1024];
+  ssize_t spktlen;
+  uint32_t stream_id;
+  size_t i, n1, n3;
+  int rv;
+  /* short header (13 bytes) + STREAM frame overhead + 100 bytes */
+  const size_t pktlen = 13 + NGTCP2_STREAM_OVERHEAD + 100;
+
+  memset(data, 0, sizeof(data));
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 0, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT ==
+            ngtcp2_conn_set_stream_priority(conn, 1, NGTCP2_MAX_URGENCY + 1,
+                                            NGTCP2_DEFAULT_WEIGHT));
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT ==
+            ngtcp2_conn_set_stream_priority(conn, 1, NGTCP2_DEFAULT_URGENCY,
+                                            0));
+  CU_ASSERT(NGTCP2_ERR_STREAM_NOT_FOUND ==
+            ngtcp2_conn_set_stream_priority(conn, 7, NGTCP2_DEFAULT_URGENCY,
+                                            NGTCP2_DEFAULT_WEIGHT));
+
+  /* Streams with the same weight are served in round-robin */
+  rv = ngtcp2_conn_submit_stream_data(conn, 1, 0, data, sizeof(data));
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_submit_stream_data(conn, 3, 0, data, sizeof(data));
+
+  CU_ASSERT(0 == rv);
+
+  for (i = 0; i < 6; ++i) {
+    spktlen = ngtcp2_conn_send(conn, buf, pktlen, 1);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  CU_ASSERT(6 == ud.nsent);
+
+  for (i = 0; i < 6; ++i) {
+    CU_ASSERT((i % 2 ? 3u : 1u) == ud.sent_strms[i]);
+  }
+
+  /* Stream 3 gets twice as much bandwidth as stream 1 */
+  rv = ngtcp2_conn_set_stream_priority(conn, 3, NGTCP2_DEFAULT_URGENCY,
+                                       NGTCP2_DEFAULT_WEIGHT * 2);
+
+  CU_ASSERT(0 == rv);
+
+  ud.nsent = 0;
+
+  for (i = 0; i < 9; ++i) {
+    spktlen = ngtcp2_conn_send(conn, buf, pktlen, 1);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  n1 = n3 = 0;
+  for (i = 0; i < ud.nsent; ++i) {
+    if (ud.sent_strms[i] == 1) {
+      ++n1;
+    } else if (ud.sent_strms[i] == 3) {
+      ++n3;
+    }
+  }
+
+  CU_ASSERT(3 == n1);
+  CU_ASSERT(6 == n3);
+
+  /* More urgent stream preempts the others */
+  rv = ngtcp2_conn_set_stream_priority(conn, 5, 0, NGTCP2_DEFAULT_WEIGHT);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_submit_stream_data(conn, 5, 1, data, 150);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGTCP2_ERR_STREAM_SHUT_WR ==
+            ngtcp2_conn_submit_stream_data(conn, 5, 0, data, 1));
+
+  ud.nsent = 0;
+
+  for (i = 0; i < 3; ++i) {
+    spktlen = ngtcp2_conn_send(conn, buf, pktlen, 1);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  CU_ASSERT(5 == ud.sent_strms[0]);
+  CU_ASSERT(0 == ud.sent_fin[0]);
+  CU_ASSERT(5 == ud.sent_strms[1]);
+  CU_ASSERT(1 == ud.sent_fin[1]);
+  CU_ASSERT(5 != ud.sent_strms[2]);
+  CU_ASSERT(ngtcp2_conn_find_stream(conn, 5)->flags &
+            NGTCP2_STRM_FLAG_SHUT_WR);
+
+  /* Drain the rest */
+  for (;;) {
+    spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 1);
+    if (spktlen == 0) {
+      break;
+    }
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  CU_ASSERT(sizeof(data) == ngtcp2_conn_find_stream(conn, 1)->tx_offset);
+  CU_ASSERT(sizeof(data) == ngtcp2_conn_find_stream(conn, 3)->tx_offset);
+  CU_ASSERT(ngtcp2_pq_empty(&conn->tx_pq));
+
+  ngtcp2_conn_del(conn);
+}
+
+/*
+ * sim_link is a one-way network path of the link simulation.  It has
+ * the limited bandwidth, the fixed propagation delay, and the
+ * drop-tail queue.  In addition, packets are dropped at random.
+ */
+typedef struct {
+  struct {
+    uint8_t data[NGTCP2_MAX_PKTLEN_IPV4];
+    size_t datalen;
+    ngtcp2_tstamp ts;
+  } pkts[64];
+  size_t head;
+  size_t len;
+  /* bw is the bandwidth in bytes per second. */
+  uint64_t bw;
+  ngtcp2_tstamp delay;
+  ngtcp2_tstamp busy_until;
+  /* agg is the interval in microseconds at which packets are
+     delivered in aggregates like a wireless link does.  0 delivers
+     each packet on time. */
+  ngtcp2_tstamp agg;
+  /* loss is the packet loss rate in 1/10000. */
+  uint32_t loss;
+  uint32_t rnd;
+  /* qlimit is the number of bytes which the queue before the
+     bottleneck holds.  0 means that only the size of pkts limits
+     it. */
+  uint64_t qlimit;
+  /* ndelivered is the number of bytes delivered to the receiver. */
+  uint64_t ndelivered;
+  /* ndropped is the number of packets dropped due to the queue
+     overflow. */
+  uint64_t ndropped;
+} sim_link;
+
+static void sim_link_init(sim_link *link, uint64_t bw, ngtcp2_tstamp delay,
+                          uint32_t loss) {
+  link->head = link->len = 0;
+  link->bw = bw;
+  link->delay = delay;
+  link->busy_until = 0;
+  link->loss = loss;
+  link->rnd = 1;
+  link->qlimit = 0;
+  link->agg = 0;
+  link->ndelivered = 0;
+  link->ndropped = 0;
+}
+
+static void sim_link_send(sim_link *link, const uint8_t *data, size_t datalen,
+                          ngtcp2_tstamp ts) {
+  size_t idx;
+
+  link->rnd = link->rnd * 1103515245 + 12345;
+
+  if ((link->rnd >> 16) % 10000 < link->loss) {
+    return;
+  }
+
+  if (link->busy_until < ts) {
+    link->busy_until = ts;
+  }
+
+  if (link->len == arraylen(link->pkts) ||
+      (link->qlimit &&
+       (link->busy_until - ts) * link->bw / 1000000 + datalen >
+           link->qlimit)) {
+    ++link->ndropped;
+    return;
+  }
+
+  link->busy_until += datalen * 1000000 / link->bw;
+
+  idx = (link->head + link->len) % arraylen(link->pkts);
+  memcpy(link->pkts[idx].data, data, datalen);
+  link->pkts[idx].datalen = datalen;
+  link->pkts[idx].ts = link->busy_until + link->delay;
+  ++link->len;
+}
+
+static void sim_link_deliver(sim_link *link, ngtcp2_conn *conn,
+                             ngtcp2_tstamp ts) {
+  int rv;
+
+  if (link->agg && ts % link->agg) {
+    return;
+  }
+
+  for (; link->len && link->pkts[link->head].ts <= ts;) {
+    rv = ngtcp2_conn_recv(conn, link->pkts[link->head].data,
+                          link->pkts[link->head].datalen, ts);
+
+    CU_ASSERT(0 == rv);
+
+    link->ndelivered += link->pkts[link->head].datalen;
+    link->head = (link->head + 1) % arraylen(link->pkts);
+    --link->len;
+  }
+}
+
+static void sim_drain(ngtcp2_conn *conn, sim_link *link, ngtcp2_tstamp ts) {
+  uint8_t buf[NGTCP2_MAX_PKTLEN_IPV4];
+  ssize_t nwrite;
+  const ngtcp2_cc_stat *ccs = ngtcp2_conn_get_cc_stat(conn);
+  uint64_t bytes_in_flight;
+
+  for (;;) {
+    bytes_in_flight = ccs->bytes_in_flight;
+
+    nwrite = ngtcp2_conn_send(conn, buf, sizeof(buf), ts);
+
+    CU_ASSERT(nwrite >= 0);
+
+    if (nwrite <= 0) {
+      return;
+    }
+
+    /* New data is sent only if cwnd allows */
+    CU_ASSERT(bytes_in_flight == ccs->bytes_in_flight ||
+              bytes_in_flight < ccs->cwnd);
+
+    sim_link_send(link, buf, (size_t)nwrite, ts);
+  }
+}
+
+/*
+ * sim_handle_expiry calls ngtcp2_conn_handle_expiry if the timer of
+ * |conn| has expired.
+ */
+static void sim_handle_expiry(ngtcp2_conn *conn, ngtcp2_tstamp ts) {
+  if (ngtcp2_conn_get_expiry(conn) <= ts) {
+    CU_ASSERT(0 == ngtcp2_conn_handle_expiry(conn, ts));
+  }
+}
+
+/*
+ * sim_bulk_transfer lets client send a single stream to server over
+ * 10Mbps link with 20ms RTT and the packet loss rate |loss| in
+ * 1/10000 for |duration|.  The queue of the link from client to
+ * server holds |qlimit| bytes if it is not 0, and the link from
+ * server to client aggregates ACKs every |agg| microseconds if it is
+ * not 0.  It returns the number of bytes delivered to server, and
+ * stores the congestion control state of client in |ccs|.  The number
+ * of bytes of stream data which server received in order is stored in
+ * |*pnrecv|, and the number of packets dropped due to the queue
+ * overflow in |*pndropped|.  After |duration|, client stops submitting
+ * data, and the simulation continues until all data are acknowledged.
+ */
+static uint64_t sim_bulk_transfer(const ngtcp2_settings *settings,
+                                  uint32_t loss, uint64_t qlimit,
+                                  ngtcp2_tstamp agg, ngtcp2_tstamp duration,
+                                  ngtcp2_cc_stat *ccs, uint64_t *pnrecv,
+                                  uint64_t *pndropped) {
+  static sim_link c2s, s2c;
+  static const uint8_t data[16384];
+  ngtcp2_conn *client, *server;
+  my_user_data cud, sud;
+  ngtcp2_strm *strm;
+  ngtcp2_tstamp ts;
+  uint32_t stream_id;
+  uint64_t ndelivered;
+
+  memset(&cud, 0, sizeof(cud));
+  memset(&sud, 0, sizeof(sud));
+  setup_conn_settings(&client, 0, settings, &cud);
+  setup_conn(&server, 1, &sud);
+
+  sim_link_init(&c2s, 1250000, 10000, loss);
+  sim_link_init(&s2c, 1250000, 10000, loss);
+  c2s.qlimit = qlimit;
+  s2c.agg = agg;
+
+  ngtcp2_conn_open_stream(client, &stream_id, NULL);
+  strm = ngtcp2_conn_find_stream(client, stream_id);
+
+  for (ts = 0; ts < duration; ts += 1000) {
+    sim_link_deliver(&c2s, server, ts);
+    sim_drain(server, &s2c, ts);
+    sim_link_deliver(&s2c, client, ts);
+    sim_handle_expiry(client, ts);
+
+    if (strm->txq_len < sizeof(data)) {
+      ngtcp2_conn_submit_stream_data(client, stream_id, 0, data, sizeof(data));
+    }
+
+    sim_drain(client, &c2s, ts);
+
+    CU_ASSERT(ngtcp2_conn_get_cc_stat(client)->cwnd >= NGTCP2_MIN_CWND);
+  }
+
+  *ccs = *ngtcp2_conn_get_cc_stat(client);
+  *pnrecv = sud.nrecv;
+  *pndropped = c2s.ndropped;
+  ndelivered = c2s.ndelivered;
+
+  CU_ASSERT(sud.nrecv <= strm->tx_offset);
+
+  /* Tail loss is recovered by retransmission timeout. */
+  for (; ts < duration + 10000000 &&
+         (strm->txq_len || client->rtb.num_entries ||
+          !ngtcp2_frame_queue_empty(&client->rtb.lostq));
+       ts += 1000) {
+    sim_link_deliver(&c2s, server, ts);
+    sim_drain(server, &s2c, ts);
+    sim_link_deliver(&s2c, client, ts);
+    sim_handle_expiry(client, ts);
+    sim_drain(client, &c2s, ts);
+  }
+
+  CU_ASSERT(0 == strm->txq_len);
+  CU_ASSERT(0 == client->rtb.num_entries);
+  CU_ASSERT(sud.nrecv == strm->tx_offset);
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+
+  return ndelivered;
+}
+
+void test_ngtcp2_conn_cc_lossy_link(void) {
+  ngtcp2_settings settings;
+  ngtcp2_cc_stat ccs;
+  uint64_t reno_lossless, reno_lossy, cubic_lossless, cubic_lossy;
+  uint64_t nrecv, ndropped;
+  /* 10Mbps for 3 seconds */
+  const uint64_t capacity = 1250000 * 3;
+
+  ngtcp2_settings_default(&settings);
+
+  CU_ASSERT(NGTCP2_CC_ALGO_CUBIC == settings.cc_algo);
+
+  settings.cc_algo = NGTCP2_CC_ALGO_RENO;
+
+  reno_lossless =
+      sim_bulk_transfer(&settings, 0, 0, 0, 3000000, &ccs, &nrecv, &ndropped);
+
+  CU_ASSERT(reno_lossless <= capacity);
+  CU_ASSERT(reno_lossless > capacity * 9 / 10);
+  CU_ASSERT(nrecv > reno_lossless * 9 / 10);
+  /* The drop-tail queue overflowed. */
+  CU_ASSERT(UINT64_MAX != ccs.ssthresh);
+  CU_ASSERT(ccs.min_rtt >= 20000);
+  CU_ASSERT(ccs.min_rtt < 25000);
+
+  /* 1% packet loss in both directions */
+  reno_lossy =
+      sim_bulk_transfer(&settings, 100, 0, 0, 3000000, &ccs, &nrecv, &ndropped);
+
+  CU_ASSERT(reno_lossy < reno_lossless);
+  CU_ASSERT(reno_lossy > capacity * 4 / 10);
+  /* Lost data is retransmitted, and stream data is delivered in order
+     without stalls. */
+  CU_ASSERT(nrecv > reno_lossy * 8 / 10);
+  CU_ASSERT(UINT64_MAX != ccs.ssthresh);
+
+  settings.cc_algo = NGTCP2_CC_ALGO_CUBIC;
+
+  cubic_lossless =
+      sim_bulk_transfer(&settings, 0, 0, 0, 3000000, &ccs, &nrecv, &ndropped);
+
+  CU_ASSERT(cubic_lossless <= capacity);
+  CU_ASSERT(cubic_lossless > capacity * 9 / 10);
+  CU_ASSERT(nrecv > cubic_lossless * 9 / 10);
+  CU_ASSERT(UINT64_MAX != ccs.ssthresh);
+
+  cubic_lossy =
+      sim_bulk_transfer(&settings, 100, 0, 0, 3000000, &ccs, &nrecv, &ndropped);
+
+  CU_ASSERT(cubic_lossy < cubic_lossless);
+  CU_ASSERT(cubic_lossy > capacity * 4 / 10);
+  CU_ASSERT(nrecv > cubic_lossy * 8 / 10);
+  CU_ASSERT(UINT64_MAX != ccs.ssthresh);
+}
+
+typedef struct {
+  ngtcp2_cc cc;
+  size_t nsent;
+  size_t nacked;
+  size_t ncongestion;
+} fixed_cc;
+
+static void fixed_cc_on_pkt_sent(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                 const ngtcp2_cc_pkt *pkt) {
+  fixed_cc *fc = cc->user_data;
+  (void)pkt;
+
+  ++fc->nsent;
+  ccs->cwnd = 3000;
+}
+
+static void fixed_cc_on_pkt_acked(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                  const ngtcp2_cc_pkt *pkt, ngtcp2_tstamp ts) {
+  fixed_cc *fc = cc->user_data;
+  (void)ccs;
+  (void)pkt;
+  (void)ts;
+
+  ++fc->nacked;
+}
+
+static void fixed_cc_congestion_event(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                      ngtcp2_tstamp ts_sent,
+                                      ngtcp2_tstamp ts) {
+  fixed_cc *fc = cc->user_data;
+  (void)ccs;
+  (void)ts_sent;
+  (void)ts;
+
+  ++fc->ncongestion;
+}
+
+void test_ngtcp2_conn_cc_custom(void) {
+  ngtcp2_conn *conn;
+  ngtcp2_conn_callbacks cb;
+  ngtcp2_settings settings;
+  fixed_cc fc;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t data[16384];
+  ngtcp2_frame fr;
+  size_t pktlen;
+  size_t pktlens[8];
+  ssize_t spktlen;
+  uint32_t stream_id;
+  size_t i;
+  int rv;
+
+  memset(&cb, 0, sizeof(cb));
+  ngtcp2_settings_default(&settings);
+
+  settings.cc_algo = NGTCP2_CC_ALGO_CUSTOM;
+
+  rv = ngtcp2_conn_client_new(&conn, 0x1, NGTCP2_PROTO_VERSION, &cb, &settings,
+                              NULL);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+
+  settings.cc_algo = (ngtcp2_cc_algo)0x7f;
+
+  rv = ngtcp2_conn_client_new(&conn, 0x1, NGTCP2_PROTO_VERSION, &cb, &settings,
+                              NULL);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+
+  memset(&fc, 0, sizeof(fc));
+  fc.cc.on_pkt_sent = fixed_cc_on_pkt_sent;
+  fc.cc.on_pkt_acked = fixed_cc_on_pkt_acked;
+  fc.cc.congestion_event = fixed_cc_congestion_event;
+  fc.cc.user_data = &fc;
+
+  settings.cc_algo = NGTCP2_CC_ALGO_CUSTOM;
+  settings.cc = &fc.cc;
+
+  memset(&ud, 0, sizeof(ud));
+  memset(data, 0, sizeof(data));
+  setup_conn_settings(&conn, 0, &settings, &ud);
+
+  CU_ASSERT(NGTCP2_INITIAL_CWND == ngtcp2_conn_get_cc_stat(conn)->cwnd);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 0, data, sizeof(data));
+
+  /* cwnd is 3000 bytes after the first packet is sent.  A packet can
+     be sent as long as bytes in flight is less than cwnd. */
+  for (i = 0;; ++i) {
+    spktlen = ngtcp2_conn_send(conn, buf, 1000, 1);
+    if (spktlen == 0) {
+      break;
+    }
+
+    CU_ASSERT(spktlen > 900);
+    CU_ASSERT(spktlen <= 1000);
+
+    pktlens[i] = (size_t)spktlen;
+  }
+
+  CU_ASSERT(4 == i);
+  CU_ASSERT(4 == fc.nsent);
+  CU_ASSERT(pktlens[0] + pktlens[1] + pktlens[2] + pktlens[3] ==
+            ngtcp2_conn_get_cc_stat(conn)->bytes_in_flight);
+
+  /* Acknowledge the last packet, which declares the first one lost */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.ack.largest_ack = 3;
+  fr.ack.ack_delay = 0;
+  fr.ack.first_ack_blklen = 0;
+  fr.ack.num_blks = 0;
+  fr.ack.num_ts = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == fc.nacked);
+  CU_ASSERT(1 == fc.ncongestion);
+  CU_ASSERT(pktlens[1] + pktlens[2] ==
+            ngtcp2_conn_get_cc_stat(conn)->bytes_in_flight);
+  CU_ASSERT(1 == ngtcp2_conn_get_cc_stat(conn)->latest_rtt);
+
+  /* ACK of the packet which has not been sent */
+  fr.ack.largest_ack = 4;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_retransmission(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t data[8192];
+  ngtcp2_frame fr;
+  ngtcp2_stream sfr;
+  ngtcp2_frame_chain *frc;
+  ngtcp2_rtb_entry *ent;
+  size_t pktlen;
+  ssize_t spktlen;
+  uint32_t stream_id;
+  size_t i;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  memset(data, 0, sizeof(data));
+  setup_conn(&conn, 0, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 1, data, 4000);
+
+  for (i = 0; i < 4; ++i) {
+    spktlen = ngtcp2_conn_send(conn, buf, 1200, 1);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  CU_ASSERT(4 == conn->rtb.num_entries);
+  CU_ASSERT(4000 == ngtcp2_conn_find_stream(conn, stream_id)->tx_offset);
+  CU_ASSERT(ngtcp2_pq_empty(&conn->tx_pq));
+  CU_ASSERT(ud.sent_fin[3]);
+
+  /* Acknowledge the last packet, which declares the first one lost */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.ack.largest_ack = 3;
+  fr.ack.ack_delay = 0;
+  fr.ack.first_ack_blklen = 0;
+  fr.ack.num_blks = 0;
+  fr.ack.num_ts = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == conn->rtb.num_entries);
+  CU_ASSERT(!ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+
+  /* The lost STREAM frame is retransmitted in a larger packet. */
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 3);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+  CU_ASSERT(3 == conn->rtb.num_entries);
+  CU_ASSERT(5 == ud.nsent);
+  CU_ASSERT(stream_id == ud.sent_strms[4]);
+  CU_ASSERT(!ud.sent_fin[4]);
+
+  ent = conn->rtb.tail;
+
+  CU_ASSERT(4 == ent->pkt_num);
+  CU_ASSERT(stream_id == ent->frc->fr.stream.stream_id);
+  CU_ASSERT(0 == ent->frc->fr.stream.offset);
+  CU_ASSERT(NULL == ent->frc->next);
+
+  /* Nothing to send */
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 4);
+
+  CU_ASSERT(0 == spktlen);
+
+  /* Lost handshake data is retransmitted in Client Cleartext packet
+     even after handshake completed. */
+  sfr.type = NGTCP2_FRAME_STREAM;
+  sfr.flags = 0;
+  sfr.fin = 0;
+  sfr.stream_id = 0;
+  sfr.offset = 100;
+  sfr.datalen = 2000;
+  sfr.data = data;
+
+  ngtcp2_frame_chain_stream_new(&frc, &sfr, conn->mem);
+  ngtcp2_frame_queue_push(&conn->rtb.hs_lostq, frc);
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 5);
+
+  CU_ASSERT(spktlen > 1100);
+  CU_ASSERT(spktlen <= 1200);
+  CU_ASSERT(NGTCP2_HEADER_FORM_BIT & buf[0]);
+  CU_ASSERT(NGTCP2_PKT_CLIENT_CLEARTEXT == (buf[0] & 0x7f));
+
+  /* The frame is split, and the rest of the data remains. */
+  ent = conn->rtb.tail;
+
+  CU_ASSERT(0 == ent->frc->fr.stream.stream_id);
+  CU_ASSERT(100 == ent->frc->fr.stream.offset);
+  CU_ASSERT(frc == ngtcp2_frame_queue_top(&conn->rtb.hs_lostq));
+  CU_ASSERT(100 + ent->frc->fr.stream.datalen == frc->fr.stream.offset);
+  CU_ASSERT(2000 == ent->frc->fr.stream.datalen + frc->fr.stream.datalen);
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 6);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->rtb.hs_lostq));
+  CU_ASSERT(2100 == conn->rtb.tail->frc->fr.stream.offset +
+                        conn->rtb.tail->frc->fr.stream.datalen);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_expiry(void) {
+  ngtcp2_conn *conn;
+  ngtcp2_settings settings;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t data[1000];
+  ngtcp2_frame fr;
+  size_t pktlen;
+  ssize_t spktlen;
+  uint32_t stream_id;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  memset(data, 0, sizeof(data));
+  ngtcp2_settings_default(&settings);
+  settings.idle_timeout = 5000000;
+  setup_conn_settings(&conn, 0, &settings, &ud);
+
+  /* No timer is running yet */
+  CU_ASSERT(UINT64_MAX == ngtcp2_conn_get_expiry(conn));
+  CU_ASSERT(0 == ngtcp2_conn_handle_expiry(conn, 1000000000));
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 0, data, sizeof(data));
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 1000000);
+
+  CU_ASSERT(spktlen > 0);
+  /* RTT has not been measured yet. */
+  CU_ASSERT(1000000 + NGTCP2_DEFAULT_INITIAL_RTO ==
+            ngtcp2_conn_get_expiry(conn));
+
+  rv = ngtcp2_conn_handle_expiry(conn, 1999999);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == conn->rtb.num_entries);
+
+  /* Retransmission timeout */
+  rv = ngtcp2_conn_handle_expiry(conn, 2000000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == conn->rtb.num_entries);
+  CU_ASSERT(0 == ngtcp2_conn_get_cc_stat(conn)->bytes_in_flight);
+  CU_ASSERT(!ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+  /* Idle timer is still running. */
+  CU_ASSERT(6000000 == ngtcp2_conn_get_expiry(conn));
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 2000000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+  /* Retransmission timeout is doubled. */
+  CU_ASSERT(2000000 + 2 * NGTCP2_DEFAULT_INITIAL_RTO ==
+            ngtcp2_conn_get_expiry(conn));
+
+  /* Acknowledge the retransmitted packet. */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.ack.largest_ack = 1;
+  fr.ack.ack_delay = 0;
+  fr.ack.first_ack_blklen = 0;
+  fr.ack.num_blks = 0;
+  fr.ack.num_ts = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2100000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == conn->rtb.num_entries);
+  CU_ASSERT(0 == conn->rtb.rto_count);
+  /* Only idle timer is running, and it restarted. */
+  CU_ASSERT(7100000 == ngtcp2_conn_get_expiry(conn));
+
+  rv = ngtcp2_conn_handle_expiry(conn, 7099999);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_handle_expiry(conn, 7100000);
+
+  CU_ASSERT(NGTCP2_ERR_IDLE_CLOSE == rv);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_write_pkts(void) {
+  ngtcp2_conn *client, *server;
+  my_user_data cud, sud;
+  static uint8_t buf[16 * 1200];
+  uint8_t data[10000];
+  ssize_t spktlen;
+  size_t npkts, i;
+  uint32_t stream_id;
+  int rv;
+
+  memset(&cud, 0, sizeof(cud));
+  memset(&sud, 0, sizeof(sud));
+  memset(data, 0, sizeof(data));
+  setup_conn(&client, 0, &cud);
+  setup_conn(&server, 1, &sud);
+
+  spktlen = ngtcp2_conn_write_pkts(client, buf, sizeof(buf), 0, &npkts, 1);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == spktlen);
+
+  spktlen = ngtcp2_conn_write_pkts(client, buf, 1199, 1200, &npkts, 1);
+
+  CU_ASSERT(NGTCP2_ERR_NOBUF == spktlen);
+
+  /* Nothing to write */
+  spktlen = ngtcp2_conn_write_pkts(client, buf, sizeof(buf), 1200, &npkts, 1);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(0 == npkts);
+
+  ngtcp2_conn_open_stream(client, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(client, stream_id, 1, data, sizeof(data));
+
+  spktlen = ngtcp2_conn_write_pkts(client, buf, sizeof(buf), 1200, &npkts, 1);
+
+  CU_ASSERT(9 == npkts);
+  CU_ASSERT(spktlen > 1200 * 8);
+  CU_ASSERT(spktlen < 1200 * 9);
+  CU_ASSERT(9 == client->rtb.num_entries);
+  CU_ASSERT((uint64_t)spktlen ==
+            ngtcp2_conn_get_cc_stat(client)->bytes_in_flight);
+
+  /* Every packet but the last one is 1200 bytes. */
+  for (i = 0; i < npkts - 1; ++i) {
+    rv = ngtcp2_conn_recv(server, buf + i * 1200, 1200, 2);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  rv = ngtcp2_conn_recv(server, buf + i * 1200, (size_t)spktlen - i * 1200, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(sizeof(data) == sud.nrecv);
+  CU_ASSERT(1 == sud.nfin);
+
+  /* A burst of ACK only packet */
+  spktlen = ngtcp2_conn_write_pkts(server, buf, sizeof(buf), 1200, &npkts, 3);
+
+  CU_ASSERT(1 == npkts);
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(spktlen < 1200);
+
+  rv = ngtcp2_conn_recv(client, buf, (size_t)spktlen, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == client->rtb.num_entries);
+
+  /* The burst is limited by the buffer. */
+  ngtcp2_conn_open_stream(client, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(client, stream_id, 1, data, sizeof(data));
+
+  spktlen = ngtcp2_conn_write_pkts(client, buf, 3 * 1200 + 1199, 1200, &npkts,
+                                   5);
+
+  CU_ASSERT(3 == npkts);
+  CU_ASSERT(3 * 1200 == spktlen);
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+}
+
+void test_ngtcp2_conn_acked_stream_data_offset(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  uint8_t a[1000], b[1500], c[500];
+  ngtcp2_vec datav[] = {{a, sizeof(a)}, {b, 0}, {b, sizeof(b)}, {c, sizeof(c)}};
+  ngtcp2_frame fr;
+  ngtcp2_frame_chain *frc;
+  ngtcp2_rtb_entry *ent;
+  ngtcp2_strm *strm;
+  size_t pktlen;
+  ssize_t spktlen;
+  uint32_t stream_id;
+  uint64_t npkts = 0;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 0, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  rv = ngtcp2_conn_submit_stream_datav(conn, stream_id, 1, datav,
+                                       arraylen(datav));
+
+  CU_ASSERT(0 == rv);
+
+  for (;;) {
+    spktlen = ngtcp2_conn_send(conn, buf, 1200, 1);
+    if (spktlen == 0) {
+      break;
+    }
+
+    CU_ASSERT(spktlen > 0);
+
+    ++npkts;
+  }
+
+  strm = ngtcp2_conn_find_stream(conn, stream_id);
+
+  CU_ASSERT(3 == npkts);
+  CU_ASSERT(3000 == strm->tx_offset);
+
+  /* The frames in flight refer to the application buffers. */
+  for (ent = conn->rtb.head; ent; ent = ent->next) {
+    for (frc = ent->frc; frc; frc = frc->next) {
+      if (frc->fr.stream.offset < 1000) {
+        CU_ASSERT(a + frc->fr.stream.offset == frc->fr.stream.data);
+      } else if (frc->fr.stream.offset < 2500) {
+        CU_ASSERT(b + frc->fr.stream.offset - 1000 == frc->fr.stream.data);
+      } else {
+        CU_ASSERT(c + frc->fr.stream.offset - 2500 == frc->fr.stream.data);
+      }
+    }
+  }
+
+  /* Acknowledging the last packet does not release anything. */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.ack.largest_ack = npkts - 1;
+  fr.ack.ack_delay = 0;
+  fr.ack.first_ack_blklen = 0;
+  fr.ack.num_blks = 0;
+  fr.ack.num_ts = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ud.nacked);
+  CU_ASSERT(strm->flags & NGTCP2_STRM_FLAG_FIN_ACKED);
+
+  /* Acknowledging the rest releases everything in order. */
+  fr.ack.first_ack_blklen = npkts - 1;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 2, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(ud.nacked > 0);
+  CU_ASSERT(stream_id == ud.stream_id);
+  CU_ASSERT(3000 == ud.acked_offset);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->rtb.ackedq));
+  CU_ASSERT(ngtcp2_strm_is_all_tx_data_acked(strm));
+  /* The stream is still open for reading. */
+  CU_ASSERT(0 == ud.nclose);
+
+  /* The lost data of the reset stream is not retransmitted, because
+     the application may have released it. */
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 0, a, sizeof(a));
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 4);
+
+  CU_ASSERT(spktlen > 0);
+
+  rv = ngtcp2_conn_handle_expiry(conn, 1000000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(!ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+
+  fr.type = NGTCP2_FRAME_RST_STREAM;
+  fr.rst_stream.stream_id = stream_id;
+  fr.rst_stream.error_code = 0xf;
+  fr.rst_stream.final_offset = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), 3, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1000000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.nclose);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf),
+                             1000000 + NGTCP2_DEFAULT_MAX_ACK_DELAY);
+
+  /* Only ACK is sent. */
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->rtb.lostq));
+  CU_ASSERT(NULL == conn->rtb.head);
+
+  ngtcp2_conn_del(conn);
+}
+
+/*
+ * write_stream_pkt writes a protected packet which contains STREAM
+ * frame of stream |stream_id| carrying |datalen| bytes at |offset|.
+ */
+static size_t write_stream_pkt(uint8_t *out, size_t outlen, uint64_t pkt_num,
+                               uint32_t stream_id, uint64_t offset,
+                               size_t datalen) {
+  static const uint8_t data[1500];
+  ngtcp2_frame fr;
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.flags = 0;
+  fr.stream.fin = 0;
+  fr.stream.stream_id = stream_id;
+  fr.stream.offset = offset;
+  fr.stream.datalen = datalen;
+  fr.stream.data = data;
+
+  return write_single_frame_pkt(out, outlen, pkt_num, &fr);
+}
+
+void test_ngtcp2_conn_recv_flow_control(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ssize_t spktlen;
+  ngtcp2_strm *strm;
+  int rv;
+
+  ngtcp2_settings_default(&settings);
+  settings.max_stream_data = 1024;
+  settings.max_stream_window = 1024;
+  settings.max_data = 1536;
+  settings.max_window = 1536;
+
+  /* Stream level limit */
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 1, 1024);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(NGTCP2_ERR_FLOW_CONTROL == rv);
+
+  ngtcp2_conn_del(conn);
+
+  /* Connection level limit counts the data buffered out of order */
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 1, 1023);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1024 == conn->rx_offset);
+
+  /* Retransmission is not counted twice. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 1, 1023);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1024 == conn->rx_offset);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 3, 3, 1, 1023);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(NGTCP2_ERR_FLOW_CONTROL == rv);
+
+  ngtcp2_conn_del(conn);
+
+  /* Window update */
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 0, 400);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->frq));
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 400, 400);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  strm = ngtcp2_conn_find_stream(conn, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(800 + 1024 == strm->max_rx_offset);
+  CU_ASSERT(800 + 1536 == conn->max_rx_offset);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 3);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(1 == ud.nsent_types[NGTCP2_FRAME_MAX_STREAM_DATA]);
+  CU_ASSERT(800 + 1024 == ud.max_stream_data);
+  CU_ASSERT(1 == ud.nsent_types[NGTCP2_FRAME_MAX_DATA]);
+  CU_ASSERT((800 + 1536) / 1024 == ud.max_data);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&conn->frq));
+
+  /* The extended window can be used. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 3, 1, 800, 1024);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1824 == ud.nrecv);
+
+  ngtcp2_conn_del(conn);
+}
+
+/*
+ * recv_ctrl_frame lets |conn| receive a packet which contains |fr|,
+ * and then sends packets until nothing is left to send.  It returns
+ * the number of packets sent.
+ */
+static size_t recv_ctrl_frame(ngtcp2_conn *conn, uint64_t pkt_num,
+                              ngtcp2_frame *fr, ngtcp2_tstamp ts) {
+  uint8_t buf[2048];
+  size_t pktlen;
+  ssize_t spktlen;
+  size_t npkts = 0;
+  int rv;
+
+  if (fr) {
+    pktlen = write_single_frame_pkt(buf, sizeof(buf), pkt_num, fr);
+    rv = ngtcp2_conn_recv(conn, buf, pktlen, ts);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  for (;;) {
+    spktlen = ngtcp2_conn_send(conn, buf, 1200, ts);
+    if (spktlen == 0) {
+      return npkts;
+    }
+
+    CU_ASSERT(spktlen > 0);
+
+    ++npkts;
+  }
+}
+
+void test_ngtcp2_conn_tx_flow_control(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_transport_params params;
+  ngtcp2_frame fr;
+  ngtcp2_strm *strm1, *strm3;
+  uint8_t buf[2048];
+  size_t npkts;
+  ssize_t spktlen;
+  size_t ndatalen;
+  uint32_t stream_id;
+  static const uint8_t data[4096];
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 0, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  strm1 = ngtcp2_conn_find_stream(conn, stream_id);
+
+  CU_ASSERT(NGTCP2_DEFAULT_MAX_STREAM_DATA == strm1->max_tx_offset);
+
+  params.initial_max_stream_data = 1500;
+  params.initial_max_data = 2;
+
+  CU_ASSERT(0 == ngtcp2_conn_set_remote_transport_params(conn, &params));
+  CU_ASSERT(1500 == strm1->max_tx_offset);
+  CU_ASSERT(2048 == conn->max_tx_offset);
+
+  /* Stream level limit */
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 1, data, sizeof(data));
+  recv_ctrl_frame(conn, 0, NULL, 1);
+
+  CU_ASSERT(1500 == strm1->tx_offset);
+  CU_ASSERT(1 == ud.nsent_types[NGTCP2_FRAME_STREAM_BLOCKED]);
+  CU_ASSERT(ngtcp2_pq_empty(&conn->tx_pq));
+
+  /* Connection level limit */
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  strm3 = ngtcp2_conn_find_stream(conn, stream_id);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 1, data, sizeof(data));
+  recv_ctrl_frame(conn, 0, NULL, 2);
+
+  CU_ASSERT(548 == strm3->tx_offset);
+  CU_ASSERT(2048 == conn->tx_offset);
+  CU_ASSERT(1 == ud.nsent_types[NGTCP2_FRAME_BLOCKED]);
+
+  /* ngtcp2_conn_write_stream is also blocked. */
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &ndatalen,
+                                     stream_id, 1, data, 1, 3);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(0 == ndatalen);
+  CU_ASSERT(!(ngtcp2_conn_find_stream(conn, stream_id)->flags &
+              NGTCP2_STRM_FLAG_SHUT_WR));
+
+  fr.type = NGTCP2_FRAME_MAX_STREAM_DATA;
+  fr.max_stream_data.stream_id = 1;
+  fr.max_stream_data.max_stream_data = 4096;
+  npkts = recv_ctrl_frame(conn, 0, &fr, 3);
+
+  /* Nothing is sent, and ACK is delayed. */
+  CU_ASSERT(0 == npkts);
+  CU_ASSERT(1500 == strm1->tx_offset);
+  CU_ASSERT(!ngtcp2_pq_empty(&conn->tx_pq));
+
+  fr.type = NGTCP2_FRAME_MAX_DATA;
+  fr.max_data.max_data = 4;
+  recv_ctrl_frame(conn, 1, &fr, 4);
+
+  CU_ASSERT(4096 == conn->tx_offset);
+  CU_ASSERT(4096 == strm1->tx_offset + strm3->tx_offset);
+  CU_ASSERT(2 == ud.nsent_types[NGTCP2_FRAME_BLOCKED]);
+
+  /* The limit never shrinks. */
+  fr.max_data.max_data = 1;
+  recv_ctrl_frame(conn, 2, &fr, 5);
+
+  CU_ASSERT(4096 == conn->max_tx_offset);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_rx_window_autotune(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ngtcp2_strm *strm;
+  int rv;
+
+  ngtcp2_settings_default(&settings);
+  settings.max_stream_data = 1024;
+  settings.max_stream_window = 4096;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  conn->ccs.min_rtt = conn->ccs.smoothed_rtt = 100000;
+
+  /* The first update does not grow the window. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 0, 600);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1000);
+
+  strm = ngtcp2_conn_find_stream(conn, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1024 == strm->rx_window);
+  CU_ASSERT(600 + 1024 == strm->max_rx_offset);
+
+  /* The window is consumed within 2 RTTs. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 600, 600);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2048 == strm->rx_window);
+  CU_ASSERT(1200 + 2048 == strm->max_rx_offset);
+  CU_ASSERT(conn->rx_window >= 2048 + 1024);
+
+  /* The window is not consumed fast enough. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 3, 1, 1200, 1500);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1000000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2048 == strm->rx_window);
+  CU_ASSERT(2700 + 2048 == strm->max_rx_offset);
+
+  /* The window does not exceed the limit. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 4, 1, 2700, 1500);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1001000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4096 == strm->rx_window);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 5, 1, 4200, 1500);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1002000);
+  pktlen = write_stream_pkt(buf, sizeof(buf), 6, 1, 5700, 1500);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1003000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4096 == strm->rx_window);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_pacing(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  static uint8_t buf[16 * 1200];
+  static const uint8_t data[65536];
+  ssize_t spktlen;
+  size_t npkts;
+  uint32_t stream_id;
+  ngtcp2_tstamp ts = 1000000;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 0, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 0, data, sizeof(data));
+
+  /* No pacing until RTT is measured */
+  CU_ASSERT((NGTCP2_INITIAL_CWND + 1199) / 1200 ==
+            ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  conn->ccs.min_rtt = conn->ccs.smoothed_rtt = 100000;
+  conn->ccs.cwnd = 100 * 1200;
+
+  /* During slow start, 2 * cwnd is sent per RTT: a packet every
+     500us.  The packets for NGTCP2_PACING_GRANULARITY are sent at
+     once. */
+  CU_ASSERT(3 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  spktlen = ngtcp2_conn_write_pkts(conn, buf, sizeof(buf), 1200, &npkts, ts);
+
+  CU_ASSERT(3 * 1200 == spktlen);
+  CU_ASSERT(3 == npkts);
+  CU_ASSERT(0 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+  CU_ASSERT(ts + 500 == ngtcp2_conn_get_expiry(conn));
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, ts + 499);
+
+  CU_ASSERT(0 == spktlen);
+
+  ts += 500;
+
+  CU_ASSERT(1 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, ts);
+
+  CU_ASSERT(spktlen > 0);
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, ts);
+
+  CU_ASSERT(0 == spktlen);
+
+  /* The sender which is late does not get more credit. */
+  ts += 100000;
+
+  CU_ASSERT(3 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  /* In congestion avoidance, 1.25 * cwnd is sent per RTT: a packet
+     every 800us. */
+  conn->ccs.ssthresh = 0;
+
+  CU_ASSERT(2 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  spktlen = ngtcp2_conn_write_pkts(conn, buf, sizeof(buf), 1200, &npkts, ts);
+
+  CU_ASSERT(2 == npkts);
+  CU_ASSERT(ts + 600 == ngtcp2_conn_get_expiry(conn));
+
+  /* The congestion window limits the burst. */
+  ts += 100000;
+  conn->ccs.cwnd = conn->ccs.bytes_in_flight + 1200;
+
+  CU_ASSERT(1 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  ngtcp2_conn_del(conn);
+
+  /* Pacing disabled */
+  ngtcp2_settings_default(&settings);
+  settings.pacing = 0;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 0, &settings, &ud);
+
+  ngtcp2_conn_open_stream(conn, &stream_id, NULL);
+  ngtcp2_conn_submit_stream_data(conn, stream_id, 0, data, sizeof(data));
+
+  conn->ccs.min_rtt = conn->ccs.smoothed_rtt = 100000;
+  conn->ccs.cwnd = 100 * 1200;
+
+  CU_ASSERT(100 == ngtcp2_conn_get_num_pkts_allowed(conn, 1200, ts));
+
+  spktlen = ngtcp2_conn_write_pkts(conn, buf, sizeof(buf), 1200, &npkts, ts);
+
+  CU_ASSERT(16 == npkts);
+  CU_ASSERT(ts + 100000 < ngtcp2_conn_get_expiry(conn));
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_pacing_shallow_buffer(void) {
+  ngtcp2_settings settings;
+  ngtcp2_cc_stat ccs;
+  uint64_t paced, unpaced, nrecv;
+  uint64_t paced_ndropped, unpaced_ndropped;
+
+  ngtcp2_settings_default(&settings);
+
+  CU_ASSERT(settings.pacing);
+
+  /* The queue holds 8 packets, which is a third of BDP, and ACKs
+     arrive in aggregates every 10ms.  Without pacing, each aggregate
+     of ACKs releases a burst which overflows the queue. */
+  paced = sim_bulk_transfer(&settings, 0, 8 * 1200, 10000, 3000000, &ccs,
+                            &nrecv, &paced_ndropped);
+
+  settings.pacing = 0;
+
+  unpaced = sim_bulk_transfer(&settings, 0, 8 * 1200, 10000, 3000000, &ccs,
+                              &nrecv, &unpaced_ndropped);
+
+  CU_ASSERT(paced_ndropped < unpaced_ndropped);
+  CU_ASSERT(paced > unpaced * 2);
+}
+
+/*
+ * recv_ping_pkt lets |conn| receive a packet |pkt_num| which contains
+ * PING frame.
+ */
+static void recv_ping_pkt(ngtcp2_conn *conn, uint64_t pkt_num,
+                          ngtcp2_tstamp ts) {
+  uint8_t buf[256];
+  size_t pktlen;
+  ngtcp2_frame fr;
+  int rv;
+
+  fr.type = NGTCP2_FRAME_PING;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), pkt_num, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, ts);
+
+  CU_ASSERT(0 == rv);
+}
+
+void test_ngtcp2_conn_ack_retention(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[2048];
+  ssize_t spktlen;
+  ngtcp2_frame fr;
+  size_t pktlen;
+  uint64_t pkt_num, ping_pkt_num = 0;
+  size_t i;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  recv_ping_pkt(conn, 1, 1);
+  recv_ping_pkt(conn, 2, 1);
+  recv_ping_pkt(conn, 3, 1);
+  recv_ping_pkt(conn, 1000, 1);
+  recv_ping_pkt(conn, 1001, 1);
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 2);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(1 == ud.nsent_acks);
+  CU_ASSERT(1001 == ud.ack.largest_ack);
+  CU_ASSERT(1 == ud.ack.first_ack_blklen);
+  /* 996 missing packets are encoded by 3 blocks of length 0 */
+  CU_ASSERT(4 == ud.ack.num_blks);
+
+  for (i = 0; i < 3; ++i) {
+    CU_ASSERT(255 == ud.ack.blks[i].gap);
+    CU_ASSERT(0 == ud.ack.blks[i].blklen);
+  }
+
+  CU_ASSERT(996 - 255 * 3 == ud.ack.blks[3].gap);
+  CU_ASSERT(3 == ud.ack.blks[3].blklen);
+
+  /* Nothing new to acknowledge */
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 3);
+
+  CU_ASSERT(0 == spktlen);
+
+  /* ACK frame was lost.  The next one still carries all ranges. */
+  recv_ping_pkt(conn, 4, 4);
+
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 5);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(2 == ud.nsent_acks);
+  CU_ASSERT(1001 == ud.ack.largest_ack);
+  CU_ASSERT(4 == ud.ack.num_blks);
+  CU_ASSERT(995 - 255 * 3 == ud.ack.blks[3].gap);
+  CU_ASSERT(4 == ud.ack.blks[3].blklen);
+
+  /* The packets which only carry ACK frame are not acknowledged.
+     Eventually, PING frame is added to have the ranges acknowledged
+     by the remote endpoint. */
+  for (pkt_num = 1002; ud.nsent_types[NGTCP2_FRAME_PING] == 0;) {
+    CU_ASSERT(pkt_num < 1002 + NGTCP2_ACKTR_MAX_ACK_ONLY * 2);
+
+    /* ACK is sent every 2 packets. */
+    recv_ping_pkt(conn, pkt_num++, 10);
+    recv_ping_pkt(conn, pkt_num++, 10);
+
+    ping_pkt_num = conn->next_tx_pkt_num;
+    spktlen = ngtcp2_conn_send(conn, buf, 1200, 10);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  CU_ASSERT(1 == conn->rtb.num_entries);
+  CU_ASSERT(0 < conn->acktr.len);
+
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.ack.largest_ack = ping_pkt_num;
+  fr.ack.ack_delay = 0;
+  fr.ack.first_ack_blklen = 0;
+  fr.ack.num_blks = 0;
+
+  pktlen = write_single_frame_pkt(buf, sizeof(buf), pkt_num, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 11);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == conn->rtb.num_entries);
+  /* Only the packet which carried ACK frame is left. */
+  CU_ASSERT(1 == conn->acktr.len);
+  CU_ASSERT(pkt_num == ngtcp2_acktr_get(&conn->acktr, 0)->pkt_num);
+  CU_ASSERT(!conn->acktr.pending);
+
+  /* The packet which only carries ACK frame is not acknowledged. */
+  spktlen = ngtcp2_conn_send(conn, buf, 1200, 12);
+
+  CU_ASSERT(0 == spktlen);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_delayed_ack(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  ssize_t spktlen;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  recv_ping_pkt(conn, 1, 1000);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 1000);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(1000 + NGTCP2_DEFAULT_MAX_ACK_DELAY ==
+            ngtcp2_conn_get_expiry(conn));
+
+  /* The second packet makes ACK due. */
+  recv_ping_pkt(conn, 2, 2000);
+
+  CU_ASSERT(1000 == ngtcp2_conn_get_expiry(conn));
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 2000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(1 == ud.nsent_acks);
+  CU_ASSERT(2 == ud.ack.largest_ack);
+  CU_ASSERT(1 == ud.ack.first_ack_blklen);
+  CU_ASSERT(!conn->acktr.pending);
+
+  /* Packet 3 is missing.  ACK is sent immediately. */
+  recv_ping_pkt(conn, 4, 3000);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 3000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(2 == ud.nsent_acks);
+  CU_ASSERT(4 == ud.ack.largest_ack);
+
+  /* Reordered packet is also acknowledged immediately. */
+  recv_ping_pkt(conn, 3, 4000);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 4000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(3 == ud.nsent_acks);
+  CU_ASSERT(4 == ud.ack.largest_ack);
+  CU_ASSERT(3 == ud.ack.first_ack_blklen);
+
+  /* Single packet is acknowledged after max_ack_delay. */
+  recv_ping_pkt(conn, 5, 5000);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf),
+                             5000 + NGTCP2_DEFAULT_MAX_ACK_DELAY - 1);
+
+  CU_ASSERT(0 == spktlen);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf),
+                             5000 + NGTCP2_DEFAULT_MAX_ACK_DELAY);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(4 == ud.nsent_acks);
+  CU_ASSERT(5 == ud.ack.largest_ack);
+
+  ngtcp2_conn_del(conn);
+
+  /* Every packet is acknowledged if the threshold is 1. */
+  ngtcp2_settings_default(&settings);
+  settings.ack_eliciting_threshold = 1;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  recv_ping_pkt(conn, 1, 1000);
+
+  spktlen = ngtcp2_conn_send(conn, buf, sizeof(buf), 1000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(1 == ud.nsent_acks);
+
+  ngtcp2_conn_del(conn);
+}
+
+/*
+ * recv_reordered_stream_data makes |conn| receive stream data on
+ * several streams in reverse order so that the data are buffered.
+ */
+static void recv_reordered_stream_data(ngtcp2_conn *conn) {
+  uint8_t buf[2048];
+  size_t pktlen;
+  uint64_t pkt_num = 1;
+  uint32_t stream_id;
+  size_t i;
+  int rv;
+
+  for (stream_id = 1; stream_id <= 7; stream_id += 2) {
+    for (i = 4; i > 0; --i) {
+      pktlen = write_stream_pkt(buf, sizeof(buf), pkt_num, stream_id,
+                                (i - 1) * 1000, 1000);
+      rv = ngtcp2_conn_recv(conn, buf, pktlen, pkt_num);
+
+      CU_ASSERT(0 == rv);
+
+      ++pkt_num;
+    }
+  }
+}
+
+void test_ngtcp2_conn_mem_pool(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  ngtcp2_t_counting_mem cm;
+  size_t nalloc;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_settings_default(&settings);
+  settings.mem = &cm.mem;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  CU_ASSERT(conn->mem == &conn->acct.mem);
+  CU_ASSERT(conn->acct.parent == &cm.mem);
+
+  recv_reordered_stream_data(conn);
+
+  CU_ASSERT(4 * 4000 == ud.nrecv);
+
+  ngtcp2_conn_del(conn);
+
+  CU_ASSERT(0 == cm.nlive);
+
+  nalloc = cm.nalloc;
+
+  /* The same traffic takes fewer allocations with the pool, and
+     everything is released by ngtcp2_conn_del. */
+  ngtcp2_t_counting_mem_init(&cm);
+  settings.mem_pool = 1;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  CU_ASSERT(conn->mem == &conn->pool.mem);
+  CU_ASSERT(conn->pool.parent == &conn->acct.mem);
+  CU_ASSERT(conn->acct.parent == &cm.mem);
+
+  recv_reordered_stream_data(conn);
+
+  CU_ASSERT(4 * 4000 == ud.nrecv);
+  CU_ASSERT(cm.nalloc < nalloc);
+
+  ngtcp2_conn_del(conn);
+
+  CU_ASSERT(0 == cm.nlive);
+}
+
+void test_ngtcp2_conn_mem_limit(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  size_t pktlen;
+  size_t usage;
+  uint32_t stream_id;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  CU_ASSERT(usage > sizeof(ngtcp2_conn));
+
+  /* Out-of-order data is buffered, and freed when delivered. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 1000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) > usage + 1000);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 0, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2000 == ud.nrecv);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  ngtcp2_conn_del(conn);
+
+  /* Out-of-order data which does not fit in the budget is discarded
+     without being acknowledged. */
+  ngtcp2_settings_default(&settings);
+  settings.max_mem = usage + 1000;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 0, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == conn->acktr.len);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 2000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(usage == ngtcp2_conn_get_mem_usage(conn));
+  CU_ASSERT(1 == conn->acktr.len);
+  CU_ASSERT(1 == ngtcp2_acktr_get(&conn->acktr, 0)->pkt_num);
+
+  /* In-order data is still accepted. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 3, 1, 1000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2000 == ud.nrecv);
+
+  /* The connection which exceeds the budget must be closed. */
+  for (stream_id = 3; rv == 0; stream_id += 2) {
+    pktlen = write_stream_pkt(buf, sizeof(buf), stream_id + 1, stream_id, 0,
+                              1);
+    rv = ngtcp2_conn_recv(conn, buf, pktlen, stream_id + 1);
+  }
+
+  CU_ASSERT(NGTCP2_ERR_MEM_LIMIT == rv);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) > settings.max_mem);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_mem_limit_pool(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  size_t pktlen;
+  size_t usage;
+  int rv;
+
+  ngtcp2_settings_default(&settings);
+  settings.mem_pool = 1;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 1000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 0, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2000 == ud.nrecv);
+
+  rv = ngtcp2_conn_close_stream(conn, ngtcp2_conn_find_stream(conn, 1), 0);
+
+  CU_ASSERT(0 == rv);
+
+  /* The chunk of the reorder buffer is kept in the pool, and it still
+     counts. */
+  CU_ASSERT(1 == conn->pool.nlarge);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) >
+            usage + NGTCP2_DEFAULT_REORDER_CHUNK);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 3, 3, 0, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 3);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3000 == ud.nrecv);
+  CU_ASSERT(1 == conn->pool.nlarge);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  /* The kept chunk is released to make room for out-of-order data. */
+  conn->max_mem = usage + 1000 + NGTCP2_DEFAULT_REORDER_CHUNK;
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 4, 3, 3000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == conn->pool.nlarge);
+  CU_ASSERT(4 == ngtcp2_acktr_get(&conn->acktr, 0)->pkt_num);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) <= conn->max_mem);
+
+  /* The budget is enforced on the memory which the pool holds. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 5, 3, 20000, 1000);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 5);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4 == ngtcp2_acktr_get(&conn->acktr, 0)->pkt_num);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) <= conn->max_mem);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_recv_ref(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  uint8_t buf[3][2048];
+  size_t pktlen[3];
+  ngtcp2_strm *strm;
+  ngtcp2_rob_data *d;
+  size_t usage;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  usage = ngtcp2_conn_get_mem_usage(conn);
+
+  /* Out-of-order data is buffered by reference to the packet. */
+  pktlen[0] = write_stream_pkt(buf[0], sizeof(buf[0]), 1, 1, 1000, 1000);
+  rv = ngtcp2_conn_recv_ref(conn, buf[0], pktlen[0], buf[0], 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ud.nrelease);
+  CU_ASSERT(ngtcp2_conn_get_mem_usage(conn) >= usage + pktlen[0]);
+
+  strm = ngtcp2_conn_find_stream(conn, 1);
+  d = ngtcp2_ksl_front(&strm->rob.dataksl)->data;
+
+  CU_ASSERT(1000 == d->offset);
+  CU_ASSERT(NULL != d->rcbuf);
+  CU_ASSERT(buf[0] < d->begin && d->end <= buf[0] + pktlen[0]);
+
+  /* The buffered packet is released once its data is delivered, and
+     the packet which is not referred to is released on return. */
+  pktlen[1] = write_stream_pkt(buf[1], sizeof(buf[1]), 2, 1, 0, 1000);
+  rv = ngtcp2_conn_recv_ref(conn, buf[1], pktlen[1], buf[1], 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2000 == ud.nrecv);
+  CU_ASSERT(2 == ud.nrelease);
+  CU_ASSERT(buf[1] == ud.released_pkt);
+  CU_ASSERT(0 == conn->rx_lent);
+
+  /* The packets still referred to are released by ngtcp2_conn_del. */
+  pktlen[2] = write_stream_pkt(buf[2], sizeof(buf[2]), 3, 1, 3000, 1000);
+  rv = ngtcp2_conn_recv_ref(conn, buf[2], pktlen[2], buf[2], 3);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ud.nrelease);
+  CU_ASSERT(pktlen[2] == conn->rx_lent);
+
+  ngtcp2_conn_del(conn);
+
+  CU_ASSERT(3 == ud.nrelease);
+  CU_ASSERT(buf[2] == ud.released_pkt);
+
+  /* release_pkt callback is required. */
+  memset(&ud, 0, sizeof(ud));
+  setup_conn(&conn, 1, &ud);
+
+  conn->callbacks.release_pkt = NULL;
+
+  pktlen[0] = write_stream_pkt(buf[0], sizeof(buf[0]), 1, 1, 1000, 1000);
+  rv = ngtcp2_conn_recv_ref(conn, buf[0], pktlen[0], buf[0], 1);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(0 == ud.nrelease);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_reorder_chunk(void) {
+  ngtcp2_conn *conn;
+  my_user_data ud;
+  ngtcp2_settings settings;
+  ngtcp2_conn_callbacks cb;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ngtcp2_strm *strm;
+  ngtcp2_rob_data *d;
+  int rv;
+
+  ngtcp2_settings_default(&settings);
+  settings.reorder_chunk = 2048;
+  settings.reorder_chunk_adaptive = 1;
+
+  memset(&ud, 0, sizeof(ud));
+  setup_conn_settings(&conn, 1, &settings, &ud);
+
+  /* A small piece of out-of-order data takes a small chunk. */
+  pktlen = write_stream_pkt(buf, sizeof(buf), 1, 1, 1000, 1);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+
+  strm = ngtcp2_conn_find_stream(conn, 1);
+  d = ngtcp2_ksl_front(&strm->rob.dataksl)->data;
+
+  CU_ASSERT(768 == d->offset);
+  CU_ASSERT(256 == d->end - d->begin);
+
+  /* The stream can use a different size. */
+  rv = ngtcp2_conn_set_stream_reorder_chunk(conn, 1, 4096, 0);
+
+  CU_ASSERT(0 == rv);
+
+  pktlen = write_stream_pkt(buf, sizeof(buf), 2, 1, 5000, 1);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+
+  d = ngtcp2_ksl_floor(&strm->rob.dataksl, 5000)->data;
+
+  CU_ASSERT(4096 == d->offset);
+  CU_ASSERT(4096 == d->end - d->begin);
+
+  rv = ngtcp2_conn_set_stream_reorder_chunk(conn, 1, 0, 0);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+
+  rv = ngtcp2_conn_set_stream_reorder_chunk(conn, 3, 4096, 0);
+
+  CU_ASSERT(NGTCP2_ERR_STREAM_NOT_FOUND == rv);
+
+  ngtcp2_conn_del(conn);
+
+  /* The chunk size must not be 0. */
+  settings.reorder_chunk = 0;
+  memset(&cb, 0, sizeof(cb));
+
+  rv = ngtcp2_conn_server_new(&conn, 0x1, NGTCP2_PROTO_VERSION, &cb, &settings,
+                              &ud);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+}
@@ -0,0 +1,57 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_CONN_TEST_H
+#define NGTCP2_CONN_TEST_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+void test_ngtcp2_conn_stream_open_close(void);
+void test_ngtcp2_conn_stream_rx_reordering(void);
+void test_ngtcp2_conn_recv_rst_stream(void);
+void test_ngtcp2_conn_many_streams(void);
+void test_ngtcp2_conn_implicit_stream_open(void);
+void test_ngtcp2_conn_stream_scheduling(void);
+void test_ngtcp2_conn_cc_lossy_link(void);
+void test_ngtcp2_conn_cc_custom(void);
+void test_ngtcp2_conn_retransmission(void);
+void test_ngtcp2_conn_expiry(void);
+void test_ngtcp2_conn_write_pkts(void);
+void test_ngtcp2_conn_acked_stream_data_offset(void);
+void test_ngtcp2_conn_recv_flow_control(void);
+void test_ngtcp2_conn_tx_flow_control(void);
+void test_ngtcp2_conn_rx_window_autotune(void);
+void test_ngtcp2_conn_pacing(void);
+void test_ngtcp2_conn_pacing_shallow_buffer(void);
+void test_ngtcp2_conn_ack_retention(void);
+void test_ngtcp2_conn_delayed_ack(void);
+void test_ngtcp2_conn_mem_pool(void);
+void test_ngtcp2_conn_mem_limit(void);
+void test_ngtcp2_conn_mem_limit_pool(void);
+void test_ngtcp2_conn_recv_ref(void);
+void test_ngtcp2_conn_reorder_chunk(void);
+
+#endif /* NGTCP2_CONN_TEST_H */
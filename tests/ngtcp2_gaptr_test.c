@@ -0,0 +1,94 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_gaptr_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_gaptr.h"
+#include "ngtcp2_test_helper.h"
+
+void test_ngtcp2_gaptr_push(void) {
+  ngtcp2_gaptr gaptr;
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_gaptr_gap *g;
+  int rv;
+
+  rv = ngtcp2_gaptr_init(&gaptr, mem);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_gaptr_first_gap_offset(&gaptr));
+
+  /* Push the range in the middle */
+  rv = ngtcp2_gaptr_push(&gaptr, 1000, 500);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_gaptr_first_gap_offset(&gaptr));
+
+  g = gaptr.gap;
+
+  CU_ASSERT(0 == g->range.begin);
+  CU_ASSERT(1000 == g->range.end);
+
+  g = g->next;
+
+  CU_ASSERT(1500 == g->range.begin);
+  CU_ASSERT(UINT64_MAX == g->range.end);
+  CU_ASSERT(NULL == g->next);
+
+  /* Push the range which overlaps both gaps */
+  rv = ngtcp2_gaptr_push(&gaptr, 900, 700);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(900 == gaptr.gap->range.end);
+  CU_ASSERT(1600 == gaptr.gap->next->range.begin);
+
+  /* Push the range which has already been pushed */
+  rv = ngtcp2_gaptr_push(&gaptr, 1000, 100);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(900 == gaptr.gap->range.end);
+  CU_ASSERT(1600 == gaptr.gap->next->range.begin);
+
+  /* Empty range does nothing */
+  rv = ngtcp2_gaptr_push(&gaptr, 0, 0);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_gaptr_first_gap_offset(&gaptr));
+
+  /* Fill the first gap */
+  rv = ngtcp2_gaptr_push(&gaptr, 0, 900);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1600 == ngtcp2_gaptr_first_gap_offset(&gaptr));
+  CU_ASSERT(NULL == gaptr.gap->next);
+
+  /* Push the range which starts before the first gap */
+  rv = ngtcp2_gaptr_push(&gaptr, 1500, 1000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2500 == ngtcp2_gaptr_first_gap_offset(&gaptr));
+
+  ngtcp2_gaptr_free(&gaptr);
+}
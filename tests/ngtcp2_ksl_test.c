@@ -0,0 +1,195 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_ksl_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_ksl.h"
+#include "ngtcp2_test_helper.h"
+
+void test_ngtcp2_ksl_insert(void) {
+  ngtcp2_t_counting_mem cm;
+  ngtcp2_ksl ksl;
+  ngtcp2_ksl_node *node;
+  int a, b, c;
+  int rv;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_ksl_init(&ksl, &cm.mem);
+
+  CU_ASSERT(NULL == ngtcp2_ksl_front(&ksl));
+  CU_ASSERT(NULL == ngtcp2_ksl_lower_bound(&ksl, 0));
+
+  rv = ngtcp2_ksl_insert(&ksl, &node, 20, &b);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(20 == node->key);
+  CU_ASSERT(&b == node->data);
+
+  rv = ngtcp2_ksl_insert(&ksl, NULL, 30, &c);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_ksl_insert(&ksl, NULL, 10, &a);
+
+  CU_ASSERT(0 == rv);
+
+  /* Duplicated key */
+  rv = ngtcp2_ksl_insert(&ksl, NULL, 20, &a);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(3 == ngtcp2_ksl_len(&ksl));
+
+  node = ngtcp2_ksl_front(&ksl);
+
+  CU_ASSERT(10 == node->key);
+  CU_ASSERT(&a == node->data);
+
+  node = node->next[0];
+
+  CU_ASSERT(20 == node->key);
+
+  node = node->next[0];
+
+  CU_ASSERT(30 == node->key);
+  CU_ASSERT(NULL == node->next[0]);
+
+  CU_ASSERT(10 == ngtcp2_ksl_lower_bound(&ksl, 0)->key);
+  CU_ASSERT(20 == ngtcp2_ksl_lower_bound(&ksl, 20)->key);
+  CU_ASSERT(30 == ngtcp2_ksl_lower_bound(&ksl, 21)->key);
+  CU_ASSERT(NULL == ngtcp2_ksl_lower_bound(&ksl, 31));
+
+  CU_ASSERT(NULL == ngtcp2_ksl_floor(&ksl, 9));
+  CU_ASSERT(10 == ngtcp2_ksl_floor(&ksl, 19)->key);
+  CU_ASSERT(20 == ngtcp2_ksl_floor(&ksl, 20)->key);
+  CU_ASSERT(30 == ngtcp2_ksl_floor(&ksl, UINT64_MAX)->key);
+
+  /* The key can be changed as long as the order is kept. */
+  node = ngtcp2_ksl_lower_bound(&ksl, 20);
+  ngtcp2_ksl_update_key(&ksl, node, 25);
+
+  CU_ASSERT(25 == ngtcp2_ksl_lower_bound(&ksl, 21)->key);
+
+  rv = ngtcp2_ksl_remove(&ksl, 20);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+
+  rv = ngtcp2_ksl_remove(&ksl, 25);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ngtcp2_ksl_len(&ksl));
+  CU_ASSERT(30 == ngtcp2_ksl_lower_bound(&ksl, 11)->key);
+
+  ngtcp2_ksl_pop_front(&ksl);
+
+  CU_ASSERT(30 == ngtcp2_ksl_front(&ksl)->key);
+  CU_ASSERT(1 == ngtcp2_ksl_len(&ksl));
+
+  ngtcp2_ksl_free(&ksl);
+
+  CU_ASSERT(0 == ngtcp2_ksl_len(&ksl));
+  CU_ASSERT(0 == cm.nlive);
+}
+
+#define NUM_KEYS 4096
+
+void test_ngtcp2_ksl_random(void) {
+  ngtcp2_t_counting_mem cm;
+  ngtcp2_ksl ksl;
+  ngtcp2_ksl_node *node;
+  static uint8_t present[NUM_KEYS];
+  uint32_t rnd = 1;
+  uint64_t key, floor;
+  size_t i, len = 0;
+  int rv;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_ksl_init(&ksl, &cm.mem);
+
+  for (i = 0; i < NUM_KEYS * 8; ++i) {
+    rnd = rnd * 1103515245 + 12345;
+    key = (rnd >> 8) % NUM_KEYS;
+
+    if ((rnd >> 4) & 1) {
+      rv = ngtcp2_ksl_insert(&ksl, NULL, key, NULL);
+
+      CU_ASSERT((present[key] ? NGTCP2_ERR_INVALID_ARGUMENT : 0) == rv);
+
+      if (!present[key]) {
+        present[key] = 1;
+        ++len;
+      }
+    } else {
+      rv = ngtcp2_ksl_remove(&ksl, key);
+
+      CU_ASSERT((present[key] ? 0 : NGTCP2_ERR_INVALID_ARGUMENT) == rv);
+
+      if (present[key]) {
+        present[key] = 0;
+        --len;
+      }
+    }
+
+    node = ngtcp2_ksl_floor(&ksl, key);
+    for (floor = key + 1; floor > 0 && !present[floor - 1]; --floor)
+      ;
+
+    if (floor == 0) {
+      CU_ASSERT(NULL == node);
+    } else {
+      CU_ASSERT(floor - 1 == node->key);
+    }
+
+    node = ngtcp2_ksl_lower_bound(&ksl, key);
+    for (; key < NUM_KEYS && !present[key]; ++key)
+      ;
+
+    if (key == NUM_KEYS) {
+      CU_ASSERT(NULL == node);
+    } else {
+      CU_ASSERT(key == node->key);
+    }
+  }
+
+  CU_ASSERT(len == ngtcp2_ksl_len(&ksl));
+
+  /* Every node is linked in the increasing order of key. */
+  node = ngtcp2_ksl_front(&ksl);
+  for (key = 0; key < NUM_KEYS; ++key) {
+    if (!present[key]) {
+      continue;
+    }
+
+    CU_ASSERT(key == node->key);
+
+    node = node->next[0];
+  }
+
+  CU_ASSERT(NULL == node);
+
+  ngtcp2_ksl_free(&ksl);
+
+  CU_ASSERT(0 == cm.nlive);
+}
@@ -0,0 +1,196 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_map_test.h"
+
+#include <stdlib.h>
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_map.h"
+#include "ngtcp2_macro.h"
+#include "ngtcp2_test_helper.h"
+
+typedef struct {
+  ngtcp2_map_entry map_entry;
+  int val;
+} strentry;
+
+static void strentry_init(strentry *entry, key_type key, int val) {
+  ngtcp2_map_entry_init(&entry->map_entry, key);
+  entry->val = val;
+}
+
+static strentry *find_strentry(ngtcp2_map *map, key_type key) {
+  ngtcp2_map_entry *me = ngtcp2_map_find(map, key);
+
+  if (me == NULL) {
+    return NULL;
+  }
+
+  return ngtcp2_struct_of(me, strentry, map_entry);
+}
+
+void test_ngtcp2_map(void) {
+  strentry foo, FOO, bar, baz, shrubbery;
+  ngtcp2_map map;
+
+  ngtcp2_map_init(&map, ngtcp2_mem_default());
+
+  strentry_init(&foo, 1, 0);
+  strentry_init(&FOO, 1, 1);
+  strentry_init(&bar, 2, 2);
+  strentry_init(&baz, 3, 3);
+  strentry_init(&shrubbery, 4, 4);
+
+  CU_ASSERT(0 == ngtcp2_map_insert(&map, &foo.map_entry));
+  CU_ASSERT(1 == ngtcp2_map_size(&map));
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT ==
+            ngtcp2_map_insert(&map, &FOO.map_entry));
+
+  CU_ASSERT(1 == ngtcp2_map_size(&map));
+  CU_ASSERT(&foo == find_strentry(&map, 1));
+
+  CU_ASSERT(0 == ngtcp2_map_insert(&map, &bar.map_entry));
+  CU_ASSERT(2 == ngtcp2_map_size(&map));
+
+  CU_ASSERT(0 == ngtcp2_map_insert(&map, &baz.map_entry));
+  CU_ASSERT(3 == ngtcp2_map_size(&map));
+
+  CU_ASSERT(0 == ngtcp2_map_insert(&map, &shrubbery.map_entry));
+  CU_ASSERT(4 == ngtcp2_map_size(&map));
+
+  CU_ASSERT(&baz == find_strentry(&map, 3));
+
+  ngtcp2_map_remove(&map, 3);
+  CU_ASSERT(3 == ngtcp2_map_size(&map));
+  CU_ASSERT(NULL == find_strentry(&map, 3));
+
+  ngtcp2_map_remove(&map, 1);
+  CU_ASSERT(2 == ngtcp2_map_size(&map));
+  CU_ASSERT(NULL == find_strentry(&map, 1));
+
+  /* Erasing non-existent entry */
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == ngtcp2_map_remove(&map, 1));
+  CU_ASSERT(2 == ngtcp2_map_size(&map));
+  CU_ASSERT(NULL == find_strentry(&map, 1));
+
+  CU_ASSERT(&bar == find_strentry(&map, 2));
+  CU_ASSERT(&shrubbery == find_strentry(&map, 4));
+
+  ngtcp2_map_free(&map);
+}
+
+static void shuffle(size_t *a, size_t n) {
+  size_t i;
+  for (i = n - 1; i >= 1; --i) {
+    size_t y;
+    size_t j = (size_t)((double)i * rand() / (RAND_MAX + 1.0));
+    y = a[j];
+    a[j] = a[i];
+    a[i] = y;
+  }
+}
+
+static int eachfun(ngtcp2_map_entry *entry, void *ptr) {
+  (void)entry;
+  (void)ptr;
+
+  return 0;
+}
+
+#define NUM_ENT 6000
+static strentry arr[NUM_ENT];
+static size_t order[NUM_ENT];
+
+void test_ngtcp2_map_functional(void) {
+  ngtcp2_map map;
+  size_t i;
+
+  ngtcp2_map_init(&map, ngtcp2_mem_default());
+  for (i = 0; i < NUM_ENT; ++i) {
+    strentry_init(&arr[i], (key_type)(i + 1), (int)i);
+    order[i] = i + 1;
+  }
+  /* insertion */
+  shuffle(order, NUM_ENT);
+  for (i = 0; i < NUM_ENT; ++i) {
+    CU_ASSERT(0 == ngtcp2_map_insert(&map, &arr[order[i] - 1].map_entry));
+  }
+  CU_ASSERT(NUM_ENT == ngtcp2_map_size(&map));
+  /* traverse */
+  ngtcp2_map_each(&map, eachfun, NULL);
+  /* find */
+  shuffle(order, NUM_ENT);
+  for (i = 0; i < NUM_ENT; ++i) {
+    CU_ASSERT(&arr[order[i] - 1] == find_strentry(&map, (key_type)order[i]));
+  }
+  /* remove */
+  shuffle(order, NUM_ENT);
+  for (i = 0; i < NUM_ENT; ++i) {
+    CU_ASSERT(0 == ngtcp2_map_remove(&map, (key_type)order[i]));
+  }
+
+  /* each_free (but no op function for testing purpose) */
+  for (i = 0; i < NUM_ENT; ++i) {
+    strentry_init(&arr[i], (key_type)(i + 1), (int)i);
+  }
+  /* insert once again */
+  for (i = 0; i < NUM_ENT; ++i) {
+    CU_ASSERT(0 == ngtcp2_map_insert(&map, &arr[i].map_entry));
+  }
+  ngtcp2_map_each_free(&map, eachfun, NULL);
+  ngtcp2_map_free(&map);
+}
+
+static int entry_free(ngtcp2_map_entry *entry, void *ptr) {
+  ngtcp2_mem *mem = ptr;
+
+  ngtcp2_mem_free(mem, entry);
+  return 0;
+}
+
+void test_ngtcp2_map_each_free(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  strentry *foo = ngtcp2_mem_malloc(mem, sizeof(strentry)),
+           *bar = ngtcp2_mem_malloc(mem, sizeof(strentry)),
+           *baz = ngtcp2_mem_malloc(mem, sizeof(strentry)),
+           *shrubbery = ngtcp2_mem_malloc(mem, sizeof(strentry));
+  ngtcp2_map map;
+  ngtcp2_map_init(&map, mem);
+
+  strentry_init(foo, 1, 0);
+  strentry_init(bar, 2, 1);
+  strentry_init(baz, 3, 2);
+  strentry_init(shrubbery, 4, 3);
+
+  ngtcp2_map_insert(&map, &foo->map_entry);
+  ngtcp2_map_insert(&map, &bar->map_entry);
+  ngtcp2_map_insert(&map, &baz->map_entry);
+  ngtcp2_map_insert(&map, &shrubbery->map_entry);
+
+  ngtcp2_map_each_free(&map, entry_free, mem);
+  ngtcp2_map_free(&map);
+}
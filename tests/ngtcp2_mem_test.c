@@ -0,0 +1,202 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_mem_test.h"
+
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_mem.h"
+#include "ngtcp2_test_helper.h"
+
+void test_ngtcp2_mem_pool(void) {
+  ngtcp2_t_counting_mem cm;
+  ngtcp2_mem_pool pool;
+  ngtcp2_mem *mem;
+  uint8_t *p, *q, *r;
+  size_t i;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_mem_pool_init(&pool, &cm.mem);
+  mem = &pool.mem;
+
+  /* No memory is allocated until it is needed */
+  CU_ASSERT(0 == cm.nalloc);
+
+  p = ngtcp2_mem_malloc(mem, 24);
+
+  CU_ASSERT(NULL != p);
+  CU_ASSERT(1 == cm.nalloc);
+
+  /* The freed object is reused */
+  ngtcp2_mem_free(mem, p);
+  q = ngtcp2_mem_malloc(mem, 32);
+
+  CU_ASSERT(p == q);
+  CU_ASSERT(1 == cm.nalloc);
+
+  /* A slab holds many objects of the same class */
+  for (i = 0; i < 8; ++i) {
+    r = ngtcp2_mem_malloc(mem, 16);
+
+    CU_ASSERT(NULL != r);
+    CU_ASSERT(r != q);
+  }
+
+  CU_ASSERT(1 == cm.nalloc);
+
+  /* Another class needs its own slab */
+  r = ngtcp2_mem_malloc(mem, 240);
+
+  CU_ASSERT(2 == cm.nalloc);
+
+  memset(r, 0xff, 240);
+  ngtcp2_mem_free(mem, r);
+  r = ngtcp2_mem_calloc(mem, 10, 24);
+
+  for (i = 0; i < 240; ++i) {
+    CU_ASSERT(0 == r[i]);
+  }
+
+  /* realloc stays in place as long as the class has room */
+  q[0] = 'a';
+  q[31] = 'z';
+  p = ngtcp2_mem_realloc(mem, q, 32);
+
+  CU_ASSERT(p == q);
+
+  p = ngtcp2_mem_realloc(mem, q, 100);
+
+  CU_ASSERT(p != q);
+  CU_ASSERT('a' == p[0]);
+  CU_ASSERT('z' == p[31]);
+  CU_ASSERT(3 == cm.nalloc);
+
+  /* All slabs are released at once, including the objects still in
+     use. */
+  ngtcp2_mem_pool_free(&pool);
+
+  CU_ASSERT(0 == cm.nlive);
+}
+
+void test_ngtcp2_mem_pool_large(void) {
+  ngtcp2_t_counting_mem cm;
+  ngtcp2_mem_pool pool;
+  ngtcp2_mem *mem;
+  uint8_t *p, *q, *ps[NGTCP2_MEM_POOL_MAX_LARGE + 1];
+  size_t i;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_mem_pool_init(&pool, &cm.mem);
+  mem = &pool.mem;
+
+  p = ngtcp2_mem_malloc(mem, 8192);
+
+  CU_ASSERT(1 == cm.nalloc);
+
+  /* The freed object of the same size is reused */
+  ngtcp2_mem_free(mem, p);
+  q = ngtcp2_mem_malloc(mem, 8192);
+
+  CU_ASSERT(p == q);
+  CU_ASSERT(1 == cm.nalloc);
+
+  ngtcp2_mem_free(mem, q);
+
+  /* The different size is allocated by the parent */
+  p = ngtcp2_mem_malloc(mem, 4096);
+
+  CU_ASSERT(2 == cm.nalloc);
+
+  p[4095] = 'z';
+  q = ngtcp2_mem_realloc(mem, p, 9000);
+
+  CU_ASSERT('z' == q[4095]);
+
+  ngtcp2_mem_free(mem, q);
+
+  /* Only a few freed objects are kept */
+  for (i = 0; i < NGTCP2_MEM_POOL_MAX_LARGE + 1; ++i) {
+    ps[i] = ngtcp2_mem_malloc(mem, 1000);
+  }
+  for (i = 0; i < NGTCP2_MEM_POOL_MAX_LARGE + 1; ++i) {
+    ngtcp2_mem_free(mem, ps[i]);
+  }
+
+  CU_ASSERT(NGTCP2_MEM_POOL_MAX_LARGE == pool.nlarge);
+  CU_ASSERT(NGTCP2_MEM_POOL_MAX_LARGE == cm.nlive);
+
+  /* Trimming releases the kept objects, but not the slabs */
+  p = ngtcp2_mem_malloc(mem, 100);
+  ngtcp2_mem_pool_trim(&pool);
+
+  CU_ASSERT(0 == pool.nlarge);
+  CU_ASSERT(1 == cm.nlive);
+
+  ngtcp2_mem_free(mem, p);
+  ngtcp2_mem_pool_free(&pool);
+
+  CU_ASSERT(0 == cm.nlive);
+}
+
+void test_ngtcp2_mem_acct(void) {
+  ngtcp2_t_counting_mem cm;
+  ngtcp2_mem_acct acct;
+  ngtcp2_mem *mem;
+  uint8_t *p, *q;
+  size_t i;
+
+  ngtcp2_t_counting_mem_init(&cm);
+  ngtcp2_mem_acct_init(&acct, &cm.mem);
+  mem = &acct.mem;
+
+  p = ngtcp2_mem_malloc(mem, 100);
+
+  CU_ASSERT(sizeof(ngtcp2_mem_acct_hd) + 100 == acct.usage);
+
+  q = ngtcp2_mem_calloc(mem, 10, 30);
+
+  CU_ASSERT(2 * sizeof(ngtcp2_mem_acct_hd) + 400 == acct.usage);
+
+  for (i = 0; i < 300; ++i) {
+    CU_ASSERT(0 == q[i]);
+  }
+
+  memset(p, 'a', 100);
+  p = ngtcp2_mem_realloc(mem, p, 1000);
+
+  CU_ASSERT(2 * sizeof(ngtcp2_mem_acct_hd) + 1300 == acct.usage);
+  CU_ASSERT('a' == p[99]);
+
+  ngtcp2_mem_free(mem, p);
+
+  CU_ASSERT(sizeof(ngtcp2_mem_acct_hd) + 300 == acct.usage);
+
+  ngtcp2_mem_free(mem, q);
+  ngtcp2_mem_free(mem, NULL);
+
+  CU_ASSERT(0 == acct.usage);
+  CU_ASSERT(0 == cm.nlive);
+}
@@ -263,6 +263,7 @@ void test_ngtcp2_pkt_decode_ack_frame(void) {
   uint8_t buf[256];
   size_t buflen;
   ngtcp2_frame fr;
+  ngtcp2_ack_blk blks[NGTCP2_MAX_NUM_ACK_BLK];
   ssize_t rv;
   size_t expectedlen;
 
@@ -275,12 +276,13 @@ void test_ngtcp2_pkt_decode_ack_frame(void) {
 
   CU_ASSERT(expectedlen == buflen);
 
-  rv = ngtcp2_pkt_decode_ack_frame(&fr.ack, buf, buflen, 0);
+  rv = ngtcp2_pkt_decode_ack_frame(&fr.ack, blks, buf, buflen, 0);
 
   CU_ASSERT((ssize_t)expectedlen == rv);
   CU_ASSERT(0x1f == fr.ack.flags);
   CU_ASSERT(0xf1f2f3f4f5f6f7f8llu == fr.ack.largest_ack);
   CU_ASSERT(1 == fr.ack.num_blks);
+  CU_ASSERT(blks == fr.ack.blks);
   CU_ASSERT(0xe1e2e3e4e5e6e7e8llu == fr.ack.first_ack_blklen);
   CU_ASSERT(99 == fr.ack.blks[0].gap);
   CU_ASSERT(0xd1d2d3d4d5d6d7d8llu == fr.ack.blks[0].blklen);
@@ -462,6 +464,7 @@ void test_ngtcp2_pkt_encode_stream_frame(void) {
 void test_ngtcp2_pkt_encode_ack_frame(void) {
   uint8_t buf[256];
   ngtcp2_frame fr, nfr;
+  ngtcp2_ack_blk blks[2], nblks[NGTCP2_MAX_NUM_ACK_BLK];
   ssize_t rv;
   size_t framelen;
   size_t i;
@@ -480,7 +483,7 @@ void test_ngtcp2_pkt_encode_ack_frame(void) {
 
   CU_ASSERT((ssize_t)framelen == rv);
 
-  rv = ngtcp2_pkt_decode_ack_frame(&nfr.ack, buf, framelen, 0);
+  rv = ngtcp2_pkt_decode_ack_frame(&nfr.ack, nblks, buf, framelen, 0);
 
   CU_ASSERT((ssize_t)framelen == rv);
   CU_ASSERT(fr.type == nfr.type);
@@ -498,6 +501,7 @@ void test_ngtcp2_pkt_encode_ack_frame(void) {
   fr.ack.first_ack_blklen = 0xe1e2e3e4llu;
   fr.ack.ack_delay = 0xf1f2;
   fr.ack.num_blks = 2;
+  fr.ack.blks = blks;
   fr.ack.blks[0].gap = 255;
   fr.ack.blks[0].blklen = 0xd1d2d3d4llu;
   fr.ack.blks[1].gap = 1;
@@ -509,7 +513,7 @@ void test_ngtcp2_pkt_encode_ack_frame(void) {
 
   CU_ASSERT((ssize_t)framelen == rv);
 
-  rv = ngtcp2_pkt_decode_ack_frame(&nfr.ack, buf, framelen, 0);
+  rv = ngtcp2_pkt_decode_ack_frame(&nfr.ack, nblks, buf, framelen, 0);
 
   CU_ASSERT((ssize_t)framelen == rv);
   CU_ASSERT(fr.type == nfr.type);
@@ -797,3 +801,98 @@ void test_ngtcp2_pkt_adjust_pkt_num(void) {
   CU_ASSERT(0x01ff == ngtcp2_pkt_adjust_pkt_num(0x0100, 0xff, 1));
   CU_ASSERT(0x02ff == ngtcp2_pkt_adjust_pkt_num(0x01ff, 0xff, 1));
 }
+
+void test_ngtcp2_frame_iter(void) {
+  uint8_t buf[256];
+  uint8_t *p = buf;
+  ngtcp2_frame fr;
+  ngtcp2_ack_blk blks[NGTCP2_MAX_NUM_ACK_BLK];
+  ngtcp2_frame_iter it;
+  ngtcp2_frame_view fv;
+  uint8_t reason[] = "foo";
+  size_t ackoff, streamoff;
+  ssize_t rv;
+
+  memset(p, NGTCP2_FRAME_PADDING, 3);
+  p += 3;
+  p += ngtcp2_t_encode_stream_frame(p, NGTCP2_STREAM_D_BIT, 0xf1f2f3f4u,
+                                    0xf1f2f3f4f5f6f7f8llu, 0x14);
+  ackoff = (size_t)(p - buf);
+  p += ngtcp2_t_encode_ack_frame(p, 1000, 10, 2, 5);
+
+  fr.type = NGTCP2_FRAME_CONNECTION_CLOSE;
+  fr.connection_close.error_code = 1;
+  fr.connection_close.reasonlen = 3;
+  fr.connection_close.reason = reason;
+  p += ngtcp2_pkt_encode_frame(p, sizeof(buf) - (size_t)(p - buf), &fr);
+
+  *p++ = NGTCP2_FRAME_PING;
+
+  /* STREAM frame without Data Length extends to the end */
+  streamoff = (size_t)(p - buf);
+  p += ngtcp2_t_encode_stream_frame(p, 0, 1, 0, 0);
+  p += 7;
+
+  ngtcp2_frame_iter_init(&it, buf, (size_t)(p - buf));
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(3 == rv);
+  CU_ASSERT(NGTCP2_FRAME_PADDING == fv.type);
+  CU_ASSERT(buf == fv.data);
+  CU_ASSERT(3 == fv.datalen);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(1 + 4 + 8 + 2 + 20 == rv);
+  CU_ASSERT(NGTCP2_FRAME_STREAM == fv.type);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(1 + 1 + 1 + 8 + 2 + 8 + 1 + 8 == rv);
+  CU_ASSERT(NGTCP2_FRAME_ACK == fv.type);
+  CU_ASSERT(buf + ackoff == fv.data);
+
+  /* The frame is decoded only on demand */
+  rv = ngtcp2_pkt_decode_frame(&fr, blks, fv.data, fv.datalen, 0);
+
+  CU_ASSERT((ssize_t)fv.datalen == rv);
+  CU_ASSERT(1000 == fr.ack.largest_ack);
+  CU_ASSERT(1 == fr.ack.num_blks);
+  CU_ASSERT(5 == fr.ack.blks[0].blklen);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(1 + 4 + 2 + 3 == rv);
+  CU_ASSERT(NGTCP2_FRAME_CONNECTION_CLOSE == fv.type);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(1 == rv);
+  CU_ASSERT(NGTCP2_FRAME_PING == fv.type);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(1 + 1 + 7 == rv);
+  CU_ASSERT(NGTCP2_FRAME_STREAM == fv.type);
+  CU_ASSERT(buf + streamoff == fv.data);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(0 == rv);
+
+  /* Truncated ACK frame */
+  ngtcp2_frame_iter_init(&it, buf + ackoff, 29);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+
+  /* Unknown frame type */
+  buf[0] = 0x0c;
+  ngtcp2_frame_iter_init(&it, buf, 1);
+
+  rv = ngtcp2_frame_iter_next(&it, &fv);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_ARGUMENT == rv);
+}
@@ -48,5 +48,6 @@ void test_ngtcp2_pkt_encode_stream_blocked_frame(void);
 void test_ngtcp2_pkt_encode_stream_id_needed_frame(void);
 void test_ngtcp2_pkt_encode_new_connection_id_frame(void);
 void test_ngtcp2_pkt_adjust_pkt_num(void);
+void test_ngtcp2_frame_iter(void);
 
 #endif /* NGTCP2_PKT_TEST_H */
@@ -24,17 +24,21 @@
  */
 #include "ngtcp2_rob_test.h"
 
+#include <string.h>
+
 #include <CUnit/CUnit.h>
 
 #include "ngtcp2_rob.h"
 #include "ngtcp2_test_helper.h"
 #include "ngtcp2_mem.h"
+#include "ngtcp2_macro.h"
 
 void test_ngtcp2_rob_push(void) {
   ngtcp2_mem *mem = ngtcp2_mem_default();
   ngtcp2_rob rob;
   int rv;
   uint8_t data[256];
+  ngtcp2_ksl_node *node;
   ngtcp2_rob_gap *g;
 
   /* Check range overlapping */
@@ -44,27 +48,31 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(0 == g->range.begin);
   CU_ASSERT(34567 == g->range.end);
 
-  g = g->next;
+  node = node->next[0];
+  g = node->data;
 
   CU_ASSERT(34567 + 145 == g->range.begin);
   CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(NULL == node->next[0]);
 
   rv = ngtcp2_rob_push(&rob, 34565, data, 1);
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(0 == g->range.begin);
   CU_ASSERT(34565 == g->range.end);
 
-  g = g->next;
+  node = node->next[0];
+  g = node->data;
 
   CU_ASSERT(34566 == g->range.begin);
   CU_ASSERT(34567 == g->range.end);
@@ -73,12 +81,14 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(0 == g->range.begin);
   CU_ASSERT(34563 == g->range.end);
 
-  g = g->next;
+  node = node->next[0];
+  g = node->data;
 
   CU_ASSERT(34564 == g->range.begin);
   CU_ASSERT(34565 == g->range.end);
@@ -87,16 +97,18 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(0 == g->range.begin);
   CU_ASSERT(34561 == g->range.end);
 
-  g = g->next;
+  node = node->next[0];
+  g = node->data;
 
   CU_ASSERT(34567 + 145 == g->range.begin);
   CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(NULL == node->next[0]);
 
   ngtcp2_rob_free(&rob);
 
@@ -107,11 +119,12 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(123 == g->range.begin);
   CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(NULL == node->next[0]);
 
   ngtcp2_rob_free(&rob);
 
@@ -122,11 +135,12 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  node = ngtcp2_ksl_front(&rob.gapksl);
+  g = node->data;
 
   CU_ASSERT(0 == g->range.begin);
   CU_ASSERT(UINT64_MAX - 123 == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(NULL == node->next[0]);
 
   ngtcp2_rob_free(&rob);
 }
@@ -139,6 +153,7 @@ void test_ngtcp2_rob_data_at(void) {
   size_t i;
   const uint8_t *p;
   size_t len;
+  ngtcp2_ksl_node *node;
   ngtcp2_rob_data *d;
 
   for (i = 0; i < sizeof(data); ++i) {
@@ -247,14 +262,16 @@ void test_ngtcp2_rob_data_at(void) {
 
   CU_ASSERT(0 == rv);
 
-  d = rob.data->next;
+  node = ngtcp2_ksl_front(&rob.dataksl)->next[0];
+  d = node->data;
 
   CU_ASSERT(16 == d->offset);
 
-  d = d->next;
+  node = node->next[0];
+  d = node->data;
 
   CU_ASSERT(32 == d->offset);
-  CU_ASSERT(NULL == d->next);
+  CU_ASSERT(NULL == node->next[0]);
 
   ngtcp2_rob_free(&rob);
 
@@ -281,8 +298,8 @@ void test_ngtcp2_rob_data_at(void) {
     ngtcp2_rob_pop(&rob, i * 16, len);
   }
 
-  CU_ASSERT(256 == rob.gap->range.begin);
-  CU_ASSERT(NULL == rob.data);
+  CU_ASSERT(256 == ngtcp2_rob_first_gap_offset(&rob));
+  CU_ASSERT(0 == ngtcp2_ksl_len(&rob.dataksl));
 
   ngtcp2_rob_free(&rob);
 
@@ -352,8 +369,8 @@ void test_ngtcp2_rob_remove_prefix(void) {
 
   ngtcp2_rob_remove_prefix(&rob, 33);
 
-  CU_ASSERT(33 == rob.gap->range.begin);
-  CU_ASSERT(32 == rob.data->offset);
+  CU_ASSERT(33 == ngtcp2_rob_first_gap_offset(&rob));
+  CU_ASSERT(32 == ngtcp2_ksl_front(&rob.dataksl)->key);
 
   ngtcp2_rob_free(&rob);
 
@@ -370,8 +387,364 @@ void test_ngtcp2_rob_remove_prefix(void) {
 
   ngtcp2_rob_remove_prefix(&rob, 16);
 
-  CU_ASSERT(16 == rob.gap->range.begin);
-  CU_ASSERT(NULL == rob.gap->next);
+  CU_ASSERT(16 == ngtcp2_rob_first_gap_offset(&rob));
+  CU_ASSERT(1 == ngtcp2_ksl_len(&rob.gapksl));
+
+  ngtcp2_rob_free(&rob);
+}
+
+/*
+ * rob_check_gaps verifies that the gaps in |rob| are exactly the
+ * ranges at or after |rx_offset| which are not marked in |received|
+ * of length |len|.
+ */
+static void rob_check_gaps(ngtcp2_rob *rob, const uint8_t *received,
+                           size_t len, uint64_t rx_offset) {
+  ngtcp2_ksl_node *node = ngtcp2_ksl_front(&rob->gapksl);
+  ngtcp2_rob_gap *g;
+  uint64_t i = rx_offset;
+
+  for (;;) {
+    for (; i < len && received[i]; ++i)
+      ;
+
+    g = node->data;
+
+    CU_ASSERT(i == g->range.begin);
+    CU_ASSERT(g->range.end == node->key);
+
+    if (i == len) {
+      CU_ASSERT(UINT64_MAX == g->range.end);
+      CU_ASSERT(NULL == node->next[0]);
+      return;
+    }
+
+    for (; i < len && !received[i]; ++i)
+      ;
+
+    if (i == len) {
+      CU_ASSERT(UINT64_MAX == g->range.end);
+      CU_ASSERT(NULL == node->next[0]);
+      return;
+    }
+
+    CU_ASSERT(i == g->range.end);
+
+    node = node->next[0];
+  }
+}
+
+/*
+ * rob_check_chunks verifies that the buffers in |rob| do not overlap.
+ */
+static void rob_check_chunks(ngtcp2_rob *rob) {
+  ngtcp2_ksl_node *node;
+  ngtcp2_rob_data *d;
+  uint64_t end = 0;
+
+  for (node = ngtcp2_ksl_front(&rob->dataksl); node; node = node->next[0]) {
+    d = node->data;
+
+    CU_ASSERT(d->offset == node->key);
+    CU_ASSERT(end <= d->offset);
+    CU_ASSERT(d->begin < d->end);
+
+    end = d->offset + (size_t)(d->end - d->begin);
+  }
+}
+
+/*
+ * rob_random_reordering pushes stream data in random order, and
+ * checks the data delivered and the gaps.  The chunks are |chunk|
+ * bytes long, and sized adaptively if |adaptive| is nonzero.  If
+ * |vary| is nonzero, the chunk size is changed every 16 pushes.
+ */
+static void rob_random_reordering(size_t chunk, int adaptive, int vary) {
+  static const size_t chunks[] = {100, 1024, 4096};
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_rob rob;
+  static uint8_t data[65536];
+  static uint8_t received[sizeof(data)];
+  const uint8_t *p;
+  uint64_t rx_offset = 0;
+  uint64_t offset;
+  uint32_t rnd = 1;
+  size_t i, len, n;
+  int rv;
+
+  for (i = 0; i < sizeof(data); ++i) {
+    data[i] = (uint8_t)(i * 7 + i / 256);
+  }
+
+  memset(received, 0, sizeof(received));
+
+  ngtcp2_rob_init(&rob, chunk, mem);
+  ngtcp2_rob_set_chunk(&rob, chunk, adaptive);
+
+  for (n = 0; rx_offset < sizeof(data); ++n) {
+    rnd = rnd * 1103515245 + 12345;
+
+    if (vary && n % 16 == 0) {
+      ngtcp2_rob_set_chunk(&rob, chunks[(rnd >> 16) % arraylen(chunks)],
+                           (rnd >> 24) & 1);
+    }
+
+    /* Most segments land near the delivery point, but some are far
+       ahead, and some are retransmissions of delivered data. */
+    if ((rnd >> 8) % 10 == 0) {
+      offset = (rnd >> 12) % sizeof(data);
+    } else {
+      offset = rx_offset + (rnd >> 12) % 8192;
+      if (offset > 64 && (rnd >> 4) % 8 == 0) {
+        offset -= 64;
+      }
+    }
+    if (offset >= sizeof(data)) {
+      continue;
+    }
+
+    len = ngtcp2_min(1 + (rnd >> 20) % 1200, sizeof(data) - offset);
+
+    /* The data before rx_offset is not pushed, like ngtcp2_conn. */
+    if (offset < rx_offset) {
+      if (offset + len <= rx_offset) {
+        continue;
+      }
+      len -= (size_t)(rx_offset - offset);
+      offset = rx_offset;
+    }
+
+    rv = ngtcp2_rob_push(&rob, offset, &data[offset], len);
+
+    CU_ASSERT(0 == rv);
+
+    memset(&received[offset], 1, len);
+
+    for (;;) {
+      len = ngtcp2_rob_data_at(&rob, &p, rx_offset);
+      if (len == 0) {
+        break;
+      }
+
+      CU_ASSERT(0 == memcmp(&data[rx_offset], p, len));
+
+      ngtcp2_rob_pop(&rob, rx_offset, len);
+      rx_offset += len;
+    }
+
+    if (n % 64 == 0 || rx_offset == sizeof(data)) {
+      rob_check_gaps(&rob, received, sizeof(data), rx_offset);
+      rob_check_chunks(&rob);
+    }
+  }
+
+  CU_ASSERT(sizeof(data) == ngtcp2_rob_first_gap_offset(&rob));
+  CU_ASSERT(0 == ngtcp2_ksl_len(&rob.dataksl));
 
   ngtcp2_rob_free(&rob);
 }
+
+void test_ngtcp2_rob_random_reordering(void) {
+  rob_random_reordering(1024, 0, 0);
+  rob_random_reordering(8192, 1, 0);
+  rob_random_reordering(1024, 0, 1);
+}
+
+void test_ngtcp2_rob_adaptive_chunk(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_rob rob;
+  static uint8_t data[1000];
+  ngtcp2_ksl_node *node;
+  ngtcp2_rob_data *d;
+  uint64_t i;
+  int rv;
+
+  ngtcp2_rob_init(&rob, 8192, mem);
+  ngtcp2_rob_set_chunk(&rob, 8192, 1);
+
+  /* A single byte takes the smallest chunk. */
+  rv = ngtcp2_rob_push(&rob, 10000, data, 1);
+
+  CU_ASSERT(0 == rv);
+
+  d = ngtcp2_ksl_front(&rob.dataksl)->data;
+
+  CU_ASSERT(9984 == d->offset);
+  CU_ASSERT(NGTCP2_ROB_MIN_CHUNK == d->end - d->begin);
+
+  /* The chunk fits the data, and the next one doubles. */
+  rv = ngtcp2_rob_push(&rob, 20000, data, 1000);
+
+  CU_ASSERT(0 == rv);
+
+  node = ngtcp2_ksl_floor(&rob.dataksl, 20000);
+  d = node->data;
+
+  CU_ASSERT(19456 == d->offset);
+  CU_ASSERT(1024 == d->end - d->begin);
+
+  d = node->next[0]->data;
+
+  CU_ASSERT(20480 == d->offset);
+  CU_ASSERT(2048 == d->end - d->begin);
+
+  /* Bulk data grows the chunks up to the limit. */
+  for (i = 21000; i < 21000 + 16000; i += 1000) {
+    rv = ngtcp2_rob_push(&rob, i, data, 1000);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  node = ngtcp2_ksl_floor(&rob.dataksl, 22528);
+  d = node->data;
+
+  CU_ASSERT(22528 == d->offset);
+  CU_ASSERT(4096 == d->end - d->begin);
+
+  d = node->next[0]->data;
+
+  CU_ASSERT(8192 == d->end - d->begin);
+
+  d = node->next[0]->next[0]->data;
+
+  CU_ASSERT(34816 == d->offset);
+  CU_ASSERT(8192 == d->end - d->begin);
+
+  rv = ngtcp2_rob_push(&rob, 19000, data, 1);
+
+  CU_ASSERT(0 == rv);
+
+  d = ngtcp2_ksl_floor(&rob.dataksl, 19000)->data;
+
+  CU_ASSERT(18944 == d->offset);
+  CU_ASSERT(256 == d->end - d->begin);
+
+  /* The chunk is trimmed so that it does not overlap its
+     neighbours. */
+  rv = ngtcp2_rob_push(&rob, 19300, data, 300);
+
+  CU_ASSERT(0 == rv);
+
+  d = ngtcp2_ksl_floor(&rob.dataksl, 19300)->data;
+
+  CU_ASSERT(19200 == d->offset);
+  CU_ASSERT(256 == d->end - d->begin);
+
+  rob_check_chunks(&rob);
+
+  ngtcp2_rob_free(&rob);
+}
+
+static size_t nrcbuf_free;
+
+static void count_rcbuf_free(ngtcp2_rcbuf *rcbuf) {
+  (void)rcbuf;
+  ++nrcbuf_free;
+}
+
+void test_ngtcp2_rob_push_ref(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_rob rob;
+  ngtcp2_rcbuf rcbuf;
+  int rv;
+  uint8_t pkt[256], other[256];
+  const uint8_t *dest;
+  size_t i, len;
+  ngtcp2_rob_data *d;
+
+  for (i = 0; i < sizeof(pkt); ++i) {
+    pkt[i] = (uint8_t)i;
+    other[i] = (uint8_t)~i;
+  }
+
+  nrcbuf_free = 0;
+  ngtcp2_rcbuf_init(&rcbuf, pkt, sizeof(pkt), count_rcbuf_free);
+
+  /* The data is kept in segments which refer to pkt. */
+  ngtcp2_rob_init(&rob, 64, mem);
+
+  rv = ngtcp2_rob_push_ref(&rob, 30, pkt + 30, 20, &rcbuf);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(rob.seg);
+  CU_ASSERT(2 == rcbuf.ref);
+
+  /* Only [50, 60) is new, and it is copied into a segment of its
+     own. */
+  rv = ngtcp2_rob_push(&rob, 40, other + 40, 20);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ngtcp2_ksl_len(&rob.dataksl));
+  CU_ASSERT(2 == rcbuf.ref);
+
+  d = ngtcp2_ksl_lower_bound(&rob.dataksl, 50)->data;
+
+  CU_ASSERT(50 == d->offset);
+  CU_ASSERT(10 == d->end - d->begin);
+  CU_ASSERT(NULL == d->rcbuf);
+
+  rv = ngtcp2_rob_push_ref(&rob, 0, pkt, 40, &rcbuf);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == rcbuf.ref);
+
+  len = ngtcp2_rob_data_at(&rob, &dest, 0);
+
+  CU_ASSERT(30 == len);
+  CU_ASSERT(pkt == dest);
+
+  ngtcp2_rob_pop(&rob, 0, len);
+
+  CU_ASSERT(2 == rcbuf.ref);
+
+  len = ngtcp2_rob_data_at(&rob, &dest, 30);
+
+  CU_ASSERT(20 == len);
+  CU_ASSERT(pkt + 30 == dest);
+
+  ngtcp2_rob_pop(&rob, 30, len);
+
+  CU_ASSERT(1 == rcbuf.ref);
+
+  len = ngtcp2_rob_data_at(&rob, &dest, 50);
+
+  CU_ASSERT(10 == len);
+  CU_ASSERT(0 == memcmp(other + 50, dest, len));
+
+  ngtcp2_rob_pop(&rob, 50, len);
+
+  CU_ASSERT(0 == ngtcp2_ksl_len(&rob.dataksl));
+  CU_ASSERT(0 == ngtcp2_rob_data_at(&rob, &dest, 60));
+
+  /* The empty buffer can hold chunks again. */
+  rv = ngtcp2_rob_push(&rob, 100, other, 10);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(!rob.seg);
+
+  /* Data pushed by reference is copied into the chunks. */
+  rv = ngtcp2_rob_push_ref(&rob, 110, pkt, 10, &rcbuf);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == rcbuf.ref);
+  CU_ASSERT(1 == ngtcp2_ksl_len(&rob.dataksl));
+
+  ngtcp2_rob_free(&rob);
+
+  /* ngtcp2_rob_free drops the references. */
+  ngtcp2_rob_init(&rob, 64, mem);
+
+  rv = ngtcp2_rob_push_ref(&rob, 10, pkt, 10, &rcbuf);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == rcbuf.ref);
+
+  ngtcp2_rob_free(&rob);
+
+  CU_ASSERT(1 == rcbuf.ref);
+  CU_ASSERT(0 == nrcbuf_free);
+
+  ngtcp2_rcbuf_decref(&rcbuf);
+
+  CU_ASSERT(1 == nrcbuf_free);
+}
@@ -32,5 +32,8 @@
 void test_ngtcp2_rob_push(void);
 void test_ngtcp2_rob_data_at(void);
 void test_ngtcp2_rob_remove_prefix(void);
+void test_ngtcp2_rob_random_reordering(void);
+void test_ngtcp2_rob_push_ref(void);
+void test_ngtcp2_rob_adaptive_chunk(void);
 
 #endif /* NGTCP2_ROB_TEST_H */
@@ -0,0 +1,403 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_rtb_test.h"
+
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_rtb.h"
+#include "ngtcp2_cc.h"
+#include "ngtcp2_test_helper.h"
+
+typedef struct {
+  ngtcp2_cc cc;
+  size_t nacked;
+  uint64_t acked_pkt_nums[16];
+  size_t ncongestion;
+  ngtcp2_tstamp congestion_ts_sent;
+} counting_cc;
+
+static void counting_cc_on_pkt_acked(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                     const ngtcp2_cc_pkt *pkt,
+                                     ngtcp2_tstamp ts) {
+  counting_cc *c = (counting_cc *)cc;
+  (void)ccs;
+  (void)ts;
+
+  c->acked_pkt_nums[c->nacked++] = pkt->pkt_num;
+}
+
+static void counting_cc_congestion_event(ngtcp2_cc *cc, ngtcp2_cc_stat *ccs,
+                                         ngtcp2_tstamp ts_sent,
+                                         ngtcp2_tstamp ts) {
+  counting_cc *c = (counting_cc *)cc;
+  (void)ccs;
+  (void)ts;
+
+  ++c->ncongestion;
+  c->congestion_ts_sent = ts_sent;
+}
+
+static void counting_cc_init(counting_cc *c) {
+  c->cc.on_pkt_sent = NULL;
+  c->cc.on_pkt_acked = counting_cc_on_pkt_acked;
+  c->cc.congestion_event = counting_cc_congestion_event;
+  c->cc.on_rto = NULL;
+  c->cc.user_data = NULL;
+  c->nacked = 0;
+  c->ncongestion = 0;
+  c->congestion_ts_sent = 0;
+}
+
+static void add_pkts(ngtcp2_rtb *rtb, ngtcp2_cc_stat *ccs, uint64_t first,
+                     uint64_t last, ngtcp2_mem *mem) {
+  ngtcp2_rtb_entry *ent;
+  uint64_t i;
+
+  for (i = first; i <= last; ++i) {
+    ngtcp2_rtb_entry_new(&ent, i, 100 * i, 100, NULL, mem);
+    ngtcp2_rtb_add(rtb, ent);
+    ccs->bytes_in_flight += 100;
+  }
+}
+
+void test_ngtcp2_rtb_recv_ack(void) {
+  ngtcp2_rtb rtb;
+  ngtcp2_cc_stat ccs;
+  counting_cc cc;
+  ngtcp2_ack fr;
+  ngtcp2_ack_blk blks[4];
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  int rv;
+
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  counting_cc_init(&cc);
+
+  add_pkts(&rtb, &ccs, 1, 10, mem);
+
+  CU_ASSERT(10 == rtb.num_entries);
+  CU_ASSERT(1000 == ccs.bytes_in_flight);
+
+  /* Acknowledge [9, 10] and [5, 6] */
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.largest_ack = 10;
+  fr.ack_delay = 0;
+  fr.first_ack_blklen = 1;
+  fr.num_blks = 1;
+  fr.blks = blks;
+  fr.blks[0].gap = 2;
+  fr.blks[0].blklen = 2;
+
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 6000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4 == cc.nacked);
+  CU_ASSERT(5 == cc.acked_pkt_nums[0]);
+  CU_ASSERT(6 == cc.acked_pkt_nums[1]);
+  CU_ASSERT(9 == cc.acked_pkt_nums[2]);
+  CU_ASSERT(10 == cc.acked_pkt_nums[3]);
+  /* 1, 2, 3, 4 and 7 are declared lost. */
+  CU_ASSERT(1 == cc.ncongestion);
+  CU_ASSERT(700 == cc.congestion_ts_sent);
+  CU_ASSERT(1 == rtb.num_entries);
+  CU_ASSERT(8 == rtb.head->pkt_num);
+  CU_ASSERT(rtb.head == rtb.tail);
+  CU_ASSERT(100 == ccs.bytes_in_flight);
+  CU_ASSERT(10 == rtb.largest_acked);
+  CU_ASSERT(5000 == ccs.latest_rtt);
+  CU_ASSERT(5000 == ccs.min_rtt);
+  CU_ASSERT(5000 == ccs.smoothed_rtt);
+  /* 8 is not lost until 9/8 RTT passes. */
+  CU_ASSERT(800 + 5625 == rtb.loss_time);
+
+  /* Duplicated ACK changes nothing */
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 6100);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4 == cc.nacked);
+  CU_ASSERT(1 == cc.ncongestion);
+  CU_ASSERT(1 == rtb.num_entries);
+  CU_ASSERT(5000 == ccs.latest_rtt);
+
+  add_pkts(&rtb, &ccs, 11, 12, mem);
+
+  /* Acknowledge [8, 12] which includes the tail */
+  fr.largest_ack = 12;
+  fr.first_ack_blklen = 4;
+  fr.num_blks = 0;
+
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 9200);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(7 == cc.nacked);
+  CU_ASSERT(8 == cc.acked_pkt_nums[4]);
+  CU_ASSERT(12 == cc.acked_pkt_nums[6]);
+  CU_ASSERT(0 == rtb.num_entries);
+  CU_ASSERT(NULL == rtb.head);
+  CU_ASSERT(NULL == rtb.tail);
+  CU_ASSERT(0 == ccs.bytes_in_flight);
+  CU_ASSERT(8000 == ccs.latest_rtt);
+  CU_ASSERT(0 == rtb.loss_time);
+
+  add_pkts(&rtb, &ccs, 13, 13, mem);
+
+  CU_ASSERT(rtb.head == rtb.tail);
+  CU_ASSERT(13 == rtb.tail->pkt_num);
+
+  ngtcp2_rtb_free(&rtb);
+}
+
+void test_ngtcp2_rtb_recv_ack_malformed(void) {
+  ngtcp2_rtb rtb;
+  ngtcp2_cc_stat ccs;
+  counting_cc cc;
+  ngtcp2_ack fr;
+  ngtcp2_ack_blk blks[4];
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  int rv;
+
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  counting_cc_init(&cc);
+
+  add_pkts(&rtb, &ccs, 0, 3, mem);
+
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.largest_ack = 3;
+  fr.ack_delay = 0;
+  fr.first_ack_blklen = 4;
+  fr.num_blks = 0;
+
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 10000);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+
+  fr.first_ack_blklen = 0;
+  fr.num_blks = 1;
+  fr.blks = blks;
+  fr.blks[0].gap = 2;
+  fr.blks[0].blklen = 2;
+
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 10000);
+
+  CU_ASSERT(NGTCP2_ERR_PROTO == rv);
+  CU_ASSERT(0 == cc.nacked);
+  CU_ASSERT(4 == rtb.num_entries);
+  CU_ASSERT(400 == ccs.bytes_in_flight);
+
+  ngtcp2_rtb_free(&rtb);
+}
+
+static ngtcp2_frame_chain *stream_frame_chain(uint32_t stream_id,
+                                              uint64_t offset,
+                                              const uint8_t *data,
+                                              size_t datalen,
+                                              ngtcp2_mem *mem) {
+  ngtcp2_stream fr;
+  ngtcp2_frame_chain *frc;
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.flags = 0;
+  fr.fin = 0;
+  fr.stream_id = stream_id;
+  fr.offset = offset;
+  fr.datalen = datalen;
+  fr.data = data;
+
+  ngtcp2_frame_chain_stream_new(&frc, &fr, mem);
+
+  return frc;
+}
+
+void test_ngtcp2_rtb_detect_lost(void) {
+  ngtcp2_rtb rtb;
+  ngtcp2_cc_stat ccs;
+  counting_cc cc;
+  ngtcp2_ack fr;
+  ngtcp2_rtb_entry *ent;
+  ngtcp2_frame_chain *frc;
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  uint8_t data[256];
+  int rv;
+
+  memset(data, 0, sizeof(data));
+
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  counting_cc_init(&cc);
+
+  /* Packet 1 carries handshake data, and 2 carries 2 STREAM
+     frames. */
+  frc = stream_frame_chain(0, 0, data, 111, mem);
+  ngtcp2_rtb_entry_new(&ent, 1, 1000, 200, frc, mem);
+  ngtcp2_rtb_add(&rtb, ent);
+
+  frc = stream_frame_chain(1, 0, data, 100, mem);
+  frc->next = stream_frame_chain(3, 7, data, 50, mem);
+  ngtcp2_rtb_entry_new(&ent, 2, 1500, 200, frc, mem);
+  ngtcp2_rtb_add(&rtb, ent);
+
+  ngtcp2_rtb_entry_new(&ent, 3, 1600, 200, NULL, mem);
+  ngtcp2_rtb_add(&rtb, ent);
+
+  ccs.bytes_in_flight = 600;
+
+  fr.type = NGTCP2_FRAME_ACK;
+  fr.largest_ack = 3;
+  fr.ack_delay = 0;
+  fr.first_ack_blklen = 0;
+  fr.num_blks = 0;
+
+  rv = ngtcp2_rtb_recv_ack(&rtb, &fr, &cc.cc, &ccs, 9600);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(8000 == ccs.latest_rtt);
+  /* Neither packet threshold nor time threshold is met. */
+  CU_ASSERT(0 == cc.ncongestion);
+  CU_ASSERT(2 == rtb.num_entries);
+  CU_ASSERT(1000 + 9000 == rtb.loss_time);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&rtb.hs_lostq));
+  CU_ASSERT(ngtcp2_frame_queue_empty(&rtb.lostq));
+
+  ngtcp2_rtb_detect_lost(&rtb, &cc.cc, &ccs, 9999);
+
+  CU_ASSERT(0 == cc.ncongestion);
+  CU_ASSERT(2 == rtb.num_entries);
+
+  /* Packet 1 is lost by time threshold. */
+  ngtcp2_rtb_detect_lost(&rtb, &cc.cc, &ccs, 10000);
+
+  CU_ASSERT(1 == cc.ncongestion);
+  CU_ASSERT(1000 == cc.congestion_ts_sent);
+  CU_ASSERT(1 == rtb.num_entries);
+  CU_ASSERT(1500 + 9000 == rtb.loss_time);
+  CU_ASSERT(200 == ccs.bytes_in_flight);
+
+  frc = ngtcp2_frame_queue_top(&rtb.hs_lostq);
+
+  CU_ASSERT(NULL != frc);
+  CU_ASSERT(0 == frc->fr.stream.stream_id);
+  CU_ASSERT(111 == frc->fr.stream.datalen);
+  CU_ASSERT(data != frc->fr.stream.data);
+  CU_ASSERT(NULL == frc->next);
+  CU_ASSERT(ngtcp2_frame_queue_empty(&rtb.lostq));
+
+  ngtcp2_rtb_detect_lost(&rtb, &cc.cc, &ccs, 10500);
+
+  CU_ASSERT(2 == cc.ncongestion);
+  CU_ASSERT(0 == rtb.num_entries);
+  CU_ASSERT(0 == rtb.loss_time);
+  CU_ASSERT(0 == ccs.bytes_in_flight);
+
+  frc = ngtcp2_frame_queue_top(&rtb.lostq);
+
+  CU_ASSERT(1 == frc->fr.stream.stream_id);
+  CU_ASSERT(3 == frc->next->fr.stream.stream_id);
+  CU_ASSERT(7 == frc->next->fr.stream.offset);
+  CU_ASSERT(frc->next == rtb.lostq.tail);
+
+  ngtcp2_frame_queue_pop(&rtb.lostq);
+  ngtcp2_frame_chain_del(frc, mem);
+
+  CU_ASSERT(3 == ngtcp2_frame_queue_top(&rtb.lostq)->fr.stream.stream_id);
+
+  ngtcp2_rtb_free(&rtb);
+}
+
+void test_ngtcp2_rtb_on_rto(void) {
+  ngtcp2_rtb rtb;
+  ngtcp2_cc_stat ccs;
+  counting_cc cc;
+  ngtcp2_reno_cc reno;
+  ngtcp2_cubic_cc cubic;
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+
+  /* The controller without on_rto gets congestion_event. */
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  counting_cc_init(&cc);
+
+  add_pkts(&rtb, &ccs, 1, 10, mem);
+
+  ngtcp2_rtb_on_rto(&rtb, &cc.cc, &ccs, 100000);
+
+  CU_ASSERT(1 == cc.ncongestion);
+  CU_ASSERT(1000 == cc.congestion_ts_sent);
+  CU_ASSERT(0 == rtb.num_entries);
+  CU_ASSERT(0 == ccs.bytes_in_flight);
+  CU_ASSERT(1 == rtb.rto_count);
+
+  ngtcp2_rtb_free(&rtb);
+
+  /* NewReno collapses cwnd, and ssthresh is halved only once. */
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  ngtcp2_reno_cc_init(&reno);
+
+  ccs.cwnd = 40 * NGTCP2_MAX_DGRAM_SIZE;
+  add_pkts(&rtb, &ccs, 1, 10, mem);
+
+  ngtcp2_rtb_on_rto(&rtb, &reno.cc, &ccs, 100000);
+
+  CU_ASSERT(NGTCP2_MIN_CWND == ccs.cwnd);
+  CU_ASSERT(20 * NGTCP2_MAX_DGRAM_SIZE == ccs.ssthresh);
+  CU_ASSERT(0 == ccs.bytes_in_flight);
+
+  add_pkts(&rtb, &ccs, 11, 11, mem);
+
+  ngtcp2_rtb_on_rto(&rtb, &reno.cc, &ccs, 300000);
+
+  CU_ASSERT(NGTCP2_MIN_CWND == ccs.cwnd);
+  CU_ASSERT(20 * NGTCP2_MAX_DGRAM_SIZE == ccs.ssthresh);
+  CU_ASSERT(2 == rtb.rto_count);
+
+  ngtcp2_rtb_free(&rtb);
+
+  /* So does CUBIC. */
+  ngtcp2_rtb_init(&rtb, mem);
+  ngtcp2_cc_stat_init(&ccs);
+  ngtcp2_cubic_cc_init(&cubic);
+
+  ccs.cwnd = 40 * NGTCP2_MAX_DGRAM_SIZE;
+  add_pkts(&rtb, &ccs, 1, 10, mem);
+
+  ngtcp2_rtb_on_rto(&rtb, &cubic.cc, &ccs, 100000);
+
+  CU_ASSERT(NGTCP2_MIN_CWND == ccs.cwnd);
+  CU_ASSERT(28 * NGTCP2_MAX_DGRAM_SIZE == ccs.ssthresh);
+  CU_ASSERT(40 * NGTCP2_MAX_DGRAM_SIZE == cubic.w_max);
+
+  add_pkts(&rtb, &ccs, 11, 11, mem);
+
+  ngtcp2_rtb_on_rto(&rtb, &cubic.cc, &ccs, 300000);
+
+  CU_ASSERT(NGTCP2_MIN_CWND == ccs.cwnd);
+  CU_ASSERT(28 * NGTCP2_MAX_DGRAM_SIZE == ccs.ssthresh);
+  CU_ASSERT(40 * NGTCP2_MAX_DGRAM_SIZE == cubic.w_max);
+
+  ngtcp2_rtb_free(&rtb);
+}
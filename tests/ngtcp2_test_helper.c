@@ -24,6 +24,7 @@
  */
 #include "ngtcp2_test_helper.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "ngtcp2_conv.h"
@@ -98,3 +99,52 @@ size_t ngtcp2_t_encode_ack_frame(uint8_t *out, uint64_t largest_ack,
 
   return (size_t)(p - out);
 }
+
+static void *counting_malloc(size_t size, void *mem_user_data) {
+  ngtcp2_t_counting_mem *cm = mem_user_data;
+
+  ++cm->nalloc;
+  ++cm->nlive;
+
+  return malloc(size);
+}
+
+static void counting_free(void *ptr, void *mem_user_data) {
+  ngtcp2_t_counting_mem *cm = mem_user_data;
+
+  if (ptr) {
+    --cm->nlive;
+  }
+
+  free(ptr);
+}
+
+static void *counting_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  ngtcp2_t_counting_mem *cm = mem_user_data;
+
+  ++cm->nalloc;
+  ++cm->nlive;
+
+  return calloc(nmemb, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *mem_user_data) {
+  ngtcp2_t_counting_mem *cm = mem_user_data;
+
+  ++cm->nalloc;
+  if (ptr == NULL) {
+    ++cm->nlive;
+  }
+
+  return realloc(ptr, size);
+}
+
+void ngtcp2_t_counting_mem_init(ngtcp2_t_counting_mem *cm) {
+  cm->mem.mem_user_data = cm;
+  cm->mem.malloc = counting_malloc;
+  cm->mem.free = counting_free;
+  cm->mem.calloc = counting_calloc;
+  cm->mem.realloc = counting_realloc;
+  cm->nalloc = 0;
+  cm->nlive = 0;
+}
@@ -67,4 +67,22 @@ size_t ngtcp2_t_encode_ack_frame(uint8_t *out, uint64_t largest_ack,
                                  uint64_t first_ack_blklen, uint8_t gap,
                                  uint64_t ack_blklen);
 
+/*
+ * ngtcp2_t_counting_mem is an allocator which counts the calls to
+ * the default allocator.
+ */
+typedef struct {
+  ngtcp2_mem mem;
+  /* nalloc is the number of calls to malloc, calloc, and realloc. */
+  size_t nalloc;
+  /* nlive is the number of blocks which have not been freed. */
+  size_t nlive;
+} ngtcp2_t_counting_mem;
+
+/*
+ * ngtcp2_t_counting_mem_init initializes |cm|.  Pass &cm->mem as the
+ * allocator.
+ */
+void ngtcp2_t_counting_mem_init(ngtcp2_t_counting_mem *cm);
+
 #endif /* NGTCP2_TEST_HELPER_H */
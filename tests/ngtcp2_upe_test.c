@@ -38,6 +38,7 @@ void test_ngtcp2_upe_encode(void) {
   uint8_t buf[1024];
   ngtcp2_pkt_hd hd, nhd;
   ngtcp2_frame s1 = {0}, s2 = {0}, ns;
+  ngtcp2_ack_blk blks[NGTCP2_MAX_NUM_ACK_BLK];
   ngtcp2_upe upe;
   int rv;
   size_t pktlen;
@@ -105,7 +106,7 @@ void test_ngtcp2_upe_encode(void) {
   pktlen -= (size_t)nread;
 
   /* Read first STREAM frame */
-  nread = ngtcp2_pkt_decode_frame(&ns, out, pktlen, 0);
+  nread = ngtcp2_pkt_decode_frame(&ns, blks, out, pktlen, 0);
 
   CU_ASSERT(nread > 0);
   CU_ASSERT(s1.type == ns.type);
@@ -118,7 +119,7 @@ void test_ngtcp2_upe_encode(void) {
   pktlen -= (size_t)nread;
 
   /* Read second STREAM frame */
-  nread = ngtcp2_pkt_decode_frame(&ns, out, pktlen, 0);
+  nread = ngtcp2_pkt_decode_frame(&ns, blks, out, pktlen, 0);
 
   CU_ASSERT(nread > 0);
   CU_ASSERT(s2.type == ns.type);
@@ -131,7 +132,7 @@ void test_ngtcp2_upe_encode(void) {
   pktlen -= (size_t)nread;
 
   /* Read PADDING frames to the end */
-  nread = ngtcp2_pkt_decode_frame(&ns, out, pktlen, 0);
+  nread = ngtcp2_pkt_decode_frame(&ns, blks, out, pktlen, 0);
 
   CU_ASSERT(nread == (ssize_t)pktlen);
   CU_ASSERT(NGTCP2_FRAME_PADDING == ns.type);